@@ -0,0 +1,235 @@
+/**
+ * @file bench_footprint.cpp
+ * @brief Measures the throughput of the bridge next to what it costs in memory and disk space.
+ * @details Starts the bridge in-process with the default or the low-footprint profile against a
+ *          HubStub, seeds the state of a few Wemos sensors and lets a number of dashboards request
+ *          that state back to back for a while. Afterwards it reports the requests per second
+ *          together with the resident set size, its peak, the number of threads and the size of
+ *          the binary, so the profiles and the WEMOS_LOW_FOOTPRINT build can be compared on the
+ *          hardware they are meant for.
+ *
+ *          Usage: bench_footprint [default|low] [seconds] [dashboards] [binary]
+ *
+ *          The binary defaults to this benchmark itself; pass the server binary of the same build
+ *          to report its size instead.
+ * @author Daan Breur
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hubstub.h"
+#include "packets.h"
+#include "packetview.h"
+#include "wemosserver.h"
+
+/**
+ * @brief Port the bridge listens on during the benchmark.
+ */
+#define BENCH_PORT 15100
+
+/**
+ * @brief Number of Wemos sensors whose state is seeded and requested.
+ */
+#define BENCH_SENSORS 16
+
+/**
+ * @brief First ID of the seeded sensors; IDs above MAX_HUB_SENSOR_ID are served by the bridge.
+ */
+#define BENCH_FIRST_SENSOR 200
+
+static int connectTo(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    const int enable_opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable_opt, sizeof(enable_opt));
+    return fd;
+}
+
+/**
+ * @brief Receives exactly length bytes.
+ * @return false if the connection was closed first.
+ */
+static bool receiveAll(int fd, uint8_t *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(fd, buffer, length, 0);
+        if (received <= 0) return false;
+        buffer += received;
+        length -= received;
+    }
+    return true;
+}
+
+/**
+ * @brief Requests the seeded sensors round-robin until told to stop.
+ */
+static void runDashboard(int fd, const std::atomic<bool> &running, std::atomic<uint64_t> &done) {
+    struct sensor_packet request = {0};
+    request.header.length = sizeof(struct sensor_metadata);
+    request.header.ptype = PacketType::DASHBOARD_GET;
+    request.data.generic.metadata.sensor_type = SensorType::TEMPERATURE;
+
+    uint8_t response[sizeof(struct sensor_header) + UINT8_MAX];
+    uint64_t requests = 0;
+    while (running) {
+        request.data.generic.metadata.sensor_id = BENCH_FIRST_SENSOR + requests % BENCH_SENSORS;
+        size_t length = PacketView(request).size();
+        if (send(fd, &request, length, MSG_NOSIGNAL) != (ssize_t)length) break;
+
+        if (!receiveAll(fd, response, sizeof(struct sensor_header))) break;
+        if (!receiveAll(fd, response + sizeof(struct sensor_header), response[0])) break;
+        ++requests;
+    }
+    done += requests;
+}
+
+/**
+ * @brief Returns a line of /proc/self/status, e.g. "VmRSS:     1234 kB", without the name.
+ */
+static std::string processStatus(const char *name) {
+    FILE *status = fopen("/proc/self/status", "r");
+    if (!status) return "?";
+
+    char line[256];
+    std::string value = "?";
+    size_t name_length = strlen(name);
+    while (fgets(line, sizeof(line), status)) {
+        if (strncmp(line, name, name_length) != 0 || line[name_length] != ':') continue;
+        const char *start = line + name_length + 1;
+        while (*start == ' ' || *start == '\t') ++start;
+        value = std::string(start, strcspn(start, "\n"));
+        break;
+    }
+    fclose(status);
+    return value;
+}
+
+int main(int argc, char **argv) {
+    std::string profile = argc > 1 ? argv[1] : "default";
+    double seconds = argc > 2 ? atof(argv[2]) : 5.0;
+    int dashboard_count = argc > 3 ? atoi(argv[3]) : 4;
+    std::string binary = argc > 4 ? argv[4] : "/proc/self/exe";
+
+    if ((profile != "default" && profile != "low") || seconds <= 0 || dashboard_count <= 0) {
+        fprintf(stderr, "Usage: %s [default|low] [seconds] [dashboards] [binary]\n", argv[0]);
+        return 2;
+    }
+
+    // the bridge is chatty on stdout; keep the report readable
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    HubStub stub;
+    stub.start();
+
+    auto server = std::make_unique<WemosServer>(BENCH_PORT, "127.0.0.1", stub.getPort());
+    if (profile == "low") server->configure(lowFootprintConfig());
+    std::thread server_thread([&server]() { server->start(); });
+
+    int wemos = -1;
+    for (int i = 0; i < 500 && wemos < 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        wemos = connectTo(BENCH_PORT);
+    }
+    if (wemos < 0) {
+        fprintf(report, "Connecting to the bridge failed\n");
+        return 2;
+    }
+
+    for (int i = 0; i < BENCH_SENSORS; ++i) {
+        struct sensor_packet data = {0};
+        data.header.length = sizeof(struct sensor_packet_temperature);
+        data.header.ptype = PacketType::DATA;
+        data.data.temperature.metadata = {SensorType::TEMPERATURE,
+                                          (uint8_t)(BENCH_FIRST_SENSOR + i)};
+        setTemperature(data, 20.0f + i);
+        send(wemos, &data, PacketView(data).size(), MSG_NOSIGNAL);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::vector<int> fds;
+    for (int i = 0; i < dashboard_count; ++i) {
+        int fd = connectTo(BENCH_PORT);
+        if (fd < 0) {
+            // the low-footprint profile refuses connections beyond its limit
+            fprintf(report, "Only %d dashboards could connect\n", i);
+            break;
+        }
+        fds.push_back(fd);
+    }
+
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> requests(0);
+    std::vector<std::thread> dashboards;
+    auto started = std::chrono::steady_clock::now();
+    for (int fd : fds) {
+        dashboards.emplace_back(runDashboard, fd, std::cref(running), std::ref(requests));
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    // sampled while the load runs, with every server thread alive
+    std::string rss = processStatus("VmRSS");
+    std::string threads = processStatus("Threads");
+
+    running = false;
+    for (int fd : fds) shutdown(fd, SHUT_RDWR);
+    for (std::thread &dashboard : dashboards) dashboard.join();
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    size_t footprint = server->memoryFootprint();
+    std::string peak_rss = processStatus("VmHWM");
+
+    for (int fd : fds) close(fd);
+    close(wemos);
+    server->requestStop();
+    server_thread.join();
+    server.reset();
+    stub.stop();
+
+    struct stat binary_stat;
+    long long binary_size = stat(binary.c_str(), &binary_stat) == 0 ? binary_stat.st_size : -1;
+
+#ifdef WEMOS_LOW_FOOTPRINT
+    const char *build = "low-footprint";
+#else
+    const char *build = "default";
+#endif
+    fprintf(report, "Build %s, profile %s, %zu dashboards for %.1f s\n", build, profile.c_str(),
+            fds.size(), elapsed);
+    fprintf(report, "Throughput   %.0f requests/s\n", requests / elapsed);
+    fprintf(report, "RSS          %s (peak %s)\n", rss.c_str(), peak_rss.c_str());
+    fprintf(report, "Pools        %zu kB\n", footprint / 1024);
+    fprintf(report, "Threads      %s (benchmark included)\n", threads.c_str());
+    fprintf(report, "Binary       %lld bytes (%s)\n", binary_size, binary.c_str());
+    fclose(report);
+
+    return 0;
+}
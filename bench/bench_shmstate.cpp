@@ -0,0 +1,86 @@
+/**
+ * @file bench_shmstate.cpp
+ * @brief Multi-reader benchmark for the shared-memory state export.
+ * @details One writer thread publishes updates round-robin over all slots while an increasing
+ *          number of reader threads read random slots. For every reader count the total read
+ *          throughput, the average cost of a single read and the write throughput are reported.
+ *
+ *          Usage: bench_shmstate [seconds per run] [max readers]
+ * @author Daan Breur
+ */
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shmstate.h"
+
+static void runBenchmark(const std::string &name, int readers, double seconds) {
+    ShmStateWriter writer(name);
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> total_reads(0);
+    uint64_t total_writes = 0;
+
+    std::thread writer_thread([&]() {
+        struct sensor_packet packet = {0};
+        packet.header.length = sizeof(struct sensor_packet_temperature);
+        packet.header.ptype = PacketType::DATA;
+        packet.data.temperature.metadata.sensor_type = SensorType::TEMPERATURE;
+
+        while (running) {
+            uint8_t sensor_id = total_writes % SHM_STATE_SLOTS;
+            packet.data.temperature.metadata.sensor_id = sensor_id;
+            packet.data.temperature.value = (float)total_writes;
+            writer.publish(sensor_id, packet);
+            ++total_writes;
+        }
+    });
+
+    std::vector<std::thread> reader_threads;
+    for (int r = 0; r < readers; ++r) {
+        reader_threads.emplace_back([&, r]() {
+            ShmStateReader reader(name);
+            struct sensor_packet packet;
+            uint64_t reads = 0;
+            uint32_t slot = r * 7919;
+
+            while (running) {
+                slot = slot * 1103515245 + 12345;
+                reader.read((slot >> 16) % SHM_STATE_SLOTS, packet);
+                ++reads;
+            }
+            total_reads += reads;
+        });
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    usleep((useconds_t)(seconds * 1000000));
+    running = false;
+    for (auto &thread : reader_threads) thread.join();
+    writer_thread.join();
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    double reads_per_second = total_reads / elapsed;
+    printf("%7d %16.0f %14.1f %16.0f\n", readers, reads_per_second,
+           readers * 1e9 / reads_per_second, total_writes / elapsed);
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    int max_readers = argc > 2 ? atoi(argv[2]) : 8;
+    std::string name = "/wemos-bench-" + std::to_string(getpid());
+
+    printf("%7s %16s %14s %16s\n", "readers", "reads/s", "ns/read", "writes/s");
+    for (int readers = 1; readers <= max_readers; readers *= 2) {
+        runBenchmark(name, readers, seconds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file bench_slavemanager.cpp
+ * @brief Lookup benchmark for the device table of the SlaveManager.
+ * @details Fills the table with an increasing number of devices spread over the full 16-bit ID
+ *          space and reports the average cost of registering a device, updating its state and
+ *          reading its state back.
+ *
+ *          Usage: bench_slavemanager [max devices] [rounds]
+ * @author Daan Breur
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "slavemanager.h"
+
+/**
+ * @brief Returns the nanoseconds per operation of running the operation over all IDs.
+ */
+template <typename Operation>
+static double measure(const std::vector<uint16_t> &ids, int rounds, Operation operation) {
+    auto started = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+        for (uint16_t id : ids) operation(id);
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return elapsed * 1e9 / ((double)ids.size() * rounds);
+}
+
+static void runBenchmark(size_t devices, int rounds) {
+    SlaveManager manager(devices);
+
+    // spread the IDs over the whole space, 0 is never used by a device
+    std::vector<uint16_t> ids;
+    for (size_t i = 0; i < devices; ++i) ids.push_back(1 + (i * 40503) % MAX_SLAVE_ID);
+
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_temperature);
+    packet.header.ptype = PacketType::DATA;
+    packet.data.temperature.metadata.sensor_type = SensorType::TEMPERATURE;
+
+    double register_ns =
+        measure(ids, 1, [&](uint16_t id) { manager.updateSlaveState(id, packet); });
+    double update_ns = measure(ids, rounds, [&](uint16_t id) {
+        packet.data.temperature.value += 0.5f;
+        manager.updateSlaveState(id, packet);
+    });
+
+    volatile float sink = 0;
+    double get_ns = measure(ids, rounds, [&](uint16_t id) {
+        sink = sink + manager.getSlaveState(id).data.temperature.value;
+    });
+
+    printf("%7zu %12.1f %12.1f %12.1f %10llu\n", devices, register_ns, update_ns, get_ns,
+           (unsigned long long)manager.getStats().refused);
+}
+
+int main(int argc, char **argv) {
+    size_t max_devices = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+
+    printf("%7s %12s %12s %12s %10s\n", "devices", "ns/register", "ns/update", "ns/get",
+           "refused");
+    for (size_t devices = 10; devices <= max_devices; devices *= 10) {
+        runBenchmark(devices, rounds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,416 @@
+/**
+ * @file replay_capture.cpp
+ * @brief Replays a traffic capture against the current build of the bridge.
+ * @details Starts the bridge in-process against a HubStub that answers every DASHBOARD_GET with
+ *          the response the real hub gave in the capture, then replays the captured client traffic
+ *          over fresh TCP connections. Afterwards it reports the latency distribution of the
+ *          responses (captured vs. replayed) and every difference between the bytes the bridge
+ *          sent to clients and to the hub in the capture and in the replay.
+ *
+ *          The speed factor controls the timing: 1 keeps the captured inter-arrival times, 10
+ *          replays ten times faster and 0 sends everything as fast as possible while keeping the
+ *          order between connections: every request waits for the responses to earlier ones.
+ *
+ *          Usage: replay_capture <capture file> [speed] [listen port]
+ *
+ *          Exits with 1 if the replay produced different output, 0 otherwise.
+ * @author Daan Breur
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture.h"
+#include "hubstub.h"
+#include "latency.h"
+#include "packets.h"
+#include "wemosserver.h"
+
+/**
+ * @brief Time to wait for outstanding responses before giving up on them.
+ */
+#define RESPONSE_TIMEOUT_MS 2000
+
+/**
+ * @brief Pause when a replay at speed 0 switches connections after a request without response.
+ * @details Gives the bridge a chance to process it (e.g. a HEARTBEAT) before a request on another
+ * connection that depends on it (e.g. a DASHBOARD_POST to that slave) overtakes it.
+ */
+#define CONNECTION_SWITCH_PAUSE_US 500
+
+/**
+ * @brief Time the last byte was sent or received during the replay.
+ */
+static std::atomic<uint64_t> last_activity_ns(0);
+
+/**
+ * @brief Bytes a captured record expects to come back on a session, and what caused them.
+ */
+struct Expectation {
+    /** @brief Index of the CLIENT_IN record that caused the response */
+    size_t cause;
+    /** @brief Number of bytes the session has received once the response is complete */
+    size_t received_end;
+};
+
+/**
+ * @brief A single client connection in the capture.
+ */
+struct Session {
+    /** @brief Everything the bridge sent on this connection in the capture */
+    std::vector<uint8_t> expected_output;
+    std::vector<struct Expectation> expectations;
+
+    int fd = -1;
+    std::thread receiver;
+    /** @brief Number of expectations caused by records already replayed */
+    size_t expectations_due = 0;
+
+    std::vector<uint8_t> output;
+    /** @brief Size of output, readable while the receiver is still running */
+    std::atomic<size_t> received{0};
+    std::vector<uint64_t> latencies_ns;
+};
+
+/**
+ * @brief Assigns every client record to a session, in the order the sessions were opened.
+ * @return The session index of every record, or -1 for records that are not about a client.
+ */
+static std::vector<int> assignSessions(const std::vector<struct CaptureRecord> &records,
+                                       size_t &session_count) {
+    std::vector<int> session_of(records.size(), -1);
+    std::map<int32_t, int> open_sessions;
+    session_count = 0;
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        const struct CaptureRecord &record = records[i];
+        if (record.event == CaptureEvent::HUB_IN || record.event == CaptureEvent::HUB_OUT)
+            continue;
+
+        auto open = open_sessions.find(record.connection);
+        if (record.event == CaptureEvent::CLIENT_OPEN || open == open_sessions.end()) {
+            // connections that were already open when the capture started begin at first use
+            open = open_sessions.insert_or_assign(record.connection, (int)session_count++).first;
+        }
+
+        session_of[i] = open->second;
+        if (record.event == CaptureEvent::CLIENT_CLOSE) open_sessions.erase(open);
+    }
+
+    return session_of;
+}
+
+/**
+ * @brief Concatenates all bytes of the given event, in order.
+ */
+static std::vector<uint8_t> concatenate(const std::vector<struct CaptureRecord> &records,
+                                        CaptureEvent event) {
+    std::vector<uint8_t> bytes;
+    for (const struct CaptureRecord &record : records) {
+        if (record.event != event) continue;
+        bytes.insert(bytes.end(), record.data.begin(), record.data.end());
+    }
+    return bytes;
+}
+
+/**
+ * @brief Queues every packet the hub sent in the capture as a scripted response of the stub.
+ */
+static size_t scriptHub(const std::vector<struct CaptureRecord> &records, HubStub &stub) {
+    std::map<int32_t, std::vector<uint8_t>> streams;
+    size_t responses = 0;
+
+    for (const struct CaptureRecord &record : records) {
+        if (record.event != CaptureEvent::HUB_IN) continue;
+
+        std::vector<uint8_t> &stream = streams[record.connection];
+        stream.insert(stream.end(), record.data.begin(), record.data.end());
+
+        size_t offset = 0;
+        while (offset + sizeof(struct sensor_header) <= stream.size()) {
+            size_t length = sizeof(struct sensor_header) + stream[offset];
+            if (offset + length > stream.size()) break;
+
+            struct sensor_packet packet = {0};
+            memcpy(&packet, &stream[offset], std::min(length, sizeof(packet)));
+            stub.queueResponse(packet);
+            ++responses;
+
+            offset += length;
+        }
+        stream.erase(stream.begin(), stream.begin() + offset);
+    }
+
+    return responses;
+}
+
+static uint64_t percentile(std::vector<uint64_t> &values, double fraction) {
+    if (values.empty()) return 0;
+    size_t index = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void printLatencies(FILE *report, const char *name, std::vector<uint64_t> values) {
+    fprintf(report, "%-9s %8zu %10.1f %10.1f %10.1f %10.1f\n", name, values.size(),
+            percentile(values, 0.50) / 1000.0, percentile(values, 0.90) / 1000.0,
+            percentile(values, 0.99) / 1000.0, percentile(values, 1.0) / 1000.0);
+}
+
+/**
+ * @brief Reports where two byte streams differ.
+ * @return true if they are identical, false otherwise.
+ */
+static bool compareOutput(FILE *report, const std::string &name,
+                          const std::vector<uint8_t> &captured,
+                          const std::vector<uint8_t> &replayed) {
+    if (captured == replayed) return true;
+
+    size_t offset = std::mismatch(captured.begin(), captured.end(), replayed.begin(),
+                                  replayed.end())
+                        .first -
+                    captured.begin();
+    fprintf(report, "DIFF %s: %zu bytes captured, %zu replayed, first difference at byte %zu\n",
+            name.c_str(), captured.size(), replayed.size(), offset);
+    return false;
+}
+
+static int connectTo(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // back-to-back requests must not wait for the delayed ACK of the previous one
+    const int enable_opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable_opt, sizeof(enable_opt));
+    return fd;
+}
+
+/**
+ * @brief Reads everything the bridge sends on a session and timestamps completed responses.
+ */
+static void receiveSession(struct Session &session,
+                           const std::vector<std::atomic<uint64_t>> &sent_ns) {
+    uint8_t buffer[1024];
+    size_t next_expectation = 0;
+
+    ssize_t received;
+    while ((received = recv(session.fd, buffer, sizeof(buffer), 0)) > 0) {
+        uint64_t now = monotonicNanoseconds();
+        session.output.insert(session.output.end(), buffer, buffer + received);
+        session.received = session.output.size();
+        last_activity_ns = now;
+
+        while (next_expectation < session.expectations.size() &&
+               session.expectations[next_expectation].received_end <= session.output.size()) {
+            uint64_t sent = sent_ns[session.expectations[next_expectation].cause];
+            if (sent > 0) session.latencies_ns.push_back(now - sent);
+            ++next_expectation;
+        }
+    }
+}
+
+/**
+ * @brief Waits until a session has received all bytes expected so far, or the timeout expires.
+ */
+static void awaitOutput(const struct Session &session, size_t expected_bytes) {
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(RESPONSE_TIMEOUT_MS);
+    while (session.received < expected_bytes && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+/**
+ * @brief Returns the number of bytes a session should have received before the given record.
+ */
+static size_t expectedBefore(const struct Session &session, size_t record) {
+    size_t expected = 0;
+    for (const struct Expectation &expectation : session.expectations) {
+        if (expectation.cause < record) expected = expectation.received_end;
+    }
+    return expected;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <capture file> [speed] [listen port]\n", argv[0]);
+        return 2;
+    }
+
+    std::string capture_path = argv[1];
+    double speed = argc > 2 ? atof(argv[2]) : 1.0;
+    int port = argc > 3 ? atoi(argv[3]) : 15000;
+    std::string replay_path = "/tmp/wemos-replay-" + std::to_string(getpid()) + ".wcap";
+
+    std::vector<struct CaptureRecord> records;
+    try {
+        records = readCapture(capture_path);
+    } catch (std::runtime_error &exc) {
+        fprintf(stderr, "Reading %s failed: %s\n", capture_path.c_str(), exc.what());
+        return 2;
+    }
+
+    // the bridge is chatty on stdout; keep the report readable
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    size_t session_count;
+    std::vector<int> session_of = assignSessions(records, session_count);
+    std::vector<struct Session> sessions(session_count);
+
+    // every response is attributed to the most recent request, on whatever connection it came in
+    std::vector<uint64_t> captured_latencies;
+    std::vector<bool> answered(records.size(), false);
+    size_t last_request = records.size();
+    for (size_t i = 0; i < records.size(); ++i) {
+        const struct CaptureRecord &record = records[i];
+        if (record.event == CaptureEvent::CLIENT_IN) last_request = i;
+        if (record.event != CaptureEvent::CLIENT_OUT) continue;
+
+        struct Session &session = sessions[session_of[i]];
+        session.expected_output.insert(session.expected_output.end(), record.data.begin(),
+                                       record.data.end());
+        if (last_request < records.size()) {
+            session.expectations.push_back({last_request, session.expected_output.size()});
+            answered[last_request] = true;
+            captured_latencies.push_back(record.timestamp_ns - records[last_request].timestamp_ns);
+        }
+    }
+
+    HubStub stub;
+    stub.start();
+    size_t hub_responses = scriptHub(records, stub);
+
+    auto server = std::make_unique<WemosServer>(port, "127.0.0.1", stub.getPort());
+    server->enableCapture(replay_path);
+    std::thread server_thread([&server]() { server->start(); });
+
+    for (int i = 0; i < 500 && !stub.hasClient(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    fprintf(report, "Replaying %zu records, %zu connections and %zu hub responses at speed %g\n",
+            records.size(), session_count, hub_responses, speed);
+
+    std::vector<std::atomic<uint64_t>> sent_ns(records.size());
+    uint64_t started_ns = monotonicNanoseconds();
+    int previous_session = -1;
+    bool previous_answered = true;
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        const struct CaptureRecord &record = records[i];
+        if (session_of[i] < 0 || record.event == CaptureEvent::CLIENT_OUT) continue;
+
+        if (speed > 0) {
+            uint64_t due_ns = started_ns + (uint64_t)(record.timestamp_ns / speed);
+            uint64_t now_ns = monotonicNanoseconds();
+            if (due_ns > now_ns)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(due_ns - now_ns));
+        } else if (record.event == CaptureEvent::CLIENT_IN) {
+            for (struct Session &other : sessions) {
+                while (other.expectations_due < other.expectations.size() &&
+                       other.expectations[other.expectations_due].cause < i)
+                    ++other.expectations_due;
+                if (other.expectations_due > 0)
+                    awaitOutput(other, other.expectations[other.expectations_due - 1].received_end);
+            }
+            if (previous_session >= 0 && previous_session != session_of[i] && !previous_answered)
+                std::this_thread::sleep_for(std::chrono::microseconds(CONNECTION_SWITCH_PAUSE_US));
+        }
+
+        struct Session &session = sessions[session_of[i]];
+        if (session.fd < 0 && record.event != CaptureEvent::CLIENT_CLOSE) {
+            session.fd = connectTo(port);
+            if (session.fd < 0) {
+                fprintf(report, "Connecting to the bridge failed\n");
+                return 2;
+            }
+            session.receiver = std::thread(receiveSession, std::ref(session), std::cref(sent_ns));
+        }
+
+        if (record.event == CaptureEvent::CLIENT_IN) {
+            sent_ns[i] = monotonicNanoseconds();
+            last_activity_ns = sent_ns[i].load();
+            send(session.fd, record.data.data(), record.data.size(), MSG_NOSIGNAL);
+
+            previous_session = session_of[i];
+            previous_answered = answered[i];
+        } else if (record.event == CaptureEvent::CLIENT_CLOSE && session.fd >= 0) {
+            awaitOutput(session, expectedBefore(session, i));
+            shutdown(session.fd, SHUT_RDWR);
+        }
+    }
+
+    for (struct Session &session : sessions) {
+        if (session.fd < 0) continue;
+        awaitOutput(session, session.expected_output.size());
+        shutdown(session.fd, SHUT_RDWR);
+    }
+
+    uint64_t replay_ns = last_activity_ns - started_ns;
+    std::vector<uint64_t> replayed_latencies;
+    for (struct Session &session : sessions) {
+        if (session.receiver.joinable()) session.receiver.join();
+        if (session.fd >= 0) close(session.fd);
+        replayed_latencies.insert(replayed_latencies.end(), session.latencies_ns.begin(),
+                                  session.latencies_ns.end());
+    }
+
+    server->requestStop();
+    server_thread.join();
+    server.reset();
+    stub.stop();
+
+    uint64_t captured_ns = records.empty() ? 0 : records.back().timestamp_ns;
+    fprintf(report, "Captured duration %.3f s, replayed in %.3f s\n", captured_ns / 1e9,
+            replay_ns / 1e9);
+    fprintf(report, "%-9s %8s %10s %10s %10s %10s\n", "latency", "count", "p50 us", "p90 us",
+            "p99 us", "max us");
+    printLatencies(report, "captured", captured_latencies);
+    printLatencies(report, "replayed", replayed_latencies);
+
+    bool identical = true;
+    for (size_t s = 0; s < sessions.size(); ++s) {
+        identical &= compareOutput(report, "connection " + std::to_string(s),
+                                   sessions[s].expected_output, sessions[s].output);
+    }
+
+    std::vector<struct CaptureRecord> replayed = readCapture(replay_path);
+    unlink(replay_path.c_str());
+    identical &= compareOutput(report, "hub", concatenate(records, CaptureEvent::HUB_OUT),
+                               concatenate(replayed, CaptureEvent::HUB_OUT));
+
+    fprintf(report, identical ? "Output identical\n" : "Output differs\n");
+    fclose(report);
+
+    return identical ? 0 : 1;
+}
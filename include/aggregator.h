@@ -0,0 +1,231 @@
+/**
+ * @file aggregator.h
+ * @brief Header file for aggregator.cpp.
+ * @details This file contains the Aggregator class, which keeps running aggregates (count, sum,
+ *          min, max, mean and last reading) of the telemetry per sensor and per configured group
+ *          of sensors, over a few windows such as the last 15 minutes or the current day. Every
+ *          window is a small ring of buckets, so a reading is added in constant time and a query
+ *          never looks at raw readings.
+ * @author Daan Breur
+ */
+
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "packets.h"
+#include "packetview.h"
+
+/**
+ * @brief Number of buckets a sliding window is divided into.
+ * @details A sliding window moves a bucket at a time, so it covers between 11/12 of its length and
+ * its full length.
+ */
+#define AGGREGATE_BUCKETS 12
+
+/**
+ * @brief Windows aggregated over when none are configured, see Aggregator::parseWindows().
+ */
+#define DEFAULT_AGGREGATE_WINDOWS "5m,15m,60m,tumbling:1d"
+
+/**
+ * @brief Maximum number of sensors and groups (per sensor type) that are aggregated.
+ * @details Readings of further sensors are not aggregated.
+ */
+#ifdef WEMOS_LOW_FOOTPRINT
+#define MAX_AGGREGATE_SERIES 64
+#else
+#define MAX_AGGREGATE_SERIES 1024
+#endif
+
+/**
+ * @brief A window readings are aggregated over.
+ */
+struct AggregateWindow {
+    /** @brief Length of the window in minutes */
+    uint16_t minutes;
+    /**
+     * @brief Whether the window is tumbling: it covers the current period of its length since the
+     * epoch, e.g. the current UTC day, instead of the last minutes up to now.
+     */
+    bool tumbling;
+};
+
+/**
+ * @brief Aggregate of the readings in a window.
+ */
+struct Aggregate {
+    uint32_t count;
+    double sum;
+    float min;
+    float max;
+    /** @brief The most recent reading */
+    float last;
+
+    /** @brief Returns the mean of the readings, 0 without readings */
+    float mean() const { return count > 0 ? sum / count : 0; }
+};
+
+/**
+ * @brief Statistics about the aggregates.
+ */
+struct AggregatorStats {
+    /** @brief Number of sensors and groups that have aggregates, per sensor type */
+    size_t series;
+    /** @brief Number of readings added */
+    uint64_t readings;
+    /** @brief Number of readings not aggregated because MAX_AGGREGATE_SERIES was reached */
+    uint64_t dropped;
+    /** @brief Number of queries answered */
+    uint64_t queries;
+};
+
+/**
+ * @brief Running aggregates of the telemetry per sensor and per sensor group.
+ * @details Windows and groups are meant to be configured before the server starts; add() and
+ * query() are safe to call from multiple threads. Timestamps are milliseconds since the epoch.
+ */
+class Aggregator {
+   private:
+    /**
+     * @brief Aggregate of the readings in one period of a window.
+     */
+    struct Bucket {
+        /** @brief The period the bucket holds, counted in bucket lengths since the epoch */
+        int64_t period;
+        uint32_t count;
+        double sum;
+        float min;
+        float max;
+        float last;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<struct AggregateWindow> windows;
+    /** @brief AGGREGATE_BUCKETS buckets per window, per sensor or group and sensor type */
+    std::unordered_map<uint32_t, std::unique_ptr<struct Bucket[]>> series;
+    /** @brief The groups every grouped sensor belongs to */
+    std::unordered_map<uint16_t, std::vector<uint16_t>> groups_of_sensor;
+    /** @brief The members of every group */
+    std::map<uint16_t, std::vector<uint16_t>> groups;
+    size_t max_series;
+
+    std::atomic<uint64_t> readings;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> queries;
+
+    /**
+     * @brief Adds a reading to the buckets of a sensor or group; called with the mutex held.
+     */
+    void addToSeries(uint32_t key, float value, uint64_t now_ms);
+
+   public:
+    /**
+     * @brief Creates an aggregator with the DEFAULT_AGGREGATE_WINDOWS and no groups.
+     * @param max_series The maximum number of sensors and groups that are aggregated.
+     */
+    explicit Aggregator(size_t max_series = MAX_AGGREGATE_SERIES);
+
+    Aggregator(const Aggregator &) = delete;
+    Aggregator &operator=(const Aggregator &) = delete;
+    Aggregator(Aggregator &&) = delete;
+    Aggregator &operator=(Aggregator &&) = delete;
+
+    /**
+     * @brief Sets the windows, discarding everything aggregated so far.
+     * @throws std::invalid_argument if there are no windows, a window is empty or two windows have
+     * the same length.
+     */
+    void setWindows(const std::vector<struct AggregateWindow> &new_windows);
+
+    /**
+     * @brief Sets the windows from a comma separated list.
+     * @details Every entry is a length in minutes, hours or days, prefixed with "tumbling:" for a
+     * tumbling window, e.g. "5m,15m,1h,tumbling:1d".
+     * @throws std::invalid_argument if the list is malformed.
+     */
+    void parseWindows(const std::string &list);
+
+    /**
+     * @brief Returns the windows as a list in the format of parseWindows().
+     */
+    std::string describeWindows() const;
+
+    /**
+     * @brief Adds sensors to a group.
+     * @param group The ID of the group.
+     * @param first The first sensor ID of the range added.
+     * @param last The last sensor ID of the range added.
+     * @throws std::invalid_argument if the range is reversed.
+     */
+    void addToGroup(uint16_t group, uint16_t first, uint16_t last);
+
+    /**
+     * @brief Adds groups from a semicolon separated list.
+     * @details Every entry is a group ID followed by a comma separated list of sensor IDs and
+     * ranges, e.g. "1=200-210,215;2=220-229".
+     * @throws std::invalid_argument if the list is malformed. Entries before the malformed one
+     * have been applied.
+     */
+    void parseGroups(const std::string &list);
+
+    /**
+     * @brief Adds a reading to the aggregates of its sensor and of every group it is in.
+     * @param sensor_id The full ID of the sensor.
+     * @param type The type of the sensor.
+     * @param value The reading.
+     * @param now_ms The time of the reading.
+     */
+    void add(uint16_t sensor_id, SensorType type, float value, uint64_t now_ms);
+
+    /**
+     * @brief Returns the aggregate of a sensor or group over a window.
+     * @param scope Whether id is a sensor or a group.
+     * @param id The full ID of the sensor or group.
+     * @param type The type of the readings aggregated.
+     * @param minutes The length of the window, one of the configured windows.
+     * @param now_ms The current time.
+     * @param result Receives the aggregate, all zero if the window holds no readings.
+     * @return false if the window is not configured or the group does not exist.
+     */
+    bool query(AggregateScope scope, uint16_t id, SensorType type, uint16_t minutes,
+               uint64_t now_ms, struct Aggregate &result);
+
+    /**
+     * @brief Returns statistics about the aggregates.
+     */
+    struct AggregatorStats getStats() const;
+};
+
+/**
+ * @brief Returns the numeric reading of a telemetry packet.
+ * @param packet The packet.
+ * @param value Receives the temperature, humidity or CO2 level.
+ * @return false if the packet carries no reading that can be aggregated.
+ */
+bool sensorReading(const PacketView &packet, float &value);
+
+/**
+ * @brief Builds an AGGREGATE_RESPONSE frame.
+ * @param metadata The metadata of the query, echoed back.
+ * @param scope The scope of the query.
+ * @param minutes The window of the query.
+ * @param aggregate The aggregate.
+ * @param frame Receives the frame, at least sizeof(sensor_header) + sizeof(aggregate_response).
+ * @return The size of the frame.
+ */
+size_t encodeAggregateResponse(const struct sensor_metadata &metadata, AggregateScope scope,
+                               uint16_t minutes, const struct Aggregate &aggregate,
+                               uint8_t *frame);
+
+#endif
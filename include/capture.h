@@ -0,0 +1,137 @@
+/**
+ * @file capture.h
+ * @brief Header file for capture.cpp.
+ * @details This file contains the format of traffic capture files, the writer the bridge records
+ *          its traffic with and the reader used to replay them.
+ *
+ *          A capture file starts with a CaptureFileHeader, followed by one record per event: a
+ *          CaptureRecordHeader and the raw bytes that were received or sent, exactly as they went
+ *          over the wire. All integers are little-endian.
+ * @author Daan Breur
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Magic number at the start of a capture file ("WCAP").
+ */
+#define CAPTURE_MAGIC 0x50414357
+
+/**
+ * @brief Version of the capture file format, bumped on every incompatible change.
+ */
+#define CAPTURE_VERSION 1
+
+/**
+ * @brief The kind of event a capture record describes.
+ */
+enum class CaptureEvent : uint8_t {
+    /** @brief A client connected; no data */
+    CLIENT_OPEN = 0,
+    /** @brief A client disconnected; no data */
+    CLIENT_CLOSE = 1,
+    /** @brief Bytes received from a client */
+    CLIENT_IN = 2,
+    /** @brief Bytes sent to a client */
+    CLIENT_OUT = 3,
+    /** @brief Bytes sent to the I2C hub */
+    HUB_OUT = 4,
+    /** @brief Bytes received from the I2C hub */
+    HUB_IN = 5,
+};
+
+/**
+ * @brief Header at the start of a capture file.
+ */
+struct CaptureFileHeader {
+    /** @brief Always CAPTURE_MAGIC */
+    uint32_t magic;
+    /** @brief Always CAPTURE_VERSION */
+    uint16_t version;
+    uint16_t reserved;
+    /** @brief Time the capture started in nanoseconds since the epoch */
+    uint64_t started_ns;
+} __attribute__((packed));
+
+/**
+ * @brief Header of a single record in a capture file.
+ */
+struct CaptureRecordHeader {
+    /** @brief Time of the event in nanoseconds since the capture started */
+    uint64_t timestamp_ns;
+    /** @brief The file descriptor of the connection the event happened on */
+    int32_t connection;
+    /** @brief The CaptureEvent */
+    CaptureEvent event;
+    uint8_t reserved;
+    /** @brief Number of data bytes following the header */
+    uint16_t length;
+} __attribute__((packed));
+
+/**
+ * @brief A record read back from a capture file.
+ */
+struct CaptureRecord {
+    uint64_t timestamp_ns;
+    int32_t connection;
+    CaptureEvent event;
+    std::vector<uint8_t> data;
+};
+
+/**
+ * @brief Records traffic into a capture file.
+ * @details Recording is safe from multiple threads. Records are buffered; they are only guaranteed
+ * to be on disk after flush() or destruction.
+ */
+class CaptureWriter {
+   private:
+    FILE *file;
+    uint64_t started_ns;
+    std::mutex file_mutex;
+
+   public:
+    /**
+     * @brief Creates (or truncates) the capture file at the given path.
+     * @throws std::runtime_error if the file cannot be created.
+     */
+    explicit CaptureWriter(const std::string &path);
+    ~CaptureWriter();
+
+    CaptureWriter(const CaptureWriter &) = delete;
+    CaptureWriter &operator=(const CaptureWriter &) = delete;
+    CaptureWriter(CaptureWriter &&) = delete;
+    CaptureWriter &operator=(CaptureWriter &&) = delete;
+
+    /**
+     * @brief Records an event.
+     * @param event The kind of event.
+     * @param connection The file descriptor of the connection.
+     * @param data The bytes received or sent, may be null if length is 0.
+     * @param length The number of bytes.
+     */
+    void record(CaptureEvent event, int connection, const void *data = nullptr, size_t length = 0);
+
+    /**
+     * @brief Writes all buffered records to the file.
+     */
+    void flush();
+};
+
+/**
+ * @brief Reads all records from a capture file.
+ * @param path The capture file.
+ * @return The records, in the order they were recorded.
+ * @throws std::runtime_error if the file cannot be read or is not a valid capture file.
+ */
+std::vector<struct CaptureRecord> readCapture(const std::string &path);
+
+#endif
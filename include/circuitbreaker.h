@@ -0,0 +1,114 @@
+/**
+ * @file circuitbreaker.h
+ * @brief Header file for circuitbreaker.cpp.
+ * @details This file contains the CircuitBreaker class, which stops requests from being sent to an
+ *          I2C hub that keeps failing them. After a number of timeouts or errors in a row the
+ *          breaker opens and requests fail right away, so dashboards get an answer without waiting
+ *          out another timeout. Once the open interval has passed, a single probe request is let
+ *          through; if it succeeds the breaker closes again, otherwise it stays open for another
+ *          interval.
+ * @author Daan Breur
+ */
+
+#ifndef CIRCUITBREAKER_H
+#define CIRCUITBREAKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <mutex>
+
+/**
+ * @brief Default number of failed requests in a row that open the breaker.
+ */
+#define BREAKER_FAILURE_THRESHOLD 5
+
+/**
+ * @brief Default time an open breaker rejects requests before probing, in milliseconds.
+ */
+#define BREAKER_OPEN_MS 2000
+
+/**
+ * @brief State of a circuit breaker.
+ */
+enum class BreakerState : uint8_t {
+    /** @brief Requests go through */
+    CLOSED = 0,
+    /** @brief Requests are rejected */
+    OPEN = 1,
+    /** @brief A single probe request is let through to see whether the hub recovered */
+    HALF_OPEN = 2,
+};
+
+/**
+ * @brief Statistics about a circuit breaker.
+ */
+struct BreakerStats {
+    BreakerState state;
+    /** @brief Number of failed requests in a row */
+    size_t consecutive_failures;
+    /** @brief Number of times the breaker opened */
+    uint64_t opened;
+    /** @brief Number of requests rejected while it was open */
+    uint64_t rejected;
+};
+
+/**
+ * @brief Rejects requests to a hub after repeated failures, probing for recovery.
+ * @details Safe to use from multiple threads. Every request allow() let through should be followed
+ * by succeeded() or failed(); a probe that is never reported on is given up after an open
+ * interval, so the breaker cannot get stuck half open.
+ */
+class CircuitBreaker {
+   private:
+    mutable std::mutex mutex;
+    BreakerState state;
+    size_t consecutive_failures;
+    size_t threshold;
+    std::chrono::steady_clock::duration open_time;
+    /** @brief When an open breaker lets the next probe through */
+    std::chrono::steady_clock::time_point probe_at;
+
+    uint64_t opened;
+    uint64_t rejected;
+
+    /**
+     * @brief Opens the breaker for another interval.
+     * @warning The mutex must be held.
+     */
+    void open(std::chrono::steady_clock::time_point now);
+
+   public:
+    CircuitBreaker();
+
+    /**
+     * @brief Returns whether a request may be sent.
+     * @details While open, the first request after the open interval is let through as the probe.
+     */
+    bool allow();
+
+    /**
+     * @brief Reports a request that got its answer; closes the breaker.
+     */
+    void succeeded();
+
+    /**
+     * @brief Reports a request that timed out or failed.
+     */
+    void failed();
+
+    /**
+     * @brief Changes when the breaker opens and for how long.
+     * @param threshold Failed requests in a row that open the breaker, 0 to never open it.
+     * @param open_time Time an open breaker rejects requests before probing.
+     */
+    void configure(size_t threshold, std::chrono::milliseconds open_time);
+
+    /**
+     * @brief Returns the state of the breaker and how often it rejected requests.
+     */
+    struct BreakerStats getStats() const;
+};
+
+#endif
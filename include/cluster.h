@@ -0,0 +1,273 @@
+/**
+ * @file cluster.h
+ * @brief Header file for cluster.cpp.
+ * @details This file contains the classes that shard the Wemos devices over several bridges. Every
+ *          bridge of the cluster owns a part of the sensor IDs and a dashboard may connect to any
+ *          of them; a DASHBOARD_GET or DASHBOARD_POST for a sensor owned by another bridge is
+ *          forwarded to that bridge over a persistent connection to its binary port.
+ *
+ *          The connection to another bridge is pipelined: requests of all workers go out back to
+ *          back without waiting for the answers of the ones before. The owner answers them in
+ *          whatever order they are done, so every answer is matched to the oldest waiting
+ *          request for the same sensor. A DASHBOARD_POST is sent without waiting; the owner
+ *          answers every post forwarded to it with a POST_ACK, which only ever matches a post,
+ *          and the link consumes it so it is never taken for the answer to a read.
+ * @author Daan Breur
+ */
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packets.h"
+#include "packetview.h"
+
+/**
+ * @brief Time a forwarded request waits for the answer of the owning bridge, in milliseconds.
+ */
+#define CLUSTER_TIMEOUT_MS 1000
+
+/**
+ * @brief Time before a lost connection to another bridge is set up again, in milliseconds.
+ */
+#define CLUSTER_RETRY_MS 500
+
+/**
+ * @brief Maximum number of other bridges in the cluster.
+ */
+#define MAX_CLUSTER_NODES 16
+
+/**
+ * @brief Marks a sensor ID in the cluster map as owned by this bridge.
+ */
+#define NO_CLUSTER_NODE 0xFF
+
+/**
+ * @brief Statistics about the connection to another bridge.
+ */
+struct PeerStats {
+    /** @brief Whether the connection is up */
+    bool connected;
+    /** @brief Number of requests forwarded */
+    uint64_t forwarded;
+    /** @brief Number of forwarded requests that got no answer */
+    uint64_t failed;
+    /** @brief Number of answers that matched no waiting request, e.g. after a timeout */
+    uint64_t unmatched;
+    /** @brief Number of requests currently waiting for their answer */
+    size_t in_flight;
+    /** @brief The highest number of requests that waited at the same time */
+    size_t peak_in_flight;
+};
+
+/**
+ * @brief Persistent, pipelined connection to the binary port of another bridge.
+ * @details call() and post() are safe to call from any number of threads. The connection is set
+ * up and kept up by a thread of its own, which also receives the answers.
+ */
+class PeerLink {
+   private:
+    /**
+     * @brief A request waiting for its answer; lives on the stack of call().
+     * @details A post is not waited for; it is allocated by post() and freed by whoever removes it
+     * from in_flight.
+     */
+    struct Request {
+        uint16_t sensor_id;
+        bool post;
+        bool done;
+        bool failed;
+        struct sensor_packet response;
+        /** @brief When a post that was not acknowledged is given up */
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    std::string ip;
+    int port;
+
+    /** @brief Connection to the bridge, -1 while it is down; written with send_mutex held */
+    std::atomic<int> fd;
+    /** @brief Keeps the frames of concurrent requests apart and in the order of in_flight */
+    std::mutex send_mutex;
+
+    std::mutex mutex;
+    std::condition_variable answered;
+    /** @brief The requests waiting for their answer, oldest first */
+    std::deque<struct Request *> in_flight;
+
+    std::thread thread;
+    std::atomic<bool> running;
+
+    std::atomic<uint64_t> forwarded;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> unmatched;
+    size_t peak_in_flight;
+
+    /**
+     * @brief Connects to the bridge and negotiates the features of a cluster connection.
+     * @return The connected socket, or -1 if the bridge cannot be reached.
+     */
+    int connectToPeer();
+
+    /**
+     * @brief Hands an answer to the oldest request waiting for the same sensor.
+     * @details A POST_ACK goes to a post, any other answer to a read. An answer without a sensor
+     * ID cannot be matched and is dropped.
+     */
+    void complete(const struct sensor_packet &response, uint16_t sensor_id);
+
+    /**
+     * @brief Closes the connection and fails every waiting request.
+     */
+    void disconnect();
+
+    /**
+     * @brief Gives up the posts the bridge did not acknowledge in time.
+     * @warning The mutex must be held.
+     */
+    void dropExpiredPosts(std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Sends a request as an extended frame.
+     * @return false if the connection is down or the frame could not be sent.
+     */
+    bool sendFrame(const PacketView &request, uint16_t sensor_id);
+
+    void receiveLoop();
+
+   public:
+    /**
+     * @param ip The IP address of the other bridge.
+     * @param port The binary port of the other bridge.
+     */
+    PeerLink(const std::string &ip, int port);
+    ~PeerLink();
+
+    PeerLink(const PeerLink &) = delete;
+    PeerLink &operator=(const PeerLink &) = delete;
+    PeerLink(PeerLink &&) = delete;
+    PeerLink &operator=(PeerLink &&) = delete;
+
+    /**
+     * @brief Starts connecting to the other bridge.
+     */
+    void start();
+
+    /**
+     * @brief Closes the connection and fails every waiting request.
+     */
+    void stop();
+
+    /**
+     * @brief Forwards a request and waits for its answer.
+     * @param request The request in the 8-bit layout.
+     * @param sensor_id The full ID of the sensor.
+     * @param timeout_ms The time to wait for the answer.
+     * @return The answer in the 8-bit layout.
+     * @throws std::runtime_error if the bridge is unreachable or does not answer in time.
+     */
+    struct sensor_packet call(const PacketView &request, uint16_t sensor_id,
+                              int timeout_ms = CLUSTER_TIMEOUT_MS);
+
+    /**
+     * @brief Forwards a post without waiting for its acknowledgment.
+     * @details A post the bridge rejects is counted as failed once its POST_ACK arrives.
+     * @throws std::runtime_error if the bridge is unreachable.
+     */
+    void post(const PacketView &request, uint16_t sensor_id);
+
+    /**
+     * @brief Returns whether the connection is up.
+     */
+    bool isConnected() const { return fd >= 0; }
+
+    /**
+     * @brief Returns the address of the other bridge as ip:port.
+     */
+    std::string address() const { return ip + ":" + std::to_string(port); }
+
+    /**
+     * @brief Returns whether the other bridge has the given IP address.
+     */
+    bool isAt(const struct in_addr &address) const;
+
+    /**
+     * @brief Returns statistics about the connection.
+     */
+    struct PeerStats getStats();
+};
+
+/**
+ * @brief Static map of which bridge owns which sensor IDs.
+ * @details Sensors the map does not assign to another bridge are owned by this one. The map is
+ * meant to be set up before the links are started; ownerOf() is safe to call from any thread.
+ */
+class ClusterMap {
+   private:
+    std::vector<std::unique_ptr<PeerLink>> nodes;
+    /** @brief Index in nodes of the owner of every sensor ID, NO_CLUSTER_NODE if it is local */
+    std::unique_ptr<uint8_t[]> owners;
+    bool started;
+
+   public:
+    ClusterMap();
+
+    ClusterMap(const ClusterMap &) = delete;
+    ClusterMap &operator=(const ClusterMap &) = delete;
+
+    /**
+     * @brief Sets the other bridges and their sensors from a semicolon separated table.
+     * @details Every entry is the binary address of a bridge followed by a comma separated list of
+     * the sensor IDs and ranges it owns, e.g. "10.0.0.6:5000=1000-1999;10.0.0.7:5000=2000-2999".
+     * @throws std::invalid_argument if the table is malformed, lists too many bridges or assigns a
+     * sensor twice.
+     * @throws std::logic_error if the links have already been started.
+     */
+    void parseTable(const std::string &table);
+
+    /**
+     * @brief Returns the link to the bridge that owns a sensor, or nullptr if it is local.
+     */
+    PeerLink *ownerOf(uint16_t sensor_id) const;
+
+    /**
+     * @brief Returns whether a connection from the given IP address comes from another bridge.
+     * @details Only the IP address is compared, as a bridge connects from a port of its own.
+     */
+    bool isNode(const struct in_addr &address) const;
+
+    /**
+     * @brief Returns the number of other bridges.
+     */
+    size_t size() const { return nodes.size(); }
+
+    /**
+     * @brief Returns the link to another bridge.
+     */
+    PeerLink &node(size_t index) { return *nodes[index]; }
+
+    /**
+     * @brief Starts the links to all other bridges.
+     */
+    void start();
+
+    /**
+     * @brief Stops the links to all other bridges.
+     */
+    void stop();
+};
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file connection.h
+ * @brief Definition of the per-client connection state.
+ * @author Daan Breur
+ */
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "httpapi.h"
+#include "latency.h"
+#include "ratelimit.h"
+
+/**
+ * @brief State of a single client connection.
+ * @details Taken from a fixed-size pool when the client connects and owned by exactly one worker
+ *          thread until it disconnects.
+ */
+struct Connection {
+    /** @brief The file descriptor of the connection */
+    int fd;
+    /** @brief The address of the client */
+    struct sockaddr_in address;
+    /** @brief Receive buffer taken from the buffer pool */
+    uint8_t *buffer;
+    /** @brief Number of bytes in the buffer; an incomplete packet waits here for the rest */
+    size_t buffered;
+    /** @brief Whether the client negotiated FEATURE_EXTENDED_IDS with a HELLO */
+    bool extended_ids;
+    /** @brief Whether the client connected to the HTTP API instead of the binary protocol */
+    bool http;
+    /** @brief Whether the client is another bridge of the cluster, see FEATURE_CLUSTER_PEER */
+    bool cluster_peer;
+    /** @brief The HTTP request being received, if http is set */
+    struct HttpRequest http_request;
+    /** @brief Token buckets of the connection, per RateClass */
+    struct TokenBucket budgets[RATE_CLASSES];
+    /** @brief Timestamps of the latest read, carried by the frames parsed from it */
+    struct ReceiveTimestamps received;
+    /** @brief Index of the worker that owns the connection */
+    size_t worker;
+    /** @brief Number of hub transactions whose answer has yet to come back to the connection */
+    unsigned int hub_transactions;
+    /** @brief Whether the client went away while hub transactions for it were still running */
+    bool closing;
+};
+
+#endif
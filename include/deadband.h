@@ -0,0 +1,109 @@
+/**
+ * @file deadband.h
+ * @brief Header file for deadband.cpp.
+ * @details This file contains the DeadbandFilter class, which decides whether a telemetry update
+ *          actually changes the known state of a sensor. Temperature, humidity and CO2 readings
+ *          are compared against a configurable deadband, every other state is compared exactly.
+ *          Button and motion packets are events rather than states and always pass.
+ * @author Daan Breur
+ */
+
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "packets.h"
+#include "packetview.h"
+
+/**
+ * @brief Threshold a reading has to move beyond to count as a change.
+ * @details A reading changes if it differs from the known value by more than the absolute
+ * threshold and by more than the relative threshold times the known value. With both at zero any
+ * difference counts.
+ */
+struct Deadband {
+    /** @brief Absolute threshold, in the unit of the reading */
+    float absolute;
+    /** @brief Relative threshold, as a fraction of the known value */
+    float relative;
+};
+
+/**
+ * @brief Statistics about filtered telemetry updates.
+ */
+struct DeadbandStats {
+    /** @brief Number of updates that changed the state of their sensor */
+    uint64_t accepted;
+    /** @brief Number of updates that were dropped because they changed nothing */
+    uint64_t suppressed;
+};
+
+/**
+ * @brief Filters out telemetry updates that do not change the state of their sensor.
+ * @details The deadbands are meant to be set before the server starts; accept() is safe to call
+ * from multiple threads.
+ */
+class DeadbandFilter {
+   private:
+    struct Deadband type_deadbands[UINT8_MAX + 1];
+    struct Deadband sensor_deadbands[UINT8_MAX + 1];
+    bool has_sensor_deadband[UINT8_MAX + 1];
+
+    std::atomic<uint64_t> accepted;
+    std::atomic<uint64_t> suppressed;
+
+   public:
+    /**
+     * @brief Creates a filter that only drops updates that are exactly equal to the known state.
+     */
+    DeadbandFilter();
+
+    DeadbandFilter(const DeadbandFilter &) = delete;
+    DeadbandFilter &operator=(const DeadbandFilter &) = delete;
+    DeadbandFilter(DeadbandFilter &&) = delete;
+    DeadbandFilter &operator=(DeadbandFilter &&) = delete;
+
+    /**
+     * @brief Sets the deadband for every sensor of a type.
+     * @throws std::invalid_argument if a threshold is negative.
+     */
+    void setTypeDeadband(SensorType type, struct Deadband deadband);
+
+    /**
+     * @brief Sets the deadband of a single sensor, overriding the one of its type.
+     * @details Only 8-bit sensor IDs can have a deadband of their own.
+     * @throws std::invalid_argument if a threshold is negative.
+     */
+    void setSensorDeadband(uint8_t sensor_id, struct Deadband deadband);
+
+    /**
+     * @brief Sets deadbands from a comma separated list.
+     * @details Every entry is a sensor type (temperature, humidity, co2) or a sensor ID, followed
+     * by an absolute threshold, a relative threshold in percent, or both separated by a slash,
+     * e.g. "temperature=0.2,humidity=2%,200=0.5/1%".
+     * @param list The list of deadbands.
+     * @throws std::invalid_argument if the list is malformed. Entries before the malformed one
+     * have been applied.
+     */
+    void parse(const std::string &list);
+
+    /**
+     * @brief Decides whether an update changes the known state of its sensor and counts it.
+     * @param sensor_id The full ID of the sensor.
+     * @param known The known state of the sensor, with a zero length if there is none.
+     * @param update The incoming update.
+     * @return true if the update should be applied, false if it can be dropped.
+     */
+    bool accept(uint16_t sensor_id, const PacketView &known, const PacketView &update);
+
+    /**
+     * @brief Returns the number of accepted and suppressed updates.
+     */
+    struct DeadbandStats getStats() const;
+};
+
+#endif
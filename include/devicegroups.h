@@ -0,0 +1,95 @@
+/**
+ * @file devicegroups.h
+ * @brief Header file for devicegroups.cpp.
+ * @details This file contains the DeviceGroups class, which holds the configured groups of
+ *          actuators a dashboard can address with a single GROUP_POST, such as all lights on a
+ *          floor, and the encoding of the GROUP_RESULT that answers it.
+ * @author Daan Breur
+ */
+
+#ifndef DEVICEGROUPS_H
+#define DEVICEGROUPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "packets.h"
+
+/**
+ * @brief Maximum number of members of a device group, as many as one GROUP_RESULT can report on.
+ * @details The payload of an extended frame holds 254 bytes next to the high byte of the ID.
+ */
+#define MAX_GROUP_MEMBERS \
+    ((UINT8_MAX - 1 - sizeof(struct group_result)) / sizeof(struct group_member_status))
+
+/**
+ * @brief Time a GROUP_POST waits for slave connections that cannot take their frame right away,
+ * in milliseconds.
+ */
+#define GROUP_SEND_TIMEOUT_MS 200
+
+/**
+ * @brief Outcome of a GROUP_POST for one member of the group.
+ */
+struct GroupMemberResult {
+    uint16_t sensor_id;
+    ErrorCode status;
+};
+
+/**
+ * @brief The configured device groups.
+ * @details Groups are meant to be configured before the server starts; members() may then be
+ * called from any thread.
+ */
+class DeviceGroups {
+   private:
+    /** @brief The members of every group, in the order they were added */
+    std::map<uint16_t, std::vector<uint16_t>> groups;
+
+   public:
+    /**
+     * @brief Adds devices to a group; devices that are in the group already are skipped.
+     * @param group The ID of the group.
+     * @param first The first device ID of the range added.
+     * @param last The last device ID of the range added.
+     * @throws std::invalid_argument if the range is reversed or the group grows beyond
+     * MAX_GROUP_MEMBERS.
+     */
+    void add(uint16_t group, uint16_t first, uint16_t last);
+
+    /**
+     * @brief Adds groups from a semicolon separated list.
+     * @details Every entry is a group ID followed by a comma separated list of device IDs and
+     * ranges, e.g. "2=200-230,64-70;3=300". Hub sensors, slaves and devices of other bridges of the
+     * cluster may be mixed in one group.
+     * @throws std::invalid_argument if the list is malformed. Entries before the malformed one
+     * have been applied.
+     */
+    void parse(const std::string &list);
+
+    /**
+     * @brief Returns the members of a group, or nullptr if the group does not exist.
+     */
+    const std::vector<uint16_t> *members(uint16_t group) const;
+
+    /**
+     * @brief Returns the number of groups.
+     */
+    size_t size() const { return groups.size(); }
+};
+
+/**
+ * @brief Builds a GROUP_RESULT frame in the basic framing.
+ * @param metadata The metadata of the GROUP_POST, echoed back.
+ * @param results The outcome for every member, at most MAX_GROUP_MEMBERS.
+ * @param frame Receives the frame, must hold MAX_FRAME_SIZE bytes.
+ * @return The size of the frame.
+ */
+size_t encodeGroupResult(const struct sensor_metadata &metadata,
+                         const std::vector<struct GroupMemberResult> &results, uint8_t *frame);
+
+#endif
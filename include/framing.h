@@ -0,0 +1,50 @@
+/**
+ * @file framing.h
+ * @brief Header file for framing.cpp.
+ * @details This file contains the conversion between frames on the wire and sensor packets with a
+ *          full 16-bit sensor ID. Connections that negotiated FEATURE_EXTENDED_IDS carry the high
+ *          byte of the sensor ID in every frame; on all others the ID is the 8-bit one from the
+ *          metadata.
+ * @author Daan Breur
+ */
+
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packets.h"
+#include "packetview.h"
+
+/**
+ * @brief Largest possible frame on the wire, header included.
+ */
+#define MAX_FRAME_SIZE (sizeof(struct sensor_header) + UINT8_MAX)
+
+/**
+ * @brief Decodes a complete frame into a packet and the full sensor ID.
+ * @details The payload is copied into the packet, as far as it fits.
+ * @param frame The frame, starting with its sensor_header.
+ * @param extended_ids Whether the connection negotiated FEATURE_EXTENDED_IDS.
+ * @param packet Receives the packet in the 8-bit layout.
+ * @param sensor_id Receives the full sensor ID.
+ * @return false if the frame is too short to be an extended frame.
+ */
+bool decodeFrame(const uint8_t *frame, bool extended_ids, struct sensor_packet &packet,
+                 uint16_t &sensor_id);
+
+/**
+ * @brief Encodes a packet into a frame for the wire.
+ * @details Payloads longer than a frame can announce are cut off.
+ * @param packet The packet in the 8-bit layout; its metadata only needs the low byte of the ID.
+ * @param sensor_id The full sensor ID.
+ * @param extended_ids Whether the connection negotiated FEATURE_EXTENDED_IDS.
+ * @param frame Receives the frame, must hold MAX_FRAME_SIZE bytes.
+ * @return The length of the frame.
+ * @throws std::invalid_argument if the ID does not fit in 8 bits on a basic connection.
+ */
+size_t encodeFrame(const PacketView &packet, uint16_t sensor_id, bool extended_ids,
+                   uint8_t *frame);
+
+#endif
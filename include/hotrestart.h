@@ -0,0 +1,103 @@
+/**
+ * @file hotrestart.h
+ * @brief Header file for hotrestart.cpp.
+ * @details This file contains the declarations used to hand the sockets and state of a running
+ *          bridge over to a freshly started one, without closing any connection. The old process
+ *          passes the file descriptors over a Unix socket using SCM_RIGHTS, together with the
+ *          slave ID to file descriptor mapping and the SlaveManager state.
+ * @author Daan Breur
+ */
+
+#ifndef HOTRESTART_H
+#define HOTRESTART_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "httpapi.h"
+#include "slavemanager.h"
+
+/**
+ * @brief Name of the environment variable that tells a new process which file descriptor to
+ * receive the handoff on.
+ */
+#define HANDOFF_FD_ENV "WEMOS_HANDOFF_FD"
+
+/**
+ * @brief File descriptor number the handoff socket is placed on in the new process.
+ */
+#define HANDOFF_FD 3
+
+/**
+ * @brief Time the old process waits for the new one to confirm the takeover.
+ */
+#define HANDOFF_ACK_TIMEOUT_MS 10000
+
+/**
+ * @brief A client connection that is handed over.
+ */
+struct HandoffClient {
+    int fd;
+    struct sockaddr_in address;
+    /** @brief Whether the connection negotiated FEATURE_EXTENDED_IDS */
+    bool extended_ids = false;
+    /** @brief Whether the connection was accepted on the HTTP listener */
+    bool http = false;
+    /** @brief Whether another bridge of the cluster negotiated FEATURE_CLUSTER_PEER */
+    bool cluster_peer = false;
+    /** @brief Received bytes that were not parsed yet, such as the first part of a frame */
+    std::vector<uint8_t> pending;
+    /** @brief The HTTP request being received, if http is set */
+    struct HttpRequest http_request = {};
+};
+
+/**
+ * @brief Everything the new process needs to take over from the old one.
+ * @details File descriptors that are not in use are -1. The file descriptors of the slaves must be
+ * either the UDP socket or one of the client file descriptors.
+ */
+struct HandoffState {
+    int listen_fd = -1;
+    int udp_fd = -1;
+    int http_fd = -1;
+    /** @brief Connection to every I2C hub, in routing table order; -1 for hubs that are down */
+    std::vector<int> hub_fds;
+    std::vector<struct HandoffClient> clients;
+    std::vector<struct SlaveSnapshot> slaves;
+};
+
+/**
+ * @brief Sends the sockets and state of this process to a new process.
+ * @param handoff_fd A connected AF_UNIX SOCK_SEQPACKET socket.
+ * @param state The state to hand over.
+ * @throws std::runtime_error if sending fails.
+ */
+void sendHandoffState(int handoff_fd, const struct HandoffState &state);
+
+/**
+ * @brief Receives the sockets and state handed over by the old process.
+ * @details All received file descriptors have FD_CLOEXEC set.
+ * @param handoff_fd The AF_UNIX SOCK_SEQPACKET socket the old process sends on.
+ * @return The state that was handed over, with file descriptors valid in this process.
+ * @throws std::runtime_error if receiving fails or the data is malformed.
+ */
+struct HandoffState receiveHandoffState(int handoff_fd);
+
+/**
+ * @brief Confirms to the old process that the new process has taken over.
+ * @param handoff_fd The socket the handoff was received on.
+ * @throws std::runtime_error if sending fails.
+ */
+void sendHandoffAck(int handoff_fd);
+
+/**
+ * @brief Waits for the new process to confirm that it has taken over.
+ * @param handoff_fd The socket the handoff was sent on.
+ * @param timeout_ms Maximum time to wait in milliseconds.
+ * @return true if the new process confirmed the takeover, false if it failed or timed out.
+ */
+bool waitForHandoffAck(int handoff_fd, int timeout_ms);
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * @file httpapi.h
+ * @brief Header file for httpapi.cpp.
+ * @details This file contains the small HTTP/1.1 request parser and the JSON helpers of the HTTP
+ *          API. The parser works on the fixed-size receive buffer of a connection: complete header
+ *          lines are consumed as soon as they arrive, so only the longest header line and the body
+ *          have to fit into the buffer, never the request as a whole.
+ * @author Daan Breur
+ */
+
+#ifndef HTTPAPI_H
+#define HTTPAPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "packets.h"
+#include "packetview.h"
+
+/**
+ * @brief Longest request path the parser keeps; longer paths cannot match any route anyway.
+ */
+#define HTTP_MAX_PATH 63
+
+/**
+ * @brief Method of an HTTP request, as far as the API cares.
+ */
+enum class HttpMethod : uint8_t {
+    OTHER = 0,
+    GET = 1,
+    POST = 2,
+    OPTIONS = 3,
+};
+
+/**
+ * @brief Outcome of feeding received data to parseHttpRequest().
+ */
+enum class HttpParseResult : uint8_t {
+    /** @brief The request is not complete yet */
+    INCOMPLETE = 0,
+    /** @brief The request is complete and can be handled */
+    COMPLETE = 1,
+    /** @brief The request is malformed or uses something the parser does not support */
+    BAD_REQUEST = 2,
+    /** @brief A header line does not fit into the receive buffer */
+    HEADER_TOO_LARGE = 3,
+    /** @brief The body does not fit into the receive buffer */
+    BODY_TOO_LARGE = 4,
+};
+
+/**
+ * @brief State of an HTTP request that is being received.
+ * @details Kept in the connection between reads; zero-initialise it before every request.
+ */
+struct HttpRequest {
+    /** @brief Whether the request line has been parsed */
+    bool started;
+    /** @brief Whether the empty line ending the headers has been parsed */
+    bool headers_done;
+    HttpMethod method;
+    /** @brief The request target without query string, null-terminated */
+    char path[HTTP_MAX_PATH + 1];
+    /** @brief Length of the body as announced by the Content-Length header */
+    size_t content_length;
+    /** @brief Whether the connection stays open after the response */
+    bool keep_alive;
+};
+
+/**
+ * @brief Parses as much of a request as the received data allows.
+ * @param request The state of the request, updated with every parsed line.
+ * @param data The received data that has not been consumed yet.
+ * @param length The number of bytes in data.
+ * @param capacity The size of the receive buffer, to tell a long line from a full buffer.
+ * @param consumed Receives the number of bytes parsed. On COMPLETE this includes the body, which
+ * is the last content_length bytes of the consumed range.
+ * @return The state of the request after parsing.
+ */
+HttpParseResult parseHttpRequest(struct HttpRequest &request, const uint8_t *data, size_t length,
+                                 size_t capacity, size_t &consumed);
+
+/**
+ * @brief Returns the reason phrase of an HTTP status code.
+ */
+const char *httpStatusText(int status);
+
+/**
+ * @brief Builds the status line and headers of a JSON response.
+ * @param status The HTTP status code.
+ * @param content_length The length of the body that follows.
+ * @param keep_alive Whether the connection stays open after the response.
+ */
+std::string httpResponseHead(int status, size_t content_length, bool keep_alive);
+
+/**
+ * @brief Returns the name of a sensor type as used in the JSON documents, e.g. "rgb_light".
+ */
+const char *sensorTypeName(SensorType type);
+
+/**
+ * @brief Serializes the state of a sensor into a JSON object.
+ * @details For example {"id":200,"type":"temperature","value":21.5}.
+ * @param sensor_id The full ID of the sensor.
+ * @param packet The known state of the sensor.
+ */
+std::string sensorToJson(uint16_t sensor_id, const PacketView &packet);
+
+/**
+ * @brief Turns the JSON body of an actuator write into a DASHBOARD_POST packet.
+ * @details The body is a flat object naming the sensor type and its target state, e.g.
+ * {"type":"light","target_state":1}, {"type":"rgb_light","red":255,"green":0,"blue":0} or
+ * {"type":"lichtkrant","text":"Hello"}.
+ * @param body The body of the request.
+ * @param length The length of the body.
+ * @param sensor_id The full ID of the sensor written to.
+ * @param packet Receives the packet in the 8-bit layout.
+ * @throws std::invalid_argument if the body is malformed or not an actuator write.
+ */
+void parseSensorWrite(const char *body, size_t length, uint16_t sensor_id,
+                      struct sensor_packet &packet);
+
+/**
+ * @brief Escapes a string for use inside a JSON string literal.
+ */
+std::string jsonEscape(const char *text, size_t length);
+
+#endif
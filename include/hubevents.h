@@ -0,0 +1,111 @@
+/**
+ * @file hubevents.h
+ * @brief Header file for hubevents.cpp.
+ * @details This file contains the HubEventDispatcher class. Packets a hub sends on its own, such as
+ *          a hub-side button or a sensor reporting a change, are sorted out from the responses by
+ *          the I2CClient and posted here. A single thread of its own processes them in arrival
+ *          order, so the receive thread of the hub never waits on what an event triggers; handling
+ *          a button press, for one, takes a transaction with the hub.
+ * @author Daan Breur
+ */
+
+#ifndef HUBEVENTS_H
+#define HUBEVENTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "packets.h"
+#include "pool.h"
+
+/**
+ * @brief Default number of hub events that can wait to be processed.
+ */
+#ifdef WEMOS_LOW_FOOTPRINT
+#define HUB_EVENT_QUEUE_CAPACITY 16
+#else
+#define HUB_EVENT_QUEUE_CAPACITY 64
+#endif
+
+/**
+ * @brief Statistics about dispatched hub events.
+ */
+struct HubEventStats {
+    /** @brief Number of events posted by the hubs */
+    uint64_t posted;
+    /** @brief Number of events that have been processed */
+    uint64_t dispatched;
+    /** @brief Number of events dropped because the queue was full */
+    uint64_t dropped;
+    /** @brief Number of events waiting to be processed */
+    size_t queued;
+};
+
+/**
+ * @brief Processes unsolicited hub packets on a thread of its own.
+ * @details post() is safe to call from any thread and never blocks on the processing.
+ */
+class HubEventDispatcher {
+   private:
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    /** @brief Events waiting to be processed; when full, the oldest event is dropped */
+    RingBuffer<struct sensor_packet> queue;
+    std::function<void(const struct sensor_packet &)> handler;
+    std::thread thread;
+    bool running;
+
+    uint64_t posted;
+    uint64_t dispatched;
+    uint64_t dropped;
+
+    /**
+     * @brief Processes events until stop() is called and the queue is empty.
+     * @warning This method should not be called directly. It is intended to be used internally
+     * by the class.
+     */
+    void dispatchLoop();
+
+   public:
+    /**
+     * @param capacity The number of events that can wait to be processed.
+     * @throws std::invalid_argument if the capacity is zero.
+     */
+    explicit HubEventDispatcher(size_t capacity = HUB_EVENT_QUEUE_CAPACITY);
+    ~HubEventDispatcher();
+
+    HubEventDispatcher(const HubEventDispatcher &) = delete;
+    HubEventDispatcher &operator=(const HubEventDispatcher &) = delete;
+    HubEventDispatcher(HubEventDispatcher &&) = delete;
+    HubEventDispatcher &operator=(HubEventDispatcher &&) = delete;
+
+    /**
+     * @brief Starts processing events.
+     * @param handler Called for every event, in the order the events were posted.
+     * @throws std::logic_error if the dispatcher is already running.
+     */
+    void start(std::function<void(const struct sensor_packet &)> handler);
+
+    /**
+     * @brief Processes the events still queued and stops the thread.
+     */
+    void stop();
+
+    /**
+     * @brief Queues an event for processing.
+     * @details Events posted while the dispatcher is stopped are processed once it starts.
+     */
+    void post(const struct sensor_packet &event);
+
+    /**
+     * @brief Returns statistics about the dispatched events.
+     */
+    struct HubEventStats getStats() const;
+};
+
+#endif
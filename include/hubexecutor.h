@@ -0,0 +1,124 @@
+/**
+ * @file hubexecutor.h
+ * @brief Header file for hubexecutor.cpp.
+ * @details This file contains the HubExecutor class, a small pool of threads that run the
+ *          transactions with the I2C hubs on behalf of the client workers. A worker hands a hub
+ *          read or post over and goes on serving its other connections; the answer is passed
+ *          back to the worker once the hub is done, so a slow or unreachable hub no longer stalls
+ *          every connection that happens to share a worker with the request.
+ * @author Daan Breur
+ */
+
+#ifndef HUBEXECUTOR_H
+#define HUBEXECUTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pool.h"
+
+/**
+ * @brief Default number of hub transactions that can wait for a thread of the executor.
+ * @details Transactions beyond it are refused right away instead of queueing up behind a hub
+ * that does not answer.
+ */
+#ifdef WEMOS_LOW_FOOTPRINT
+#define HUB_EXECUTOR_QUEUE_CAPACITY 16
+#else
+#define HUB_EXECUTOR_QUEUE_CAPACITY 64
+#endif
+
+/**
+ * @brief Statistics about the hub transactions run by the executor.
+ */
+struct HubExecutorStats {
+    /** @brief Number of threads running transactions */
+    size_t threads;
+    /** @brief Number of transactions accepted */
+    uint64_t submitted;
+    /** @brief Number of transactions that have finished */
+    uint64_t completed;
+    /** @brief Number of transactions refused because the queue was full or it was stopped */
+    uint64_t rejected;
+    /** @brief Number of transactions waiting for a thread */
+    size_t queued;
+    /** @brief Number of transactions being run right now */
+    size_t running;
+};
+
+/**
+ * @brief Runs hub transactions on threads of its own.
+ * @details A transaction is a record owned by the caller, which the executor only passes on to
+ * the handler given to start(), so queueing one allocates nothing. submit() is safe to call from
+ * any thread and never blocks on a transaction.
+ */
+class HubExecutor {
+   private:
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    /** @brief Transactions waiting for a thread, oldest first */
+    RingBuffer<void *> queue;
+    /** @brief Runs a single transaction, set by start() */
+    std::function<void(void *transaction)> handler;
+    std::vector<std::thread> threads;
+    bool running;
+
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t rejected;
+    size_t busy;
+
+    /**
+     * @brief Runs transactions until stop() is called and the queue is empty.
+     * @warning This method should not be called directly. It is intended to be used internally
+     * by the class.
+     */
+    void runLoop();
+
+   public:
+    /**
+     * @param capacity The number of transactions that can wait for a thread.
+     * @throws std::invalid_argument if the capacity is zero.
+     */
+    explicit HubExecutor(size_t capacity = HUB_EXECUTOR_QUEUE_CAPACITY);
+    ~HubExecutor();
+
+    HubExecutor(const HubExecutor &) = delete;
+    HubExecutor &operator=(const HubExecutor &) = delete;
+    HubExecutor(HubExecutor &&) = delete;
+    HubExecutor &operator=(HubExecutor &&) = delete;
+
+    /**
+     * @brief Starts the threads.
+     * @param thread_count The number of transactions that can run at the same time.
+     * @param run Runs a single transaction, called on a thread of the executor.
+     * @throws std::invalid_argument if thread_count is zero.
+     * @throws std::logic_error if the executor is already running.
+     */
+    void start(size_t thread_count, std::function<void(void *transaction)> run);
+
+    /**
+     * @brief Runs the transactions still queued and stops the threads.
+     */
+    void stop();
+
+    /**
+     * @brief Queues a transaction.
+     * @param transaction Passed to the handler once a thread is free; must stay valid until then.
+     * @return false if the queue is full or the executor is stopped; the transaction is not run.
+     */
+    bool submit(void *transaction);
+
+    /**
+     * @brief Returns statistics about the transactions.
+     */
+    struct HubExecutorStats getStats() const;
+};
+
+#endif
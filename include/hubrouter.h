@@ -0,0 +1,221 @@
+/**
+ * @file hubrouter.h
+ * @brief Header file for hubrouter.cpp.
+ * @details This file contains the routing table that spreads the sensors behind the bridge over
+ *          several I2C hubs. Every hub gets its own I2CClient, and with that its own connection,
+ *          receive thread, packet queue and HubScheduler, so a slow or unreachable hub only
+ *          affects the sensors routed to it.
+ * @author Daan Breur
+ */
+
+#ifndef HUBROUTER_H
+#define HUBROUTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "hubscheduler.h"
+#include "i2cclient.h"
+#include "pool.h"
+
+/**
+ * @brief Highest sensor ID that lives behind an I2C hub; higher IDs are WiFi slaves.
+ */
+#define MAX_HUB_SENSOR_ID 127
+
+/**
+ * @brief Maximum number of I2C hubs the bridge can be connected to.
+ */
+#define MAX_HUBS 16
+
+/**
+ * @brief Marks a sensor ID that is not routed to any hub.
+ */
+#define NO_HUB 0xFF
+
+/**
+ * @brief Maps sensor IDs to the I2C hub the sensor is connected to.
+ * @details Lookups are a single array index. The table is meant to be filled in before start()
+ * and is not synchronized; the clients themselves are safe to use from any thread.
+ */
+class HubRouter {
+   private:
+    struct Hub {
+        std::string ip;
+        int port;
+        std::unique_ptr<I2CClient> client;
+        std::unique_ptr<HubScheduler> scheduler;
+    };
+
+    std::vector<struct Hub> hubs;
+
+    /** @brief Index into hubs for every hub sensor ID, NO_HUB if unrouted */
+    uint8_t routes[MAX_HUB_SENSOR_ID + 1];
+
+    size_t queue_capacity;
+    std::chrono::milliseconds aging;
+    size_t max_concurrency;
+    size_t breaker_threshold;
+    std::chrono::milliseconds breaker_open_time;
+    CaptureWriter *capture;
+    std::function<void(const struct sensor_packet &)> event_handler;
+    bool started;
+
+   public:
+    HubRouter();
+
+    HubRouter(const HubRouter &) = delete;
+    HubRouter &operator=(const HubRouter &) = delete;
+    HubRouter(HubRouter &&) = delete;
+    HubRouter &operator=(HubRouter &&) = delete;
+
+    /**
+     * @brief Adds an I2C hub without routing any sensors to it.
+     * @param ip The IP address of the hub.
+     * @param port The port number of the hub.
+     * @return The index of the new hub, to be passed to route().
+     * @throws std::invalid_argument if the address is invalid or MAX_HUBS is exceeded.
+     * @throws std::logic_error if the hubs have already been started.
+     */
+    size_t addHub(const std::string &ip, int port);
+
+    /**
+     * @brief Routes a range of sensor IDs to a hub, replacing any previous route.
+     * @param first The first sensor ID of the range.
+     * @param last The last sensor ID of the range, inclusive.
+     * @param hub The index of the hub as returned by addHub().
+     * @throws std::invalid_argument if the range or the hub index is invalid.
+     */
+    void route(uint8_t first, uint8_t last, size_t hub);
+
+    /**
+     * @brief Replaces all hubs and routes with the given routing table.
+     * @details The table lists the hubs separated by semicolons, each followed by the sensor IDs
+     * routed to it as comma separated IDs and ranges, e.g. "10.0.0.2:5000=0-63,100;10.0.0.3:5000=
+     * 64-99". A sensor must not be routed to more than one hub. The current table is kept if the
+     * new one is invalid.
+     * @param table The routing table.
+     * @throws std::invalid_argument if the table is malformed.
+     * @throws std::logic_error if the hubs have already been started.
+     */
+    void parseTable(const std::string &table);
+
+    /**
+     * @brief Returns the index of the hub a sensor is routed to, or NO_HUB.
+     */
+    uint8_t hubIndex(uint8_t sensor_id) const;
+
+    /**
+     * @brief Returns the client of the hub a sensor is routed to.
+     * @throws std::runtime_error if the sensor is not routed to any hub.
+     */
+    I2CClient &hubFor(uint8_t sensor_id);
+
+    /**
+     * @brief Returns the scheduler of the link to the hub a sensor is routed to.
+     * @details Every transaction with the hub must hold a HubScheduler::Slot of this scheduler.
+     * @throws std::runtime_error if the sensor is not routed to any hub.
+     */
+    HubScheduler &schedulerFor(uint8_t sensor_id);
+
+    /**
+     * @brief Returns the number of hubs.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Returns the client of the hub with the given index.
+     */
+    I2CClient &hub(size_t index);
+
+    /**
+     * @brief Returns the scheduler of the link to the hub with the given index.
+     */
+    HubScheduler &scheduler(size_t index);
+
+    /**
+     * @brief Returns the address of the hub with the given index as "ip:port".
+     */
+    std::string hubAddress(size_t index) const;
+
+    /**
+     * @brief Starts the clients of all hubs; each connects in the background.
+     */
+    void start();
+
+    /**
+     * @brief Stops the clients of all hubs and closes their connections.
+     */
+    void closeConnections();
+
+    /**
+     * @brief Stops the clients of all hubs without closing their connections.
+     * @return The file descriptor of every hub in order, -1 for hubs that were not connected.
+     */
+    std::vector<int> releaseConnections();
+
+    /**
+     * @brief Takes over already established connections, as returned by releaseConnections().
+     * @details Connections to hubs that are no longer in the table are closed.
+     * @param fds The file descriptor of every hub in order, negative ones are ignored.
+     */
+    void adoptConnections(const std::vector<int> &fds);
+
+    /**
+     * @brief Changes the number of received packets each hub can queue.
+     * @throws std::invalid_argument if the capacity is zero.
+     * @throws std::logic_error if the hubs have already been started.
+     */
+    void setQueueCapacity(size_t queue_capacity);
+
+    /**
+     * @brief Changes the aging interval of the schedulers of all hubs.
+     * @param aging The time after which a waiting request is promoted by one priority class, zero
+     * for strict priority.
+     */
+    void setSchedulerAging(std::chrono::milliseconds aging);
+
+    /**
+     * @brief Changes when the circuit breakers in front of all hubs open and for how long.
+     * @details See CircuitBreaker::configure().
+     */
+    void setBreaker(size_t threshold, std::chrono::milliseconds open_time);
+
+    /**
+     * @brief Changes the highest number of requests outstanding on the link to each hub.
+     * @throws std::invalid_argument if max_concurrency is zero.
+     */
+    void setSchedulerConcurrency(size_t max_concurrency);
+
+    /**
+     * @brief Records the traffic with all hubs into the given capture, or stops recording.
+     * @warning This method should be called before start().
+     */
+    void setCapture(CaptureWriter *capture);
+
+    /**
+     * @brief Hands the unsolicited packets of all hubs to the given handler.
+     * @details See I2CClient::setEventHandler().
+     * @warning This method should be called before start().
+     */
+    void setEventHandler(std::function<void(const struct sensor_packet &)> handler);
+
+    /**
+     * @brief Returns the statistics of the packet queues of all hubs added together.
+     */
+    struct PoolStats getQueueStats() const;
+
+    /**
+     * @brief Returns the statistics of the schedulers of all hubs added together.
+     */
+    struct HubSchedulerStats getSchedulerStats() const;
+};
+
+#endif
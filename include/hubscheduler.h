@@ -0,0 +1,267 @@
+/**
+ * @file hubscheduler.h
+ * @brief Header file for hubscheduler.cpp.
+ * @details This file contains the HubScheduler class, which decides who gets to use the link to an
+ *          I2C hub next. Requests are served by strict priority, actuation before interactive
+ *          reads before background polling, so a light switch never waits behind a burst of
+ *          temperature reads. A request that has waited long enough is promoted one class per
+ *          aging interval, so background polling still gets through under sustained load.
+ *
+ *          Several requests may be outstanding on the link at once. How many is adapted to the
+ *          round trips the hub achieves: while they stay close to the lowest one seen recently,
+ *          the limit grows by one request per round trip, and once they inflate, which means
+ *          requests are queueing up on the Pi, or a request fails, the limit is halved. Requests
+ *          beyond the limit wait here, where they are still served by priority.
+ * @author Daan Breur
+ */
+
+#ifndef HUBSCHEDULER_H
+#define HUBSCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "packetview.h"
+
+/**
+ * @brief Default time after which a waiting request is promoted by one priority class.
+ */
+#define HUB_AGING_MS 50
+
+/**
+ * @brief Default highest number of requests outstanding on the link to a hub at once.
+ */
+#define HUB_MAX_CONCURRENCY 8
+
+/**
+ * @brief Factor by which round trips may exceed the lowest recent one before the limit is cut.
+ */
+#define HUB_RTT_TOLERANCE 2.0
+
+/**
+ * @brief Factor the limit is multiplied with when it is cut.
+ */
+#define HUB_BACKOFF_RATIO 0.5
+
+/**
+ * @brief Number of round trips after which the lowest round trip is measured anew, so the limit
+ * follows a hub that got slower for good.
+ */
+#define HUB_RTT_WINDOW 256
+
+/**
+ * @brief Priority class of a request to an I2C hub, lower is more urgent.
+ */
+enum class HubPriority : uint8_t {
+    /** @brief Writes to actuators, e.g. switching a light */
+    ACTUATION = 0,
+    /** @brief Reads someone is waiting for, e.g. the state of a light */
+    INTERACTIVE = 1,
+    /** @brief Periodic reads of telemetry, e.g. a dashboard polling temperatures */
+    BACKGROUND = 2,
+};
+
+/**
+ * @brief Number of HubPriority classes.
+ */
+#define HUB_PRIORITY_CLASSES 3
+
+/**
+ * @brief Returns the priority class of a packet sent to a hub.
+ * @details Posts are actuation, reads of telemetry sensors are background polling and all other
+ * reads are interactive.
+ */
+HubPriority hubPriorityFor(const PacketView &packet);
+
+/**
+ * @brief Statistics about the requests of a single priority class.
+ */
+struct HubClassStats {
+    /** @brief Number of requests that got the link */
+    uint64_t granted;
+    /** @brief Number of those that got it only after being promoted by aging */
+    uint64_t aged;
+    /** @brief Number of requests currently waiting for the link */
+    size_t waiting;
+    /** @brief Total time granted requests waited for the link, in microseconds */
+    uint64_t total_wait_us;
+    /** @brief Longest time a request waited for the link, in microseconds */
+    uint64_t max_wait_us;
+    /** @brief Number of requests that gave up waiting at their deadline */
+    uint64_t expired;
+};
+
+/**
+ * @brief Statistics about the scheduling of a hub link, per priority class.
+ */
+struct HubSchedulerStats {
+    struct HubClassStats classes[HUB_PRIORITY_CLASSES];
+};
+
+/**
+ * @brief Statistics about the number of requests outstanding on a hub link.
+ */
+struct HubConcurrencyStats {
+    /** @brief The current limit on outstanding requests */
+    size_t limit;
+    /** @brief The highest the limit may grow to */
+    size_t max_limit;
+    /** @brief Number of requests currently outstanding */
+    size_t in_flight;
+    /** @brief Smoothed round-trip time, in microseconds */
+    uint64_t rtt_us;
+    /** @brief Lowest round-trip time the limit is measured against, in microseconds */
+    uint64_t min_rtt_us;
+    /** @brief Number of round trips measured */
+    uint64_t samples;
+    /** @brief Number of times the limit was cut */
+    uint64_t backoffs;
+};
+
+/**
+ * @brief Grants use of the link to a hub by priority, with aging and an adaptive limit on the
+ * number of outstanding requests.
+ * @details Safe to use from multiple threads. Within a class requests are served in arrival order.
+ */
+class HubScheduler {
+   private:
+    /**
+     * @brief A request waiting for the link; lives on the stack of acquire().
+     */
+    struct Waiter {
+        std::chrono::steady_clock::time_point since;
+        bool granted;
+        bool aged;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<struct Waiter *> queues[HUB_PRIORITY_CLASSES];
+    size_t in_flight;
+    std::chrono::steady_clock::duration aging;
+
+    /** @brief The limit on outstanding requests, fractional so it can grow by less than one */
+    double limit;
+    size_t max_limit;
+    std::chrono::steady_clock::duration smoothed_rtt;
+    std::chrono::steady_clock::duration min_rtt;
+    /** @brief Lowest round trip of the window being measured, and its number of samples */
+    std::chrono::steady_clock::duration window_min_rtt;
+    size_t window_samples;
+    /** @brief No cut before this time, so one burst of slow round trips halves the limit once */
+    std::chrono::steady_clock::time_point next_backoff;
+    uint64_t samples;
+    uint64_t backoffs;
+
+    struct HubClassStats stats[HUB_PRIORITY_CLASSES];
+
+    /**
+     * @brief Hands the link to the most urgent waiters, as long as the limit allows.
+     * @warning The mutex must be held.
+     * @return true if a waiter was granted the link.
+     */
+    bool grantNext();
+
+    /**
+     * @brief Cuts the limit, unless it was cut less than a round trip ago.
+     * @warning The mutex must be held.
+     */
+    void backOff(std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Counts a granted request.
+     * @warning The mutex must be held.
+     */
+    void record(HubPriority priority, std::chrono::steady_clock::duration waited, bool aged);
+
+   public:
+    /**
+     * @brief Holds a place on the link for as long as it exists.
+     * @details A request that waits for an answer calls completed() once it is in, so its round
+     * trip is measured. A Slot given up by an exception before that counts as a failed request.
+     */
+    class Slot {
+       private:
+        HubScheduler &scheduler;
+        std::chrono::steady_clock::time_point granted;
+        int exceptions;
+        bool done;
+
+       public:
+        /**
+         * @brief Waits until the link is granted to a request of the given class.
+         * @throws std::runtime_error if the deadline passes first.
+         */
+        Slot(HubScheduler &scheduler, HubPriority priority,
+             std::chrono::steady_clock::time_point deadline =
+                 std::chrono::steady_clock::time_point::max());
+        ~Slot();
+
+        /**
+         * @brief Marks the answer to the request as received and measures the round trip.
+         */
+        void completed();
+
+        Slot(const Slot &) = delete;
+        Slot &operator=(const Slot &) = delete;
+    };
+
+    HubScheduler();
+
+    HubScheduler(const HubScheduler &) = delete;
+    HubScheduler &operator=(const HubScheduler &) = delete;
+    HubScheduler(HubScheduler &&) = delete;
+    HubScheduler &operator=(HubScheduler &&) = delete;
+
+    /**
+     * @brief Waits until the link is granted to a request of the given class.
+     * @details Every successful acquire() must be followed by a release(); prefer a Slot.
+     * @param priority The class of the request.
+     * @param deadline The time after which the request stops waiting.
+     * @return false if the deadline passed before the link was granted.
+     */
+    bool acquire(HubPriority priority, std::chrono::steady_clock::time_point deadline =
+                                           std::chrono::steady_clock::time_point::max());
+
+    /**
+     * @brief Gives up the link, handing it to the next waiter.
+     */
+    void release();
+
+    /**
+     * @brief Adapts the limit to the outcome of a request, see the file description.
+     * @param rtt The round trip of the request.
+     * @param failed Whether the request got no answer; rtt is ignored then.
+     */
+    void sample(std::chrono::steady_clock::duration rtt, bool failed);
+
+    /**
+     * @brief Changes the time after which a waiting request is promoted by one class.
+     * @param aging The aging interval, zero for strict priority without aging.
+     */
+    void setAging(std::chrono::milliseconds aging);
+
+    /**
+     * @brief Changes the highest number of requests that may be outstanding at once.
+     * @param max_limit The highest limit, 1 to give every request exclusive use of the link.
+     * @throws std::invalid_argument if max_limit is zero.
+     */
+    void setMaxConcurrency(size_t max_limit);
+
+    /**
+     * @brief Returns statistics about the scheduled requests.
+     */
+    struct HubSchedulerStats getStats() const;
+
+    /**
+     * @brief Returns the current limit on outstanding requests and the round trips it is based on.
+     */
+    struct HubConcurrencyStats getConcurrencyStats() const;
+};
+
+#endif
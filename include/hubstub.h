@@ -0,0 +1,144 @@
+/**
+ * @file hubstub.h
+ * @brief Header file for hubstub.cpp.
+ * @details This file contains the declaration of the HubStub class, a local stand-in for the
+ *          Raspberry Pi I2C hub. It speaks the same protocol as the real hub and keeps the state of
+ *          every sensor in memory, so the bridge can be exercised without any hardware attached.
+ * @author Erynn Scholtes
+ */
+
+#ifndef HUBSTUB_H
+#define HUBSTUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "packets.h"
+
+class HubStub {
+   private:
+    int listen_fd;
+    std::atomic<int> client_fd;
+    uint16_t port;
+
+    std::thread serve_thread;
+    std::atomic<bool> running;
+    std::atomic<bool> drop_clients;
+    std::atomic<uint64_t> request_count;
+    /** @brief Set while requests are received but not answered */
+    std::atomic<bool> silent;
+
+    std::mutex state_mutex;
+    std::mutex send_mutex;
+    struct sensor_packet states[256];
+    /** @brief Scripted responses per sensor, answered verbatim before falling back to states */
+    std::deque<struct sensor_packet> scripted[256];
+
+    /**
+     * @brief Accepts the bridge and answers its requests until stop() is called.
+     * @warning This method should not be called directly. It is intended to be used internally
+     * by the class.
+     */
+    void serveLoop();
+
+    /**
+     * @brief Closes the connection to the bridge.
+     */
+    void dropClient();
+
+    /**
+     * @brief Handles a single packet received from the bridge.
+     * @param packet The received packet.
+     */
+    void handlePacket(const struct sensor_packet &packet);
+
+   public:
+    HubStub();
+    ~HubStub();
+
+    HubStub(const HubStub &) = delete;
+    HubStub &operator=(const HubStub &) = delete;
+    HubStub(HubStub &&) = delete;
+    HubStub &operator=(HubStub &&) = delete;
+
+    /**
+     * @brief Starts listening on localhost and serving the bridge in a background thread.
+     * @param listen_port The port to listen on, or 0 to pick any free port.
+     * @throws std::invalid_argument if the port number is invalid.
+     * @throws std::runtime_error if the listening socket cannot be set up.
+     */
+    void start(int listen_port = 0);
+
+    /**
+     * @brief Stops serving and closes all sockets.
+     */
+    void stop();
+
+    /**
+     * @brief Returns the port the stub is listening on.
+     */
+    uint16_t getPort() const;
+
+    /**
+     * @brief Sets the state the stub reports for a sensor.
+     * @param packet The new state; the sensor ID is taken from its metadata.
+     */
+    void setState(const struct sensor_packet &packet);
+
+    /**
+     * @brief Returns the state the stub currently holds for a sensor.
+     * @param sensor_id The ID of the sensor.
+     */
+    struct sensor_packet getState(uint8_t sensor_id);
+
+    /**
+     * @brief Queues a response to be sent verbatim for the next DASHBOARD_GET of its sensor.
+     * @details Used to replay captured hub traffic. Queued responses are answered in order; once
+     * they are used up, the stub answers from the stored state again.
+     * @param packet The response; the sensor ID is taken from its metadata.
+     */
+    void queueResponse(const struct sensor_packet &packet);
+
+    /**
+     * @brief Sends an unsolicited packet to the connected bridge, as a hub-side sensor would.
+     * @param packet The packet to send.
+     * @return true if a bridge was connected and the packet was sent, false otherwise.
+     */
+    bool emit(const struct sensor_packet &packet);
+
+    /**
+     * @brief Sends raw bytes to the connected bridge, e.g. a packet cut in pieces.
+     * @param data The bytes to send.
+     * @param length The number of bytes to send.
+     * @return true if a bridge was connected and the bytes were sent, false otherwise.
+     */
+    bool emitRaw(const void *data, size_t length);
+
+    /**
+     * @brief Drops the connection to the bridge, as a rebooting hub would.
+     */
+    void disconnectClients();
+
+    /**
+     * @brief Stops or resumes answering requests, as a hub with a stuck bus would.
+     * @details The connection stays up and requests are still counted.
+     */
+    void setSilent(bool silent);
+
+    /**
+     * @brief Returns whether a bridge is currently connected.
+     */
+    bool hasClient() const;
+
+    /**
+     * @brief Returns the number of packets received from the bridge.
+     */
+    uint64_t getRequestCount() const;
+};
+
+#endif
@@ -13,13 +13,52 @@
 #include <arpa/inet.h>
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <thread>
 
+#include "capture.h"
+#include "circuitbreaker.h"
 #include "packets.h"
+#include "pool.h"
+
+/**
+ * @brief Default number of packets from the hub that can be queued before the oldest is dropped.
+ */
+#define I2C_QUEUE_CAPACITY 64
+
+/**
+ * @brief Default time a request to the I2C hub may take, from arrival to answer, in milliseconds.
+ */
+#define HUB_TIMEOUT_MS 500
+
+/**
+ * @brief Statistics about the connection to the I2C hub.
+ */
+struct HubConnectionStats {
+    /** @brief Whether the hub is currently connected */
+    bool connected;
+    /** @brief Number of times the connection was re-established after being lost */
+    uint64_t reconnects;
+    /** @brief Number of connection attempts that failed */
+    uint64_t failed_attempts;
+    /** @brief Total time the hub has been unreachable since start(), in milliseconds */
+    uint64_t total_downtime_ms;
+    /** @brief Duration of the current outage in milliseconds, 0 while connected */
+    uint64_t current_downtime_ms;
+    /** @brief Number of unsolicited packets handed to the event handler */
+    uint64_t events;
+    /** @brief Number of reads that got no answer before their deadline */
+    uint64_t timeouts;
+    /** @brief Number of answers that arrived after their read gave up, and were dropped */
+    uint64_t late_responses;
+    /** @brief The state of the circuit breaker in front of the hub */
+    struct BreakerStats breaker;
+};
 
 class I2CClient {
    private:
@@ -33,16 +72,53 @@ class I2CClient {
     std::atomic<bool> running;
 
     std::mutex receive_mutex;
-    std::mutex queue_mutex;
+    mutable std::mutex queue_mutex;
 
     std::condition_variable queue_condition;
 
-    std::queue<struct sensor_packet> read_packets_queue;
+    /** @brief Packets received from the hub; when full, the oldest packet is dropped */
+    RingBuffer<struct sensor_packet> read_packets_queue;
+
+    /** @brief Receives the DATA packets the hub sends on its own, if set */
+    std::function<void(const struct sensor_packet &)> event_handler;
+    /** @brief Reads sent per sensor that have not been answered yet, guarded by queue_mutex */
+    uint8_t outstanding_reads[UINT8_MAX + 1];
+    /** @brief Counted with queue_mutex held */
+    uint64_t timeouts;
+    uint64_t late_responses;
+
+    /** @brief Rejects requests while the hub keeps failing them */
+    CircuitBreaker breaker;
+
+    /** @brief Used to interrupt the reconnect backoff when the client is stopped */
+    std::mutex backoff_mutex;
+    std::condition_variable backoff_condition;
+
+    /** @brief Records the traffic with the hub if set */
+    CaptureWriter *capture;
+
+    mutable std::mutex stats_mutex;
+    bool ever_connected;
+    uint64_t reconnects;
+    uint64_t failed_attempts;
+    uint64_t events;
+    std::chrono::steady_clock::time_point down_since;
+    std::chrono::steady_clock::duration total_downtime;
+
+    /**
+     * @brief Keeps the connection to the I2C hub alive.
+     * @details This method runs in a separate thread. It connects to the hub, runs receiveLoop()
+     * until the connection is lost, and then reconnects using exponential backoff with jitter.
+     * @warning This method should not be called directly. It is intended to be used internally
+     * by the class.
+     */
+    void connectionLoop();
 
     /**
      * @brief Internal receive loop for handling incoming data from the I2C hub.
-     * @details This method runs in a separate thread and continuously listens for incoming data
-     * from the I2C hub. It processes the received data and stores it in a buffer for later use.
+     * @details This method continuously listens for incoming data from the I2C hub. It processes
+     * the received data and stores it in a buffer for later use. It returns when the connection is
+     * lost or the client is stopped.
      * @warning This method should not be called directly. It is intended to be used internally
      * by the class.
      */
@@ -58,11 +134,12 @@ class I2CClient {
     /**
      * @brief Constructor for I2CClient class.
      * @details This constructor initializes the I2C client with the specified IP address and port.
-     * @throws std::invalid_argument if the port number is invalid.
+     * @param queue_capacity The number of received packets that can be queued.
+     * @throws std::invalid_argument if the queue capacity is zero.
      * @warning This constructor does not start the I2C client. Use setup(), openConnection() and
      * start() instead.
      */
-    I2CClient();
+    explicit I2CClient(size_t queue_capacity = I2C_QUEUE_CAPACITY);
     ~I2CClient();
 
     I2CClient(const I2CClient &) = delete;
@@ -83,32 +160,97 @@ class I2CClient {
     /**
      * @brief Connects to the I2C hub.
      * @details This method establishes a connection to the I2C hub using the specified IP address
-     * and port.
+     * and port. It gives up after a few seconds if the hub does not answer.
      * @return true if the connection is successful, false otherwise.
      */
     bool openConnection();
 
     /**
      * @brief Starts the I2C client.
-     * @details This method starts the I2C client and begins listening for incoming data from the
-     * I2C hub.
-     * @throws std::runtime_error if the client is not connected to the hub.
+     * @details This method starts a background thread that connects to the I2C hub and begins
+     * listening for incoming data from it. It returns immediately; whenever the connection is lost
+     * (or cannot be made in the first place) it is re-established with exponential backoff.
      */
     void start();
 
     /**
      * @brief Disconnects from the I2C hub.
-     * @details This method closes the connection to the I2C hub.
+     * @details This method stops the background thread and closes the connection to the I2C hub.
      */
     void closeConnection();
 
+    /**
+     * @brief Stops the client without closing the connection to the I2C hub.
+     * @details Used to hand the connection over to another process.
+     * @return The file descriptor of the connection, or -1 if the hub was not connected.
+     */
+    int releaseConnection();
+
+    /**
+     * @brief Takes over an already established connection to the I2C hub.
+     * @details Used to take over the connection from another process. start() then skips
+     * connecting and starts receiving right away.
+     * @param fd The file descriptor of the connection, ignored if negative.
+     * @throws std::logic_error if the client is already running.
+     */
+    void adoptConnection(int fd);
+
+    /**
+     * @brief Returns whether the client is currently connected to the I2C hub.
+     */
+    bool isConnected() const;
+
+    /**
+     * @brief Returns statistics about the connection to the I2C hub.
+     */
+    struct HubConnectionStats getStats() const;
+
+    /**
+     * @brief Changes the number of received packets that can be queued.
+     * @throws std::invalid_argument if the capacity is zero.
+     * @throws std::logic_error if the client is already running.
+     */
+    void setQueueCapacity(size_t queue_capacity);
+
+    /**
+     * @brief Returns statistics about the queue of received packets.
+     */
+    struct PoolStats getQueueStats() const;
+
+    /**
+     * @brief Records all traffic with the hub into the given capture, or stops recording.
+     * @param capture The capture to record into, or nullptr. Must outlive the client.
+     * @warning This method should be called before start().
+     */
+    void setCapture(CaptureWriter *capture);
+
+    /**
+     * @brief Hands unsolicited packets to the given handler instead of queueing them.
+     * @details A DATA packet is unsolicited unless a read of its sensor is still unanswered; older
+     * hubs answer reads with DATA instead of DASHBOARD_RESPONSE. The handler runs on the receive
+     * thread and must not wait for the hub.
+     * @param handler The handler, or an empty function to queue every packet.
+     * @warning This method should be called before start().
+     */
+    void setEventHandler(std::function<void(const struct sensor_packet &)> handler);
+
+    /**
+     * @brief Changes when the circuit breaker in front of the hub opens and for how long.
+     * @details See CircuitBreaker::configure().
+     */
+    void setBreaker(size_t threshold, std::chrono::milliseconds open_time);
+
     /**
      * @brief Internal method to send data to the I2C hub.
+     * @details Answers to earlier reads of the same sensor that gave up waiting are dropped first,
+     * so they cannot be taken for the answer to this one. A read is reported to the circuit
+     * breaker once its answer arrives, anything else as soon as it is sent.
      * @param data The data to send to the I2C hub.
      * @param length The length of the data to send.
-     * @throws std::runtime_error if sending data fails.
+     * @throws std::runtime_error if the hub is not connected, the circuit breaker is open or
+     * sending data fails.
      */
-    void sendRawData(uint8_t *data, size_t length);
+    void sendRawData(const uint8_t *data, size_t length);
 
     /**
      * @brief Sends packet data to the I2C hub.
@@ -120,11 +262,25 @@ class I2CClient {
     /**
      * @brief Receives data from the I2C hub.
      * @param block Whether or not to block until a packet can be retrieved
-     * @return A struct containing the received packet data.
-     * @throws std::runtime_error if receiving data fails.
+     * @return A struct containing the received packet data, or an all-zero packet if none is
+     * available and block is false.
+     * @throws std::runtime_error if blocking while the connection to the hub is (or gets) lost.
      */
     struct sensor_packet retrievePacket(bool block = false);
 
+    /**
+     * @brief Waits for the response to a read of the given sensor.
+     * @details Responses for other sensors stay queued for the requests waiting on them, so any
+     * number of reads may be outstanding at once. The outcome is reported to the circuit breaker.
+     * @param sensor_id The ID of the sensor that was read.
+     * @param deadline The time after which the read is given up.
+     * @return The oldest queued response for the sensor.
+     * @throws std::runtime_error if the deadline passes or the connection to the hub is (or gets)
+     * lost.
+     */
+    struct sensor_packet retrievePacketFor(uint8_t sensor_id,
+                                           std::chrono::steady_clock::time_point deadline);
+
     struct sensor_packet popPacket();
 };
 
@@ -0,0 +1,89 @@
+/**
+ * @file jsonstate.h
+ * @brief Header file for jsonstate.cpp.
+ * @details This file contains the JsonStateCache class, which keeps the JSON representation of
+ *          the sensor state for the HTTP API. Every sensor is serialized once when its state
+ *          changes, and the full document is assembled from those fragments at most once per
+ *          change; all readers share the same immutable strings.
+ * @author Daan Breur
+ */
+
+#ifndef JSONSTATE_H
+#define JSONSTATE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "packets.h"
+
+/**
+ * @brief Statistics about the JSON state cache.
+ */
+struct JsonStateStats {
+    /** @brief Number of sensors in the document */
+    size_t sensors;
+    /** @brief Number of times a sensor was serialized because its state changed */
+    uint64_t fragments_serialized;
+    /** @brief Number of times the full document was assembled */
+    uint64_t documents_serialized;
+    /** @brief Number of fragments and documents handed out to readers */
+    uint64_t reads;
+};
+
+/**
+ * @brief Pre-serialized JSON view of the sensor state.
+ * @details Safe to use from multiple threads.
+ */
+class JsonStateCache {
+   private:
+    mutable std::mutex mutex;
+    std::map<uint16_t, std::shared_ptr<const std::string>> fragments;
+    /** @brief The full document, null while it has to be assembled again */
+    std::shared_ptr<const std::string> cached_document;
+    /** @brief Bumped on every change, so a document assembled meanwhile is not cached */
+    uint64_t version;
+
+    std::atomic<uint64_t> fragments_serialized;
+    std::atomic<uint64_t> documents_serialized;
+    std::atomic<uint64_t> reads;
+
+   public:
+    JsonStateCache();
+
+    JsonStateCache(const JsonStateCache &) = delete;
+    JsonStateCache &operator=(const JsonStateCache &) = delete;
+    JsonStateCache(JsonStateCache &&) = delete;
+    JsonStateCache &operator=(JsonStateCache &&) = delete;
+
+    /**
+     * @brief Serializes the new state of a sensor.
+     * @details The full document is only invalidated if the JSON of the sensor actually changed.
+     * @param sensor_id The full ID of the sensor.
+     * @param packet The new state of the sensor.
+     */
+    void update(uint16_t sensor_id, const struct sensor_packet &packet);
+
+    /**
+     * @brief Returns the JSON object of a single sensor.
+     * @return The shared fragment, or null if nothing is known about the sensor.
+     */
+    std::shared_ptr<const std::string> sensor(uint16_t sensor_id);
+
+    /**
+     * @brief Returns the JSON document with all sensors, {"sensors":[...]} ordered by ID.
+     * @details Assembled from the fragments on the first call after a change.
+     */
+    std::shared_ptr<const std::string> document();
+
+    /**
+     * @brief Returns statistics about the cache.
+     */
+    struct JsonStateStats getStats() const;
+};
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @file latency.h
+ * @brief Header file for latency.cpp.
+ * @details This file contains the latency histograms that break the time spent on a request down
+ *          into its stages, so it shows whether the milliseconds of a dashboard read or a
+ *          button-to-lamp action go to the network, to the bridge itself or to the hub.
+ *
+ *          Client, Wemos and hub sockets have kernel receive timestamps (SO_TIMESTAMPNS) enabled.
+ *          The time from the kernel timestamp of a read to the moment the read returns is the
+ *          kernel-to-user stage; every frame parsed from a read carries the timestamps of that
+ *          read, so the later stages of its request are measured from there.
+ *
+ *          Every histogram has power-of-two buckets in microseconds and is updated with relaxed
+ *          atomics, so recording costs a clock read and a few increments and never takes a lock.
+ * @author Daan Breur
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <atomic>
+
+/**
+ * @brief Number of buckets of a latency histogram.
+ * @details Bucket i counts latencies below 2^i microseconds, the last one everything above.
+ */
+#define LATENCY_BUCKETS 24
+
+/**
+ * @brief Size of the control buffer that receives a kernel receive timestamp.
+ */
+#define RECEIVE_TIMESTAMP_CONTROL_SIZE CMSG_SPACE(sizeof(struct timespec))
+
+/**
+ * @brief Stages of a request that latency is attributed to.
+ */
+enum class LatencyStage : uint8_t {
+    /** @brief From the kernel receiving a client or Wemos packet to the bridge reading it */
+    KERNEL_TO_USER = 0,
+    /** @brief From the bridge reading a frame to the frame being dispatched to its handler */
+    PARSE_TO_DISPATCH = 1,
+    /** @brief Waiting for the link to a hub, see HubScheduler */
+    HUB_QUEUE_WAIT = 2,
+    /** @brief From getting the link to a hub to having its answer */
+    HUB_ROUND_TRIP = 3,
+    /** @brief From the kernel receiving a hub answer to the bridge reading it */
+    HUB_KERNEL_TO_USER = 4,
+    /** @brief Handing a frame to the kernel for a dashboard, Wemos or hub */
+    SEND = 5,
+    /** @brief From the kernel receiving a request to its handler being done with it */
+    REQUEST_TOTAL = 6,
+};
+
+/**
+ * @brief Number of LatencyStage values.
+ */
+#define LATENCY_STAGES 7
+
+/**
+ * @brief A snapshot of the latency histogram of a single stage.
+ */
+struct LatencyHistogram {
+    uint64_t buckets[LATENCY_BUCKETS];
+    /** @brief Number of latencies recorded */
+    uint64_t count;
+    /** @brief Sum of all latencies recorded, in nanoseconds */
+    uint64_t total_ns;
+    /** @brief Highest latency recorded, in nanoseconds */
+    uint64_t max_ns;
+};
+
+/**
+ * @brief Timestamps of a read from a socket, carried with the frames parsed from it.
+ */
+struct ReceiveTimestamps {
+    /** @brief When the read returned (CLOCK_MONOTONIC) */
+    uint64_t user_ns;
+    /** @brief Time from the kernel receiving the data to the read returning */
+    uint64_t kernel_delay_ns;
+    /** @brief Whether the kernel timestamped the data; kernel_delay_ns is 0 otherwise */
+    bool kernel_stamped;
+};
+
+/**
+ * @brief Process-wide latency histograms per stage.
+ * @details Safe to use from any thread.
+ */
+class Latency {
+   private:
+    static std::atomic<uint64_t> buckets[LATENCY_STAGES][LATENCY_BUCKETS];
+    static std::atomic<uint64_t> counts[LATENCY_STAGES];
+    static std::atomic<uint64_t> totals_ns[LATENCY_STAGES];
+    static std::atomic<uint64_t> maxima_ns[LATENCY_STAGES];
+
+   public:
+    /**
+     * @brief Adds a latency to the histogram of a stage.
+     */
+    static void record(LatencyStage stage, uint64_t latency_ns);
+
+    /**
+     * @brief Adds the time since a CLOCK_MONOTONIC timestamp to the histogram of a stage.
+     */
+    static void recordSince(LatencyStage stage, uint64_t since_ns);
+
+    /**
+     * @brief Records the kernel-to-user latency of a read, if the kernel gave a timestamp.
+     */
+    static void recordReceive(LatencyStage stage, const struct ReceiveTimestamps &received);
+
+    /**
+     * @brief Records the time from the kernel receiving a request to now as REQUEST_TOTAL.
+     */
+    static void recordRequest(const struct ReceiveTimestamps &received);
+
+    /**
+     * @brief Returns a snapshot of the histogram of a stage.
+     */
+    static struct LatencyHistogram snapshot(LatencyStage stage);
+
+    /**
+     * @brief Clears all histograms.
+     */
+    static void reset();
+};
+
+/**
+ * @brief Returns the name of a stage, e.g. "hub_round_trip".
+ */
+const char *latencyStageName(LatencyStage stage);
+
+/**
+ * @brief Returns the upper bound of the bucket a percentile of a histogram falls in.
+ * @param histogram The histogram.
+ * @param percentile The percentile, between 0 and 100.
+ * @return The bound in microseconds, 0 if the histogram is empty.
+ */
+uint64_t latencyPercentileUs(const struct LatencyHistogram &histogram, double percentile);
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t monotonicNanoseconds();
+
+/**
+ * @brief Lets the kernel timestamp the data received on a socket.
+ * @details Failures are ignored; reads of the socket then carry no kernel timestamp.
+ */
+void enableReceiveTimestamps(int fd);
+
+/**
+ * @brief Takes the timestamps of a read that just returned.
+ * @param message The message filled by recvmsg() or recvmmsg(), with a control buffer of
+ * RECEIVE_TIMESTAMP_CONTROL_SIZE bytes or more.
+ */
+struct ReceiveTimestamps receiveTimestamps(const struct msghdr &message);
+
+#endif
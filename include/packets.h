@@ -30,7 +30,76 @@ enum class PacketType : uint8_t {
     HEARTBEAT = 1,
     DASHBOARD_POST = 2,
     DASHBOARD_GET = 3,
-    DASHBOARD_RESPONSE = 4
+    DASHBOARD_RESPONSE = 4,
+    DASHBOARD_ERROR = 5,
+    /** @brief Negotiates optional protocol features for the connection, see connection_hello */
+    HELLO = 6,
+    /** @brief Asks for the aggregate of a sensor or group over a window, see aggregate_query */
+    AGGREGATE_QUERY = 7,
+    /** @brief Answers an AGGREGATE_QUERY, see aggregate_response */
+    AGGREGATE_RESPONSE = 8,
+    /**
+     * @brief A DASHBOARD_POST to every member of a device group, with the group ID in place of the
+     * sensor ID
+     */
+    GROUP_POST = 9,
+    /** @brief Answers a GROUP_POST with the status of every member, see group_result */
+    GROUP_RESULT = 10,
+    /**
+     * @brief Answers a DASHBOARD_POST forwarded by another bridge, with the outcome in a
+     * sensor_packet_error; no other request is answered with it
+     */
+    POST_ACK = 11,
+};
+
+/**
+ * @brief Protocol feature: 16-bit sensor IDs.
+ * @details Once both sides agreed on this feature, every frame on the connection carries the high
+ * byte of the sensor ID right after the sensor_header (counted in its length), followed by the
+ * regular payload whose metadata holds the low byte. Firmware that never sends a HELLO keeps using
+ * 8-bit IDs.
+ */
+#define FEATURE_EXTENDED_IDS 0x01
+
+/**
+ * @brief Protocol feature: the client is another bridge of the cluster forwarding requests.
+ * @details Requests on such a connection are served locally and never forwarded again, and are not
+ * rate limited a second time. A DASHBOARD_GET of SensorType::NOOP on it asks for the last known
+ * state of the sensor, whatever its type, as the bridge forwarding an HTTP read cannot know it.
+ */
+#define FEATURE_CLUSTER_PEER 0x02
+
+/**
+ * @brief Reason a request could not be handled, as sent in a DASHBOARD_ERROR packet.
+ */
+enum class ErrorCode : uint8_t {
+    /** @brief No error, e.g. in the POST_ACK of a post that was carried out */
+    NONE = 0,
+    /** @brief The I2C hub the request is meant for is currently unreachable */
+    HUB_UNAVAILABLE = 1,
+    /** @brief The client exceeded its request rate and the request was rejected unprocessed */
+    RATE_LIMITED = 2,
+    /** @brief The aggregate window or sensor group of an AGGREGATE_QUERY is not configured */
+    NOT_AGGREGATED = 3,
+    /** @brief The bridge of the cluster that owns the sensor is currently unreachable */
+    NODE_UNAVAILABLE = 4,
+    /**
+     * @brief The slave device is not connected, so a post could not be delivered; to another
+     * bridge also the answer to a read of a device that never reported in
+     */
+    NOT_CONNECTED = 5,
+    /** @brief The device group of a GROUP_POST is not configured */
+    UNKNOWN_GROUP = 6,
+};
+
+/**
+ * @brief What an AGGREGATE_QUERY aggregates over.
+ */
+enum class AggregateScope : uint8_t {
+    /** @brief A single sensor; the metadata holds its ID */
+    SENSOR = 0,
+    /** @brief A configured group of sensors; the metadata holds the group ID */
+    GROUP = 1,
 };
 
 /**
@@ -57,6 +126,20 @@ struct sensor_metadata {
     uint8_t sensor_id;
 } __attribute__((packed));
 
+/**
+ * @struct connection_hello
+ * @brief Structure for HELLO packets.
+ * @details The client sends the features it would like to use, the bridge answers with the ones
+ * it accepted. The answer is sent in the framing the HELLO arrived in; the accepted features apply
+ * from the next frame on. A bridge that does not know HELLO ignores it, so clients that get no
+ * answer should stick to the basic protocol.
+ * @ingroup Packets
+ */
+struct connection_hello {
+    /** @brief Bitmask of FEATURE_* flags */
+    uint8_t features;
+} __attribute__((packed));
+
 // Specific packet structures (ensure alignment/packing matches expected format)
 
 /**
@@ -165,6 +248,84 @@ struct sensor_packet_lichtkrant {
     struct sensor_metadata metadata;
     char text[16];
 } __attribute__((packed));
+
+/**
+ * @struct sensor_packet_error
+ * @brief Structure for error packets.
+ * @details This structure is sent by the backend (wemos bridge) with the DASHBOARD_ERROR packet
+ * type instead of the expected response, when a request for the given sensor could not be
+ * handled. A POST_ACK carries it as well.
+ * @ingroup Packets
+ */
+struct sensor_packet_error {
+    struct sensor_metadata metadata;
+    /** @brief Reason the request failed as ErrorCode */
+    ErrorCode error_code;
+} __attribute__((packed));
+
+/**
+ * @struct aggregate_query
+ * @brief Structure for AGGREGATE_QUERY packets.
+ * @details Asks for the aggregate of the readings of the given sensor type over one of the
+ * configured windows. For a GROUP query the sensor ID in the metadata is the group ID; with
+ * FEATURE_EXTENDED_IDS its high byte is carried like that of a sensor ID.
+ * @ingroup Packets
+ */
+struct aggregate_query {
+    struct sensor_metadata metadata;
+    AggregateScope scope;
+    /** @brief Length of the window in minutes, little-endian */
+    uint16_t window_minutes;
+} __attribute__((packed));
+
+/**
+ * @struct aggregate_response
+ * @brief Structure for AGGREGATE_RESPONSE packets.
+ * @details Echoes the query and carries the aggregate; every field is zero if the window holds no
+ * readings. Multi-byte fields are little-endian.
+ * @note Larger than any member of sensor_packet, so it is not part of that union; see
+ * encodeAggregateResponse().
+ * @ingroup Packets
+ */
+struct aggregate_response {
+    struct sensor_metadata metadata;
+    AggregateScope scope;
+    uint16_t window_minutes;
+    /** @brief Number of readings in the window */
+    uint32_t count;
+    float sum;
+    float min;
+    float max;
+    float mean;
+    /** @brief The most recent reading in the window */
+    float last;
+} __attribute__((packed));
+
+/**
+ * @struct group_member_status
+ * @brief Outcome of a GROUP_POST for one member of the group.
+ * @ingroup Packets
+ */
+struct group_member_status {
+    /** @brief Full ID of the member, little-endian */
+    uint16_t sensor_id;
+    /** @brief ErrorCode::NONE if the post was passed on to the member */
+    ErrorCode status;
+} __attribute__((packed));
+
+/**
+ * @struct group_result
+ * @brief Structure for GROUP_RESULT packets.
+ * @details Echoes the metadata of the GROUP_POST and is followed by member_count
+ * group_member_status entries, in the order the members were configured.
+ * @note Larger than any member of sensor_packet, so it is not part of that union; see
+ * encodeGroupResult().
+ * @ingroup Packets
+ */
+struct group_result {
+    struct sensor_metadata metadata;
+    uint8_t member_count;
+} __attribute__((packed));
 // --- End Structures ---
 
 /**
@@ -245,6 +406,8 @@ struct sensor_packet {
         struct sensor_packet_light light;
         struct sensor_packet_rgb_light rgb_light;
         struct sensor_packet_lichtkrant lichtkrant;
+        struct sensor_packet_error error;
+        struct connection_hello hello;
     } data;
 } __attribute__((packed));
 
@@ -0,0 +1,285 @@
+/**
+ * @file packetview.h
+ * @brief Bounds-checked, endian-safe views on packets in their wire format.
+ * @details A PacketView reads the fields of a packet in place, straight from a receive buffer or
+ *          from a stored sensor_packet, without casting the bytes to a struct and without copying
+ *          them. Every accessor is checked against header.length, so a short frame never gets read
+ *          past its end. Multi-byte fields are little-endian on the wire, which is what the Wemos
+ *          firmware and the hubs send; the accessors decode them the same way on any host.
+ * @author Daan Breur
+ */
+
+#ifndef PACKETVIEW_H
+#define PACKETVIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "packets.h"
+
+/**
+ * @brief Reads a little-endian 16-bit value.
+ */
+inline uint16_t loadLE16(const uint8_t *bytes) { return bytes[0] | (uint16_t)bytes[1] << 8; }
+
+/**
+ * @brief Reads a little-endian 32-bit value.
+ */
+inline uint32_t loadLE32(const uint8_t *bytes) {
+    return bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 |
+           (uint32_t)bytes[3] << 24;
+}
+
+/**
+ * @brief Reads a little-endian 64-bit value.
+ */
+inline uint64_t loadLE64(const uint8_t *bytes) {
+    return loadLE32(bytes) | (uint64_t)loadLE32(bytes + 4) << 32;
+}
+
+/**
+ * @brief Reads a little-endian IEEE 754 single precision float.
+ */
+inline float loadLEFloat(const uint8_t *bytes) {
+    uint32_t bits = loadLE32(bytes);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Writes a 16-bit value in little-endian byte order.
+ */
+inline void storeLE16(uint8_t *bytes, uint16_t value) {
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+}
+
+/**
+ * @brief Writes a 32-bit value in little-endian byte order.
+ */
+inline void storeLE32(uint8_t *bytes, uint32_t value) {
+    for (int i = 0; i < 4; ++i) bytes[i] = value >> (8 * i);
+}
+
+/**
+ * @brief Writes a 64-bit value in little-endian byte order.
+ */
+inline void storeLE64(uint8_t *bytes, uint64_t value) {
+    storeLE32(bytes, value);
+    storeLE32(bytes + 4, value >> 32);
+}
+
+/**
+ * @brief Writes an IEEE 754 single precision float in little-endian byte order.
+ */
+inline void storeLEFloat(uint8_t *bytes, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    storeLE32(bytes, bits);
+}
+
+/**
+ * @brief Read-only view on a single packet in wire format.
+ * @details The view does not own the bytes; they must stay valid while it is used. Fields that do
+ * not fit in the payload read as zero (metadata) or throw (readings), see the accessors.
+ */
+class PacketView {
+   private:
+    const uint8_t *frame;
+    size_t available;
+
+    /**
+     * @brief Returns a field of the payload after checking that it is there.
+     * @param offset The offset of the field in the payload.
+     * @param size The size of the field.
+     * @throws std::out_of_range if the payload is too short for the field.
+     */
+    const uint8_t *field(size_t offset, size_t size) const {
+        if (offset + size > payloadLength())
+            throw std::out_of_range("Packet is too short for the requested field");
+        return payload() + offset;
+    }
+
+   public:
+    /**
+     * @brief Creates a view on the bytes of a frame.
+     * @param frame The frame, starting with its sensor_header.
+     * @param available The number of bytes that may be read, which may be less or more than the
+     * frame; see complete().
+     */
+    PacketView(const void *frame, size_t available)
+        : frame(static_cast<const uint8_t *>(frame)), available(available) {}
+
+    /**
+     * @brief Creates a view on a stored packet.
+     */
+    PacketView(const struct sensor_packet &packet) : PacketView(&packet, sizeof(packet)) {}
+
+    /**
+     * @brief Returns whether the header and the complete payload it announces are available.
+     */
+    bool complete() const {
+        return available >= sizeof(struct sensor_header) && available >= frameLength();
+    }
+
+    /**
+     * @brief Returns the length of the frame as announced by its header, header included.
+     * @warning Only meaningful if at least the header is available.
+     */
+    size_t frameLength() const { return sizeof(struct sensor_header) + frame[0]; }
+
+    /**
+     * @brief Returns the number of bytes of the frame that are actually there, header included.
+     * @details Equal to frameLength() for complete frames; this is what may be forwarded.
+     */
+    size_t size() const { return sizeof(struct sensor_header) + payloadLength(); }
+
+    /**
+     * @brief Returns a view limited to the announced frame, so it never reads into the next one.
+     * @warning Only meaningful if the frame is complete().
+     */
+    PacketView frameOnly() const { return PacketView(frame, frameLength()); }
+
+    /** @brief Returns the raw bytes of the frame, starting with the header */
+    const uint8_t *data() const { return frame; }
+
+    /** @brief Returns the packet type from the header */
+    PacketType type() const { return (PacketType)frame[1]; }
+
+    /** @brief Returns the payload length as announced by the header */
+    uint8_t length() const { return frame[0]; }
+
+    /** @brief Returns the payload, which is payloadLength() bytes long */
+    const uint8_t *payload() const { return frame + sizeof(struct sensor_header); }
+
+    /**
+     * @brief Returns the number of payload bytes that may be read.
+     * @details The announced length, limited by the bytes available.
+     */
+    size_t payloadLength() const {
+        if (available < sizeof(struct sensor_header)) return 0;
+        return std::min<size_t>(length(), available - sizeof(struct sensor_header));
+    }
+
+    /**
+     * @brief Returns whether the payload is long enough to hold the given packet structure.
+     */
+    template <typename T>
+    bool holds() const {
+        return payloadLength() >= sizeof(T);
+    }
+
+    /** @brief Returns the sensor type from the metadata, NOOP if the payload has none */
+    SensorType sensorType() const {
+        return payloadLength() >= 1 ? (SensorType)payload()[0] : SensorType::NOOP;
+    }
+
+    /** @brief Returns the (low byte of the) sensor ID from the metadata, 0 if there is none */
+    uint8_t sensorId() const { return payloadLength() >= 2 ? payload()[1] : 0; }
+
+    /** @brief Returns the metadata, zeroed where the payload is too short */
+    struct sensor_metadata metadata() const { return {sensorType(), sensorId()}; }
+
+    /**
+     * @brief Returns the reading of a temperature packet in degrees Celsius.
+     * @throws std::out_of_range if the packet is too short, like all accessors below.
+     */
+    float temperature() const {
+        return loadLEFloat(field(offsetof(struct sensor_packet_temperature, value), 4));
+    }
+
+    /** @brief Returns the reading of a humidity packet in percent */
+    float humidity() const {
+        return loadLEFloat(field(offsetof(struct sensor_packet_humidity, value), 4));
+    }
+
+    /** @brief Returns the reading of a CO2 packet in ppm */
+    uint16_t co2() const { return loadLE16(field(offsetof(struct sensor_packet_co2, value), 2)); }
+
+    /** @brief Returns the target state of a light packet */
+    uint8_t lightState() const {
+        return *field(offsetof(struct sensor_packet_light, target_state), 1);
+    }
+
+    /** @brief Returns the red component of an RGB light packet */
+    uint8_t red() const { return *field(offsetof(struct sensor_packet_rgb_light, red_state), 1); }
+
+    /** @brief Returns the green component of an RGB light packet */
+    uint8_t green() const {
+        return *field(offsetof(struct sensor_packet_rgb_light, green_state), 1);
+    }
+
+    /** @brief Returns the blue component of an RGB light packet */
+    uint8_t blue() const {
+        return *field(offsetof(struct sensor_packet_rgb_light, blue_state), 1);
+    }
+
+    /** @brief Returns the text of a lichtkrant packet, up to its first null byte */
+    std::string text() const {
+        const size_t size = sizeof(sensor_packet_lichtkrant::text);
+        const char *text =
+            (const char *)field(offsetof(struct sensor_packet_lichtkrant, text), size);
+        return std::string(text, strnlen(text, size));
+    }
+
+    /** @brief Returns the error code of a DASHBOARD_ERROR or POST_ACK packet */
+    ErrorCode errorCode() const {
+        return (ErrorCode)*field(offsetof(struct sensor_packet_error, error_code), 1);
+    }
+
+    /** @brief Returns the feature flags of a HELLO packet, 0 if it carries none */
+    uint8_t helloFeatures() const { return holds<struct connection_hello>() ? payload()[0] : 0; }
+
+    /** @brief Returns the scope of an AGGREGATE_QUERY packet */
+    AggregateScope aggregateScope() const {
+        return (AggregateScope)*field(offsetof(struct aggregate_query, scope), 1);
+    }
+
+    /** @brief Returns the window of an AGGREGATE_QUERY packet in minutes */
+    uint16_t windowMinutes() const {
+        return loadLE16(field(offsetof(struct aggregate_query, window_minutes), 2));
+    }
+
+    /**
+     * @brief Copies the packet into a sensor_packet, for storage.
+     * @details Bytes beyond the payload are zeroed; a payload longer than the structure is cut off
+     * and header.length is lowered to match.
+     */
+    void copyTo(struct sensor_packet &packet) const {
+        size_t copied = std::min(payloadLength(), sizeof(packet.data));
+        memset(&packet, 0, sizeof(packet));
+        packet.header.length = copied;
+        packet.header.ptype = type();
+        memcpy(&packet.data, payload(), copied);
+    }
+};
+
+/**
+ * @brief Sets the reading of a temperature packet, in wire byte order.
+ */
+inline void setTemperature(struct sensor_packet &packet, float value) {
+    storeLEFloat((uint8_t *)&packet.data + offsetof(struct sensor_packet_temperature, value),
+                 value);
+}
+
+/**
+ * @brief Sets the reading of a humidity packet, in wire byte order.
+ */
+inline void setHumidity(struct sensor_packet &packet, float value) {
+    storeLEFloat((uint8_t *)&packet.data + offsetof(struct sensor_packet_humidity, value), value);
+}
+
+/**
+ * @brief Sets the reading of a CO2 packet, in wire byte order.
+ */
+inline void setCo2(struct sensor_packet &packet, uint16_t value) {
+    storeLE16((uint8_t *)&packet.data + offsetof(struct sensor_packet_co2, value), value);
+}
+
+#endif
@@ -0,0 +1,259 @@
+/**
+ * @file pool.h
+ * @brief Header file for pool.cpp.
+ * @details This file contains fixed-capacity allocators that are sized once at startup: a pool of
+ *          equally sized blocks, a typed object pool on top of it and a ring buffer. None of them
+ *          allocate after construction, so the steady-state packet path never calls malloc and the
+ *          memory they reserve is a hard upper limit.
+ * @author Daan Breur
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Statistics of a fixed-capacity allocator.
+ */
+struct PoolStats {
+    /** @brief Maximum number of objects the allocator can hold */
+    size_t capacity;
+    /** @brief Number of objects currently allocated */
+    size_t in_use;
+    /** @brief Highest number of objects ever allocated at the same time */
+    size_t high_water;
+    /** @brief Size of a single object in bytes */
+    size_t object_size;
+    /** @brief Total number of successful allocations */
+    uint64_t allocations;
+    /** @brief Number of allocations that failed (or pushes that dropped an object) */
+    uint64_t failures;
+    /** @brief Memory reserved by the allocator in bytes */
+    size_t reserved_bytes;
+};
+
+/**
+ * @brief Thread-safe pool of equally sized memory blocks.
+ */
+class BlockPool {
+   private:
+    size_t block_size;
+    size_t capacity;
+
+    std::unique_ptr<uint8_t[]> storage;
+    std::vector<uint32_t> free_blocks;
+    std::vector<uint8_t> block_in_use;
+
+    mutable std::mutex pool_mutex;
+    size_t high_water;
+    uint64_t allocations;
+    uint64_t failures;
+
+   public:
+    /**
+     * @brief Reserves memory for the given number of blocks.
+     * @param block_size The size of every block; rounded up to keep blocks suitably aligned.
+     * @param capacity The number of blocks.
+     * @throws std::invalid_argument if the block size or capacity is zero.
+     */
+    BlockPool(size_t block_size, size_t capacity);
+
+    BlockPool(const BlockPool &) = delete;
+    BlockPool &operator=(const BlockPool &) = delete;
+    BlockPool(BlockPool &&) = delete;
+    BlockPool &operator=(BlockPool &&) = delete;
+
+    /**
+     * @brief Takes a block from the pool.
+     * @return The block, or nullptr if all blocks are in use.
+     */
+    void *acquire();
+
+    /**
+     * @brief Returns a block to the pool.
+     * @param block A block previously returned by acquire().
+     * @throws std::invalid_argument if the block does not belong to this pool or is not in use.
+     */
+    void release(void *block);
+
+    /**
+     * @brief Returns whether the block with the given index is currently in use.
+     */
+    bool isInUse(size_t index) const;
+
+    /**
+     * @brief Returns the block with the given index.
+     */
+    void *blockAt(size_t index) const;
+
+    /**
+     * @brief Returns the memory a pool with the given dimensions reserves, in bytes.
+     */
+    static size_t reservedBytes(size_t block_size, size_t capacity);
+
+    size_t getBlockSize() const;
+    size_t getCapacity() const;
+    struct PoolStats getStats() const;
+};
+
+/**
+ * @brief Thread-safe pool of objects of type T.
+ */
+template <typename T>
+class ObjectPool {
+   private:
+    BlockPool blocks;
+
+   public:
+    /**
+     * @brief Reserves memory for the given number of objects.
+     * @throws std::invalid_argument if the capacity is zero.
+     */
+    explicit ObjectPool(size_t capacity) : blocks(sizeof(T), capacity) {}
+
+    /**
+     * @brief Constructs an object in the pool.
+     * @return The object, or nullptr if the pool is exhausted.
+     */
+    template <typename... Args>
+    T *acquire(Args &&...args) {
+        void *memory = blocks.acquire();
+        if (!memory) return nullptr;
+        return new (memory) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Destroys an object and returns its memory to the pool.
+     * @param object An object previously returned by acquire().
+     */
+    void release(T *object) {
+        object->~T();
+        blocks.release(object);
+    }
+
+    /**
+     * @brief Calls the given function for every object currently in use.
+     * @warning Not synchronized with acquire() and release(); only use while nobody else touches
+     * the pool.
+     */
+    template <typename Function>
+    void forEach(Function function) {
+        for (size_t i = 0; i < blocks.getCapacity(); ++i) {
+            if (blocks.isInUse(i)) function(*static_cast<T *>(blocks.blockAt(i)));
+        }
+    }
+
+    struct PoolStats getStats() const { return blocks.getStats(); }
+};
+
+/**
+ * @brief Fixed-capacity FIFO queue.
+ * @warning Not thread-safe; callers are expected to hold their own lock.
+ */
+template <typename T>
+class RingBuffer {
+   private:
+    std::unique_ptr<T[]> slots;
+    size_t capacity;
+    size_t head;
+    size_t count;
+
+    size_t high_water;
+    uint64_t pushes;
+    uint64_t dropped;
+
+   public:
+    /**
+     * @brief Reserves memory for the given number of elements.
+     * @throws std::invalid_argument if the capacity is zero.
+     */
+    explicit RingBuffer(size_t capacity)
+        : capacity(capacity), head(0), count(0), high_water(0), pushes(0), dropped(0) {
+        if (capacity == 0) throw std::invalid_argument("Ring buffer capacity must not be zero");
+        slots.reset(new T[capacity]);
+    }
+
+    /**
+     * @brief Appends an element, dropping the oldest one if the buffer is full.
+     * @return false if an element had to be dropped, true otherwise.
+     */
+    bool pushOverwrite(const T &element) {
+        bool had_room = count < capacity;
+        if (!had_room) {
+            head = (head + 1) % capacity;
+            --count;
+            ++dropped;
+        }
+
+        slots[(head + count) % capacity] = element;
+        ++count;
+        ++pushes;
+        if (count > high_water) high_water = count;
+        return had_room;
+    }
+
+    /**
+     * @brief Removes the oldest element.
+     * @param element Receives the removed element.
+     * @return false if the buffer was empty, true otherwise.
+     */
+    bool pop(T &element) {
+        if (count == 0) return false;
+        element = slots[head];
+        head = (head + 1) % capacity;
+        --count;
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest element the given predicate holds for, keeping the order of the
+     * others.
+     * @param element Receives the removed element.
+     * @return false if no element matched, true otherwise.
+     */
+    template <typename Predicate>
+    bool popFirst(Predicate predicate, T &element) {
+        for (size_t i = 0; i < count; ++i) {
+            if (!predicate(slots[(head + i) % capacity])) continue;
+
+            element = slots[(head + i) % capacity];
+            for (; i + 1 < count; ++i)
+                slots[(head + i) % capacity] = slots[(head + i + 1) % capacity];
+            --count;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Calls the given function for every element, oldest first, without removing any.
+     */
+    template <typename Function>
+    void forEach(Function function) const {
+        for (size_t i = 0; i < count; ++i) function(slots[(head + i) % capacity]);
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    size_t getCapacity() const { return capacity; }
+
+    struct PoolStats getStats() const {
+        return {capacity, count, high_water, sizeof(T), pushes, dropped, capacity * sizeof(T)};
+    }
+};
+
+#endif
@@ -0,0 +1,191 @@
+/**
+ * @file ratelimit.h
+ * @brief Header file for ratelimit.cpp.
+ * @details This file contains the RateLimiter class, which admits requests against token buckets
+ *          per connection and per client IP. Requests that end up on the I2C bus draw from a
+ *          separate, usually much smaller, budget than requests served locally, so a flooding
+ *          client is rejected right away instead of queueing in front of the slow hub.
+ * @author Daan Breur
+ */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Maximum number of client IPs with buckets of their own.
+ * @details Once reached, idle clients are forgotten; new clients beyond it are only limited per
+ * connection.
+ */
+#ifdef WEMOS_LOW_FOOTPRINT
+#define MAX_RATE_CLIENTS 256
+#else
+#define MAX_RATE_CLIENTS 4096
+#endif
+
+/**
+ * @brief Budget a request is admitted against.
+ */
+enum class RateClass : uint8_t {
+    /** @brief Requests that are sent on to an I2C hub */
+    HUB = 0,
+    /** @brief Requests served by the server itself, and telemetry updates */
+    LOCAL = 1,
+};
+
+/**
+ * @brief Number of RateClass budgets.
+ */
+#define RATE_CLASSES 2
+
+/**
+ * @brief A rate limit: a sustained rate with room for a burst.
+ */
+struct RateLimit {
+    /** @brief Requests per second, 0 for no limit */
+    double rate;
+    /** @brief Requests that may be made at once after being idle */
+    double burst;
+};
+
+/**
+ * @brief The tokens left in a single bucket.
+ */
+struct TokenBucket {
+    double tokens;
+    std::chrono::steady_clock::time_point refilled;
+};
+
+/**
+ * @brief Refills a bucket for the time passed and takes a token from it.
+ * @param bucket The bucket.
+ * @param limit The limit the bucket enforces; without a rate every token is granted.
+ * @param now The current time.
+ * @return false if the bucket is empty.
+ */
+bool takeToken(struct TokenBucket &bucket, const struct RateLimit &limit,
+               std::chrono::steady_clock::time_point now);
+
+/**
+ * @brief Requests admitted and rejected for a single client IP.
+ */
+struct ClientThrottleStats {
+    struct in_addr address;
+    uint64_t admitted;
+    /** @brief Rejected requests per RateClass */
+    uint64_t throttled[RATE_CLASSES];
+};
+
+/**
+ * @brief Statistics about admission control.
+ */
+struct RateLimiterStats {
+    uint64_t admitted;
+    uint64_t throttled;
+    /** @brief Number of client IPs with buckets of their own */
+    size_t clients;
+};
+
+/**
+ * @brief Admits requests against per-connection and per-client token buckets.
+ * @details The limits are meant to be set before the server starts. The buckets of a connection
+ * are kept in the connection itself and belong to its worker thread; the buckets of client IPs
+ * are shared and locked. Without any limits, admit() returns right away.
+ */
+class RateLimiter {
+   private:
+    struct Client {
+        struct TokenBucket buckets[RATE_CLASSES];
+        uint64_t admitted;
+        uint64_t throttled[RATE_CLASSES];
+        std::chrono::steady_clock::time_point last_seen;
+    };
+
+    struct RateLimit connection_limits[RATE_CLASSES];
+    struct RateLimit client_limits[RATE_CLASSES];
+    bool enabled;
+
+    mutable std::mutex clients_mutex;
+    std::unordered_map<in_addr_t, struct Client> clients;
+
+    std::atomic<uint64_t> admitted;
+    std::atomic<uint64_t> throttled;
+
+    /**
+     * @brief Forgets clients that have been idle long enough for their buckets to be full again.
+     * @warning clients_mutex must be held.
+     */
+    void forgetIdleClients(std::chrono::steady_clock::time_point now);
+
+   public:
+    /**
+     * @brief Creates a limiter without any limits.
+     */
+    RateLimiter();
+
+    RateLimiter(const RateLimiter &) = delete;
+    RateLimiter &operator=(const RateLimiter &) = delete;
+    RateLimiter(RateLimiter &&) = delete;
+    RateLimiter &operator=(RateLimiter &&) = delete;
+
+    /**
+     * @brief Sets the limit of every single connection for a class of requests.
+     * @throws std::invalid_argument if the rate or burst is negative, or the burst is below 1
+     * while there is a rate.
+     */
+    void setConnectionLimit(RateClass rate_class, struct RateLimit limit);
+
+    /**
+     * @brief Sets the limit of all connections and datagrams of a client IP together.
+     * @throws std::invalid_argument like setConnectionLimit().
+     */
+    void setClientLimit(RateClass rate_class, struct RateLimit limit);
+
+    /**
+     * @brief Sets limits from a comma separated list.
+     * @details Every entry names a budget (hub, local, client_hub or client_local) followed by a
+     * rate per second and optionally a burst, e.g. "hub=10/20,client_hub=25,local=200/400". The
+     * burst defaults to the rate.
+     * @param list The list of limits.
+     * @throws std::invalid_argument if the list is malformed. Entries before the malformed one
+     * have been applied.
+     */
+    void parse(const std::string &list);
+
+    /**
+     * @brief Fills the buckets of a new connection.
+     */
+    void resetBuckets(struct TokenBucket (&buckets)[RATE_CLASSES]) const;
+
+    /**
+     * @brief Takes a token for a request from the buckets of its connection and its client.
+     * @param buckets The buckets of the connection, null for datagrams.
+     * @param address The IP address of the client.
+     * @param rate_class The budget the request draws from.
+     * @return false if the request should be rejected.
+     */
+    bool admit(struct TokenBucket *buckets, struct in_addr address, RateClass rate_class);
+
+    /**
+     * @brief Returns the clients with the most rejected requests, most rejected first.
+     * @param count The maximum number of clients to return.
+     */
+    std::vector<struct ClientThrottleStats> topThrottled(size_t count) const;
+
+    /**
+     * @brief Returns statistics about admitted and rejected requests.
+     */
+    struct RateLimiterStats getStats() const;
+};
+
+#endif
@@ -0,0 +1,218 @@
+/**
+ * @file replication.h
+ * @brief Header file for replication.cpp.
+ * @details This file contains the classes that keep a standby bridge in sync with the primary
+ *          one. The primary marks every slave device whose state or liveness changes, and a
+ *          thread of its own sends the changed devices to the connected standbys in batches, so
+ *          the packet path only ever sets a bit. A standby follows the primary, applies every
+ *          batch to its own SlaveManager and takes over with that warm state once the primary has
+ *          been gone for REPLICATION_TIMEOUT_MS.
+ *
+ *          The stream consists of records of a little-endian 16-bit slave ID, a flags byte and,
+ *          unless the record is a keepalive, the state of the device as a frame (sensor_header
+ *          plus payload).
+ * @author Daan Breur
+ */
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packets.h"
+#include "slavemanager.h"
+
+/**
+ * @brief Interval at which changed devices are sent to the standbys, in milliseconds.
+ */
+#define REPLICATION_INTERVAL_MS 50
+
+/**
+ * @brief Time without anything from the primary after which a standby takes over, in
+ * milliseconds.
+ * @details The primary sends a keepalive every REPLICATION_KEEPALIVE_MS when nothing changed.
+ */
+#define REPLICATION_TIMEOUT_MS 2000
+
+/**
+ * @brief Interval of keepalives on an otherwise idle replication stream, in milliseconds.
+ */
+#define REPLICATION_KEEPALIVE_MS 500
+
+/**
+ * @brief Time a standby waits before it tries to reach the primary again, in milliseconds.
+ */
+#define REPLICATION_RETRY_MS 200
+
+/**
+ * @brief Record flag: the device was connected to the primary.
+ */
+#define REPLICATION_LIVE 0x01
+
+/**
+ * @brief Record flag: the record only shows that the primary is alive and carries no device.
+ */
+#define REPLICATION_KEEPALIVE 0x80
+
+/**
+ * @brief Size of a record without its frame.
+ */
+#define REPLICATION_RECORD_HEADER 3
+
+/**
+ * @brief Statistics about the replication stream of the primary.
+ */
+struct ReplicationStats {
+    /** @brief Number of standbys currently following */
+    size_t standbys;
+    /** @brief Number of batches of changes sent, full snapshots included */
+    uint64_t batches;
+    /** @brief Number of device records sent */
+    uint64_t records;
+    /** @brief Number of bytes sent to all standbys together */
+    uint64_t bytes;
+};
+
+/**
+ * @brief Appends the record of a slave device to a batch.
+ * @param batch The batch to append to.
+ * @param slave_id The ID of the device.
+ * @param live Whether the device is connected.
+ * @param state The known state of the device.
+ */
+void encodeReplicationRecord(std::vector<uint8_t> &batch, uint16_t slave_id, bool live,
+                             const struct sensor_packet &state);
+
+/**
+ * @brief Streams the changes of the device table to standbys.
+ * @details markDirty() is safe to call from any thread and never blocks; everything else is meant
+ * to be called from the thread that owns the server.
+ */
+class ReplicationPublisher {
+   private:
+    const SlaveManager &slaves;
+    /** @brief One bit per possible slave ID, set while its change has not been sent */
+    std::unique_ptr<std::atomic<uint64_t>[]> dirty;
+
+    int listen_fd;
+    std::vector<int> standbys;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    std::atomic<size_t> standby_count;
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> records;
+    std::atomic<uint64_t> bytes;
+
+    void publishLoop();
+
+    /**
+     * @brief Accepts a standby and sends it everything known so far.
+     */
+    void acceptStandby();
+
+    /**
+     * @brief Sends a batch to every standby, dropping the ones that cannot keep up.
+     */
+    void sendToStandbys(const std::vector<uint8_t> &batch, size_t record_count);
+
+   public:
+    /**
+     * @param slaves The device table that is replicated.
+     */
+    explicit ReplicationPublisher(const SlaveManager &slaves);
+    ~ReplicationPublisher();
+
+    ReplicationPublisher(const ReplicationPublisher &) = delete;
+    ReplicationPublisher &operator=(const ReplicationPublisher &) = delete;
+    ReplicationPublisher(ReplicationPublisher &&) = delete;
+    ReplicationPublisher &operator=(ReplicationPublisher &&) = delete;
+
+    /**
+     * @brief Starts listening for standbys and sending changes.
+     * @param port The TCP port standbys connect to, 0 for any free port.
+     * @throws std::runtime_error if the port cannot be bound.
+     */
+    void start(int port);
+
+    /**
+     * @brief Stops sending changes and disconnects all standbys.
+     */
+    void stop();
+
+    /**
+     * @brief Returns the port standbys connect to, or -1 if not started.
+     */
+    int getPort() const;
+
+    /**
+     * @brief Marks the state or liveness of a device as changed.
+     * @param slave_id The ID of the device.
+     */
+    void markDirty(uint16_t slave_id) {
+        dirty[slave_id / 64].fetch_or(1ULL << (slave_id % 64), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns statistics about the replication stream.
+     */
+    struct ReplicationStats getStats() const;
+};
+
+/**
+ * @brief Follows the replication stream of a primary.
+ */
+class ReplicationFollower {
+   public:
+    /**
+     * @brief Receives a replicated device.
+     * @details The snapshot has no file descriptor, as the connection of the device only exists
+     * on the primary; live tells whether the device was connected there.
+     */
+    using ApplyFunction = std::function<void(const struct SlaveSnapshot &snapshot, bool live)>;
+
+   private:
+    ApplyFunction apply;
+    std::atomic<uint64_t> records;
+
+    /**
+     * @brief Applies all complete records at the start of the buffer and removes them.
+     */
+    void applyRecords(std::vector<uint8_t> &buffer);
+
+   public:
+    explicit ReplicationFollower(ApplyFunction apply);
+
+    ReplicationFollower(const ReplicationFollower &) = delete;
+    ReplicationFollower &operator=(const ReplicationFollower &) = delete;
+
+    /**
+     * @brief Follows the primary until it is gone.
+     * @details Reconnects after a lost connection, so a primary that hot-restarts keeps its
+     * standby. The primary only counts as gone once it was reached at least once, so a standby
+     * started before its primary keeps waiting for it.
+     * @param host The IP address of the primary.
+     * @param port The replication port of the primary.
+     * @param timeout_ms The time without contact after which the primary is gone.
+     * @param stop Makes follow() return false as soon as it is set.
+     * @return true if the primary is gone, false if stopped.
+     * @throws std::invalid_argument if the address is invalid.
+     */
+    bool follow(const std::string &host, int port, int timeout_ms,
+                const std::atomic<bool> &stop);
+
+    /**
+     * @brief Returns the number of device records applied.
+     */
+    uint64_t getRecords() const;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * @file serverconfig.h
+ * @brief Limits and sizing of the Wemos server.
+ * @details Everything the server allocates for its connections is sized from these settings once,
+ *          when the server is configured. Nothing grows afterwards, so the configured limits are a
+ *          hard ceiling on the memory the server reserves for clients and hub traffic.
+ * @author Daan Breur
+ */
+
+#ifndef SERVERCONFIG_H
+#define SERVERCONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2cclient.h"
+#include "packets.h"
+#include "slavemanager.h"
+
+/**
+ * @brief Smallest receive buffer that still fits the largest possible packet.
+ */
+#define MIN_RECEIVE_BUFFER_SIZE (sizeof(struct sensor_header) + UINT8_MAX)
+
+/**
+ * @brief Maximum number of connected clients in the low-footprint profile.
+ * @details The low-footprint profile is meant for small gateway hardware serving a single room:
+ * one worker thread, small stacks and pools sized for a few dozen devices. It is selected at
+ * runtime with lowFootprintConfig(), and becomes the default when built with WEMOS_LOW_FOOTPRINT.
+ */
+#define LOW_FOOTPRINT_MAX_CONNECTIONS 16
+
+/**
+ * @brief Size of the receive buffer of a connection in the low-footprint profile.
+ */
+#define LOW_FOOTPRINT_RECEIVE_BUFFER_SIZE MIN_RECEIVE_BUFFER_SIZE
+
+/**
+ * @brief Number of threads serving client connections in the low-footprint profile.
+ */
+#define LOW_FOOTPRINT_WORKER_THREADS 1
+
+/**
+ * @brief Number of threads running hub transactions in the low-footprint profile.
+ */
+#define LOW_FOOTPRINT_HUB_THREADS 2
+
+/**
+ * @brief Number of packets per I2C hub that can be queued in the low-footprint profile.
+ */
+#define LOW_FOOTPRINT_HUB_QUEUE_CAPACITY 16
+
+/**
+ * @brief Number of slave devices tracked in the low-footprint profile.
+ */
+#define LOW_FOOTPRINT_MAX_DEVICES 256
+
+/**
+ * @brief Stack size of every server thread in the low-footprint profile.
+ * @details None of the threads recurses or keeps large buffers on its stack.
+ */
+#define LOW_FOOTPRINT_THREAD_STACK_SIZE (64 * 1024)
+
+/**
+ * @brief Memory budget for the pools in the low-footprint profile.
+ * @details Most of it is the ID index of the SlaveManager, which always covers every possible ID.
+ */
+#define LOW_FOOTPRINT_MEMORY_LIMIT (256 * 1024)
+
+#ifdef WEMOS_LOW_FOOTPRINT
+#define DEFAULT_MAX_CONNECTIONS LOW_FOOTPRINT_MAX_CONNECTIONS
+#define DEFAULT_RECEIVE_BUFFER_SIZE LOW_FOOTPRINT_RECEIVE_BUFFER_SIZE
+#define DEFAULT_WORKER_THREADS LOW_FOOTPRINT_WORKER_THREADS
+#define DEFAULT_HUB_THREADS LOW_FOOTPRINT_HUB_THREADS
+#define DEFAULT_HUB_QUEUE_CAPACITY LOW_FOOTPRINT_HUB_QUEUE_CAPACITY
+#define DEFAULT_THREAD_STACK_SIZE LOW_FOOTPRINT_THREAD_STACK_SIZE
+#define DEFAULT_MEMORY_LIMIT LOW_FOOTPRINT_MEMORY_LIMIT
+#else
+/**
+ * @brief Default maximum number of simultaneously connected clients (Wemos and dashboards).
+ */
+#define DEFAULT_MAX_CONNECTIONS 128
+
+/**
+ * @brief Default size of the receive buffer of a single connection.
+ */
+#define DEFAULT_RECEIVE_BUFFER_SIZE 512
+
+/**
+ * @brief Default number of threads serving client connections.
+ */
+#define DEFAULT_WORKER_THREADS 4
+
+/**
+ * @brief Default number of threads running hub transactions, as many as one hub takes at once.
+ */
+#define DEFAULT_HUB_THREADS 8
+
+/**
+ * @brief Default number of packets per I2C hub that can be queued.
+ */
+#define DEFAULT_HUB_QUEUE_CAPACITY I2C_QUEUE_CAPACITY
+
+/**
+ * @brief Default stack size of the server threads, 0 for the system default.
+ */
+#define DEFAULT_THREAD_STACK_SIZE 0
+
+/**
+ * @brief Default memory budget for the pools, 0 for no limit.
+ */
+#define DEFAULT_MEMORY_LIMIT 0
+#endif
+
+/**
+ * @brief Limits and sizing of the Wemos server.
+ */
+struct ServerConfig {
+    /** @brief Maximum number of connected clients; further connections are refused */
+    size_t max_connections = DEFAULT_MAX_CONNECTIONS;
+    /** @brief Size of the receive buffer of every connection, at least MIN_RECEIVE_BUFFER_SIZE */
+    size_t receive_buffer_size = DEFAULT_RECEIVE_BUFFER_SIZE;
+    /** @brief Number of threads serving client connections */
+    size_t worker_threads = DEFAULT_WORKER_THREADS;
+    /** @brief Number of threads running hub transactions, so the workers never wait on a hub */
+    size_t hub_threads = DEFAULT_HUB_THREADS;
+    /** @brief Number of packets from the I2C hub that can be queued */
+    size_t hub_queue_capacity = DEFAULT_HUB_QUEUE_CAPACITY;
+    /** @brief Number of slave devices the server can keep track of, at most MAX_SLAVE_ID */
+    size_t max_devices = DEFAULT_MAX_DEVICES;
+    /** @brief Upper limit for the memory reserved by the pools in bytes, 0 for no limit */
+    size_t memory_limit = DEFAULT_MEMORY_LIMIT;
+    /** @brief Stack size of the threads the server starts in bytes, 0 for the system default */
+    size_t thread_stack_size = DEFAULT_THREAD_STACK_SIZE;
+};
+
+/**
+ * @brief Returns the low-footprint profile, see LOW_FOOTPRINT_MAX_CONNECTIONS.
+ */
+inline struct ServerConfig lowFootprintConfig() {
+    struct ServerConfig config;
+    config.max_connections = LOW_FOOTPRINT_MAX_CONNECTIONS;
+    config.receive_buffer_size = LOW_FOOTPRINT_RECEIVE_BUFFER_SIZE;
+    config.worker_threads = LOW_FOOTPRINT_WORKER_THREADS;
+    config.hub_threads = LOW_FOOTPRINT_HUB_THREADS;
+    config.hub_queue_capacity = LOW_FOOTPRINT_HUB_QUEUE_CAPACITY;
+    config.max_devices = LOW_FOOTPRINT_MAX_DEVICES;
+    config.memory_limit = LOW_FOOTPRINT_MEMORY_LIMIT;
+    config.thread_stack_size = LOW_FOOTPRINT_THREAD_STACK_SIZE;
+    return config;
+}
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * @file shmstate.h
+ * @brief Header file for shmstate.cpp.
+ * @details This file contains the layout of the shared-memory segment the bridge publishes its
+ *          sensor state table in, together with the writer used by the bridge and the reader
+ *          library used by co-located consumers (dashboard backend, logger, ...).
+ *
+ *          Every slot is protected by a seqlock-style version counter: the writer makes the version
+ *          odd before touching a slot and even again afterwards, readers copy the slot and retry if
+ *          the version was odd or changed in the meantime. On top of that a global change sequence
+ *          is bumped after every update, which readers can poll or wait on with a futex. Reading a
+ *          slot never needs a system call.
+ * @author Daan Breur
+ */
+
+#ifndef SHMSTATE_H
+#define SHMSTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "packets.h"
+#include "slavemanager.h"
+
+/**
+ * @brief Magic number at the start of the segment ("WEMS").
+ */
+#define SHM_STATE_MAGIC 0x534D4557
+
+/**
+ * @brief Version of the segment layout, bumped on every incompatible change.
+ */
+#define SHM_STATE_LAYOUT_VERSION 1
+
+/**
+ * @brief Number of slots in the segment, one per 8-bit sensor ID.
+ * @details Devices with extended 16-bit IDs are not exported.
+ */
+#define SHM_STATE_SLOTS (MAX_BASIC_SLAVE_ID + 1)
+
+/**
+ * @brief A single sensor slot in the shared-memory segment.
+ */
+struct ShmStateSlot {
+    /** @brief Seqlock version; odd while the slot is being written, 0 if never written */
+    std::atomic<uint32_t> version;
+    /** @brief Value of the global change sequence right after this slot was last written */
+    uint32_t change_seq;
+    /** @brief Time of the last update in nanoseconds since the epoch (CLOCK_REALTIME) */
+    uint64_t updated_ns;
+    /** @brief Last known state of the sensor */
+    struct sensor_packet packet;
+};
+
+/**
+ * @brief Header at the start of the shared-memory segment.
+ */
+struct ShmStateHeader {
+    /** @brief Always SHM_STATE_MAGIC */
+    uint32_t magic;
+    /** @brief Always SHM_STATE_LAYOUT_VERSION */
+    uint32_t layout_version;
+    /** @brief Number of slots following the header */
+    uint32_t slot_count;
+    /** @brief Size of a single slot in bytes */
+    uint32_t slot_size;
+    /** @brief PID of the bridge process writing the segment */
+    pid_t writer_pid;
+    /** @brief Global change sequence, bumped after every slot update; doubles as futex word */
+    std::atomic<uint32_t> change_seq;
+    /** @brief Number of readers currently sleeping on the futex */
+    std::atomic<uint32_t> waiters;
+};
+
+/**
+ * @brief Complete layout of the shared-memory segment.
+ */
+struct ShmStateSegment {
+    struct ShmStateHeader header;
+    struct ShmStateSlot slots[SHM_STATE_SLOTS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "shared-memory state export needs lock-free 32-bit atomics");
+
+/**
+ * @brief Publishes the sensor state table into a POSIX shared-memory segment.
+ * @details Used by the bridge itself. Publishing is safe from multiple threads.
+ */
+class ShmStateWriter {
+   private:
+    std::string name;
+    struct ShmStateSegment *segment;
+
+    std::mutex write_mutex;
+
+   public:
+    /**
+     * @brief Creates (or takes over) the shared-memory segment with the given name.
+     * @param name The name of the segment, e.g. "/wemos-state".
+     * @throws std::invalid_argument if the name is not a valid shared-memory object name.
+     * @throws std::runtime_error if creating or mapping the segment fails.
+     */
+    explicit ShmStateWriter(const std::string &name);
+
+    /**
+     * @brief Unmaps and removes the shared-memory segment.
+     */
+    ~ShmStateWriter();
+
+    ShmStateWriter(const ShmStateWriter &) = delete;
+    ShmStateWriter &operator=(const ShmStateWriter &) = delete;
+    ShmStateWriter(ShmStateWriter &&) = delete;
+    ShmStateWriter &operator=(ShmStateWriter &&) = delete;
+
+    /**
+     * @brief Publishes the new state of a sensor and wakes up waiting readers.
+     * @param sensor_id The ID of the sensor.
+     * @param packet The new state of the sensor.
+     */
+    void publish(uint8_t sensor_id, const struct sensor_packet &packet);
+};
+
+/**
+ * @brief Reads the sensor state table from the shared-memory segment of a running bridge.
+ * @details Reads never perform system calls; only waitForChange() may sleep in the kernel.
+ */
+class ShmStateReader {
+   private:
+    struct ShmStateSegment *segment;
+
+   public:
+    /**
+     * @brief Opens and maps the shared-memory segment with the given name.
+     * @param name The name of the segment, e.g. "/wemos-state".
+     * @throws std::runtime_error if the segment does not exist or has an unexpected layout.
+     */
+    explicit ShmStateReader(const std::string &name);
+    ~ShmStateReader();
+
+    ShmStateReader(const ShmStateReader &) = delete;
+    ShmStateReader &operator=(const ShmStateReader &) = delete;
+    ShmStateReader(ShmStateReader &&) = delete;
+    ShmStateReader &operator=(ShmStateReader &&) = delete;
+
+    /**
+     * @brief Reads a consistent copy of the state of a sensor.
+     * @param sensor_id The ID of the sensor.
+     * @param packet Receives the state of the sensor.
+     * @param change_seq If not null, receives the global change sequence of the last update.
+     * @return true if the sensor has ever been published, false otherwise.
+     */
+    bool read(uint8_t sensor_id, struct sensor_packet &packet,
+              uint32_t *change_seq = nullptr) const;
+
+    /**
+     * @brief Returns the current global change sequence.
+     * @details Comparing this against a previously seen value is the cheapest way to find out
+     * whether anything changed at all.
+     */
+    uint32_t changeSequence() const;
+
+    /**
+     * @brief Waits until the global change sequence differs from the given value.
+     * @param last_seen The change sequence the caller has already processed.
+     * @param timeout_ms Maximum time to wait in milliseconds, or -1 to wait forever.
+     * @return true if something changed, false on timeout.
+     */
+    bool waitForChange(uint32_t last_seen, int timeout_ms = -1);
+};
+
+#endif
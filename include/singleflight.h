@@ -0,0 +1,105 @@
+/**
+ * @file singleflight.h
+ * @brief Header file for singleflight.cpp.
+ * @details This file contains the SingleFlight class, which coalesces identical hub reads: while a
+ *          read of a sensor is in flight, later reads of the same sensor wait for it and share its
+ *          response instead of becoming an I2C transaction of their own. Nothing is remembered
+ *          once the read completes, so this never serves stale data.
+ * @author Daan Breur
+ */
+
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+#include "packets.h"
+
+/**
+ * @brief Statistics about coalesced hub reads.
+ */
+struct SingleFlightStats {
+    /** @brief Number of reads that were actually sent to the hub */
+    uint64_t requests_sent;
+    /** @brief Number of reads that shared the response of a read already in flight */
+    uint64_t requests_saved;
+    /** @brief Number of reads currently in flight */
+    size_t in_flight;
+};
+
+/**
+ * @brief Coalesces concurrent identical reads into a single request.
+ * @details Safe to use from multiple threads. Reads are identified by the sensor ID and type.
+ * A fixed table holds one flight per sensor ID, so a read allocates nothing; a read of the same ID
+ * with another type than the one in flight is run on its own.
+ */
+class SingleFlight {
+   private:
+    /** @brief A read in flight, shared by its caller and everyone waiting for it */
+    struct Flight {
+        bool active;
+        SensorType type;
+        bool done;
+        /** @brief Number of callers waiting for the response */
+        unsigned int waiters;
+        /** @brief The response, kept by the caller that runs the read until every waiter has it */
+        const struct sensor_packet *response;
+        std::exception_ptr error;
+    };
+
+    std::mutex flights_mutex;
+    std::condition_variable flights_condition;
+    /** @brief The flights, indexed by the sensor ID */
+    struct Flight flights[UINT8_MAX + 1];
+    size_t in_flight;
+
+    uint64_t requests_sent;
+    uint64_t requests_saved;
+
+    /**
+     * @brief Implements read() for any kind of read function.
+     * @param read Performs the actual read, given the context.
+     * @param context Passed to read.
+     */
+    struct sensor_packet run(const struct sensor_metadata &metadata,
+                             struct sensor_packet (*read)(const void *context),
+                             const void *context);
+
+   public:
+    SingleFlight();
+
+    SingleFlight(const SingleFlight &) = delete;
+    SingleFlight &operator=(const SingleFlight &) = delete;
+    SingleFlight(SingleFlight &&) = delete;
+    SingleFlight &operator=(SingleFlight &&) = delete;
+
+    /**
+     * @brief Reads a sensor, sharing the read with any identical reads in flight.
+     * @details The first caller for a sensor runs the read, every caller arriving before it
+     * completes blocks and receives the same response, or the same exception.
+     * @param metadata The sensor to read.
+     * @param read Performs the actual read.
+     * @return The response to the read.
+     * @throws Whatever the read throws.
+     */
+    template <typename Read>
+    struct sensor_packet read(const struct sensor_metadata &metadata, const Read &read) {
+        return run(
+            metadata,
+            [](const void *context) -> struct sensor_packet {
+                return (*static_cast<const Read *>(context))();
+            },
+            &read);
+    }
+
+    /**
+     * @brief Returns statistics about the coalesced reads.
+     */
+    struct SingleFlightStats getStats();
+};
+
+#endif
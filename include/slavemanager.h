@@ -4,6 +4,10 @@
  * @details This file contains declarations for the SlaveManager class and the SlaveDevice struct.
  *          The SlaveManager class is responsible for managing slave devices and their file
  *          descriptors.
+ *
+ *          Devices are stored densely in a table that is reserved up front, in the order they were
+ *          first seen. A flat index maps every possible 16-bit ID to its slot in that table, so a
+ *          lookup is two array accesses and never allocates.
  * @author Daan Breur
  */
 
@@ -13,32 +17,115 @@
 /**
  * @brief Biggest possible slave ID.
  */
-#define MAX_SLAVE_ID 0xFF
+#define MAX_SLAVE_ID 0xFFFF
 
+/**
+ * @brief Biggest slave ID that can be used without FEATURE_EXTENDED_IDS.
+ */
+#define MAX_BASIC_SLAVE_ID 0xFF
+
+/**
+ * @brief Default number of devices the SlaveManager can keep track of.
+ */
+#ifdef WEMOS_LOW_FOOTPRINT
+#define DEFAULT_MAX_DEVICES 256
+#else
+#define DEFAULT_MAX_DEVICES 4096
+#endif
+
+#include <netinet/in.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "capture.h"
 #include "packets.h"
+#include "packetview.h"
 
 /**
  * @brief Structure representing a slave device.
  * @details This structure contains the file descriptor associated with the slave device, and also
- * its current state in the form of a packet.
+ * its current state in the form of a packet. Devices that talk to us over UDP share the UDP socket
+ * as their file descriptor, and are addressed using the address learned from their heartbeats.
  */
 struct SlaveDevice {
     int fd = -1;
+    /** @brief Whether the device is reached over UDP (fd is then the shared UDP socket) */
+    bool udp = false;
+    /** @brief Address the device last sent a heartbeat from, only valid if udp is set */
+    struct sockaddr_in udp_address = {0};
+    /** @brief Whether the connection of the device negotiated FEATURE_EXTENDED_IDS */
+    bool extended_ids = false;
     struct sensor_packet sensor_data = {0};
 
     bool isConnected() const;
     void setSensorData(const struct sensor_packet &);
 };
 
+/**
+ * @brief Copy of everything the SlaveManager knows about a single slave device.
+ */
+struct SlaveSnapshot {
+    uint16_t slave_id;
+    int fd;
+    bool udp;
+    struct sockaddr_in udp_address;
+    struct sensor_packet sensor_data;
+    bool extended_ids;
+};
+
+/**
+ * @brief Statistics about the device table of the SlaveManager.
+ */
+struct SlaveManagerStats {
+    /** @brief Number of devices in the table */
+    size_t devices;
+    /** @brief Maximum number of devices in the table */
+    size_t capacity;
+    /** @brief Number of registrations and updates dropped because the table was full */
+    uint64_t refused;
+};
+
 class SlaveManager {
    private:
-    SlaveDevice slave_devices[MAX_SLAVE_ID + 1];
+    /** @brief The devices, in the order they were first seen */
+    std::unique_ptr<SlaveDevice[]> slave_devices;
+    /** @brief The ID of every device in slave_devices */
+    std::unique_ptr<uint16_t[]> slave_ids;
+    /** @brief Slot in slave_devices plus one for every possible ID, 0 if the ID is unknown */
+    std::unique_ptr<std::atomic<uint16_t>[]> slot_index;
+
+    size_t capacity;
+    std::atomic<size_t> device_count;
+    std::atomic<uint64_t> refused;
+
+    /** @brief Serializes adding devices; looking them up needs no lock */
+    std::mutex insert_mutex;
+
+    /** @brief Records the packets sent to slaves over TCP if set */
+    CaptureWriter *capture;
+
+    /**
+     * @brief Returns the device with the given ID, or nullptr if it is unknown.
+     */
+    SlaveDevice *findDevice(uint16_t slave_id) const;
+
+    /**
+     * @brief Returns the device with the given ID, adding it if it is unknown.
+     * @return The device, or nullptr if it is unknown and the table is full.
+     */
+    SlaveDevice *findOrAddDevice(uint16_t slave_id);
 
    public:
-    SlaveManager();
+    /**
+     * @brief Creates a manager that can keep track of the given number of devices.
+     * @throws std::invalid_argument if the capacity is zero or larger than MAX_SLAVE_ID.
+     */
+    explicit SlaveManager(size_t capacity = DEFAULT_MAX_DEVICES);
     ~SlaveManager();
 
     SlaveManager(const SlaveManager &) = delete;
@@ -46,21 +133,68 @@ class SlaveManager {
     SlaveManager(SlaveManager &&) = delete;
     SlaveManager &operator=(SlaveManager &&) = delete;
 
+    /**
+     * @brief Records all packets sent to slaves over TCP into the given capture.
+     * @param capture The capture to record into, or nullptr to stop recording. Must outlive the
+     * manager.
+     */
+    void setCapture(CaptureWriter *capture);
+
+    /**
+     * @brief Changes the number of devices the manager can keep track of.
+     * @throws std::invalid_argument if the capacity is zero or larger than MAX_SLAVE_ID.
+     * @throws std::logic_error if any device is known already.
+     */
+    void setCapacity(size_t capacity);
+
+    /**
+     * @brief Returns the memory reserved for a device table of the given capacity, in bytes.
+     */
+    static size_t reservedBytes(size_t capacity);
+
+    /**
+     * @brief Returns statistics about the device table.
+     */
+    struct SlaveManagerStats getStats() const;
+
     /**
      * @brief Registers a slave device with the given ID and file descriptor.
+     * @details Nothing is registered if the device table is full.
      * @param slave_id The ID of the slave device to register.
      * @param fd The file descriptor associated with the slave device.
+     * @param extended_ids Whether the connection negotiated FEATURE_EXTENDED_IDS.
      * @throws std::invalid_argument if the slave ID is invalid.
      */
-    void registerSlave(uint8_t slave_id, int fd);
+    void registerSlave(uint16_t slave_id, int fd, bool extended_ids = false);
+
+    /**
+     * @brief Registers a slave device that is reached over UDP.
+     * @details The device is addressed with sendto() on the shared UDP socket. Registering the same
+     * device again from the same address keeps its state; a new address replaces the old one.
+     * @param slave_id The ID of the slave device to register.
+     * @param udp_fd The (shared) UDP socket the device sent its heartbeat to.
+     * @param address The address the heartbeat was sent from.
+     * @throws std::invalid_argument if the slave ID is invalid.
+     */
+    void registerUdpSlave(uint16_t slave_id, int udp_fd, const struct sockaddr_in &address);
 
     /**
      * @brief Unregisters a slave device with the given ID.
      * @param slave_id The ID of the slave device to unregister.
      * @throws std::invalid_argument if the slave ID is invalid.
-     * @warning This method closes the file descriptor associated with the slave device.
+     * @warning This method closes the file descriptor associated with the slave device, unless the
+     * device is reached over the shared UDP socket.
+     */
+    void unregisterSlave(uint16_t slave_id);
+
+    /**
+     * @brief Forgets a closed TCP connection for every slave device registered on it.
+     * @details The devices keep their state, but are no longer sent anything until they register
+     * again; otherwise a new connection reusing the file descriptor would receive their packets.
+     * @param fd The file descriptor of the connection that is being closed.
+     * @return The IDs of the devices that were registered on the connection.
      */
-    void unregisterSlave(uint8_t slave_id);
+    std::vector<uint16_t> detachConnection(int fd);
 
     /**
      * @brief Sends data to the slave device with the given ID.
@@ -69,31 +203,69 @@ class SlaveManager {
      * @param length The length of the data to send.
      * @return 0 on success, -1 on failure.
      */
-    int sendToSlave(uint8_t slave_id, const void *data, size_t length);
+    int sendToSlave(uint16_t slave_id, const void *data, size_t length);
+
+    /**
+     * @brief Sends a packet to the slave device with the given ID, in the framing its connection
+     * negotiated.
+     * @param slave_id The ID of the slave device to send the packet to.
+     * @param packet The packet to send.
+     * @return 0 on success, -1 on failure.
+     */
+    int sendToSlave(uint16_t slave_id, const PacketView &packet);
+
+    /**
+     * @brief Sends a packet to many slave devices at once, e.g. the members of a device group.
+     * @details No single connection is waited for: every connection gets all of its frames in one
+     * write without blocking, and the connections that cannot take them right away are waited for
+     * together. A device that is slow to read thereby delays the others by at most timeout_ms, where
+     * sending one after the other adds up the delays of all of them. A connection that took only
+     * part of its frames by then is shut down, as the rest cannot follow without blocking.
+     * @param slave_ids The IDs of the devices; the packet is addressed to each of them.
+     * @param packet The packet in the 8-bit layout.
+     * @param timeout_ms The time to wait for connections that cannot take their frames right away.
+     * @return One result per device, in the order of slave_ids: 0 on success, -1 on failure.
+     */
+    std::vector<int> sendToSlaves(const std::vector<uint16_t> &slave_ids, const PacketView &packet,
+                                  int timeout_ms);
 
     /**
      * @brief Gets the file descriptor associated with the given slave ID.
      * @param slave_id The ID of the slave device.
      * @return The file descriptor associated with the slave device.
      */
-    int getSlaveFD(uint8_t slave_id) const;
+    int getSlaveFD(uint16_t slave_id) const;
 
     /**
      * @brief Updates the internal sensor_packet structure that contains the current state of the
      * device
+     * @details Nothing is stored if the device is unknown and the device table is full.
      * @param slave_id The ID of the slave device.
      * @param packet A sensor_packet structure that represents the updated internal state of the
      * device.
      */
-    void updateSlaveState(uint8_t slave_id, const struct sensor_packet &packet);
+    void updateSlaveState(uint16_t slave_id, const struct sensor_packet &packet);
 
     /**
      * @brief Retrieves the internal sensor_packet structure that contains the current state of the
      * device
      * @param slave_id The ID of the slave device.
-     * @return The internal state of the device as a sensor_packet struct
+     * @return The internal state of the device as a sensor_packet struct, all zero if the device is
+     * unknown
+     */
+    struct sensor_packet getSlaveState(uint16_t slave_id) const;
+
+    /**
+     * @brief Takes a snapshot of all slave devices that are registered or have a known state.
+     * @return One entry per device, ordered by ID.
+     */
+    std::vector<struct SlaveSnapshot> snapshot() const;
+
+    /**
+     * @brief Restores a slave device from a snapshot, e.g. one taken by another process.
+     * @param snapshot The snapshot of the device.
      */
-    struct sensor_packet getSlaveState(uint8_t slave_id);
+    void restore(const struct SlaveSnapshot &snapshot);
 };
 
 #endif
@@ -0,0 +1,187 @@
+/**
+ * @file tracer.h
+ * @brief Header file for tracer.cpp.
+ * @details This file contains the trace points placed at the main stages of a request, and the
+ *          in-process tracer they feed.
+ *
+ *          Every trace point is a USDT probe (provider "wemos") when the build found <sys/sdt.h>,
+ *          so bpftrace or perf can attach to a running bridge, e.g.
+ *          `bpftrace -e 'usdt:./server:wemos:hub_request_sent { @[arg0] = count(); }'`.
+ *          A probe that nobody attached to is a single nop.
+ *
+ *          On top of that, the in-process tracer records the stages of every Nth request in a ring
+ *          buffer and dumps them as Chrome trace-event JSON (load it in chrome://tracing or
+ *          Perfetto). While the tracer is disabled a trace point costs a single relaxed load;
+ *          building with -DWEMOS_TRACING=OFF removes the trace points altogether.
+ * @author Daan Breur
+ */
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "packets.h"
+#include "pool.h"
+
+/**
+ * @brief Default number of events kept by the tracer; older events are overwritten.
+ */
+#define TRACE_BUFFER_EVENTS 4096
+
+/**
+ * @brief Stages of a request that are traced.
+ */
+enum class TraceStage : uint8_t {
+    /** @brief A complete packet was parsed from a client connection */
+    FRAME_PARSED,
+    /** @brief A request was sent to the I2C hub */
+    HUB_REQUEST_SENT,
+    /** @brief A response of the I2C hub was taken from the queue */
+    HUB_RESPONSE_DEQUEUED,
+    /** @brief A packet was sent to a dashboard */
+    DASHBOARD_SENT,
+    /** @brief The state of a sensor was updated */
+    SLAVE_STATE_UPDATED,
+};
+
+/**
+ * @brief A single event recorded by the tracer.
+ */
+struct TraceEvent {
+    /** @brief ID of the request the event belongs to */
+    uint64_t trace_id;
+    /** @brief Time of the event in nanoseconds (CLOCK_MONOTONIC) */
+    uint64_t timestamp_ns;
+    /** @brief Duration in nanoseconds for request spans, 0 for stage events */
+    uint64_t duration_ns;
+    /** @brief ID of the thread that recorded the event */
+    uint32_t thread_id;
+    /** @brief Whether this is the span of the whole request or a stage within it */
+    bool request_span;
+    /** @brief The stage, only for stage events */
+    TraceStage stage;
+    /** @brief Packet type of the request */
+    PacketType packet_type;
+    /** @brief The sensor the event is about */
+    uint16_t sensor_id;
+};
+
+/**
+ * @brief Process-wide sampling tracer for requests.
+ * @details A request is the handling of a single packet received from a client. It is handled
+ * completely by one thread, so the request being traced is tracked per thread and every stage
+ * reached by that thread in the meantime is attributed to it.
+ */
+class Tracer {
+   private:
+    static std::atomic<bool> enabled;
+    static std::atomic<uint64_t> request_counter;
+    static std::atomic<unsigned int> sample_every;
+
+    static std::mutex events_mutex;
+    static std::unique_ptr<RingBuffer<struct TraceEvent>> events;
+
+    static void record(const struct TraceEvent &event);
+
+   public:
+    /**
+     * @brief Starts tracing every Nth request.
+     * @param sample_every Trace one out of this many requests; 1 traces all of them.
+     * @param capacity Number of events kept; older events are overwritten.
+     * @throws std::invalid_argument if sample_every or capacity is zero.
+     */
+    static void enable(unsigned int sample_every, size_t capacity = TRACE_BUFFER_EVENTS);
+
+    /**
+     * @brief Stops tracing and discards all recorded events.
+     */
+    static void disable();
+
+    /**
+     * @brief Returns whether the tracer is enabled.
+     */
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Marks the start of a request on the calling thread and decides whether to sample it.
+     * @param packet_type The type of the packet being handled.
+     * @param sensor_id The sensor the packet is about.
+     */
+    static void beginRequest(PacketType packet_type, uint16_t sensor_id);
+
+    /**
+     * @brief Marks the end of the request on the calling thread.
+     */
+    static void endRequest();
+
+    /**
+     * @brief Records that the request on the calling thread reached the given stage.
+     * @details Does nothing if the request is not sampled.
+     */
+    static void stage(TraceStage stage, uint16_t sensor_id);
+
+    /**
+     * @brief Writes all recorded events as Chrome trace-event JSON.
+     * @param path The file to write to.
+     * @return The number of events written.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    static size_t dumpChromeTrace(const std::string &path);
+};
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define WEMOS_PROBE(probe, sensor_id, value) DTRACE_PROBE2(wemos, probe, sensor_id, value)
+#else
+#define WEMOS_PROBE(probe, sensor_id, value) \
+    do {                                     \
+    } while (0)
+#endif
+
+#ifdef WEMOS_TRACING
+
+/**
+ * @brief Marks a stage of a request: fires the USDT probe and feeds the tracer if enabled.
+ * @param probe Name of the USDT probe.
+ * @param trace_stage The TraceStage of the stage.
+ * @param sensor_id The sensor the stage is about (first probe argument).
+ * @param value An additional value for the probe, e.g. a length or file descriptor.
+ */
+#define TRACE_POINT(probe, trace_stage, sensor_id, value)                           \
+    do {                                                                            \
+        WEMOS_PROBE(probe, sensor_id, value);                                       \
+        if (Tracer::isEnabled()) Tracer::stage(TraceStage::trace_stage, sensor_id); \
+    } while (0)
+
+#define TRACE_REQUEST_BEGIN(packet_type, sensor_id)                            \
+    do {                                                                       \
+        if (Tracer::isEnabled()) Tracer::beginRequest(packet_type, sensor_id); \
+    } while (0)
+
+#define TRACE_REQUEST_END()                            \
+    do {                                               \
+        if (Tracer::isEnabled()) Tracer::endRequest(); \
+    } while (0)
+
+#else
+
+#define TRACE_POINT(probe, trace_stage, sensor_id, value) \
+    do {                                                  \
+    } while (0)
+#define TRACE_REQUEST_BEGIN(packet_type, sensor_id) \
+    do {                                            \
+    } while (0)
+#define TRACE_REQUEST_END() \
+    do {                    \
+    } while (0)
+
+#endif
+
+#endif
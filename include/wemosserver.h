@@ -11,28 +11,541 @@
 
 #include <netinet/in.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "aggregator.h"
+#include "capture.h"
+#include "cluster.h"
+#include "connection.h"
+#include "deadband.h"
+#include "devicegroups.h"
+#include "framing.h"
+#include "hotrestart.h"
+#include "hubevents.h"
+#include "hubexecutor.h"
+#include "hubrouter.h"
 #include "i2cclient.h"
+#include "jsonstate.h"
 #include "packets.h"
+#include "packetview.h"
+#include "pool.h"
+#include "ratelimit.h"
+#include "replication.h"
+#include "serverconfig.h"
+#include "shmstate.h"
+#include "singleflight.h"
 #include "slavemanager.h"
+#include "writecombiner.h"
+
+/**
+ * @brief Statistics about the memory pools of the server.
+ */
+struct AllocatorStats {
+    /** @brief Pool of client connections; failures are refused connections */
+    struct PoolStats connections;
+    /** @brief Pool of per-connection receive buffers */
+    struct PoolStats receive_buffers;
+    /** @brief Queue of packets received from the I2C hub; failures are dropped packets */
+    struct PoolStats hub_queue;
+    /** @brief Table of slave devices; failures are devices ignored because it was full */
+    struct PoolStats devices;
+    /** @brief Records of hub transactions; failures are transactions refused for lack of one */
+    struct PoolStats hub_transactions;
+};
+
+/**
+ * @brief What a hub transaction does.
+ */
+enum class HubTask : uint8_t {
+    /** @brief Reads a hub sensor for a DASHBOARD_GET */
+    READ,
+    /** @brief Sends a DASHBOARD_POST to a hub sensor */
+    POST,
+    /** @brief Passes a GROUP_POST on to the members of the group */
+    GROUP_POST,
+    /** @brief Toggles the lamp of a table button; nobody waits for the answer */
+    BUTTON_TOGGLE,
+    /** @brief Forwards a DASHBOARD_GET to the bridge of the cluster that owns the sensor */
+    FORWARD_READ,
+    /** @brief Forwards an HTTP read to the bridge of the cluster that owns the sensor */
+    FORWARD_HTTP_READ,
+};
+
+/**
+ * @brief A hub transaction on its way from a worker to the hub executor and back.
+ * @details Plain data taken from a pool, so handing a transaction over and answering it
+ * allocates nothing.
+ */
+struct HubTransaction {
+    HubTask task;
+    /** @brief The connection the answer goes to, null if nobody waits for one */
+    struct Connection *conn;
+    /** @brief The request, in the 8-bit layout */
+    struct sensor_packet request;
+    /** @brief The metadata of the request as the client sent it */
+    struct sensor_metadata metadata;
+    /** @brief The full ID of the sensor or group */
+    uint16_t sensor_id;
+    /** @brief Whether another bridge of the cluster sent the request */
+    bool from_peer;
+    /** @brief Set when the request is taken, so waiting for a thread counts as well */
+    std::chrono::steady_clock::time_point deadline;
+    struct ReceiveTimestamps received;
+    /** @brief Whether an HTTP connection stays open after the answer */
+    bool keep_alive;
+    /** @brief Whether the hub or the owning bridge carried the transaction out */
+    bool succeeded;
+    /** @brief The frame to answer with, filled in by the executor */
+    uint8_t reply[MAX_FRAME_SIZE];
+    size_t reply_length;
+};
 
 class WemosServer {
    private:
+    /**
+     * @brief The completed hub transactions of one worker.
+     */
+    struct WorkerMailbox {
+        /** @brief eventfd in the epoll instance of the worker, signalled for every completion */
+        int event_fd;
+        std::mutex mutex;
+        /** @brief Room for every record of the pool, so a completion is never dropped */
+        RingBuffer<struct HubTransaction *> completions;
+
+        explicit WorkerMailbox(size_t capacity) : event_fd(-1), completions(capacity) {}
+    };
+
     int server_fd;
     struct sockaddr_in listen_address;
 
-    I2CClient i2c_client;
-    std::string hub_ip;
-    int hub_port;
+    int udp_fd;
+    struct sockaddr_in udp_listen_address;
+    bool udp_enabled;
+    std::atomic<bool> udp_running;
+    std::thread udp_thread;
+
+    int http_fd;
+    struct sockaddr_in http_listen_address;
+    bool http_enabled;
+
+    /** @brief JSON view of the sensor state served by the HTTP API, null while it is disabled */
+    std::unique_ptr<JsonStateCache> json_state;
+    std::chrono::steady_clock::time_point started_at;
+
+    std::atomic<bool> stats_requested;
+    std::atomic<bool> stop_requested;
+
+    /** @brief Cleared to stop the worker threads, e.g. while handing over to a new process */
+    std::atomic<bool> serving;
+    std::atomic<bool> restart_requested;
+    char **restart_argv;
+
+    struct ServerConfig config;
+    std::unique_ptr<ObjectPool<struct Connection>> connection_pool;
+    std::unique_ptr<BlockPool> buffer_pool;
+    std::unique_ptr<ObjectPool<struct HubTransaction>> transaction_pool;
+
+    /** @brief One epoll instance per worker thread, holding the connections that worker owns */
+    std::vector<int> worker_epoll_fds;
+    std::vector<std::thread> workers;
+    size_t next_worker;
+    /** @brief One mailbox per worker thread, in the same order as worker_epoll_fds */
+    std::vector<std::unique_ptr<struct WorkerMailbox>> mailboxes;
+
+    /** @brief Client connections taken over from a previous process, served once started */
+    std::vector<struct HandoffClient> adopted_clients;
+
+    /** @brief The I2C hubs and which sensors are connected to which of them */
+    HubRouter hub_router;
+
+    /** @brief Processes the packets the hubs send on their own, e.g. a hub-side button */
+    HubEventDispatcher hub_events;
+
+    /**
+     * @brief Runs the hub transactions and forwarded reads of the workers, so no worker waits on a
+     * hub or on another bridge
+     */
+    HubExecutor hub_executor;
+
+    /** @brief Lets identical dashboard reads of a hub sensor share one hub transaction */
+    SingleFlight hub_reads;
+    /** @brief Time a request to a hub may take, waiting for the link included */
+    std::chrono::milliseconds hub_timeout;
+
+    /** @brief Sends only the latest of a burst of posts to an RGB light or lichtkrant */
+    WriteCombiner actuator_writes;
 
     SlaveManager slave_manager;
 
-    void handleClient(int client_fd, const struct sockaddr_in client_address);
+    /** @brief Drops telemetry updates that do not change the known state of their sensor */
+    DeadbandFilter telemetry_filter;
+
+    /** @brief Windowed aggregates of the telemetry, for AGGREGATE_QUERY */
+    Aggregator aggregates;
+
+    /** @brief Rejects requests of clients that exceed their rate limits */
+    RateLimiter admission;
+
+    /** @brief The other bridges of the cluster and the sensors they own */
+    ClusterMap cluster;
+
+    /** @brief The groups of devices a GROUP_POST can address */
+    DeviceGroups device_groups;
+
+    std::unique_ptr<ShmStateWriter> shm_writer;
+
+    /** @brief Streams the device table to standbys if set */
+    std::unique_ptr<ReplicationPublisher> replication;
+    int replication_port;
+
+    /** @brief The primary this server is a standby of, empty if it is not a standby */
+    std::string primary_ip;
+    int primary_port;
+
+    /** @brief Records all client and hub traffic if set */
+    std::unique_ptr<CaptureWriter> capture;
+
+    /** @brief File the request trace is dumped to together with the statistics, empty if off */
+    std::string trace_path;
+
+    /**
+     * @brief Starts the worker threads, creating their epoll instances on first use.
+     * @throws std::runtime_error if creating an epoll instance fails.
+     */
+    void startWorkers();
+
+    /**
+     * @brief Stops the worker threads without closing any connection.
+     */
+    void stopWorkers();
+
+    /**
+     * @brief Event loop of a single worker thread.
+     * @details Waits for data on the connections owned by the worker and reads them until
+     * stopWorkers() is called.
+     * @param worker The index of the worker.
+     */
+    void workerLoop(size_t worker);
+
+    /**
+     * @brief Takes a connection from the pool and hands it to one of the workers.
+     * @param client The connection; for one taken over from the previous process also what it
+     * negotiated and the bytes it had received but not parsed yet.
+     * @return false if the connection limit is reached or the pending bytes do not fit the receive
+     * buffer, true otherwise.
+     */
+    bool addClient(const struct HandoffClient &client);
+
+    /**
+     * @brief Accepts a pending connection on one of the listening sockets.
+     * @param listen_fd The listening socket.
+     * @param http Whether the socket is the HTTP listener.
+     */
+    void acceptClient(int listen_fd, bool http);
+
+    /**
+     * @brief Closes a connection and returns it to the pool.
+     * @details A connection with hub transactions still running for it is returned to the pool
+     * once the last of them has come back.
+     * @warning Must only be called by the worker owning the connection, or while the workers are
+     * stopped.
+     */
+    void closeClient(struct Connection *conn);
+
+    /**
+     * @brief Returns the buffer and the state of a closed connection to their pools.
+     */
+    void releaseClient(struct Connection *conn);
+
+    /**
+     * @brief Takes a record for a hub transaction from the pool and fills in the request.
+     * @param task What the transaction does.
+     * @param conn The connection the answer goes to, null if nobody waits for one.
+     * @param request The request of the client.
+     * @param sensor_id The full ID of the sensor or group.
+     * @return null if every record is in use.
+     */
+    struct HubTransaction *beginHubTransaction(HubTask task, struct Connection *conn,
+                                               const PacketView &request, uint16_t sensor_id);
+
+    /**
+     * @brief Runs a hub transaction on the hub executor instead of the worker.
+     * @param transaction Taken with beginHubTransaction(), may be null.
+     * @return false if there is no record or the executor has no room for the transaction, which
+     * is then not run and its record returned to the pool.
+     * @warning Must only be called by the worker owning the connection of the transaction.
+     */
+    bool submitHubTransaction(struct HubTransaction *transaction);
+
+    /**
+     * @brief Carries a hub transaction out, on a thread of the hub executor.
+     * @details Passes the record on to the mailbox of the worker of its connection.
+     */
+    void runHubTransaction(struct HubTransaction &transaction);
+
+    /**
+     * @brief Sends the answer of a hub transaction and returns its record to the pool.
+     * @details Goes on with the HTTP requests that were pipelined behind a forwarded read.
+     * @warning Must only be called by the worker owning the connection of the transaction.
+     */
+    void finishHubTransaction(struct HubTransaction &transaction);
+
+    /**
+     * @brief Starts or stops reading from a client connection.
+     * @details Stopped while an HTTP request waits for another bridge, so the requests pipelined
+     * behind it stay in the socket until it is answered.
+     */
+    void watchClient(struct Connection &conn, bool reading);
+
+    /**
+     * @brief Sends the answers of the hub transactions that came back to a worker.
+     * @warning Must only be called by that worker, or while the workers are stopped.
+     */
+    void completeHubTransactions(size_t worker);
+
+    /**
+     * @brief Starts the threads of the hub executor.
+     */
+    void startHubExecutor();
+
+    /**
+     * @brief Stops the hub executor and sends the answers of its last transactions.
+     * @warning Must only be called while the workers are stopped.
+     */
+    void stopHubExecutor();
+
+    /**
+     * @brief Reads available data from a connection and handles every complete packet.
+     * @return false if the connection was closed or failed, true otherwise.
+     */
+    bool readClient(struct Connection &conn);
+
+    /**
+     * @brief Handles a single complete packet received from a client.
+     * @details Requests that need a hub transaction are handed to the hub executor and answered
+     * once the hub is done, possibly after requests that came in later.
+     * @param conn The connection the packet was received on.
+     * @param packet The packet in the 8-bit layout, viewed in the receive buffer of the connection
+     * unless it had to be converted.
+     * @param sensor_id The full ID of the sensor the packet is about.
+     * @return false if the request was handed to the hub executor, true if it is done.
+     */
+    bool handleFrame(struct Connection &conn, const PacketView &packet, uint16_t sensor_id);
+
+    /**
+     * @brief Handles every complete HTTP request in the receive buffer of a connection.
+     * @details Stops at a request forwarded to another bridge, and does nothing while one is
+     * waiting; finishHubTransaction() goes on with the rest once it is answered.
+     * @return false if the connection has to be closed, true otherwise.
+     */
+    bool serveHttp(struct Connection &conn);
+
+    /**
+     * @brief Routes a single HTTP request and sends the response.
+     * @details GET /sensors and GET /sensors/{id} are answered from the JSON state cache, GET
+     * /health reports liveness and POST /sensors/{id} writes to an actuator like a DASHBOARD_POST.
+     * @param conn The connection the request was received on.
+     * @param request The parsed request.
+     * @param body The body of the request, request.content_length bytes long.
+     * @return false if the response is sent once another bridge answered, true if it was sent.
+     */
+    bool handleHttpRequest(struct Connection &conn, const struct HttpRequest &request,
+                           const char *body);
+
+    /**
+     * @brief Sends an HTTP response with a JSON body, without copying the body.
+     */
+    void sendHttpResponse(const struct Connection &conn, int status, const std::string &body,
+                          bool keep_alive);
+
+    /**
+     * @brief Returns the liveness document served on /health.
+     */
+    std::string healthJson();
+
+    /**
+     * @brief Passes a write on to the slave or hub the sensor belongs to, and updates its state.
+     * @param packet The DASHBOARD_POST packet in the 8-bit layout.
+     * @param sensor_id The full ID of the sensor.
+     * @return false if the hub of the sensor is unavailable.
+     */
+    bool postToSensor(const PacketView &packet, uint16_t sensor_id);
+
+    /**
+     * @brief Passes a GROUP_POST on to every member of the group and reports back on each.
+     * @details The posts to the members of one I2C hub go out as a single write, the posts to the
+     * slaves are fanned out over their connections without waiting on any single one, and the
+     * posts to members of other bridges are forwarded to them. The dashboard gets one
+     * GROUP_RESULT, or a DASHBOARD_ERROR with ErrorCode::UNKNOWN_GROUP. As it waits for the hubs
+     * and slaves, it runs on the hub executor.
+     * @param packet The GROUP_POST in the 8-bit layout.
+     * @param group_id The full ID of the group.
+     * @param from_peer Whether another bridge of the cluster forwarded the post, in which case no
+     * member is forwarded again.
+     * @param reply Receives the answer for the dashboard, must hold MAX_FRAME_SIZE bytes.
+     * @return The length of the answer, 0 if the group is unknown.
+     */
+    size_t postToGroup(const PacketView &packet, uint16_t group_id, bool from_peer,
+                       uint8_t *reply);
+
+    /**
+     * @brief Forwards a DASHBOARD_GET or DASHBOARD_POST to the bridge that owns the sensor.
+     * @details A post goes out right away, a read waits for its answer on the hub executor.
+     * Answers the dashboard with ErrorCode::NODE_UNAVAILABLE if that bridge is unreachable.
+     * @param conn The connection of the dashboard.
+     * @param owner The link to the owning bridge.
+     * @param packet The request in the 8-bit layout.
+     * @param sensor_id The full ID of the sensor.
+     * @return false if the answer is sent once the owner answered, true if it was sent.
+     */
+    bool forwardToOwner(struct Connection &conn, PeerLink &owner, const PacketView &packet,
+                        uint16_t sensor_id);
+
+    /**
+     * @brief Serves an HTTP read or write of a sensor owned by another bridge over the link to it.
+     * @details A write is answered with 202 as soon as it is forwarded, the owner carries it out
+     * on its own. A read waits for the answer of the owner on the hub executor. Answers 502 if
+     * that bridge is unreachable.
+     * @param conn The connection of the HTTP client.
+     * @param owner The link to the owning bridge.
+     * @param write The DASHBOARD_POST of a write, nullptr for a read.
+     * @param sensor_id The full ID of the sensor.
+     * @param keep_alive Whether the connection stays open after the response.
+     * @return false if the response is sent once the owner answered, true if it was sent.
+     */
+    bool forwardHttpToOwner(struct Connection &conn, PeerLink &owner,
+                            const struct sensor_packet *write, uint16_t sensor_id, bool keep_alive);
+
+    /**
+     * @brief Sends the HTTP response to a read the owning bridge answered, or failed to.
+     */
+    void sendForwardedHttpRead(const struct Connection &conn,
+                               const struct HubTransaction &transaction);
+
+    /**
+     * @brief Hands all sockets and state over to a freshly launched process.
+     * @details Stops reading from every socket without closing any of them, launches the binary
+     * set with setRestartCommand() and passes it the sockets and state. Exits the process once the
+     * new process has confirmed the takeover; if it does not, serving simply resumes.
+     */
+    void hotRestart();
+
+    /**
+     * @brief Launches the new process and hands the given state over to it.
+     * @param state The sockets and state to hand over.
+     * @return true if the new process confirmed the takeover, false otherwise.
+     */
+    bool launchSuccessor(const struct HandoffState &state);
+
+    /**
+     * @brief Receive loop for the UDP telemetry socket.
+     * @details Reads datagrams in batches using recvmmsg() and hands each of them to
+     * handleDatagram(). Runs in its own thread until tearDown() is called.
+     */
+    void udpReceiveLoop();
+
+    /**
+     * @brief Processes all packets contained in a single datagram.
+     * @details A datagram may contain several packets back to back. DATA packets are processed
+     * like their TCP counterparts, HEARTBEAT packets register the sender as a UDP slave so that
+     * DASHBOARD_POST packets for it can be sent back over UDP. Other packet types are ignored.
+     * @param data The datagram contents.
+     * @param length The length of the datagram.
+     * @param sender The address the datagram was sent from.
+     */
+    void handleDatagram(const uint8_t *data, size_t length, const struct sockaddr_in &sender);
+
+    /**
+     * @brief Starts processing the packets the hubs send on their own.
+     * @details They go through processSensorData() like telemetry from a slave, so hub-side
+     * changes reach the state store and everything subscribed to it without anyone polling.
+     */
+    void startHubEvents();
 
-    void processSensorData(const struct sensor_packet *data);
+    /**
+     * @brief Starts sending the posts held back by the write combiner.
+     */
+    void startWriteCombiner();
 
-    void sendToDashboard(int dashboard_fd, struct sensor_packet *pkt_ptr, size_t len);
+    /**
+     * @brief Follows the primary as its standby until it is gone.
+     * @details The replicated devices are restored into the SlaveManager as they come in, so the
+     * state is warm once this server takes over.
+     * @return true if this server has to take over, false if it was stopped first.
+     */
+    bool followPrimary();
+
+    /**
+     * @brief Applies a telemetry update and runs the rules triggered by it.
+     * @details Every reading is aggregated; updates that do not move the sensor beyond its
+     * deadband are dropped right after that.
+     * @param packet The telemetry update, read in place.
+     * @param sensor_id The full ID of the sensor.
+     */
+    void processSensorData(const PacketView &packet, uint16_t sensor_id);
+
+    /**
+     * @brief Stores the new state of a sensor and publishes it to all state consumers.
+     * @details All state changes must go through this method, so the shared-memory export (if
+     * enabled) never lags behind the SlaveManager. This is where a received packet is copied,
+     * once, into storage.
+     * @param sensor_id The ID of the sensor.
+     * @param packet The new state of the sensor.
+     */
+    void updateState(uint16_t sensor_id, const PacketView &packet);
+
+    /**
+     * @brief Sends a packet to a client, in the framing its connection negotiated.
+     * @param conn The connection of the client.
+     * @param packet The packet in the 8-bit layout.
+     * @param sensor_id The full ID of the sensor the packet is about.
+     */
+    void sendToDashboard(const struct Connection &conn, const PacketView &packet,
+                         uint16_t sensor_id);
+
+    /**
+     * @brief Tells the dashboard that its request for a sensor could not be handled.
+     * @param conn The connection of the dashboard.
+     * @param metadata The metadata of the sensor the request was for.
+     * @param sensor_id The full ID of the sensor.
+     * @param error_code The reason the request failed.
+     */
+    void sendErrorToDashboard(const struct Connection &conn, const struct sensor_metadata &metadata,
+                              uint16_t sensor_id, ErrorCode error_code);
+
+    /**
+     * @brief Answers a post with its outcome.
+     * @details Bridges get a POST_ACK for every post, a type no read is answered with, so the
+     * answer to a post cannot be taken for the answer to a read whatever order they are sent in.
+     * Dashboards only hear about failed posts, with a DASHBOARD_ERROR.
+     * @param conn The connection the post came in on.
+     * @param metadata The metadata of the sensor the post was for.
+     * @param sensor_id The full ID of the sensor.
+     * @param error_code ErrorCode::NONE if the post was carried out.
+     */
+    void acknowledgePost(const struct Connection &conn, const struct sensor_metadata &metadata,
+                         uint16_t sensor_id, ErrorCode error_code = ErrorCode::NONE);
+
+    /**
+     * @brief Answers a DASHBOARD_GET from the last known state, for when the hub is unavailable.
+     * @details Sends a DASHBOARD_ERROR with ErrorCode::HUB_UNAVAILABLE instead if no state is known
+     * for the requested sensor.
+     * @param conn The connection of the dashboard.
+     * @param metadata The metadata of the requested sensor.
+     */
+    void sendLastKnownState(const struct Connection &conn, const struct sensor_metadata &metadata);
+
+    /**
+     * @brief Prints statistics about the server to stdout.
+     */
+    void printStats();
 
    public:
     /**
@@ -54,6 +567,130 @@ class WemosServer {
     WemosServer(WemosServer &&) = delete;
     WemosServer &operator=(WemosServer &&) = delete;
 
+    /**
+     * @brief Sets the limits and sizing of the server.
+     * @details Reserves all pools right away; the server never allocates more for its clients.
+     * @param config The new configuration.
+     * @throws std::invalid_argument if the configuration is invalid or needs more memory than its
+     * memory_limit.
+     * @throws std::logic_error if the server has already been started.
+     */
+    void configure(const struct ServerConfig &config);
+
+    /**
+     * @brief Spreads the hub sensors over several I2C hubs.
+     * @details Replaces the single hub passed to the constructor, see HubRouter::parseTable() for
+     * the format of the table. Sensors that are not in the table are served as if their hub is
+     * down.
+     * @param table The hub routing table.
+     * @throws std::invalid_argument if the table is malformed.
+     * @throws std::logic_error if the server has already been started.
+     */
+    void setHubRoutes(const std::string &table);
+
+    /**
+     * @brief Sets the deadbands telemetry has to move beyond before the state is updated.
+     * @details See DeadbandFilter::parse() for the format. Without deadbands only updates that are
+     * exactly equal to the known state are dropped.
+     * @param list The list of deadbands.
+     * @throws std::invalid_argument if the list is malformed.
+     */
+    void setDeadbands(const std::string &list);
+
+    /**
+     * @brief Sets the windows telemetry is aggregated over.
+     * @details See Aggregator::parseWindows() for the format; DEFAULT_AGGREGATE_WINDOWS without it.
+     * @param list The list of windows.
+     * @throws std::invalid_argument if the list is malformed.
+     */
+    void setAggregateWindows(const std::string &list);
+
+    /**
+     * @brief Sets the sensor groups that are aggregated as a whole, e.g. the sensors of a room.
+     * @details See Aggregator::parseGroups() for the format.
+     * @param list The list of groups.
+     * @throws std::invalid_argument if the list is malformed.
+     */
+    void setSensorGroups(const std::string &list);
+
+    /**
+     * @brief Sets how fast waiting requests to the I2C hubs climb to a more urgent class.
+     * @details Requests are served actuation first, then interactive reads, then background
+     * polling; a request is promoted by one class for every aging interval it has waited.
+     * @param aging_ms The aging interval in milliseconds, 0 for strict priority.
+     */
+    void setHubAging(unsigned int aging_ms);
+
+    /**
+     * @brief Sets how many requests may be outstanding on the link to every I2C hub at once.
+     * @details The actual limit adapts to the round trips of the hub and only grows this far.
+     * @param max_limit The highest limit, 1 for one request at a time.
+     * @throws std::invalid_argument if max_limit is zero.
+     */
+    void setHubConcurrency(size_t max_limit);
+
+    /**
+     * @brief Sets the time a request to an I2C hub may take before it fails.
+     * @details The time runs from the moment the request is about to wait for the link to the hub
+     * until its answer is in. A read that fails is served the last known state.
+     * @param timeout_ms The timeout in milliseconds.
+     * @throws std::invalid_argument if the timeout is zero.
+     */
+    void setHubTimeout(unsigned int timeout_ms);
+
+    /**
+     * @brief Sets when requests to an I2C hub that keeps failing are rejected right away.
+     * @param threshold Failed requests in a row after which the hub is given a rest, 0 to never
+     * give it one.
+     * @param open_ms The time requests are rejected before a single one probes the hub again.
+     */
+    void setHubBreaker(unsigned int threshold, unsigned int open_ms);
+
+    /**
+     * @brief Sets how long posts to RGB lights and lichtkranten are held back for newer ones.
+     * @details Of a burst of posts to the same actuator only the latest is sent. Posts are also
+     * combined while an earlier write to the same actuator is still being sent, even with a
+     * window of zero. A combined post that cannot be sent is counted, not answered with an error.
+     * @param window_ms The window in milliseconds.
+     */
+    void setWriteCombineWindow(unsigned int window_ms);
+
+    /**
+     * @brief Sets the rate limits of connections and client IPs.
+     * @details See RateLimiter::parse() for the format. Without limits every request is admitted.
+     * @param list The list of limits.
+     * @throws std::invalid_argument if the list is malformed.
+     */
+    void setRateLimits(const std::string &list);
+
+    /**
+     * @brief Makes this server one bridge of a cluster that shards the sensors.
+     * @details See ClusterMap::parseTable() for the format. Dashboard requests for sensors of
+     * another bridge are forwarded to it; every other sensor is owned by this server.
+     * @param table The other bridges and the sensors they own.
+     * @throws std::invalid_argument if the table is malformed.
+     * @throws std::logic_error if the server has already been started.
+     */
+    void setClusterMap(const std::string &table);
+
+    /**
+     * @brief Sets the device groups a dashboard can post to at once with GROUP_POST.
+     * @details See DeviceGroups::parse() for the format.
+     * @param list The list of groups.
+     * @throws std::invalid_argument if the list is malformed.
+     */
+    void setDeviceGroups(const std::string &list);
+
+    /**
+     * @brief Returns the memory reserved by the pools of the server, in bytes.
+     */
+    size_t memoryFootprint() const;
+
+    /**
+     * @brief Returns statistics about the memory pools of the server.
+     */
+    struct AllocatorStats getAllocatorStats() const;
+
     /**
      * @brief Sets up the server socket and starts listening for incoming connections.
      * @details This method creates a socket, binds it to the specified port, and
@@ -65,12 +702,120 @@ class WemosServer {
     void socketSetup();
 
     /**
-     * @brief Sets up the I2C client for communication with the I2C hub.
+     * @brief Enables the UDP telemetry listener on the given port.
+     * @details The UDP listener accepts the same packets as the TCP listener (DATA and HEARTBEAT
+     * only), several of them per datagram. It is started together with the server by start().
+     * @param port The UDP port to listen on, may be the same number as the TCP port.
+     * @throws std::invalid_argument if the port number is invalid.
+     * @warning This method should be called before start().
+     */
+    void enableUdp(int port);
+
+    /**
+     * @brief Sets up the UDP telemetry socket.
+     * @throws std::runtime_error if socket creation or binding fails.
+     */
+    void udpSocketSetup();
+
+    /**
+     * @brief Enables the HTTP/1.1 JSON API on the given port.
+     * @details HTTP connections are served by the same worker threads and pools as the binary
+     * protocol. The JSON state is serialized whenever a sensor changes, not per request.
+     * @param port The TCP port to listen on.
+     * @throws std::invalid_argument if the port number is invalid.
+     * @warning This method should be called before start().
+     */
+    void enableHttp(int port);
+
+    /**
+     * @brief Sets up the HTTP listening socket.
+     * @throws std::runtime_error if socket creation, binding, or listening fails.
      */
-    void setupI2cClient();
+    void httpSocketSetup();
+
+    /**
+     * @brief Publishes the sensor state table in a POSIX shared-memory segment.
+     * @details Co-located consumers can read the segment with ShmStateReader instead of sending
+     * DASHBOARD_GET packets over TCP.
+     * @param name The name of the shared-memory segment, e.g. "/wemos-state".
+     * @throws std::invalid_argument if the name is invalid.
+     * @throws std::runtime_error if the segment cannot be created.
+     */
+    void enableSharedMemoryExport(const std::string &name);
+
+    /**
+     * @brief Traces every Nth request and dumps the trace whenever statistics are printed.
+     * @param sample_every Trace one out of this many requests.
+     * @param path The file the Chrome trace-event JSON is written to.
+     * @throws std::invalid_argument if sample_every is zero.
+     */
+    void enableTracing(unsigned int sample_every, const std::string &path);
+
+    /**
+     * @brief Records all traffic with clients and the I2C hub into a capture file.
+     * @details The capture can be replayed against another build with the replay_capture tool.
+     * @param path The capture file, truncated if it exists.
+     * @throws std::runtime_error if the file cannot be created.
+     * @warning This method should be called before start().
+     */
+    void enableCapture(const std::string &path);
+
+    /**
+     * @brief Streams every change of the device table to standbys that connect to the given port.
+     * @details The changes are sent in batches by a thread of their own; the packet path only
+     * marks the changed devices. See ReplicationPublisher.
+     * @param port The TCP port standbys connect to.
+     * @throws std::invalid_argument if the port is invalid.
+     * @warning This method should be called before start().
+     */
+    void enableReplication(int port);
+
+    /**
+     * @brief Makes this server a standby of a primary.
+     * @details start() first follows the primary, without opening any socket or hub connection,
+     * and only starts serving once the primary has been gone for REPLICATION_TIMEOUT_MS.
+     * @param primary The replication address of the primary, e.g. "10.0.0.5:5100".
+     * @throws std::invalid_argument if the address is invalid.
+     * @warning This method should be called before start().
+     */
+    void enableStandby(const std::string &primary);
 
     void start();
 
+    /**
+     * @brief Asks the server loop to print its statistics.
+     * @details Only sets a flag, so it is safe to call from a signal handler.
+     */
+    void requestStats();
+
+    /**
+     * @brief Asks the server loop to stop; start() returns shortly afterwards.
+     * @details Only sets a flag, so it is safe to call from a signal handler.
+     */
+    void requestStop();
+
+    /**
+     * @brief Sets the command used to launch the new process on a hot restart.
+     * @param argv The argument vector for the new process, terminated by a null pointer. Must stay
+     * valid for the lifetime of the server.
+     */
+    void setRestartCommand(char **argv);
+
+    /**
+     * @brief Asks the server loop to hand over to a new process.
+     * @details Only sets a flag, so it is safe to call from a signal handler.
+     */
+    void requestHotRestart();
+
+    /**
+     * @brief Takes over the sockets and state of a previous process.
+     * @details Must be called before start(), which then serves the taken-over connections instead
+     * of setting up new sockets.
+     * @param handoff_fd The socket the previous process sends the handoff on; closed afterwards.
+     * @throws std::runtime_error if receiving the handoff fails.
+     */
+    void adoptHandoff(int handoff_fd);
+
     void tearDown();
 };
 
@@ -0,0 +1,148 @@
+/**
+ * @file writecombiner.h
+ * @brief Header file for writecombiner.cpp.
+ * @details This file contains the WriteCombiner class. Dashboard sliders and color pickers send
+ *          bursts of posts to the same actuator, of which only the last one matters. Posts to such
+ *          actuators are held back for a short window and sent by a thread of its own; a newer
+ *          post to the same actuator that arrives meanwhile, or while the previous write to it is
+ *          still being sent, replaces the one held back, so only the latest state goes out.
+ * @author Daan Breur
+ */
+
+#ifndef WRITECOMBINER_H
+#define WRITECOMBINER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "packets.h"
+#include "packetview.h"
+
+/**
+ * @brief Default time a post to an actuator is held back for newer ones, in milliseconds.
+ */
+#define WRITE_COMBINE_MS 20
+
+/**
+ * @brief Maximum number of actuators with a write held back at the same time.
+ * @details Posts to further actuators are not combined.
+ */
+#ifdef WEMOS_LOW_FOOTPRINT
+#define MAX_COMBINED_ACTUATORS 16
+#else
+#define MAX_COMBINED_ACTUATORS 128
+#endif
+
+/**
+ * @brief Statistics about combined writes.
+ */
+struct WriteCombinerStats {
+    /** @brief Number of posts taken */
+    uint64_t posted;
+    /** @brief Number of writes sent */
+    uint64_t sent;
+    /** @brief Number of posts replaced by a newer one before they were sent */
+    uint64_t collapsed;
+    /** @brief Number of writes that could not be sent */
+    uint64_t failed;
+    /** @brief Number of actuators with a write held back or being sent */
+    size_t pending;
+};
+
+/**
+ * @brief Combines bursts of posts to the same actuator into a single write.
+ * @details post() is safe to call from any thread and never waits for a write to be sent.
+ */
+class WriteCombiner {
+   private:
+    /**
+     * @brief The write held back for a single actuator.
+     */
+    struct PendingWrite {
+        /** @brief The latest post, valid while held is set */
+        struct sensor_packet packet;
+        /** @brief When the held back post is sent */
+        std::chrono::steady_clock::time_point due;
+        bool held;
+        /** @brief Whether an earlier write to the actuator is being sent */
+        bool sending;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::unordered_map<uint16_t, struct PendingWrite> writes;
+    std::function<bool(uint16_t, const PacketView &)> sender;
+    std::chrono::steady_clock::duration window;
+    std::thread thread;
+    bool running;
+
+    uint64_t posted;
+    uint64_t sent;
+    uint64_t collapsed;
+    uint64_t failed;
+
+    /**
+     * @brief Sends the writes as they become due until stop() is called and none is held back.
+     * @warning This method should not be called directly. It is intended to be used internally
+     * by the class.
+     */
+    void sendLoop();
+
+   public:
+    WriteCombiner();
+    ~WriteCombiner();
+
+    WriteCombiner(const WriteCombiner &) = delete;
+    WriteCombiner &operator=(const WriteCombiner &) = delete;
+    WriteCombiner(WriteCombiner &&) = delete;
+    WriteCombiner &operator=(WriteCombiner &&) = delete;
+
+    /**
+     * @brief Starts sending writes.
+     * @param sender Sends a write to an actuator, returns false if it failed. Called from the
+     * thread of the combiner, for one write at a time.
+     * @throws std::logic_error if the combiner is already running.
+     */
+    void start(std::function<bool(uint16_t, const PacketView &)> sender);
+
+    /**
+     * @brief Sends the writes still held back right away and stops the thread.
+     */
+    void stop();
+
+    /**
+     * @brief Holds back a post to an actuator, replacing one that is held back already.
+     * @param sensor_id The full ID of the actuator.
+     * @param packet The post, in the 8-bit layout.
+     * @return false if the post was not taken, because the combiner is stopped or too many
+     * actuators have a write held back; the caller sends it itself then.
+     */
+    bool post(uint16_t sensor_id, const PacketView &packet);
+
+    /**
+     * @brief Changes the time a post is held back for newer ones.
+     * @param window The window; with zero, posts are only combined while an earlier write to the
+     * same actuator is being sent.
+     */
+    void setWindow(std::chrono::milliseconds window);
+
+    /**
+     * @brief Returns statistics about the combined writes.
+     */
+    struct WriteCombinerStats getStats() const;
+};
+
+/**
+ * @brief Returns whether posts of the given packet only matter as the latest state, so they may
+ * be combined; true for RGB lights and lichtkranten.
+ */
+bool combinesWrites(const PacketView &packet);
+
+#endif
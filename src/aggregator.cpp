@@ -0,0 +1,286 @@
+/**
+ * @file aggregator.cpp
+ * @brief Implementation of the Aggregator class.
+ * @author Daan Breur
+ */
+
+#include "aggregator.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#include "slavemanager.h"
+
+/**
+ * @brief Prefix of a tumbling window in the window list.
+ */
+static const char TUMBLING_PREFIX[] = "tumbling:";
+
+/**
+ * @brief Returns the key of the buckets of a sensor or group and sensor type.
+ */
+static uint32_t seriesKey(AggregateScope scope, uint16_t id, SensorType type) {
+    return (uint32_t)scope << 24 | (uint32_t)type << 16 | id;
+}
+
+/**
+ * @brief Returns the length of a bucket of the window in milliseconds.
+ */
+static uint64_t bucketLength(const struct AggregateWindow &window) {
+    uint64_t window_ms = window.minutes * 60000ULL;
+    return window.tumbling ? window_ms : window_ms / AGGREGATE_BUCKETS;
+}
+
+/**
+ * @brief Parses a window length such as "15m", "1h" or "1d" into minutes.
+ * @return 0 if the length is malformed or does not fit.
+ */
+static uint16_t parseMinutes(const std::string &text) {
+    if (text.size() < 2) return 0;
+
+    char *end;
+    unsigned long value = strtoul(text.c_str(), &end, 10);
+    if (end != text.c_str() + text.size() - 1) return 0;
+
+    switch (text.back()) {
+        case 'm':
+            break;
+        case 'h':
+            value *= 60;
+            break;
+        case 'd':
+            value *= 24 * 60;
+            break;
+        default:
+            return 0;
+    }
+    return value <= UINT16_MAX ? value : 0;
+}
+
+/**
+ * @brief Parses a sensor or group ID.
+ * @throws std::invalid_argument if it is malformed or above MAX_SLAVE_ID.
+ */
+static uint16_t parseId(const std::string &text) {
+    char *end;
+    unsigned long id = strtoul(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || id > MAX_SLAVE_ID)
+        throw std::invalid_argument("Invalid ID in the sensor group list");
+    return id;
+}
+
+Aggregator::Aggregator(size_t max_series)
+    : max_series(max_series), readings(0), dropped(0), queries(0) {
+    parseWindows(DEFAULT_AGGREGATE_WINDOWS);
+}
+
+void Aggregator::setWindows(const std::vector<struct AggregateWindow> &new_windows) {
+    if (new_windows.empty()) throw std::invalid_argument("At least one window is needed");
+    for (size_t i = 0; i < new_windows.size(); ++i) {
+        if (new_windows[i].minutes == 0) throw std::invalid_argument("Windows must not be empty");
+        for (size_t j = 0; j < i; ++j) {
+            if (new_windows[j].minutes == new_windows[i].minutes)
+                throw std::invalid_argument("Every window needs a length of its own");
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    windows = new_windows;
+    series.clear();
+}
+
+void Aggregator::parseWindows(const std::string &list) {
+    std::vector<struct AggregateWindow> parsed;
+    std::stringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        struct AggregateWindow window = {0, false};
+        if (entry.compare(0, sizeof(TUMBLING_PREFIX) - 1, TUMBLING_PREFIX) == 0) {
+            window.tumbling = true;
+            entry.erase(0, sizeof(TUMBLING_PREFIX) - 1);
+        }
+
+        window.minutes = parseMinutes(entry);
+        if (window.minutes == 0) throw std::invalid_argument("Invalid length in the window list");
+        parsed.push_back(window);
+    }
+
+    setWindows(parsed);
+}
+
+std::string Aggregator::describeWindows() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string list;
+    for (const struct AggregateWindow &window : windows) {
+        if (!list.empty()) list += ',';
+        if (window.tumbling) list += TUMBLING_PREFIX;
+        list += std::to_string(window.minutes) + "m";
+    }
+    return list;
+}
+
+void Aggregator::addToGroup(uint16_t group, uint16_t first, uint16_t last) {
+    // every uint16_t is a valid ID, parseId() range-checks the text before narrowing
+    if (first > last) throw std::invalid_argument("Invalid sensor group");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint16_t> &members = groups[group];
+    for (uint32_t sensor_id = first; sensor_id <= last; ++sensor_id) {
+        if (std::find(members.begin(), members.end(), sensor_id) != members.end()) continue;
+        members.push_back(sensor_id);
+        groups_of_sensor[sensor_id].push_back(group);
+    }
+}
+
+void Aggregator::parseGroups(const std::string &list) {
+    std::stringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ';')) {
+        size_t equals = entry.find('=');
+        if (equals == std::string::npos)
+            throw std::invalid_argument("Expected group=sensors in the sensor group list");
+        uint16_t group = parseId(entry.substr(0, equals));
+
+        std::stringstream ranges(entry.substr(equals + 1));
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            size_t dash = range.find('-');
+            uint16_t first = parseId(range.substr(0, dash));
+            uint16_t last = dash == std::string::npos ? first : parseId(range.substr(dash + 1));
+            addToGroup(group, first, last);
+        }
+    }
+}
+
+void Aggregator::addToSeries(uint32_t key, float value, uint64_t now_ms) {
+    auto found = series.find(key);
+    if (found == series.end()) {
+        if (series.size() >= max_series) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        std::unique_ptr<struct Bucket[]> buckets(
+            new struct Bucket[windows.size() * AGGREGATE_BUCKETS]);
+        for (size_t i = 0; i < windows.size() * AGGREGATE_BUCKETS; ++i) buckets[i].period = -1;
+        found = series.emplace(key, std::move(buckets)).first;
+    }
+
+    for (size_t w = 0; w < windows.size(); ++w) {
+        int64_t period = now_ms / bucketLength(windows[w]);
+        struct Bucket &bucket = found->second[w * AGGREGATE_BUCKETS + period % AGGREGATE_BUCKETS];
+
+        // a bucket still holding an older period is reused for the current one
+        if (bucket.period != period) bucket = {period, 0, 0, value, value, value};
+        ++bucket.count;
+        bucket.sum += value;
+        bucket.min = std::min(bucket.min, value);
+        bucket.max = std::max(bucket.max, value);
+        bucket.last = value;
+    }
+}
+
+void Aggregator::add(uint16_t sensor_id, SensorType type, float value, uint64_t now_ms) {
+    readings.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    addToSeries(seriesKey(AggregateScope::SENSOR, sensor_id, type), value, now_ms);
+
+    auto grouped = groups_of_sensor.find(sensor_id);
+    if (grouped == groups_of_sensor.end()) return;
+    for (uint16_t group : grouped->second)
+        addToSeries(seriesKey(AggregateScope::GROUP, group, type), value, now_ms);
+}
+
+bool Aggregator::query(AggregateScope scope, uint16_t id, SensorType type, uint16_t minutes,
+                       uint64_t now_ms, struct Aggregate &result) {
+    result = {0, 0, 0, 0, 0};
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (scope != AggregateScope::SENSOR && (scope != AggregateScope::GROUP || !groups.count(id)))
+        return false;
+
+    size_t w = 0;
+    while (w < windows.size() && windows[w].minutes != minutes) ++w;
+    if (w == windows.size()) return false;
+
+    queries.fetch_add(1, std::memory_order_relaxed);
+    auto found = series.find(seriesKey(scope, id, type));
+    if (found == series.end()) return true;
+
+    int64_t current = now_ms / bucketLength(windows[w]);
+    int64_t oldest = windows[w].tumbling ? current : current - (AGGREGATE_BUCKETS - 1);
+    int64_t latest = -1;
+    for (size_t i = 0; i < AGGREGATE_BUCKETS; ++i) {
+        const struct Bucket &bucket = found->second[w * AGGREGATE_BUCKETS + i];
+        if (bucket.period < oldest || bucket.period > current) continue;
+
+        if (result.count == 0) {
+            result.min = bucket.min;
+            result.max = bucket.max;
+        }
+        result.count += bucket.count;
+        result.sum += bucket.sum;
+        result.min = std::min(result.min, bucket.min);
+        result.max = std::max(result.max, bucket.max);
+        if (bucket.period > latest) {
+            latest = bucket.period;
+            result.last = bucket.last;
+        }
+    }
+    return true;
+}
+
+struct AggregatorStats Aggregator::getStats() const {
+    size_t series_count;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        series_count = series.size();
+    }
+    return {series_count, readings.load(std::memory_order_relaxed),
+            dropped.load(std::memory_order_relaxed), queries.load(std::memory_order_relaxed)};
+}
+
+bool sensorReading(const PacketView &packet, float &value) {
+    switch (packet.sensorType()) {
+        case SensorType::TEMPERATURE:
+            if (!packet.holds<struct sensor_packet_temperature>()) return false;
+            value = packet.temperature();
+            return true;
+        case SensorType::HUMIDITY:
+            if (!packet.holds<struct sensor_packet_humidity>()) return false;
+            value = packet.humidity();
+            return true;
+        case SensorType::CO2:
+            if (!packet.holds<struct sensor_packet_co2>()) return false;
+            value = packet.co2();
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t encodeAggregateResponse(const struct sensor_metadata &metadata, AggregateScope scope,
+                               uint16_t minutes, const struct Aggregate &aggregate,
+                               uint8_t *frame) {
+    frame[0] = sizeof(struct aggregate_response);
+    frame[1] = (uint8_t)PacketType::AGGREGATE_RESPONSE;
+
+    uint8_t *payload = frame + sizeof(struct sensor_header);
+    payload[offsetof(struct aggregate_response, metadata)] = (uint8_t)metadata.sensor_type;
+    payload[offsetof(struct aggregate_response, metadata) + 1] = metadata.sensor_id;
+    payload[offsetof(struct aggregate_response, scope)] = (uint8_t)scope;
+    storeLE16(payload + offsetof(struct aggregate_response, window_minutes), minutes);
+    storeLE32(payload + offsetof(struct aggregate_response, count), aggregate.count);
+    storeLEFloat(payload + offsetof(struct aggregate_response, sum), aggregate.sum);
+    storeLEFloat(payload + offsetof(struct aggregate_response, min), aggregate.min);
+    storeLEFloat(payload + offsetof(struct aggregate_response, max), aggregate.max);
+    storeLEFloat(payload + offsetof(struct aggregate_response, mean), aggregate.mean());
+    storeLEFloat(payload + offsetof(struct aggregate_response, last), aggregate.last);
+
+    return sizeof(struct sensor_header) + sizeof(struct aggregate_response);
+}
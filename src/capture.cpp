@@ -0,0 +1,156 @@
+/**
+ * @file capture.cpp
+ * @brief Implementation of the CaptureWriter class and the capture reader.
+ * @author Daan Breur
+ */
+
+#include "capture.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "packetview.h"
+
+/**
+ * @brief Size of the stdio buffer of a capture file.
+ */
+#define CAPTURE_FILE_BUFFER_SIZE (64 * 1024)
+
+static uint64_t clockNanoseconds(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Writes a file header in little-endian byte order, whatever the byte order of the host.
+ */
+static void encodeFileHeader(const struct CaptureFileHeader &header,
+                             uint8_t bytes[sizeof(struct CaptureFileHeader)]) {
+    storeLE32(bytes + offsetof(struct CaptureFileHeader, magic), header.magic);
+    storeLE16(bytes + offsetof(struct CaptureFileHeader, version), header.version);
+    storeLE16(bytes + offsetof(struct CaptureFileHeader, reserved), header.reserved);
+    storeLE64(bytes + offsetof(struct CaptureFileHeader, started_ns), header.started_ns);
+}
+
+static struct CaptureFileHeader decodeFileHeader(
+    const uint8_t bytes[sizeof(struct CaptureFileHeader)]) {
+    struct CaptureFileHeader header;
+    header.magic = loadLE32(bytes + offsetof(struct CaptureFileHeader, magic));
+    header.version = loadLE16(bytes + offsetof(struct CaptureFileHeader, version));
+    header.reserved = loadLE16(bytes + offsetof(struct CaptureFileHeader, reserved));
+    header.started_ns = loadLE64(bytes + offsetof(struct CaptureFileHeader, started_ns));
+    return header;
+}
+
+/**
+ * @brief Writes a record header in little-endian byte order, whatever the byte order of the host.
+ */
+static void encodeRecordHeader(const struct CaptureRecordHeader &header,
+                               uint8_t bytes[sizeof(struct CaptureRecordHeader)]) {
+    storeLE64(bytes + offsetof(struct CaptureRecordHeader, timestamp_ns), header.timestamp_ns);
+    storeLE32(bytes + offsetof(struct CaptureRecordHeader, connection), header.connection);
+    bytes[offsetof(struct CaptureRecordHeader, event)] = (uint8_t)header.event;
+    bytes[offsetof(struct CaptureRecordHeader, reserved)] = header.reserved;
+    storeLE16(bytes + offsetof(struct CaptureRecordHeader, length), header.length);
+}
+
+static struct CaptureRecordHeader decodeRecordHeader(
+    const uint8_t bytes[sizeof(struct CaptureRecordHeader)]) {
+    struct CaptureRecordHeader header;
+    header.timestamp_ns = loadLE64(bytes + offsetof(struct CaptureRecordHeader, timestamp_ns));
+    header.connection = (int32_t)loadLE32(bytes + offsetof(struct CaptureRecordHeader, connection));
+    header.event = (CaptureEvent)bytes[offsetof(struct CaptureRecordHeader, event)];
+    header.reserved = bytes[offsetof(struct CaptureRecordHeader, reserved)];
+    header.length = loadLE16(bytes + offsetof(struct CaptureRecordHeader, length));
+    return header;
+}
+
+CaptureWriter::CaptureWriter(const std::string &path) : file(nullptr) {
+    file = fopen(path.c_str(), "wbe");
+    if (!file) {
+        perror("fopen() failed");
+        throw std::runtime_error("Could not create capture file");
+    }
+    setvbuf(file, nullptr, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+
+    started_ns = clockNanoseconds(CLOCK_MONOTONIC);
+
+    struct CaptureFileHeader header;
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.reserved = 0;
+    header.started_ns = clockNanoseconds(CLOCK_REALTIME);
+    uint8_t bytes[sizeof(header)];
+    encodeFileHeader(header, bytes);
+    fwrite(bytes, sizeof(bytes), 1, file);
+}
+
+CaptureWriter::~CaptureWriter() { fclose(file); }
+
+void CaptureWriter::record(CaptureEvent event, int connection, const void *data, size_t length) {
+    struct CaptureRecordHeader header;
+    header.timestamp_ns = clockNanoseconds(CLOCK_MONOTONIC) - started_ns;
+    header.connection = connection;
+    header.event = event;
+    header.reserved = 0;
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+    do {
+        // anything longer than a record can hold is split over several records
+        size_t chunk = std::min(length, (size_t)UINT16_MAX);
+        header.length = chunk;
+        uint8_t encoded[sizeof(header)];
+        encodeRecordHeader(header, encoded);
+        fwrite(encoded, sizeof(encoded), 1, file);
+        if (chunk > 0) fwrite(bytes, 1, chunk, file);
+
+        bytes += chunk;
+        length -= chunk;
+    } while (length > 0);
+}
+
+void CaptureWriter::flush() {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    fflush(file);
+}
+
+std::vector<struct CaptureRecord> readCapture(const std::string &path) {
+    std::unique_ptr<FILE, int (*)(FILE *)> file(fopen(path.c_str(), "rb"), fclose);
+    if (!file) throw std::runtime_error("Could not open capture file");
+
+    uint8_t file_bytes[sizeof(struct CaptureFileHeader)];
+    if (fread(file_bytes, sizeof(file_bytes), 1, file.get()) != 1)
+        throw std::runtime_error("Not a capture file");
+    struct CaptureFileHeader file_header = decodeFileHeader(file_bytes);
+    if (file_header.magic != CAPTURE_MAGIC) throw std::runtime_error("Not a capture file");
+    if (file_header.version != CAPTURE_VERSION)
+        throw std::runtime_error("Unsupported capture file version");
+
+    std::vector<struct CaptureRecord> records;
+    uint8_t header_bytes[sizeof(struct CaptureRecordHeader)];
+    while (fread(header_bytes, sizeof(header_bytes), 1, file.get()) == 1) {
+        struct CaptureRecordHeader header = decodeRecordHeader(header_bytes);
+        struct CaptureRecord record;
+        record.timestamp_ns = header.timestamp_ns;
+        record.connection = header.connection;
+        record.event = header.event;
+        record.data.resize(header.length);
+
+        if (header.length > 0 && fread(record.data.data(), 1, header.length, file.get()) !=
+                                     header.length) {
+            // the recording process died halfway through a record; keep what is complete
+            break;
+        }
+
+        records.push_back(std::move(record));
+    }
+
+    return records;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file circuitbreaker.cpp
+ * @brief Implementation of the CircuitBreaker class.
+ * @author Daan Breur
+ */
+
+#include "circuitbreaker.h"
+
+CircuitBreaker::CircuitBreaker()
+    : state(BreakerState::CLOSED),
+      consecutive_failures(0),
+      threshold(BREAKER_FAILURE_THRESHOLD),
+      open_time(std::chrono::milliseconds(BREAKER_OPEN_MS)),
+      opened(0),
+      rejected(0) {}
+
+bool CircuitBreaker::allow() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (state == BreakerState::CLOSED) return true;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now < probe_at) {
+        ++rejected;
+        return false;
+    }
+
+    // the probe; if it is never reported on, another one goes out an interval later
+    state = BreakerState::HALF_OPEN;
+    probe_at = now + open_time;
+    return true;
+}
+
+void CircuitBreaker::succeeded() {
+    std::lock_guard<std::mutex> lock(mutex);
+    state = BreakerState::CLOSED;
+    consecutive_failures = 0;
+}
+
+void CircuitBreaker::failed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++consecutive_failures;
+
+    if (state == BreakerState::HALF_OPEN) {
+        open(std::chrono::steady_clock::now());
+    } else if (state == BreakerState::CLOSED && threshold > 0 &&
+               consecutive_failures >= threshold) {
+        open(std::chrono::steady_clock::now());
+        ++opened;
+    }
+}
+
+void CircuitBreaker::open(std::chrono::steady_clock::time_point now) {
+    state = BreakerState::OPEN;
+    probe_at = now + open_time;
+}
+
+void CircuitBreaker::configure(size_t threshold, std::chrono::milliseconds open_time) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->threshold = threshold;
+    this->open_time = open_time;
+    if (threshold == 0) state = BreakerState::CLOSED;
+}
+
+struct BreakerStats CircuitBreaker::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {state, consecutive_failures, opened, rejected};
+}
@@ -0,0 +1,400 @@
+/**
+ * @file cluster.cpp
+ * @brief Implementation of the PeerLink and ClusterMap classes.
+ * @author Daan Breur
+ */
+
+#include "cluster.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#include "framing.h"
+#include "slavemanager.h"
+
+/**
+ * @brief Features a bridge asks for when it connects to another bridge of the cluster.
+ */
+#define CLUSTER_FEATURES (FEATURE_EXTENDED_IDS | FEATURE_CLUSTER_PEER)
+
+/**
+ * @brief Receives exactly length bytes, waiting at most timeout_ms for each part.
+ * @return false if the connection was closed or nothing arrived in time.
+ */
+static bool receiveAll(int fd, uint8_t *buffer, size_t length, int timeout_ms) {
+    while (length > 0) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0) return false;
+
+        ssize_t received = recv(fd, buffer, length, 0);
+        if (received <= 0) return false;
+        buffer += received;
+        length -= received;
+    }
+    return true;
+}
+
+static bool parseNumber(const std::string &text, unsigned long max, unsigned long &value) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) return false;
+
+    value = strtoul(text.c_str(), nullptr, 10);
+    return value <= max;
+}
+
+PeerLink::PeerLink(const std::string &ip, int port)
+    : ip(ip),
+      port(port),
+      fd(-1),
+      running(false),
+      forwarded(0),
+      failed(0),
+      unmatched(0),
+      peak_in_flight(0) {}
+
+PeerLink::~PeerLink() { stop(); }
+
+void PeerLink::start() {
+    if (running) return;
+    running = true;
+    thread = std::thread(&PeerLink::receiveLoop, this);
+}
+
+void PeerLink::stop() {
+    running = false;
+    if (thread.joinable()) thread.join();
+    disconnect();
+}
+
+int PeerLink::connectToPeer() {
+    struct sockaddr_in peer_address;
+    memset(&peer_address, 0, sizeof(peer_address));
+    peer_address.sin_family = AF_INET;
+    peer_address.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &peer_address.sin_addr);
+
+    int peer_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (peer_fd < 0) return -1;
+
+    // bounds the connect as well as a send to a bridge that stopped reading
+    struct timeval timeout = {CLUSTER_TIMEOUT_MS / 1000, (CLUSTER_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(peer_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    const int enable_opt = 1;
+    setsockopt(peer_fd, IPPROTO_TCP, TCP_NODELAY, &enable_opt, sizeof(enable_opt));
+
+    if (connect(peer_fd, (struct sockaddr *)&peer_address, sizeof(peer_address)) < 0) {
+        close(peer_fd);
+        return -1;
+    }
+
+    struct sensor_packet hello = {0};
+    hello.header.length = sizeof(struct connection_hello);
+    hello.header.ptype = PacketType::HELLO;
+    hello.data.hello.features = CLUSTER_FEATURES;
+    size_t length = PacketView(hello).size();
+
+    // the reply still comes in the basic framing
+    uint8_t reply[sizeof(struct sensor_header) + sizeof(struct connection_hello)];
+    if (send(peer_fd, &hello, length, MSG_NOSIGNAL) != (ssize_t)length ||
+        !receiveAll(peer_fd, reply, sizeof(reply), CLUSTER_TIMEOUT_MS) ||
+        reply[1] != (uint8_t)PacketType::HELLO || reply[0] != sizeof(struct connection_hello)) {
+        close(peer_fd);
+        return -1;
+    }
+
+    if ((reply[sizeof(struct sensor_header)] & CLUSTER_FEATURES) != CLUSTER_FEATURES) {
+        printf("Bridge %s does not support clustering\n", address().c_str());
+        close(peer_fd);
+        return -1;
+    }
+    return peer_fd;
+}
+
+bool PeerLink::isAt(const struct in_addr &address) const {
+    return inet_addr(ip.c_str()) == address.s_addr;
+}
+
+void PeerLink::disconnect() {
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        int old_fd = fd.exchange(-1);
+        if (old_fd >= 0) close(old_fd);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (struct Request *request : in_flight) {
+        if (request->post) {
+            delete request;
+            continue;
+        }
+        request->done = true;
+        request->failed = true;
+    }
+    in_flight.clear();
+    answered.notify_all();
+}
+
+void PeerLink::dropExpiredPosts(std::chrono::steady_clock::time_point now) {
+    for (auto request = in_flight.begin(); request != in_flight.end();) {
+        if (!(*request)->post || (*request)->expires > now) {
+            ++request;
+            continue;
+        }
+        delete *request;
+        request = in_flight.erase(request);
+        failed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void PeerLink::complete(const struct sensor_packet &response, uint16_t sensor_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // a frame too short for metadata carries only the high byte of the ID
+    bool identified = response.header.length >= sizeof(struct sensor_metadata);
+    bool acknowledgment = response.header.ptype == PacketType::POST_ACK;
+    dropExpiredPosts(std::chrono::steady_clock::now());
+    auto found = std::find_if(in_flight.begin(), in_flight.end(), [&](struct Request *request) {
+        return request->post == acknowledgment && request->sensor_id == sensor_id;
+    });
+    if (!identified || found == in_flight.end()) {
+        unmatched.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    struct Request *request = *found;
+    in_flight.erase(found);
+    if (request->post) {
+        // ErrorCode::NONE acknowledges a post that was carried out
+        if (response.data.error.error_code != ErrorCode::NONE) {
+            printf("Bridge %s rejected a post to sensor ID=%u\n", address().c_str(), sensor_id);
+            failed.fetch_add(1, std::memory_order_relaxed);
+        }
+        delete request;
+        return;
+    }
+
+    request->response = response;
+    request->done = true;
+    answered.notify_all();
+}
+
+bool PeerLink::sendFrame(const PacketView &request, uint16_t sensor_id) {
+    uint8_t frame[MAX_FRAME_SIZE];
+    size_t length = encodeFrame(request, sensor_id, true, frame);
+
+    // called with send_mutex held, so the frame cannot interleave with another one
+    int peer_fd = fd;
+    if (peer_fd < 0) return false;
+    if (send(peer_fd, frame, length, MSG_NOSIGNAL) == (ssize_t)length) return true;
+
+    // a partly sent frame leaves the stream unusable; the receive thread sets it up again
+    shutdown(peer_fd, SHUT_RDWR);
+    return false;
+}
+
+struct sensor_packet PeerLink::call(const PacketView &request, uint16_t sensor_id,
+                                    int timeout_ms) {
+    struct Request waiting = {sensor_id, false, false, false, {}, {}};
+    {
+        // queued in the order the frames go out; the first answer for a sensor goes to the oldest
+        std::lock_guard<std::mutex> send_lock(send_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            in_flight.push_back(&waiting);
+            peak_in_flight = std::max(peak_in_flight, in_flight.size());
+        }
+
+        if (!sendFrame(request, sensor_id)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto queued = std::find(in_flight.begin(), in_flight.end(), &waiting);
+            if (queued != in_flight.end()) in_flight.erase(queued);
+            failed.fetch_add(1, std::memory_order_relaxed);
+            throw std::runtime_error("Bridge " + address() + " is unreachable");
+        }
+    }
+    forwarded.fetch_add(1, std::memory_order_relaxed);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    answered.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&]() { return waiting.done; });
+    if (!waiting.done) {
+        // a late answer no longer matches and is dropped
+        in_flight.erase(std::find(in_flight.begin(), in_flight.end(), &waiting));
+        failed.fetch_add(1, std::memory_order_relaxed);
+        throw std::runtime_error("Bridge " + address() + " did not answer in time");
+    }
+    if (waiting.failed) {
+        failed.fetch_add(1, std::memory_order_relaxed);
+        throw std::runtime_error("Lost the connection to bridge " + address());
+    }
+    return waiting.response;
+}
+
+void PeerLink::post(const PacketView &request, uint16_t sensor_id) {
+    auto now = std::chrono::steady_clock::now();
+    struct Request *waiting = new Request{
+        sensor_id, true, false, false, {}, now + std::chrono::milliseconds(CLUSTER_TIMEOUT_MS)};
+    {
+        // queued like a call, so its POST_ACK is consumed here and not left unmatched
+        std::lock_guard<std::mutex> send_lock(send_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            dropExpiredPosts(now);
+            in_flight.push_back(waiting);
+            peak_in_flight = std::max(peak_in_flight, in_flight.size());
+        }
+
+        if (!sendFrame(request, sensor_id)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            // a disconnect may have freed it already
+            auto queued = std::find(in_flight.begin(), in_flight.end(), waiting);
+            if (queued != in_flight.end()) {
+                in_flight.erase(queued);
+                delete waiting;
+            }
+            failed.fetch_add(1, std::memory_order_relaxed);
+            throw std::runtime_error("Bridge " + address() + " is unreachable");
+        }
+    }
+    forwarded.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PeerLink::receiveLoop() {
+    std::vector<uint8_t> buffer;
+
+    while (running) {
+        if (fd < 0) {
+            int peer_fd = connectToPeer();
+            if (peer_fd < 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(CLUSTER_RETRY_MS));
+                continue;
+            }
+
+            printf("Connected to cluster bridge %s\n", address().c_str());
+            buffer.clear();
+            std::lock_guard<std::mutex> lock(send_mutex);
+            fd = peer_fd;
+        }
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, CLUSTER_RETRY_MS) <= 0) continue;
+
+        uint8_t chunk[4096];
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            printf("Lost the connection to cluster bridge %s\n", address().c_str());
+            disconnect();
+            continue;
+        }
+        buffer.insert(buffer.end(), chunk, chunk + received);
+
+        size_t offset = 0;
+        while (offset + sizeof(struct sensor_header) <= buffer.size()) {
+            PacketView frame(&buffer[offset], buffer.size() - offset);
+            if (!frame.complete()) break;
+
+            struct sensor_packet response;
+            uint16_t sensor_id;
+            if (decodeFrame(frame.data(), true, response, sensor_id))
+                complete(response, sensor_id);
+            offset += frame.frameLength();
+        }
+        buffer.erase(buffer.begin(), buffer.begin() + offset);
+    }
+}
+
+struct PeerStats PeerLink::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {isConnected(),
+            forwarded.load(std::memory_order_relaxed),
+            failed.load(std::memory_order_relaxed),
+            unmatched.load(std::memory_order_relaxed),
+            in_flight.size(),
+            peak_in_flight};
+}
+
+ClusterMap::ClusterMap() : owners(new uint8_t[MAX_SLAVE_ID + 1]), started(false) {
+    memset(owners.get(), NO_CLUSTER_NODE, MAX_SLAVE_ID + 1);
+}
+
+void ClusterMap::parseTable(const std::string &table) {
+    if (started) throw std::logic_error("Cannot change the cluster map while running");
+
+    std::vector<std::unique_ptr<PeerLink>> new_nodes;
+    std::unique_ptr<uint8_t[]> new_owners(new uint8_t[MAX_SLAVE_ID + 1]);
+    memset(new_owners.get(), NO_CLUSTER_NODE, MAX_SLAVE_ID + 1);
+
+    std::stringstream entries(table);
+    std::string entry;
+    while (std::getline(entries, entry, ';')) {
+        if (entry.empty()) continue;
+        if (new_nodes.size() >= MAX_CLUSTER_NODES)
+            throw std::invalid_argument("Too many bridges in the cluster map");
+
+        size_t equals = entry.find('=');
+        size_t colon = entry.rfind(':', equals);
+        unsigned long port;
+        if (equals == std::string::npos || colon == std::string::npos ||
+            !parseNumber(entry.substr(colon + 1, equals - colon - 1), 65535, port) || port == 0)
+            throw std::invalid_argument("Expected ip:port=ids in the cluster map");
+
+        std::string ip = entry.substr(0, colon);
+        if (INADDR_NONE == inet_addr(ip.c_str()))
+            throw std::invalid_argument("Invalid bridge IP address in the cluster map");
+
+        std::stringstream ranges(entry.substr(equals + 1));
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            size_t dash = range.find('-');
+            unsigned long first, last;
+            if (!parseNumber(range.substr(0, dash), MAX_SLAVE_ID, first) ||
+                !parseNumber(dash == std::string::npos ? range : range.substr(dash + 1),
+                             MAX_SLAVE_ID, last) ||
+                first > last)
+                throw std::invalid_argument("Invalid sensor ID range in the cluster map");
+
+            for (unsigned long id = first; id <= last; ++id) {
+                if (new_owners[id] != NO_CLUSTER_NODE)
+                    throw std::invalid_argument(
+                        "Sensor ID owned by two bridges in the cluster map");
+                new_owners[id] = new_nodes.size();
+            }
+        }
+
+        new_nodes.push_back(std::make_unique<PeerLink>(ip, port));
+    }
+
+    nodes = std::move(new_nodes);
+    owners = std::move(new_owners);
+}
+
+PeerLink *ClusterMap::ownerOf(uint16_t sensor_id) const {
+    uint8_t owner = owners[sensor_id];
+    return owner == NO_CLUSTER_NODE ? nullptr : nodes[owner].get();
+}
+
+bool ClusterMap::isNode(const struct in_addr &address) const {
+    return std::any_of(nodes.begin(), nodes.end(),
+                       [&address](const std::unique_ptr<PeerLink> &node) {
+                           return node->isAt(address);
+                       });
+}
+
+void ClusterMap::start() {
+    for (auto &node : nodes) node->start();
+    started = true;
+}
+
+void ClusterMap::stop() {
+    for (auto &node : nodes) node->stop();
+    started = false;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file deadband.cpp
+ * @brief Implementation of the DeadbandFilter class.
+ * @author Daan Breur
+ */
+
+#include "deadband.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * @brief Returns whether a reading moved beyond the deadband around the known value.
+ */
+static bool outsideDeadband(float known, float update, const struct Deadband &deadband) {
+    float delta = std::fabs(update - known);
+    if (std::isnan(delta)) return !(std::isnan(known) && std::isnan(update));
+
+    return delta > deadband.absolute && delta > deadband.relative * std::fabs(known);
+}
+
+/**
+ * @brief Parses a threshold such as "0.5" (absolute) or "2%" (relative) into the deadband.
+ * @return false if the threshold is malformed or negative.
+ */
+static bool parseThreshold(const std::string &text, struct Deadband &deadband) {
+    bool relative = !text.empty() && text.back() == '%';
+    std::string number = relative ? text.substr(0, text.size() - 1) : text;
+
+    char *end;
+    float value = strtof(number.c_str(), &end);
+    if (number.empty() || *end != '\0' || !(value >= 0)) return false;
+
+    if (relative)
+        deadband.relative = value / 100;
+    else
+        deadband.absolute = value;
+    return true;
+}
+
+DeadbandFilter::DeadbandFilter() : accepted(0), suppressed(0) {
+    memset(type_deadbands, 0, sizeof(type_deadbands));
+    memset(sensor_deadbands, 0, sizeof(sensor_deadbands));
+    memset(has_sensor_deadband, 0, sizeof(has_sensor_deadband));
+}
+
+void DeadbandFilter::setTypeDeadband(SensorType type, struct Deadband deadband) {
+    if (!(deadband.absolute >= 0) || !(deadband.relative >= 0))
+        throw std::invalid_argument("Deadband thresholds must not be negative");
+
+    type_deadbands[(uint8_t)type] = deadband;
+}
+
+void DeadbandFilter::setSensorDeadband(uint8_t sensor_id, struct Deadband deadband) {
+    if (!(deadband.absolute >= 0) || !(deadband.relative >= 0))
+        throw std::invalid_argument("Deadband thresholds must not be negative");
+
+    sensor_deadbands[sensor_id] = deadband;
+    has_sensor_deadband[sensor_id] = true;
+}
+
+void DeadbandFilter::parse(const std::string &list) {
+    std::stringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        size_t equals = entry.find('=');
+        if (equals == std::string::npos)
+            throw std::invalid_argument("Expected sensor=threshold in the deadband list");
+
+        struct Deadband deadband = {0, 0};
+        std::stringstream thresholds(entry.substr(equals + 1));
+        std::string threshold;
+        int count = 0;
+        while (std::getline(thresholds, threshold, '/')) {
+            if (!parseThreshold(threshold, deadband))
+                throw std::invalid_argument("Invalid threshold in the deadband list");
+            ++count;
+        }
+        if (count == 0) throw std::invalid_argument("Missing threshold in the deadband list");
+
+        std::string sensor = entry.substr(0, equals);
+        if (sensor == "temperature") {
+            setTypeDeadband(SensorType::TEMPERATURE, deadband);
+        } else if (sensor == "humidity") {
+            setTypeDeadband(SensorType::HUMIDITY, deadband);
+        } else if (sensor == "co2") {
+            setTypeDeadband(SensorType::CO2, deadband);
+        } else {
+            char *end;
+            unsigned long sensor_id = strtoul(sensor.c_str(), &end, 10);
+            if (sensor.empty() || *end != '\0' || sensor_id > UINT8_MAX)
+                throw std::invalid_argument("Unknown sensor in the deadband list");
+            setSensorDeadband(sensor_id, deadband);
+        }
+    }
+}
+
+bool DeadbandFilter::accept(uint16_t sensor_id, const PacketView &known,
+                            const PacketView &update) {
+    SensorType type = update.sensorType();
+    const struct Deadband &deadband = sensor_id <= UINT8_MAX && has_sensor_deadband[sensor_id]
+                                          ? sensor_deadbands[sensor_id]
+                                          : type_deadbands[(uint8_t)type];
+
+    bool changed;
+    if (type == SensorType::BUTTON || type == SensorType::MOTION) {
+        // every press is news, even though all presses look the same
+        changed = true;
+    } else if (known.length() != update.length() || known.sensorType() != type ||
+               known.payloadLength() != update.payloadLength()) {
+        changed = true;
+    } else if (type == SensorType::TEMPERATURE &&
+               update.holds<struct sensor_packet_temperature>()) {
+        changed = outsideDeadband(known.temperature(), update.temperature(), deadband);
+    } else if (type == SensorType::HUMIDITY && update.holds<struct sensor_packet_humidity>()) {
+        changed = outsideDeadband(known.humidity(), update.humidity(), deadband);
+    } else if (type == SensorType::CO2 && update.holds<struct sensor_packet_co2>()) {
+        changed = outsideDeadband(known.co2(), update.co2(), deadband);
+    } else {
+        // readings without a deadband, and packets too short for their reading, change on any byte
+        changed = memcmp(known.payload(), update.payload(), update.payloadLength()) != 0;
+    }
+
+    if (changed)
+        accepted.fetch_add(1, std::memory_order_relaxed);
+    else
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+    return changed;
+}
+
+struct DeadbandStats DeadbandFilter::getStats() const {
+    return {accepted.load(std::memory_order_relaxed), suppressed.load(std::memory_order_relaxed)};
+}
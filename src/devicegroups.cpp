@@ -0,0 +1,86 @@
+/**
+ * @file devicegroups.cpp
+ * @brief Implementation of the DeviceGroups class.
+ * @author Daan Breur
+ */
+
+#include "devicegroups.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#include "packetview.h"
+#include "slavemanager.h"
+
+/**
+ * @brief Parses a group or device ID.
+ * @throws std::invalid_argument if it is malformed or above MAX_SLAVE_ID.
+ */
+static uint16_t parseId(const std::string &text) {
+    char *end;
+    unsigned long id = strtoul(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || id > MAX_SLAVE_ID)
+        throw std::invalid_argument("Invalid ID in the device group list");
+    return id;
+}
+
+void DeviceGroups::add(uint16_t group, uint16_t first, uint16_t last) {
+    if (first > last) throw std::invalid_argument("Invalid device group range");
+
+    std::vector<uint16_t> &members = groups[group];
+    for (uint32_t device = first; device <= last; ++device) {
+        if (std::find(members.begin(), members.end(), device) != members.end()) continue;
+        if (members.size() >= MAX_GROUP_MEMBERS)
+            throw std::invalid_argument("Too many members in device group " +
+                                        std::to_string(group));
+        members.push_back(device);
+    }
+}
+
+void DeviceGroups::parse(const std::string &list) {
+    std::stringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ';')) {
+        size_t equals = entry.find('=');
+        if (equals == std::string::npos)
+            throw std::invalid_argument("Expected group=devices in the device group list");
+        uint16_t group = parseId(entry.substr(0, equals));
+
+        std::stringstream ranges(entry.substr(equals + 1));
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            size_t dash = range.find('-');
+            uint16_t first = parseId(range.substr(0, dash));
+            uint16_t last = dash == std::string::npos ? first : parseId(range.substr(dash + 1));
+            add(group, first, last);
+        }
+    }
+}
+
+const std::vector<uint16_t> *DeviceGroups::members(uint16_t group) const {
+    auto found = groups.find(group);
+    return found == groups.end() ? nullptr : &found->second;
+}
+
+size_t encodeGroupResult(const struct sensor_metadata &metadata,
+                         const std::vector<struct GroupMemberResult> &results, uint8_t *frame) {
+    size_t count = std::min<size_t>(results.size(), MAX_GROUP_MEMBERS);
+    frame[0] = sizeof(struct group_result) + count * sizeof(struct group_member_status);
+    frame[1] = (uint8_t)PacketType::GROUP_RESULT;
+
+    uint8_t *payload = frame + sizeof(struct sensor_header);
+    payload[offsetof(struct group_result, metadata)] = (uint8_t)metadata.sensor_type;
+    payload[offsetof(struct group_result, metadata) + 1] = metadata.sensor_id;
+    payload[offsetof(struct group_result, member_count)] = count;
+
+    uint8_t *entry = payload + sizeof(struct group_result);
+    for (size_t i = 0; i < count; ++i) {
+        storeLE16(entry + offsetof(struct group_member_status, sensor_id), results[i].sensor_id);
+        entry[offsetof(struct group_member_status, status)] = (uint8_t)results[i].status;
+        entry += sizeof(struct group_member_status);
+    }
+
+    return entry - frame;
+}
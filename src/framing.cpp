@@ -0,0 +1,55 @@
+/**
+ * @file framing.cpp
+ * @brief Implementation of the frame encoding and decoding.
+ * @author Daan Breur
+ */
+
+#include "framing.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+bool decodeFrame(const uint8_t *frame, bool extended_ids, struct sensor_packet &packet,
+                 uint16_t &sensor_id) {
+    struct sensor_header header;
+    memcpy(&header, frame, sizeof(header));
+    const uint8_t *payload = frame + sizeof(header);
+
+    uint8_t id_high = 0;
+    if (extended_ids) {
+        if (header.length < 1) return false;
+        id_high = *payload++;
+        header.length -= 1;
+    }
+
+    memset(&packet, 0, sizeof(packet));
+    packet.header = header;
+    memcpy(&packet.data, payload, std::min<size_t>(header.length, sizeof(packet.data)));
+
+    sensor_id = (uint16_t)id_high << 8 | packet.data.generic.metadata.sensor_id;
+    return true;
+}
+
+size_t encodeFrame(const PacketView &packet, uint16_t sensor_id, bool extended_ids,
+                   uint8_t *frame) {
+    if (!extended_ids && sensor_id > UINT8_MAX)
+        throw std::invalid_argument("Sensor ID needs extended addressing");
+
+    size_t payload_length = std::min<size_t>(packet.payloadLength(), UINT8_MAX - extended_ids);
+    struct sensor_header header = {(uint8_t)payload_length, packet.type()};
+    uint8_t *cursor = frame + sizeof(header);
+
+    if (extended_ids) {
+        *cursor++ = sensor_id >> 8;
+        header.length += 1;
+    }
+    memcpy(frame, &header, sizeof(header));
+
+    memcpy(cursor, packet.payload(), payload_length);
+    if (payload_length >= sizeof(struct sensor_metadata))
+        cursor[offsetof(struct sensor_packet_generic, metadata.sensor_id)] = sensor_id & 0xFF;
+
+    return cursor + payload_length - frame;
+}
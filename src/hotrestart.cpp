@@ -0,0 +1,329 @@
+/**
+ * @file hotrestart.cpp
+ * @brief Implementation of the socket and state handoff used for hot restarts.
+ * @author Daan Breur
+ */
+
+#include "hotrestart.h"
+
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+
+#include "packets.h"
+#include "slavemanager.h"
+
+/**
+ * @brief Magic number at the start of a handoff ("HOFF").
+ */
+#define HANDOFF_MAGIC 0x46464F48
+
+/**
+ * @brief Version of the handoff format, bumped on every incompatible change.
+ */
+#define HANDOFF_VERSION 6
+
+/**
+ * @brief Maximum number of file descriptors passed in one message (the kernel allows 253).
+ */
+#define HANDOFF_FDS_PER_MESSAGE 200
+
+/**
+ * @brief Maximum size of one message of the body, well below the default socket buffer size.
+ */
+#define HANDOFF_BODY_CHUNK 65536
+
+/**
+ * @brief Byte the new process sends once it has taken over.
+ */
+#define HANDOFF_ACK 0x06
+
+struct handoff_header {
+    uint32_t magic;
+    uint32_t version;
+    int32_t listen_index;
+    int32_t udp_index;
+    int32_t http_index;
+    uint32_t hub_count;
+    uint32_t fd_count;
+    uint32_t client_count;
+    uint32_t slave_count;
+    uint32_t body_length;
+} __attribute__((packed));
+
+struct handoff_client {
+    int32_t fd_index;
+    struct sockaddr_in address;
+    uint8_t extended_ids;
+    uint8_t http;
+    uint8_t cluster_peer;
+    /** @brief Number of pending bytes that follow the record */
+    uint32_t pending_length;
+    struct HttpRequest http_request;
+} __attribute__((packed));
+
+struct handoff_slave {
+    uint16_t slave_id;
+    uint8_t udp;
+    uint8_t extended_ids;
+    int32_t fd_index;
+    struct sockaddr_in udp_address;
+    struct sensor_packet sensor_data;
+} __attribute__((packed));
+
+static void sendMessage(int handoff_fd, const void *data, size_t length, const int *fds = nullptr,
+                        size_t fd_count = 0) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void *>(data);
+    iov.iov_len = length;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)];
+    if (fd_count > 0) {
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    if (sendmsg(handoff_fd, &message, MSG_NOSIGNAL) != (ssize_t)length) {
+        perror("sendmsg() failed");
+        throw std::runtime_error("Sending handoff state failed");
+    }
+}
+
+void sendHandoffState(int handoff_fd, const struct HandoffState &state) {
+    std::vector<int> fds;
+    std::map<int, int32_t> fd_indices;
+    auto addFD = [&](int fd) -> int32_t {
+        if (fd < 0) return -1;
+        auto found = fd_indices.find(fd);
+        if (found != fd_indices.end()) return found->second;
+
+        fds.push_back(fd);
+        return fd_indices[fd] = fds.size() - 1;
+    };
+
+    struct handoff_header header;
+    header.magic = HANDOFF_MAGIC;
+    header.version = HANDOFF_VERSION;
+    header.listen_index = addFD(state.listen_fd);
+    header.udp_index = addFD(state.udp_fd);
+    header.http_index = addFD(state.http_fd);
+    header.hub_count = state.hub_fds.size();
+
+    std::vector<uint8_t> body;
+    for (int hub_fd : state.hub_fds) {
+        int32_t fd_index = addFD(hub_fd);
+        body.insert(body.end(), (uint8_t *)&fd_index, (uint8_t *)&fd_index + sizeof(fd_index));
+    }
+
+    for (const struct HandoffClient &client : state.clients) {
+        struct handoff_client wire;
+        wire.fd_index = addFD(client.fd);
+        wire.address = client.address;
+        wire.extended_ids = client.extended_ids;
+        wire.http = client.http;
+        wire.cluster_peer = client.cluster_peer;
+        wire.pending_length = client.pending.size();
+        wire.http_request = client.http_request;
+        body.insert(body.end(), (uint8_t *)&wire, (uint8_t *)&wire + sizeof(wire));
+        body.insert(body.end(), client.pending.begin(), client.pending.end());
+    }
+
+    for (const struct SlaveSnapshot &slave : state.slaves) {
+        struct handoff_slave wire;
+        wire.slave_id = slave.slave_id;
+        wire.udp = slave.udp;
+        wire.extended_ids = slave.extended_ids;
+        wire.udp_address = slave.udp_address;
+        wire.sensor_data = slave.sensor_data;
+
+        // a slave whose connection is not handed over just keeps its state
+        auto found = fd_indices.find(slave.fd);
+        wire.fd_index = found != fd_indices.end() ? found->second : -1;
+
+        body.insert(body.end(), (uint8_t *)&wire, (uint8_t *)&wire + sizeof(wire));
+    }
+
+    header.fd_count = fds.size();
+    header.client_count = state.clients.size();
+    header.slave_count = state.slaves.size();
+    header.body_length = body.size();
+    sendMessage(handoff_fd, &header, sizeof(header));
+
+    for (size_t sent = 0; sent < fds.size(); sent += HANDOFF_FDS_PER_MESSAGE) {
+        uint32_t count = std::min(fds.size() - sent, (size_t)HANDOFF_FDS_PER_MESSAGE);
+        sendMessage(handoff_fd, &count, sizeof(count), &fds[sent], count);
+    }
+
+    // thousands of slaves do not fit in a single message
+    for (size_t sent = 0; sent < body.size(); sent += HANDOFF_BODY_CHUNK)
+        sendMessage(handoff_fd, body.data() + sent,
+                    std::min(body.size() - sent, (size_t)HANDOFF_BODY_CHUNK));
+}
+
+static size_t receiveMessage(int handoff_fd, void *data, size_t length, std::vector<int> &fds) {
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = length;
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received = recvmsg(handoff_fd, &message, MSG_CMSG_CLOEXEC);
+    if (received < 0) {
+        perror("recvmsg() failed");
+        throw std::runtime_error("Receiving handoff state failed");
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *received_fds = (const int *)CMSG_DATA(cmsg);
+        fds.insert(fds.end(), received_fds, received_fds + count);
+    }
+
+    if (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+        throw std::runtime_error("Handoff message was truncated");
+
+    return received;
+}
+
+struct HandoffState receiveHandoffState(int handoff_fd) {
+    std::vector<int> fds;
+
+    try {
+        struct handoff_header header;
+        if (receiveMessage(handoff_fd, &header, sizeof(header), fds) != sizeof(header) ||
+            header.magic != HANDOFF_MAGIC || header.version != HANDOFF_VERSION)
+            throw std::runtime_error("Unexpected handoff header");
+
+        while (fds.size() < header.fd_count) {
+            uint32_t count;
+            size_t before = fds.size();
+            if (receiveMessage(handoff_fd, &count, sizeof(count), fds) != sizeof(count) ||
+                fds.size() - before != count)
+                throw std::runtime_error("Unexpected handoff file descriptor message");
+        }
+
+        // the pending bytes of the clients come on top of the fixed-size records
+        size_t body_length = header.body_length;
+        size_t records_length = header.hub_count * sizeof(int32_t) +
+                                header.client_count * sizeof(struct handoff_client) +
+                                header.slave_count * sizeof(struct handoff_slave);
+        if (body_length < records_length) throw std::runtime_error("Unexpected handoff body");
+
+        std::vector<uint8_t> body(body_length);
+        for (size_t received = 0; received < body_length;) {
+            size_t expected = std::min(body_length - received, (size_t)HANDOFF_BODY_CHUNK);
+            if (receiveMessage(handoff_fd, body.data() + received, expected, fds) != expected)
+                throw std::runtime_error("Unexpected handoff body");
+            received += expected;
+        }
+        if (fds.size() != header.fd_count) throw std::runtime_error("Unexpected handoff body");
+
+        auto fdAt = [&fds](int32_t index) -> int {
+            if (index < 0) return -1;
+            if ((size_t)index >= fds.size())
+                throw std::runtime_error("Handoff refers to a missing file descriptor");
+            return fds[index];
+        };
+
+        struct HandoffState state;
+        state.listen_fd = fdAt(header.listen_index);
+        state.udp_fd = fdAt(header.udp_index);
+        state.http_fd = fdAt(header.http_index);
+
+        const uint8_t *cursor = body.data();
+        size_t pending_total = 0;
+        for (uint32_t i = 0; i < header.hub_count; ++i) {
+            int32_t fd_index;
+            memcpy(&fd_index, cursor, sizeof(fd_index));
+            cursor += sizeof(fd_index);
+
+            state.hub_fds.push_back(fdAt(fd_index));
+        }
+
+        for (uint32_t i = 0; i < header.client_count; ++i) {
+            struct handoff_client wire;
+            memcpy(&wire, cursor, sizeof(wire));
+            cursor += sizeof(wire);
+
+            pending_total += wire.pending_length;
+            if (records_length + pending_total > body_length)
+                throw std::runtime_error("Unexpected handoff body");
+
+            struct HandoffClient client;
+            client.fd = fdAt(wire.fd_index);
+            client.address = wire.address;
+            client.extended_ids = wire.extended_ids != 0;
+            client.http = wire.http != 0;
+            client.cluster_peer = wire.cluster_peer != 0;
+            client.pending.assign(cursor, cursor + wire.pending_length);
+            client.http_request = wire.http_request;
+            cursor += wire.pending_length;
+            state.clients.push_back(client);
+        }
+        if (records_length + pending_total != body_length)
+            throw std::runtime_error("Unexpected handoff body");
+
+        for (uint32_t i = 0; i < header.slave_count; ++i) {
+            struct handoff_slave wire;
+            memcpy(&wire, cursor, sizeof(wire));
+            cursor += sizeof(wire);
+
+            struct SlaveSnapshot slave;
+            slave.slave_id = wire.slave_id;
+            slave.fd = fdAt(wire.fd_index);
+            slave.udp = wire.udp;
+            slave.extended_ids = wire.extended_ids;
+            slave.udp_address = wire.udp_address;
+            slave.sensor_data = wire.sensor_data;
+            state.slaves.push_back(slave);
+        }
+
+        return state;
+    } catch (std::runtime_error &) {
+        for (int fd : fds) close(fd);
+        throw;
+    }
+}
+
+void sendHandoffAck(int handoff_fd) {
+    uint8_t ack = HANDOFF_ACK;
+    sendMessage(handoff_fd, &ack, sizeof(ack));
+}
+
+bool waitForHandoffAck(int handoff_fd, int timeout_ms) {
+    struct pollfd pf;
+    pf.fd = handoff_fd;
+    pf.events = POLLIN;
+    if (poll(&pf, 1, timeout_ms) < 1) return false;
+
+    // EOF here means the new process died before taking over
+    uint8_t ack = 0;
+    return recv(handoff_fd, &ack, sizeof(ack), 0) == sizeof(ack) && ack == HANDOFF_ACK;
+}
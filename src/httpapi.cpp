@@ -0,0 +1,438 @@
+/**
+ * @file httpapi.cpp
+ * @brief Implementation of the HTTP request parser and the JSON helpers of the HTTP API.
+ * @author Daan Breur
+ */
+
+#include "httpapi.h"
+
+#include <string.h>
+#include <strings.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+
+/**
+ * @brief Parses the request line, e.g. "GET /sensors/200?pretty HTTP/1.1".
+ * @return false if the line is malformed.
+ */
+static bool parseRequestLine(struct HttpRequest &request, const char *line, size_t length) {
+    const char *end = line + length;
+    const char *method_end = (const char *)memchr(line, ' ', length);
+    if (!method_end) return false;
+    const char *target = method_end + 1;
+    const char *target_end = (const char *)memchr(target, ' ', end - target);
+    if (!target_end || target == target_end || *target != '/') return false;
+
+    std::string method(line, method_end);
+    if (method == "GET")
+        request.method = HttpMethod::GET;
+    else if (method == "POST")
+        request.method = HttpMethod::POST;
+    else if (method == "OPTIONS")
+        request.method = HttpMethod::OPTIONS;
+    else
+        request.method = HttpMethod::OTHER;
+
+    std::string version(target_end + 1, end);
+    if (version == "HTTP/1.1")
+        request.keep_alive = true;
+    else if (version == "HTTP/1.0")
+        request.keep_alive = false;
+    else
+        return false;
+
+    const char *query = (const char *)memchr(target, '?', target_end - target);
+    size_t path_length = (query ? query : target_end) - target;
+
+    // a path this long cannot match any route, so it is dropped rather than cut off
+    if (path_length > HTTP_MAX_PATH) path_length = 0;
+    memcpy(request.path, target, path_length);
+    request.path[path_length] = '\0';
+    return true;
+}
+
+/**
+ * @brief Parses a single header line; only the headers the API cares about are looked at.
+ * @return false if the header is malformed or unsupported.
+ */
+static bool parseHeader(struct HttpRequest &request, const char *line, size_t length) {
+    const char *colon = (const char *)memchr(line, ':', length);
+    if (!colon || colon == line) return false;
+
+    size_t name_length = colon - line;
+    const char *value = colon + 1;
+    const char *end = line + length;
+    while (value < end && (*value == ' ' || *value == '\t')) ++value;
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) --end;
+    std::string text(value, end);
+
+    auto isHeader = [&](const char *name) {
+        return name_length == strlen(name) && strncasecmp(line, name, name_length) == 0;
+    };
+
+    if (isHeader("Content-Length")) {
+        char *number_end;
+        unsigned long long content_length = strtoull(text.c_str(), &number_end, 10);
+        if (text.empty() || *number_end != '\0' || text[0] == '-') return false;
+        request.content_length = content_length;
+    } else if (isHeader("Connection")) {
+        if (strcasestr(text.c_str(), "close"))
+            request.keep_alive = false;
+        else if (strcasestr(text.c_str(), "keep-alive"))
+            request.keep_alive = true;
+    } else if (isHeader("Transfer-Encoding")) {
+        // nothing the API accepts needs a chunked body
+        return false;
+    }
+    return true;
+}
+
+HttpParseResult parseHttpRequest(struct HttpRequest &request, const uint8_t *data, size_t length,
+                                 size_t capacity, size_t &consumed) {
+    consumed = 0;
+
+    while (!request.headers_done) {
+        const char *line = (const char *)data + consumed;
+        const char *newline = (const char *)memchr(line, '\n', length - consumed);
+        if (!newline) {
+            // nothing was consumed, so the buffer is full of a single line
+            if (consumed == 0 && length >= capacity) return HttpParseResult::HEADER_TOO_LARGE;
+            return HttpParseResult::INCOMPLETE;
+        }
+
+        size_t line_length = newline - line;
+        if (line_length > 0 && line[line_length - 1] == '\r') --line_length;
+        consumed = newline + 1 - (const char *)data;
+
+        if (!request.started) {
+            // empty lines before a request are allowed and ignored
+            if (line_length == 0) continue;
+            if (!parseRequestLine(request, line, line_length)) return HttpParseResult::BAD_REQUEST;
+            request.started = true;
+        } else if (line_length == 0) {
+            request.headers_done = true;
+            if (request.content_length > capacity) return HttpParseResult::BODY_TOO_LARGE;
+        } else if (!parseHeader(request, line, line_length)) {
+            return HttpParseResult::BAD_REQUEST;
+        }
+    }
+
+    if (length - consumed < request.content_length) return HttpParseResult::INCOMPLETE;
+    consumed += request.content_length;
+    return HttpParseResult::COMPLETE;
+}
+
+const char *httpStatusText(int status) {
+    switch (status) {
+        case 200:
+            return "OK";
+        case 202:
+            return "Accepted";
+        case 204:
+            return "No Content";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 413:
+            return "Payload Too Large";
+        case 429:
+            return "Too Many Requests";
+        case 431:
+            return "Request Header Fields Too Large";
+        case 502:
+            return "Bad Gateway";
+        case 503:
+            return "Service Unavailable";
+        default:
+            return "Internal Server Error";
+    }
+}
+
+std::string httpResponseHead(int status, size_t content_length, bool keep_alive) {
+    char head[384];
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %d %s\r\n"
+             "Content-Type: application/json\r\n"
+             "Content-Length: %zu\r\n"
+             "Cache-Control: no-store\r\n"
+             "Access-Control-Allow-Origin: *\r\n"
+             "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
+             "Access-Control-Allow-Headers: Content-Type\r\n"
+             "Connection: %s\r\n\r\n",
+             status, httpStatusText(status), content_length, keep_alive ? "keep-alive" : "close");
+    return head;
+}
+
+const char *sensorTypeName(SensorType type) {
+    switch (type) {
+        case SensorType::NOOP:
+            return "noop";
+        case SensorType::BUTTON:
+            return "button";
+        case SensorType::TEMPERATURE:
+            return "temperature";
+        case SensorType::CO2:
+            return "co2";
+        case SensorType::HUMIDITY:
+            return "humidity";
+        case SensorType::PRESSURE:
+            return "pressure";
+        case SensorType::LIGHT:
+            return "light";
+        case SensorType::MOTION:
+            return "motion";
+        case SensorType::RGB_LIGHT:
+            return "rgb_light";
+        case SensorType::LICHTKRANT:
+            return "lichtkrant";
+        default:
+            return "unknown";
+    }
+}
+
+std::string jsonEscape(const char *text, size_t length) {
+    std::string escaped;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c < 0x20 || c >= 0x7F) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+/**
+ * @brief Formats a reading as a JSON number, or null if it has no JSON representation.
+ */
+static std::string jsonNumber(float value) {
+    if (!std::isfinite(value)) return "null";
+
+    char number[32];
+    snprintf(number, sizeof(number), "%.7g", value);
+    return number;
+}
+
+std::string sensorToJson(uint16_t sensor_id, const PacketView &packet) {
+    SensorType type = packet.sensorType();
+
+    std::string json = "{\"id\":" + std::to_string(sensor_id) + ",\"type\":\"" +
+                       sensorTypeName(type) + "\"";
+
+    // fields are only present if the packet is long enough to hold them
+    switch (type) {
+        case SensorType::TEMPERATURE:
+            if (packet.holds<struct sensor_packet_temperature>())
+                json += ",\"value\":" + jsonNumber(packet.temperature());
+            break;
+        case SensorType::HUMIDITY:
+            if (packet.holds<struct sensor_packet_humidity>())
+                json += ",\"value\":" + jsonNumber(packet.humidity());
+            break;
+        case SensorType::CO2:
+            if (packet.holds<struct sensor_packet_co2>())
+                json += ",\"value\":" + std::to_string(packet.co2());
+            break;
+        case SensorType::LIGHT:
+            if (packet.holds<struct sensor_packet_light>())
+                json += ",\"target_state\":" + std::to_string(packet.lightState());
+            break;
+        case SensorType::RGB_LIGHT:
+            if (packet.holds<struct sensor_packet_rgb_light>())
+                json += ",\"red\":" + std::to_string(packet.red()) +
+                        ",\"green\":" + std::to_string(packet.green()) +
+                        ",\"blue\":" + std::to_string(packet.blue());
+            break;
+        case SensorType::LICHTKRANT:
+            if (packet.holds<struct sensor_packet_lichtkrant>()) {
+                std::string text = packet.text();
+                json += ",\"text\":\"" + jsonEscape(text.data(), text.size()) + "\"";
+            }
+            break;
+        default:
+            break;
+    }
+
+    return json + "}";
+}
+
+/**
+ * @brief A value of a flat JSON object, kept as text until it is known what it should be.
+ */
+struct JsonValue {
+    bool is_string;
+    std::string text;
+};
+
+/**
+ * @brief Minimal parser for the flat JSON objects sent as actuator writes.
+ */
+class FlatJsonParser {
+   private:
+    const char *cursor;
+    const char *end;
+
+    void skipSpace() {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' ||
+                                *cursor == '\n'))
+            ++cursor;
+    }
+
+    void expect(char c) {
+        skipSpace();
+        if (cursor >= end || *cursor != c)
+            throw std::invalid_argument(std::string("Expected '") + c + "' in the JSON body");
+        ++cursor;
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string text;
+        while (cursor < end && *cursor != '"') {
+            char c = *cursor++;
+            if (c != '\\') {
+                text += c;
+                continue;
+            }
+
+            if (cursor >= end) break;
+            switch (char escaped = *cursor++) {
+                case '"':
+                case '\\':
+                case '/':
+                    text += escaped;
+                    break;
+                case 'n':
+                    text += '\n';
+                    break;
+                case 't':
+                    text += '\t';
+                    break;
+                case 'u': {
+                    // only ASCII fits in the packets
+                    if (end - cursor < 4) throw std::invalid_argument("Invalid escape in string");
+                    std::string digits(cursor, cursor + 4);
+                    char *digits_end;
+                    unsigned long code = strtoul(digits.c_str(), &digits_end, 16);
+                    if (*digits_end != '\0' || code >= 0x80)
+                        throw std::invalid_argument("Only ASCII text can be written");
+                    text += (char)code;
+                    cursor += 4;
+                    break;
+                }
+                default:
+                    throw std::invalid_argument("Invalid escape in string");
+            }
+        }
+        expect('"');
+        return text;
+    }
+
+    struct JsonValue parseValue() {
+        skipSpace();
+        if (cursor < end && *cursor == '"') return {true, parseString()};
+
+        const char *start = cursor;
+        while (cursor < end && *cursor != ',' && *cursor != '}' && *cursor != ' ' &&
+               *cursor != '\t' && *cursor != '\r' && *cursor != '\n')
+            ++cursor;
+        if (cursor == start) throw std::invalid_argument("Missing value in the JSON body");
+        return {false, std::string(start, cursor)};
+    }
+
+   public:
+    FlatJsonParser(const char *text, size_t length) : cursor(text), end(text + length) {}
+
+    std::map<std::string, struct JsonValue> parseObject() {
+        std::map<std::string, struct JsonValue> fields;
+        expect('{');
+        skipSpace();
+        if (cursor < end && *cursor == '}') {
+            ++cursor;
+        } else {
+            while (true) {
+                std::string key = parseString();
+                expect(':');
+                fields[key] = parseValue();
+                skipSpace();
+                if (cursor < end && *cursor == ',') {
+                    ++cursor;
+                    continue;
+                }
+                expect('}');
+                break;
+            }
+        }
+
+        skipSpace();
+        if (cursor != end) throw std::invalid_argument("Trailing data after the JSON body");
+        return fields;
+    }
+};
+
+void parseSensorWrite(const char *body, size_t length, uint16_t sensor_id,
+                      struct sensor_packet &packet) {
+    std::map<std::string, struct JsonValue> fields = FlatJsonParser(body, length).parseObject();
+
+    auto integerField = [&fields](const char *name, long max) -> uint8_t {
+        auto found = fields.find(name);
+        if (found == fields.end() || found->second.is_string)
+            throw std::invalid_argument(std::string("Missing number \"") + name + "\"");
+
+        const std::string &text = found->second.text;
+        if (text == "true") return 1;
+        if (text == "false") return 0;
+
+        char *number_end;
+        long value = strtol(text.c_str(), &number_end, 10);
+        if (*number_end != '\0' || value < 0 || value > max)
+            throw std::invalid_argument(std::string("Invalid value for \"") + name + "\"");
+        return value;
+    };
+
+    auto type = fields.find("type");
+    if (type == fields.end() || !type->second.is_string)
+        throw std::invalid_argument("Missing sensor \"type\"");
+
+    memset(&packet, 0, sizeof(packet));
+    packet.header.ptype = PacketType::DASHBOARD_POST;
+
+    if (type->second.text == "light") {
+        packet.header.length = sizeof(struct sensor_packet_light);
+        packet.data.light.metadata.sensor_type = SensorType::LIGHT;
+        packet.data.light.target_state = integerField("target_state", 1);
+    } else if (type->second.text == "rgb_light") {
+        packet.header.length = sizeof(struct sensor_packet_rgb_light);
+        packet.data.rgb_light.metadata.sensor_type = SensorType::RGB_LIGHT;
+        packet.data.rgb_light.red_state = integerField("red", UINT8_MAX);
+        packet.data.rgb_light.green_state = integerField("green", UINT8_MAX);
+        packet.data.rgb_light.blue_state = integerField("blue", UINT8_MAX);
+    } else if (type->second.text == "lichtkrant") {
+        auto text = fields.find("text");
+        if (text == fields.end() || !text->second.is_string ||
+            text->second.text.size() > sizeof(packet.data.lichtkrant.text))
+            throw std::invalid_argument("Missing or too long \"text\"");
+
+        packet.header.length = sizeof(struct sensor_packet_lichtkrant);
+        packet.data.lichtkrant.metadata.sensor_type = SensorType::LICHTKRANT;
+        memcpy(packet.data.lichtkrant.text, text->second.text.data(), text->second.text.size());
+    } else {
+        throw std::invalid_argument("Sensors of type \"" + type->second.text +
+                                    "\" cannot be written");
+    }
+
+    packet.data.generic.metadata.sensor_id = sensor_id & 0xFF;
+}
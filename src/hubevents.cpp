@@ -0,0 +1,62 @@
+/**
+ * @file hubevents.cpp
+ * @brief Implementation of the HubEventDispatcher class.
+ * @author Daan Breur
+ */
+
+#include "hubevents.h"
+
+#include <stdexcept>
+
+HubEventDispatcher::HubEventDispatcher(size_t capacity)
+    : queue(capacity), running(false), posted(0), dispatched(0), dropped(0) {}
+
+HubEventDispatcher::~HubEventDispatcher() { stop(); }
+
+void HubEventDispatcher::start(std::function<void(const struct sensor_packet &)> new_handler) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running) throw std::logic_error("The hub event dispatcher is already running");
+
+    handler = std::move(new_handler);
+    running = true;
+    thread = std::thread(&HubEventDispatcher::dispatchLoop, this);
+}
+
+void HubEventDispatcher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    condition.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+void HubEventDispatcher::post(const struct sensor_packet &event) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++posted;
+        if (!queue.pushOverwrite(event)) ++dropped;
+    }
+    condition.notify_one();
+}
+
+void HubEventDispatcher::dispatchLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [this] { return !running || !queue.empty(); });
+
+        struct sensor_packet event;
+        if (!queue.pop(event)) return;
+
+        // processed without the lock, so the hubs can keep posting meanwhile
+        lock.unlock();
+        handler(event);
+        lock.lock();
+        ++dispatched;
+    }
+}
+
+struct HubEventStats HubEventDispatcher::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {posted, dispatched, dropped, queue.size()};
+}
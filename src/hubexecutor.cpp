@@ -0,0 +1,72 @@
+/**
+ * @file hubexecutor.cpp
+ * @brief Implementation of the HubExecutor class.
+ * @author Daan Breur
+ */
+
+#include "hubexecutor.h"
+
+#include <stdexcept>
+
+HubExecutor::HubExecutor(size_t capacity)
+    : queue(capacity), running(false), submitted(0), completed(0), rejected(0), busy(0) {}
+
+HubExecutor::~HubExecutor() { stop(); }
+
+void HubExecutor::start(size_t thread_count, std::function<void(void *transaction)> run) {
+    if (thread_count == 0) throw std::invalid_argument("The hub executor needs a thread");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running) throw std::logic_error("The hub executor is already running");
+
+    handler = std::move(run);
+    running = true;
+    for (size_t i = 0; i < thread_count; ++i) threads.emplace_back(&HubExecutor::runLoop, this);
+}
+
+void HubExecutor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    condition.notify_all();
+    for (std::thread &thread : threads) thread.join();
+    threads.clear();
+}
+
+bool HubExecutor::submit(void *transaction) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running || queue.size() >= queue.getCapacity()) {
+            ++rejected;
+            return false;
+        }
+        queue.pushOverwrite(transaction);
+        ++submitted;
+    }
+    condition.notify_one();
+    return true;
+}
+
+void HubExecutor::runLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [this] { return !running || !queue.empty(); });
+
+        void *transaction;
+        if (!queue.pop(transaction)) return;
+
+        // run without the lock, so the workers can keep submitting meanwhile
+        ++busy;
+        lock.unlock();
+        handler(transaction);
+        lock.lock();
+        --busy;
+        ++completed;
+    }
+}
+
+struct HubExecutorStats HubExecutor::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {threads.size(), submitted, completed, rejected, queue.size(), busy};
+}
@@ -0,0 +1,243 @@
+/**
+ * @file hubrouter.cpp
+ * @brief Implementation of the HubRouter class.
+ * @author Daan Breur
+ */
+
+#include "hubrouter.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * @brief Parses a decimal number that makes up the whole string.
+ * @return false if the string is empty, not a number or larger than max.
+ */
+static bool parseNumber(const std::string &text, unsigned long max, unsigned long &value) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) return false;
+
+    value = strtoul(text.c_str(), nullptr, 10);
+    return value <= max;
+}
+
+HubRouter::HubRouter()
+    : queue_capacity(I2C_QUEUE_CAPACITY),
+      aging(HUB_AGING_MS),
+      max_concurrency(HUB_MAX_CONCURRENCY),
+      breaker_threshold(BREAKER_FAILURE_THRESHOLD),
+      breaker_open_time(BREAKER_OPEN_MS),
+      capture(nullptr),
+      started(false) {
+    memset(routes, NO_HUB, sizeof(routes));
+}
+
+size_t HubRouter::addHub(const std::string &ip, int port) {
+    if (started) throw std::logic_error("Cannot add hubs while running");
+    if (hubs.size() >= MAX_HUBS) throw std::invalid_argument("Too many I2C hubs");
+
+    auto client = std::make_unique<I2CClient>(queue_capacity);
+    client->setup(ip, port);
+    client->setCapture(capture);
+    client->setEventHandler(event_handler);
+    client->setBreaker(breaker_threshold, breaker_open_time);
+
+    auto scheduler = std::make_unique<HubScheduler>();
+    scheduler->setAging(aging);
+    scheduler->setMaxConcurrency(max_concurrency);
+
+    hubs.push_back({ip, port, std::move(client), std::move(scheduler)});
+    return hubs.size() - 1;
+}
+
+void HubRouter::route(uint8_t first, uint8_t last, size_t hub) {
+    if (first > last || last > MAX_HUB_SENSOR_ID)
+        throw std::invalid_argument("Invalid sensor ID range for a hub");
+    if (hub >= hubs.size()) throw std::invalid_argument("No such I2C hub");
+
+    memset(routes + first, hub, last - first + 1);
+}
+
+void HubRouter::parseTable(const std::string &table) {
+    if (started) throw std::logic_error("Cannot change the routing table while running");
+
+    struct HubSpec {
+        std::string ip;
+        int port;
+    };
+    std::vector<struct HubSpec> specs;
+    uint8_t new_routes[MAX_HUB_SENSOR_ID + 1];
+    memset(new_routes, NO_HUB, sizeof(new_routes));
+
+    std::stringstream entries(table);
+    std::string entry;
+    while (std::getline(entries, entry, ';')) {
+        if (entry.empty()) continue;
+        if (specs.size() >= MAX_HUBS) throw std::invalid_argument("Too many I2C hubs");
+
+        size_t equals = entry.find('=');
+        size_t colon = entry.rfind(':', equals);
+        unsigned long port;
+        if (equals == std::string::npos || colon == std::string::npos ||
+            !parseNumber(entry.substr(colon + 1, equals - colon - 1), 65535, port) || port == 0)
+            throw std::invalid_argument("Expected ip:port=ids in the hub routing table");
+
+        std::string ip = entry.substr(0, colon);
+        if (INADDR_NONE == inet_addr(ip.c_str()))
+            throw std::invalid_argument("Invalid hub IP address in the hub routing table");
+
+        std::stringstream ranges(entry.substr(equals + 1));
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            size_t dash = range.find('-');
+            unsigned long first, last;
+            if (!parseNumber(range.substr(0, dash), MAX_HUB_SENSOR_ID, first) ||
+                !parseNumber(dash == std::string::npos ? range : range.substr(dash + 1),
+                             MAX_HUB_SENSOR_ID, last) ||
+                first > last)
+                throw std::invalid_argument("Invalid sensor ID range in the hub routing table");
+
+            for (unsigned long id = first; id <= last; ++id) {
+                if (new_routes[id] != NO_HUB)
+                    throw std::invalid_argument("Sensor routed to more than one hub");
+                new_routes[id] = specs.size();
+            }
+        }
+
+        specs.push_back({ip, (int)port});
+    }
+
+    if (specs.empty()) throw std::invalid_argument("The hub routing table is empty");
+
+    hubs.clear();
+    for (const struct HubSpec &spec : specs) addHub(spec.ip, spec.port);
+    memcpy(routes, new_routes, sizeof(routes));
+}
+
+uint8_t HubRouter::hubIndex(uint8_t sensor_id) const {
+    return sensor_id > MAX_HUB_SENSOR_ID ? NO_HUB : routes[sensor_id];
+}
+
+I2CClient &HubRouter::hubFor(uint8_t sensor_id) {
+    uint8_t index = hubIndex(sensor_id);
+    if (index == NO_HUB) throw std::runtime_error("Sensor is not routed to any I2C hub");
+
+    return *hubs[index].client;
+}
+
+HubScheduler &HubRouter::schedulerFor(uint8_t sensor_id) {
+    uint8_t index = hubIndex(sensor_id);
+    if (index == NO_HUB) throw std::runtime_error("Sensor is not routed to any I2C hub");
+
+    return *hubs[index].scheduler;
+}
+
+size_t HubRouter::size() const { return hubs.size(); }
+
+I2CClient &HubRouter::hub(size_t index) { return *hubs.at(index).client; }
+
+HubScheduler &HubRouter::scheduler(size_t index) { return *hubs.at(index).scheduler; }
+
+std::string HubRouter::hubAddress(size_t index) const {
+    const struct Hub &hub = hubs.at(index);
+    return hub.ip + ":" + std::to_string(hub.port);
+}
+
+void HubRouter::start() {
+    for (struct Hub &hub : hubs) hub.client->start();
+    started = true;
+}
+
+void HubRouter::closeConnections() {
+    for (struct Hub &hub : hubs) hub.client->closeConnection();
+    started = false;
+}
+
+std::vector<int> HubRouter::releaseConnections() {
+    std::vector<int> fds;
+    for (struct Hub &hub : hubs) fds.push_back(hub.client->releaseConnection());
+    started = false;
+    return fds;
+}
+
+void HubRouter::adoptConnections(const std::vector<int> &fds) {
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (i < hubs.size())
+            hubs[i].client->adoptConnection(fds[i]);
+        else if (fds[i] >= 0)
+            close(fds[i]);
+    }
+}
+
+void HubRouter::setQueueCapacity(size_t new_capacity) {
+    if (new_capacity == 0) throw std::invalid_argument("Queue capacity must not be zero");
+    if (started) throw std::logic_error("Cannot resize the queues while running");
+
+    for (struct Hub &hub : hubs) hub.client->setQueueCapacity(new_capacity);
+    queue_capacity = new_capacity;
+}
+
+void HubRouter::setSchedulerAging(std::chrono::milliseconds new_aging) {
+    for (struct Hub &hub : hubs) hub.scheduler->setAging(new_aging);
+    aging = new_aging;
+}
+
+void HubRouter::setBreaker(size_t threshold, std::chrono::milliseconds open_time) {
+    for (struct Hub &hub : hubs) hub.client->setBreaker(threshold, open_time);
+    breaker_threshold = threshold;
+    breaker_open_time = open_time;
+}
+
+void HubRouter::setSchedulerConcurrency(size_t new_max_concurrency) {
+    if (new_max_concurrency == 0) throw std::invalid_argument("Hub concurrency must not be zero");
+    for (struct Hub &hub : hubs) hub.scheduler->setMaxConcurrency(new_max_concurrency);
+    max_concurrency = new_max_concurrency;
+}
+
+void HubRouter::setCapture(CaptureWriter *writer) {
+    for (struct Hub &hub : hubs) hub.client->setCapture(writer);
+    capture = writer;
+}
+
+void HubRouter::setEventHandler(std::function<void(const struct sensor_packet &)> handler) {
+    for (struct Hub &hub : hubs) hub.client->setEventHandler(handler);
+    event_handler = std::move(handler);
+}
+
+struct PoolStats HubRouter::getQueueStats() const {
+    struct PoolStats total = {0};
+    for (const struct Hub &hub : hubs) {
+        struct PoolStats stats = hub.client->getQueueStats();
+        total.capacity += stats.capacity;
+        total.in_use += stats.in_use;
+        total.high_water += stats.high_water;
+        total.object_size = stats.object_size;
+        total.allocations += stats.allocations;
+        total.failures += stats.failures;
+        total.reserved_bytes += stats.reserved_bytes;
+    }
+    return total;
+}
+
+struct HubSchedulerStats HubRouter::getSchedulerStats() const {
+    struct HubSchedulerStats total = {};
+    for (const struct Hub &hub : hubs) {
+        struct HubSchedulerStats stats = hub.scheduler->getStats();
+        for (size_t index = 0; index < HUB_PRIORITY_CLASSES; ++index) {
+            struct HubClassStats &sum = total.classes[index];
+            const struct HubClassStats &part = stats.classes[index];
+            sum.granted += part.granted;
+            sum.aged += part.aged;
+            sum.waiting += part.waiting;
+            sum.total_wait_us += part.total_wait_us;
+            sum.max_wait_us = std::max(sum.max_wait_us, part.max_wait_us);
+            sum.expired += part.expired;
+        }
+    }
+    return total;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file hubscheduler.cpp
+ * @brief Implementation of the HubScheduler class.
+ * @author Daan Breur
+ */
+
+#include "hubscheduler.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include "latency.h"
+
+HubPriority hubPriorityFor(const PacketView &packet) {
+    if (packet.type() == PacketType::DASHBOARD_POST) return HubPriority::ACTUATION;
+
+    switch (packet.sensorType()) {
+        case SensorType::TEMPERATURE:
+        case SensorType::CO2:
+        case SensorType::HUMIDITY:
+        case SensorType::PRESSURE:
+            return HubPriority::BACKGROUND;
+        default:
+            return HubPriority::INTERACTIVE;
+    }
+}
+
+HubScheduler::HubScheduler()
+    : in_flight(0),
+      aging(std::chrono::milliseconds(HUB_AGING_MS)),
+      limit(1),
+      max_limit(HUB_MAX_CONCURRENCY),
+      smoothed_rtt(std::chrono::steady_clock::duration::zero()),
+      min_rtt(std::chrono::steady_clock::duration::zero()),
+      window_min_rtt(std::chrono::steady_clock::duration::zero()),
+      window_samples(0),
+      samples(0),
+      backoffs(0) {
+    memset(stats, 0, sizeof(stats));
+}
+
+HubScheduler::Slot::Slot(HubScheduler &scheduler, HubPriority priority,
+                         std::chrono::steady_clock::time_point deadline)
+    : scheduler(scheduler), exceptions(std::uncaught_exceptions()), done(false) {
+    if (!scheduler.acquire(priority, deadline))
+        throw std::runtime_error("I2C hub link busy past the request deadline");
+    granted = std::chrono::steady_clock::now();
+}
+
+HubScheduler::Slot::~Slot() {
+    // unwinding past a request that never got its answer means the hub failed it
+    if (!done && std::uncaught_exceptions() > exceptions)
+        scheduler.sample(std::chrono::steady_clock::duration::zero(), true);
+    scheduler.release();
+}
+
+void HubScheduler::Slot::completed() {
+    if (done) return;
+    done = true;
+
+    auto rtt = std::chrono::steady_clock::now() - granted;
+    Latency::record(LatencyStage::HUB_ROUND_TRIP,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(rtt).count());
+    scheduler.sample(rtt, false);
+}
+
+bool HubScheduler::acquire(HubPriority priority, std::chrono::steady_clock::time_point deadline) {
+    size_t index = (size_t)priority;
+    auto since = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    bool idle = in_flight < (size_t)limit &&
+                std::all_of(std::begin(queues), std::end(queues),
+                            [](const std::deque<struct Waiter *> &queue) { return queue.empty(); });
+    if (idle) {
+        ++in_flight;
+        record(priority, std::chrono::steady_clock::duration::zero(), false);
+        return true;
+    }
+
+    struct Waiter waiter = {since, false, false};
+    queues[index].push_back(&waiter);
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+        condition.wait(lock, [&waiter] { return waiter.granted; });
+    } else if (!condition.wait_until(lock, deadline, [&waiter] { return waiter.granted; })) {
+        std::deque<struct Waiter *> &queue = queues[index];
+        queue.erase(std::find(queue.begin(), queue.end(), &waiter));
+        ++stats[index].expired;
+        return false;
+    }
+
+    record(priority, std::chrono::steady_clock::now() - since, waiter.aged);
+    return true;
+}
+
+void HubScheduler::release() {
+    bool granted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --in_flight;
+        granted = grantNext();
+    }
+    if (granted) condition.notify_all();
+}
+
+bool HubScheduler::grantNext() {
+    auto now = std::chrono::steady_clock::now();
+    bool granted = false;
+
+    while (in_flight < (size_t)limit) {
+        // the most urgent head of queue wins; aging lowers the class, arrival order breaks ties
+        int best = -1;
+        size_t best_class = 0;
+        for (size_t index = 0; index < HUB_PRIORITY_CLASSES; ++index) {
+            if (queues[index].empty()) continue;
+
+            const struct Waiter &head = *queues[index].front();
+            size_t promotion = aging.count() > 0 ? (now - head.since) / aging : 0;
+            size_t effective = index - std::min(index, promotion);
+
+            if (best < 0 || effective < best_class ||
+                (effective == best_class && head.since < queues[best].front()->since)) {
+                best = index;
+                best_class = effective;
+            }
+        }
+        if (best < 0) break;
+
+        struct Waiter &waiter = *queues[best].front();
+        waiter.granted = true;
+        waiter.aged = best_class < (size_t)best;
+        queues[best].pop_front();
+        ++in_flight;
+        granted = true;
+    }
+    return granted;
+}
+
+void HubScheduler::sample(std::chrono::steady_clock::duration rtt, bool failed) {
+    auto now = std::chrono::steady_clock::now();
+    bool granted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed) {
+            backOff(now);
+            return;
+        }
+
+        ++samples;
+        smoothed_rtt = samples == 1 ? rtt : smoothed_rtt + (rtt - smoothed_rtt) / 8;
+        if (min_rtt.count() == 0 || rtt < min_rtt) min_rtt = rtt;
+        window_min_rtt = window_samples == 0 ? rtt : std::min(window_min_rtt, rtt);
+        if (++window_samples >= HUB_RTT_WINDOW) {
+            min_rtt = window_min_rtt;
+            window_samples = 0;
+        }
+
+        if (smoothed_rtt > min_rtt * HUB_RTT_TOLERANCE) {
+            backOff(now);
+        } else if (in_flight >= (size_t)limit) {
+            // only a limit that is actually reached has earned a raise, by one per round trip
+            limit = std::min((double)max_limit, limit + 1 / limit);
+        }
+        granted = grantNext();
+    }
+    if (granted) condition.notify_all();
+}
+
+void HubScheduler::backOff(std::chrono::steady_clock::time_point now) {
+    if (now < next_backoff) return;
+
+    limit = std::max(1.0, limit * HUB_BACKOFF_RATIO);
+    next_backoff = now + smoothed_rtt;
+    ++backoffs;
+}
+
+void HubScheduler::record(HubPriority priority, std::chrono::steady_clock::duration waited,
+                          bool aged) {
+    struct HubClassStats &entry = stats[(size_t)priority];
+    uint64_t waited_us = std::chrono::duration_cast<std::chrono::microseconds>(waited).count();
+    Latency::record(LatencyStage::HUB_QUEUE_WAIT,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+
+    ++entry.granted;
+    if (aged) ++entry.aged;
+    entry.total_wait_us += waited_us;
+    entry.max_wait_us = std::max(entry.max_wait_us, waited_us);
+}
+
+void HubScheduler::setAging(std::chrono::milliseconds aging) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->aging = aging;
+}
+
+void HubScheduler::setMaxConcurrency(size_t max_limit) {
+    if (max_limit == 0) throw std::invalid_argument("Hub concurrency must not be zero");
+
+    bool granted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->max_limit = max_limit;
+        limit = std::min(limit, (double)max_limit);
+        granted = grantNext();
+    }
+    if (granted) condition.notify_all();
+}
+
+struct HubSchedulerStats HubScheduler::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    struct HubSchedulerStats result;
+    memcpy(result.classes, stats, sizeof(stats));
+    for (size_t index = 0; index < HUB_PRIORITY_CLASSES; ++index)
+        result.classes[index].waiting = queues[index].size();
+    return result;
+}
+
+struct HubConcurrencyStats HubScheduler::getConcurrencyStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {(size_t)limit,
+            max_limit,
+            in_flight,
+            (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(smoothed_rtt).count(),
+            (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(min_rtt).count(),
+            samples,
+            backoffs};
+}
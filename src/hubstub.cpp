@@ -0,0 +1,212 @@
+/**
+ * @file hubstub.cpp
+ * @brief Implementation of HubStub class.
+ * @author Erynn Scholtes
+ */
+
+#include "hubstub.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "packets.h"
+
+#define BUFFER_SIZE 1024
+
+HubStub::HubStub()
+    : listen_fd(-1), client_fd(-1), port(0), running(false), drop_clients(false), request_count(0),
+      silent(false) {
+    memset(states, 0, sizeof(states));
+}
+
+HubStub::~HubStub() { stop(); }
+
+void HubStub::start(int listen_port) {
+    if (listen_port < 0 || listen_port > 65535) throw std::invalid_argument("Invalid port number");
+
+    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket() failed");
+        throw std::runtime_error("socket() failed");
+    }
+
+    const int enable_opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable_opt, sizeof(enable_opt));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(listen_port);
+
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listen_fd, 1) < 0) {
+        perror("bind()/listen() failed");
+        close(listen_fd);
+        listen_fd = -1;
+        throw std::runtime_error("Could not set up hub stub listening socket");
+    }
+
+    socklen_t address_length = sizeof(address);
+    getsockname(listen_fd, (struct sockaddr *)&address, &address_length);
+    port = ntohs(address.sin_port);
+
+    running = true;
+    serve_thread = std::thread(&HubStub::serveLoop, this);
+}
+
+void HubStub::stop() {
+    running = false;
+    if (serve_thread.joinable()) serve_thread.join();
+
+    if (client_fd >= 0) dropClient();
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+void HubStub::serveLoop() {
+    uint8_t buffer[BUFFER_SIZE];
+    size_t buffered = 0;
+
+    while (running) {
+        if (drop_clients.exchange(false) && client_fd >= 0) {
+            dropClient();
+            buffered = 0;
+        }
+
+        // only one bridge at a time, like the real hub
+        struct pollfd pf;
+        pf.fd = client_fd >= 0 ? (int)client_fd : listen_fd;
+        pf.events = POLLIN;
+
+        if (poll(&pf, 1, 50) < 1) continue;
+
+        if (client_fd < 0) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) client_fd = fd;
+            continue;
+        }
+
+        ssize_t amount_read = recv(client_fd, buffer + buffered, sizeof(buffer) - buffered, 0);
+        if (amount_read <= 0) {
+            dropClient();
+            buffered = 0;
+            continue;
+        }
+        buffered += amount_read;
+
+        size_t offset = 0;
+        while (offset + sizeof(struct sensor_header) <= buffered) {
+            const struct sensor_header *head = (const struct sensor_header *)&buffer[offset];
+            size_t packet_length = sizeof(struct sensor_header) + head->length;
+            if (offset + packet_length > buffered) break;
+
+            struct sensor_packet packet = {0};
+            memcpy(&packet, &buffer[offset], std::min(packet_length, sizeof(packet)));
+            ++request_count;
+            if (!silent) handlePacket(packet);
+
+            offset += packet_length;
+        }
+
+        memmove(buffer, buffer + offset, buffered - offset);
+        buffered -= offset;
+    }
+}
+
+void HubStub::dropClient() {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    close(client_fd.exchange(-1));
+}
+
+void HubStub::handlePacket(const struct sensor_packet &packet) {
+    uint8_t sensor_id = packet.data.generic.metadata.sensor_id;
+
+    switch (packet.header.ptype) {
+        case PacketType::DASHBOARD_GET: {
+            struct sensor_packet response;
+            bool verbatim = false;
+            {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                if (!scripted[sensor_id].empty()) {
+                    response = scripted[sensor_id].front();
+                    scripted[sensor_id].pop_front();
+                    verbatim = true;
+                } else {
+                    response = states[sensor_id];
+                }
+            }
+
+            if (!verbatim) {
+                if (response.header.length == 0) {
+                    // never set; answer with an empty reading of the requested type
+                    response = packet;
+                    response.header.length = sizeof(struct sensor_packet_generic);
+                }
+                response.header.ptype = PacketType::DASHBOARD_RESPONSE;
+            }
+
+            std::lock_guard<std::mutex> lock(send_mutex);
+            send(client_fd, &response, sizeof(struct sensor_header) + response.header.length,
+                 MSG_NOSIGNAL);
+            break;
+        }
+
+        case PacketType::DASHBOARD_POST:
+        case PacketType::DATA: {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            states[sensor_id] = packet;
+            states[sensor_id].header.ptype = PacketType::DATA;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+uint16_t HubStub::getPort() const { return port; }
+
+void HubStub::setState(const struct sensor_packet &packet) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    states[packet.data.generic.metadata.sensor_id] = packet;
+}
+
+void HubStub::queueResponse(const struct sensor_packet &packet) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    scripted[packet.data.generic.metadata.sensor_id].push_back(packet);
+}
+
+struct sensor_packet HubStub::getState(uint8_t sensor_id) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return states[sensor_id];
+}
+
+bool HubStub::emit(const struct sensor_packet &packet) {
+    return emitRaw(&packet, sizeof(struct sensor_header) + packet.header.length);
+}
+
+bool HubStub::emitRaw(const void *data, size_t length) {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    int fd = client_fd;
+    if (fd < 0) return false;
+
+    return send(fd, data, length, MSG_NOSIGNAL) >= 0;
+}
+
+void HubStub::disconnectClients() { drop_clients = true; }
+
+bool HubStub::hasClient() const { return client_fd >= 0; }
+
+uint64_t HubStub::getRequestCount() const { return request_count; }
+
+void HubStub::setSilent(bool new_silent) { silent = new_silent; }
@@ -8,29 +8,64 @@
 #include "i2cclient.h"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <string.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdio>
 #include <exception>
-#include <iostream>
-#include <queue>
+#include <random>
 #include <stdexcept>
 
+#include "latency.h"
 #include "packets.h"
+#include "packetview.h"
+#include "tracer.h"
 
 #define BUFFER_SIZE 1024
 
-I2CClient::I2CClient() : client_fd(-1), connected(false), running(false) {
+/**
+ * @brief Time to wait for the hub to accept a connection before giving up on the attempt.
+ */
+#define CONNECT_TIMEOUT_MS 3000
+
+/**
+ * @brief Backoff before the first reconnect attempt; doubles after every failed attempt.
+ */
+#define RECONNECT_BACKOFF_INITIAL_MS 250
+
+/**
+ * @brief Upper limit for the reconnect backoff.
+ */
+#define RECONNECT_BACKOFF_MAX_MS 30000
+
+I2CClient::I2CClient(size_t queue_capacity)
+    : client_fd(-1),
+      connected(false),
+      running(false),
+      read_packets_queue(queue_capacity),
+      timeouts(0),
+      late_responses(0),
+      capture(nullptr),
+      ever_connected(false),
+      reconnects(0),
+      failed_attempts(0),
+      events(0),
+      down_since(std::chrono::steady_clock::now()),
+      total_downtime(0) {
     memset(&hub_address, 0, sizeof(hub_address));
+    memset(outstanding_reads, 0, sizeof(outstanding_reads));
 }
 
 I2CClient::~I2CClient() {
-    if (connected) closeConnection();
+    if (running || receive_thread.joinable()) closeConnection();
 }
 
 // first unlocks the mutex passed, then continues in the while loop
@@ -44,11 +79,17 @@ I2CClient::~I2CClient() {
 
 void I2CClient::receiveLoop() {
     uint8_t receive_buffer[BUFFER_SIZE] = {0};
+    // bytes of a packet the hub split across reads, kept until the rest arrives
+    size_t buffered = 0;
     struct pollfd pf;
 
     pf.fd = client_fd;
     pf.events = POLLIN;
 
+    // also set on a connection taken over from another process, setting it twice is harmless
+    enableReceiveTimestamps(client_fd);
+    alignas(struct cmsghdr) uint8_t control[RECEIVE_TIMESTAMP_CONTROL_SIZE];
+
     while (true == running && true == connected) {
         // TODO: revise error handling within the loop;
         // maybe always stop loop on error, instead of just continuing?
@@ -70,69 +111,149 @@ void I2CClient::receiveLoop() {
         // if we get here, there is guaranteed to be readable data.
         // either this data is because the other end disconnected, or because there
         // is proper data to read from the wire
-        int amount_read = recv(pf.fd, receive_buffer, BUFFER_SIZE, MSG_DONTWAIT);
+        struct iovec iov = {receive_buffer + buffered, BUFFER_SIZE - buffered};
+        struct msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        int amount_read = recvmsg(pf.fd, &message, MSG_DONTWAIT);
 
         if (amount_read == -1) {
             // error occured, errno set
-            perror("recv() failed");
+            perror("recvmsg() failed");
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) connected = false;
 
             THREAD_RELINQUISH(receive_mutex);
         } else if (amount_read == 0) {
-            // socket disconnected
+            // socket disconnected, connectionLoop() takes it from here
             connected = false;
-            running = false;
-            client_fd = -1;
 
             THREAD_RELINQUISH(receive_mutex);
         }
 
         receive_mutex.unlock();
 
-        std::cout << "Received " << amount_read << " bytes from Raspberry PI I2C controller."
-                  << std::endl;
+        if (capture)
+            capture->record(CaptureEvent::HUB_IN, pf.fd, receive_buffer + buffered, amount_read);
+
+#ifndef WEMOS_LOW_FOOTPRINT
+        // formatting every byte is more than small gateway hardware can spare, the capture has them
+        printf("Received %d bytes from Raspberry PI I2C controller.\n", amount_read);
 
         for (int i = 0; i < amount_read; ++i) {
-            printf("%02X ", receive_buffer[i]);
+            printf("%02X ", receive_buffer[buffered + i]);
         }
         printf("\n");
+#endif
+
+        buffered += amount_read;
 
         {
             size_t buffer_offset = 0;
 
-            do {
-                const struct sensor_header *head =
-                    (const struct sensor_header *)&receive_buffer[buffer_offset];
-                uint8_t length = head->length;
-                uint8_t p_type = (uint8_t)head->ptype;
+            while (buffer_offset + sizeof(struct sensor_header) <= buffered) {
+                PacketView view(&receive_buffer[buffer_offset], buffered - buffer_offset);
 
-                uint8_t s_type = receive_buffer[sizeof(*head)];
+                // the rest of the packet arrives with a later read
+                if (!view.complete()) break;
 
-                if ((buffer_offset + sizeof(*head) + length) > amount_read) {
-                    // oopsie woopsie; incomplete packet from RPI
-                    printf(
-                        "We received an incomplete packet from the Raspberry Pi I2C controller; "
-                        "Discarding...\n");
-                    break;
-                }
-
-                struct sensor_packet packet = {0};
-                int to_copy = sizeof(*head) + length;
-                if (to_copy > sizeof(packet)) to_copy = sizeof(packet);
-                memcpy(&packet, receive_buffer + buffer_offset, to_copy);
+                struct sensor_packet packet;
+                view.frameOnly().copyTo(packet);
 
                 printf("AAAAAAAAAAAAA\n");
                 queue_mutex.lock();
-                read_packets_queue.push(packet);
-                queue_mutex.unlock();
-                queue_condition.notify_one();  // maybe switch this with the line before if issues
-                                               // occur - Erynn
+                uint8_t &outstanding = outstanding_reads[view.sensorId()];
+                bool unsolicited = event_handler && view.type() == PacketType::DATA && !outstanding;
+                if (unsolicited) {
+                    queue_mutex.unlock();
+
+                    {
+                        std::lock_guard<std::mutex> lock(stats_mutex);
+                        ++events;
+                    }
+                    event_handler(packet);
+                } else {
+                    if (outstanding) --outstanding;
+                    if (!read_packets_queue.pushOverwrite(packet))
+                        printf("I2C hub queue full, dropped the oldest packet\n");
+                    queue_mutex.unlock();
+                    // several reads may be waiting, each for the response of its own sensor
+                    queue_condition.notify_all();
+                }
+
+                buffer_offset += view.frameLength();
+            }
 
-                buffer_offset += sizeof(*head) + length;
-            } while (buffer_offset + sizeof(struct sensor_header) <= amount_read);
+            // a packet is never longer than the buffer, so there is always room for its rest
+            buffered -= buffer_offset;
+            if (buffered > 0 && buffer_offset > 0)
+                memmove(receive_buffer, receive_buffer + buffer_offset, buffered);
         }
     }
+}
+
+void I2CClient::connectionLoop() {
+    std::minstd_rand jitter(std::random_device{}());
+    unsigned int backoff_ms = RECONNECT_BACKOFF_INITIAL_MS;
+
+    while (running) {
+        if (!connected && !openConnection()) {
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                ++failed_attempts;
+            }
+
+            // "equal jitter": wait somewhere between half and all of the current backoff, so a
+            // room full of bridges does not hammer a rebooting hub in lockstep
+            unsigned int delay_ms = backoff_ms / 2 + jitter() % (backoff_ms / 2 + 1);
+            printf("Retrying connection to I2C hub in %u ms\n", delay_ms);
+
+            std::unique_lock<std::mutex> lock(backoff_mutex);
+            backoff_condition.wait_for(lock, std::chrono::milliseconds(delay_ms),
+                                       [this] { return !running; });
+
+            backoff_ms = std::min(backoff_ms * 2, (unsigned int)RECONNECT_BACKOFF_MAX_MS);
+            continue;
+        }
+
+        backoff_ms = RECONNECT_BACKOFF_INITIAL_MS;
+        {
+            // whatever was sent over the old connection is never going to be answered
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            memset(outstanding_reads, 0, sizeof(outstanding_reads));
+        }
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            total_downtime += std::chrono::steady_clock::now() - down_since;
+            if (ever_connected) ++reconnects;
+            ever_connected = true;
+        }
+
+        receiveLoop();
 
-    std::terminate();
+        // stopped on purpose; closeConnection() or releaseConnection() takes care of the socket
+        if (!running) break;
+
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            down_since = std::chrono::steady_clock::now();
+        }
+
+        connected = false;
+        close(client_fd);
+        client_fd = -1;
+
+        printf("Lost connection to I2C hub, reconnecting\n");
+
+        // whoever is still waiting for a response will never get it, and whatever is still queued
+        // belongs to requests from before the outage
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            read_packets_queue.clear();
+        }
+        queue_condition.notify_all();
+    }
 }
 
 void I2CClient::setup(const std::string &hub_ip, int hub_port) {
@@ -157,57 +278,226 @@ bool I2CClient::openConnection() {
     std::string ip(inet_ntoa(hub_address.sin_addr));
     uint16_t port = ntohs(hub_address.sin_port);
 
-    std::cout << "Connecting to I2C hub at " << ip << ":" << port << std::endl;
+    printf("Connecting to I2C hub at %s:%u\n", ip.c_str(), port);
 
-    client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    client_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (client_fd < 0) {
-        std::cerr << "Socket creation failed" << std::endl;
+        fprintf(stderr, "Socket creation failed\n");
         return false;
     }
 
+    // requests are tiny and latency-bound; Nagle would hold one back until the previous is acked
+    int nodelay = 1;
+    if (setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0)
+        perror("setsockopt(TCP_NODELAY) failed");
+
+    // connect without blocking, so an unreachable hub does not stall us for minutes
+    int err = 0;
     if (connect(client_fd, (struct sockaddr *)&hub_address, sizeof(hub_address)) < 0) {
-        int err = errno;
-        std::cerr << "Connection failed: " << strerror(err) << std::endl;
+        err = errno;
+        if (err == EINPROGRESS) {
+            struct pollfd pf;
+            pf.fd = client_fd;
+            pf.events = POLLOUT;
+
+            int ready = poll(&pf, 1, CONNECT_TIMEOUT_MS);
+            if (ready == 0) {
+                err = ETIMEDOUT;
+            } else if (ready < 0) {
+                err = errno;
+            } else {
+                socklen_t err_length = sizeof(err);
+                getsockopt(client_fd, SOL_SOCKET, SO_ERROR, &err, &err_length);
+            }
+        }
+    }
+
+    if (err != 0) {
+        fprintf(stderr, "Connection failed: %s\n", strerror(err));
         close(client_fd);
         client_fd = -1;
         return false;
     }
 
-    std::cout << "Connected to I2C hub at " << ip << ":" << port << std::endl;
+    fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) & ~O_NONBLOCK);
+
+    printf("Connected to I2C hub at %s:%u\n", ip.c_str(), port);
     connected = true;
 
     return true;
 }
 
 void I2CClient::start() {
-    if (!connected) {
-        std::cerr
-            << "Could not start communicating with I2C-bridge because not connected to I2C hub"
-            << std::endl;
-        throw std::runtime_error("Not connected to I2C-bridge");
+    if (running) return;
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        down_since = std::chrono::steady_clock::now();
     }
 
     running = true;
-    receive_thread = std::thread(&I2CClient::receiveLoop, this);
+    receive_thread = std::thread(&I2CClient::connectionLoop, this);
 }
 
 void I2CClient::closeConnection() {
-    if (!connected) {
-        std::cerr << "Could not close the connection to I2C-bridge because not connected to I2C "
-                     "hub (either already closed, or never connected in the first place)"
-                  << std::endl;
+    if (!running && !receive_thread.joinable()) {
+        if (connected) {
+            // connected through openConnection(), but never started
+            close(client_fd);
+            client_fd = -1;
+            connected = false;
+            return;
+        }
+
+        fprintf(stderr,
+                "Could not close the connection to I2C-bridge because not connected to I2C hub "
+                "(either already closed, or never connected in the first place)\n");
         return;
     }
 
-    running = false;
+    {
+        std::lock_guard<std::mutex> lock(backoff_mutex);
+        running = false;
+    }
+    backoff_condition.notify_all();
     receive_thread.join();
+
+    if (client_fd >= 0) {
+        close(client_fd);
+        client_fd = -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        connected = false;
+    }
+    queue_condition.notify_all();
 }
 
-void I2CClient::sendRawData(uint8_t *data, size_t length) {
-    if (send(client_fd, data, length, 0) == -1) {
+int I2CClient::releaseConnection() {
+    {
+        std::lock_guard<std::mutex> lock(backoff_mutex);
+        running = false;
+    }
+    backoff_condition.notify_all();
+    if (receive_thread.joinable()) receive_thread.join();
+
+    int fd = connected ? client_fd : -1;
+    if (!connected && client_fd >= 0) close(client_fd);
+    client_fd = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        connected = false;
+    }
+    queue_condition.notify_all();
+
+    return fd;
+}
+
+void I2CClient::adoptConnection(int fd) {
+    if (running) throw std::logic_error("Cannot adopt a connection while running");
+    if (fd < 0) return;
+
+    if (client_fd >= 0) close(client_fd);
+    client_fd = fd;
+    connected = true;
+}
+
+bool I2CClient::isConnected() const { return connected; }
+
+struct HubConnectionStats I2CClient::getStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+
+    struct HubConnectionStats stats;
+    stats.connected = connected;
+    stats.reconnects = reconnects;
+    stats.failed_attempts = failed_attempts;
+    stats.events = events;
+    stats.breaker = breaker.getStats();
+
+    auto downtime = total_downtime;
+    auto current_downtime = std::chrono::steady_clock::duration::zero();
+    if (!connected) current_downtime = std::chrono::steady_clock::now() - down_since;
+
+    stats.current_downtime_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(current_downtime).count();
+    stats.total_downtime_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(downtime + current_downtime).count();
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex);
+        stats.timeouts = timeouts;
+        stats.late_responses = late_responses;
+    }
+    return stats;
+}
+
+void I2CClient::setQueueCapacity(size_t queue_capacity) {
+    if (running) throw std::logic_error("Cannot resize the queue while running");
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    read_packets_queue = RingBuffer<struct sensor_packet>(queue_capacity);
+}
+
+struct PoolStats I2CClient::getQueueStats() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return read_packets_queue.getStats();
+}
+
+void I2CClient::setCapture(CaptureWriter *writer) { capture = writer; }
+
+void I2CClient::setEventHandler(std::function<void(const struct sensor_packet &)> handler) {
+    event_handler = std::move(handler);
+}
+
+void I2CClient::setBreaker(size_t threshold, std::chrono::milliseconds open_time) {
+    breaker.configure(threshold, open_time);
+}
+
+void I2CClient::sendRawData(const uint8_t *data, size_t length) {
+    if (!connected) throw std::runtime_error("Not connected to I2C-bridge");
+    if (!breaker.allow()) throw std::runtime_error("I2C-bridge keeps failing, circuit is open");
+
+    // counted before sending, the response may well arrive before send() returns
+    PacketView request(data, length);
+    bool read = request.type() == PacketType::DASHBOARD_GET;
+    if (read) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        uint8_t &outstanding = outstanding_reads[request.sensorId()];
+        if (outstanding == 0) {
+            // nobody waits for these any more, they belong to reads that gave up
+            uint8_t sensor_id = request.sensorId();
+            struct sensor_packet late;
+            while (read_packets_queue.popFirst(
+                [sensor_id](const struct sensor_packet &packet) {
+                    return PacketView(packet).sensorId() == sensor_id;
+                },
+                late))
+                ++late_responses;
+        }
+        if (outstanding < UINT8_MAX) ++outstanding;
+    }
+
+    // MSG_NOSIGNAL: a hub that just went away must not take the whole process down with SIGPIPE
+    uint64_t sending_ns = monotonicNanoseconds();
+    ssize_t sent = send(client_fd, data, length, MSG_NOSIGNAL);
+    Latency::recordSince(LatencyStage::SEND, sending_ns);
+    if (sent == -1) {
         perror("send() failed");
+        if (read) {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            uint8_t &outstanding = outstanding_reads[request.sensorId()];
+            if (outstanding) --outstanding;
+        }
+        breaker.failed();
         throw std::runtime_error("Sending data to I2C-bridge failed");
     }
+
+    if (capture) capture->record(CaptureEvent::HUB_OUT, client_fd, data, length);
+
+    // nothing else comes back for a post, so a half open breaker must not wait for an answer
+    if (!read) breaker.succeeded();
+
+    TRACE_POINT(hub_request_sent, HUB_REQUEST_SENT, request.sensorId(), length);
 }
 
 struct sensor_packet I2CClient::retrievePacket(bool block) {
@@ -224,17 +514,60 @@ struct sensor_packet I2CClient::retrievePacket(bool block) {
     // }
 
     struct sensor_packet pkt = {0};
-    while (read_packets_queue.size() < 1) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+
+    if (block) {
+        queue_condition.wait(lock, [this] {
+            return !read_packets_queue.empty() || !connected || !running;
+        });
+    }
+
+    if (read_packets_queue.empty()) {
         if (!block) return pkt;
-        usleep(1000);
+        throw std::runtime_error("Connection to I2C-bridge lost");
     }
 
     struct sensor_packet return_packet;
-    memcpy(&return_packet, &read_packets_queue.front(), sizeof(return_packet));
-    read_packets_queue.pop();
+    read_packets_queue.pop(return_packet);
+
+    TRACE_POINT(hub_response_dequeued, HUB_RESPONSE_DEQUEUED,
+                return_packet.data.generic.metadata.sensor_id, read_packets_queue.size());
 
     printf("packet get\n");
 
     printf("returning\n");
     return return_packet;
 }
+
+struct sensor_packet I2CClient::retrievePacketFor(uint8_t sensor_id,
+                                                 std::chrono::steady_clock::time_point deadline) {
+    auto matches = [sensor_id](const struct sensor_packet &packet) {
+        return PacketView(packet).sensorId() == sensor_id;
+    };
+
+    struct sensor_packet response;
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    bool found;
+    while (!(found = read_packets_queue.popFirst(matches, response))) {
+        if (!connected || !running) throw std::runtime_error("Connection to I2C-bridge lost");
+        if (std::chrono::steady_clock::now() >= deadline) break;
+        queue_condition.wait_until(lock, deadline);
+    }
+
+    if (!found) {
+        // given up; an answer that still comes is dropped by the next read of the sensor
+        uint8_t &outstanding = outstanding_reads[sensor_id];
+        if (outstanding) --outstanding;
+        ++timeouts;
+        lock.unlock();
+
+        breaker.failed();
+        throw std::runtime_error("I2C-bridge did not answer in time");
+    }
+    TRACE_POINT(hub_response_dequeued, HUB_RESPONSE_DEQUEUED, sensor_id,
+                read_packets_queue.size());
+    lock.unlock();
+
+    breaker.succeeded();
+    return response;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file jsonstate.cpp
+ * @brief Implementation of the JsonStateCache class.
+ * @author Daan Breur
+ */
+
+#include "jsonstate.h"
+
+#include <vector>
+
+#include "httpapi.h"
+
+JsonStateCache::JsonStateCache()
+    : version(0), fragments_serialized(0), documents_serialized(0), reads(0) {}
+
+void JsonStateCache::update(uint16_t sensor_id, const struct sensor_packet &packet) {
+    auto fragment = std::make_shared<const std::string>(sensorToJson(sensor_id, packet));
+    fragments_serialized.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const std::string> &current = fragments[sensor_id];
+    if (current && *current == *fragment) return;
+
+    current = std::move(fragment);
+    cached_document.reset();
+    ++version;
+}
+
+std::shared_ptr<const std::string> JsonStateCache::sensor(uint16_t sensor_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = fragments.find(sensor_id);
+    if (found == fragments.end()) return nullptr;
+
+    reads.fetch_add(1, std::memory_order_relaxed);
+    return found->second;
+}
+
+std::shared_ptr<const std::string> JsonStateCache::document() {
+    std::vector<std::shared_ptr<const std::string>> parts;
+    uint64_t assembled_version;
+    size_t length = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reads.fetch_add(1, std::memory_order_relaxed);
+        if (cached_document) return cached_document;
+
+        assembled_version = version;
+        parts.reserve(fragments.size());
+        for (const auto &fragment : fragments) {
+            parts.push_back(fragment.second);
+            length += fragment.second->size() + 1;
+        }
+    }
+
+    // assembled without the lock, so telemetry updates never wait for a large document
+    auto assembled = std::make_shared<std::string>();
+    assembled->reserve(length + 16);
+    *assembled += "{\"sensors\":[";
+    for (size_t i = 0; i < parts.size(); ++i) {
+        if (i > 0) *assembled += ',';
+        *assembled += *parts[i];
+    }
+    *assembled += "]}";
+    documents_serialized.fetch_add(1, std::memory_order_relaxed);
+
+    std::shared_ptr<const std::string> document = std::move(assembled);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (version == assembled_version) cached_document = document;
+    return document;
+}
+
+struct JsonStateStats JsonStateCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {fragments.size(), fragments_serialized.load(std::memory_order_relaxed),
+            documents_serialized.load(std::memory_order_relaxed),
+            reads.load(std::memory_order_relaxed)};
+}
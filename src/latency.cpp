@@ -0,0 +1,133 @@
+/**
+ * @file latency.cpp
+ * @brief Implementation of the Latency class.
+ * @author Daan Breur
+ */
+
+#include "latency.h"
+
+#include <string.h>
+#include <time.h>
+
+std::atomic<uint64_t> Latency::buckets[LATENCY_STAGES][LATENCY_BUCKETS];
+std::atomic<uint64_t> Latency::counts[LATENCY_STAGES];
+std::atomic<uint64_t> Latency::totals_ns[LATENCY_STAGES];
+std::atomic<uint64_t> Latency::maxima_ns[LATENCY_STAGES];
+
+static uint64_t clockNanoseconds(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint64_t monotonicNanoseconds() { return clockNanoseconds(CLOCK_MONOTONIC); }
+
+void Latency::record(LatencyStage stage, uint64_t latency_ns) {
+    size_t index = (size_t)stage;
+
+    // the bucket is the number of bits of the latency in microseconds
+    size_t bucket = 0;
+    for (uint64_t us = latency_ns / 1000; us > 0 && bucket < LATENCY_BUCKETS - 1; us >>= 1)
+        ++bucket;
+
+    buckets[index][bucket].fetch_add(1, std::memory_order_relaxed);
+    counts[index].fetch_add(1, std::memory_order_relaxed);
+    totals_ns[index].fetch_add(latency_ns, std::memory_order_relaxed);
+
+    uint64_t max = maxima_ns[index].load(std::memory_order_relaxed);
+    while (latency_ns > max &&
+           !maxima_ns[index].compare_exchange_weak(max, latency_ns, std::memory_order_relaxed)) {
+    }
+}
+
+void Latency::recordSince(LatencyStage stage, uint64_t since_ns) {
+    uint64_t now = monotonicNanoseconds();
+    record(stage, now > since_ns ? now - since_ns : 0);
+}
+
+void Latency::recordReceive(LatencyStage stage, const struct ReceiveTimestamps &received) {
+    if (received.kernel_stamped) record(stage, received.kernel_delay_ns);
+}
+
+void Latency::recordRequest(const struct ReceiveTimestamps &received) {
+    uint64_t now = monotonicNanoseconds();
+    uint64_t in_user = now > received.user_ns ? now - received.user_ns : 0;
+    record(LatencyStage::REQUEST_TOTAL, in_user + received.kernel_delay_ns);
+}
+
+struct LatencyHistogram Latency::snapshot(LatencyStage stage) {
+    size_t index = (size_t)stage;
+    struct LatencyHistogram histogram;
+    for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket)
+        histogram.buckets[bucket] = buckets[index][bucket].load(std::memory_order_relaxed);
+    histogram.count = counts[index].load(std::memory_order_relaxed);
+    histogram.total_ns = totals_ns[index].load(std::memory_order_relaxed);
+    histogram.max_ns = maxima_ns[index].load(std::memory_order_relaxed);
+    return histogram;
+}
+
+void Latency::reset() {
+    for (size_t index = 0; index < LATENCY_STAGES; ++index) {
+        for (std::atomic<uint64_t> &bucket : buckets[index]) bucket = 0;
+        counts[index] = 0;
+        totals_ns[index] = 0;
+        maxima_ns[index] = 0;
+    }
+}
+
+const char *latencyStageName(LatencyStage stage) {
+    switch (stage) {
+        case LatencyStage::KERNEL_TO_USER:
+            return "kernel_to_user";
+        case LatencyStage::PARSE_TO_DISPATCH:
+            return "parse_to_dispatch";
+        case LatencyStage::HUB_QUEUE_WAIT:
+            return "hub_queue_wait";
+        case LatencyStage::HUB_ROUND_TRIP:
+            return "hub_round_trip";
+        case LatencyStage::HUB_KERNEL_TO_USER:
+            return "hub_kernel_to_user";
+        case LatencyStage::SEND:
+            return "send";
+        case LatencyStage::REQUEST_TOTAL:
+            return "request_total";
+    }
+    return "unknown";
+}
+
+uint64_t latencyPercentileUs(const struct LatencyHistogram &histogram, double percentile) {
+    if (histogram.count == 0) return 0;
+
+    uint64_t rank = (uint64_t)(histogram.count * percentile / 100.0);
+    if (rank >= histogram.count) rank = histogram.count - 1;
+
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+        seen += histogram.buckets[bucket];
+        if (seen > rank) return 1ULL << bucket;
+    }
+    return 1ULL << (LATENCY_BUCKETS - 1);
+}
+
+void enableReceiveTimestamps(int fd) {
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+}
+
+struct ReceiveTimestamps receiveTimestamps(const struct msghdr &message) {
+    struct ReceiveTimestamps received = {monotonicNanoseconds(), 0, false};
+    for (struct cmsghdr *control = CMSG_FIRSTHDR(&message); control;
+         control = CMSG_NXTHDR(const_cast<struct msghdr *>(&message), control)) {
+        if (control->cmsg_level != SOL_SOCKET || control->cmsg_type != SCM_TIMESTAMPNS) continue;
+
+        // the kernel stamps with the wall clock, so the read is compared against that too
+        struct timespec stamp;
+        memcpy(&stamp, CMSG_DATA(control), sizeof(stamp));
+        uint64_t kernel_ns = (uint64_t)stamp.tv_sec * 1000000000ULL + stamp.tv_nsec;
+        uint64_t read_ns = clockNanoseconds(CLOCK_REALTIME);
+
+        received.kernel_delay_ns = read_ns > kernel_ns ? read_ns - kernel_ns : 0;
+        received.kernel_stamped = true;
+    }
+    return received;
+}
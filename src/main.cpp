@@ -7,33 +7,255 @@
 
 #include <atomic>
 #include <csignal>
-#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
+#include "hotrestart.h"
 #include "wemosserver.h"
 
 #define SERVER_PORT 5000
 #define I2C_HUB_IP "192.168.226.245"
 #define I2C_HUB_PORT 5000
+#define SHM_STATE_NAME "/wemos-state"
+#define TRACE_FILE "/tmp/wemos-trace.json"
+
+/**
+ * @brief Environment variable that enables request tracing, set to trace 1 in N requests.
+ */
+#define TRACE_ENV "WEMOS_TRACE"
+
+/**
+ * @brief Environment variable that enables traffic capture, set to the capture file path.
+ * @details The PID is appended, so a hot restart does not overwrite the capture of its predecessor.
+ */
+#define CAPTURE_ENV "WEMOS_CAPTURE"
+
+/**
+ * @brief Environment variable with a hub routing table, to spread the sensors over several hubs.
+ * @details For example "10.0.0.2:5000=0-63;10.0.0.3:5000=64-127". Without it every hub sensor
+ * lives behind I2C_HUB_IP.
+ */
+#define HUBS_ENV "WEMOS_HUBS"
+
+/**
+ * @brief Environment variable with telemetry deadbands, e.g. "temperature=0.2,humidity=2%".
+ */
+#define DEADBANDS_ENV "WEMOS_DEADBANDS"
+
+/**
+ * @brief Environment variable with the aggregate windows, e.g. "5m,15m,60m,tumbling:1d".
+ */
+#define AGGREGATE_WINDOWS_ENV "WEMOS_AGGREGATE_WINDOWS"
+
+/**
+ * @brief Environment variable with the sensor groups that are aggregated, e.g. "1=200-210,215".
+ */
+#define SENSOR_GROUPS_ENV "WEMOS_SENSOR_GROUPS"
+
+/**
+ * @brief Environment variable that enables the UDP telemetry listener, set to the port to listen
+ * on.
+ */
+#define UDP_PORT_ENV "WEMOS_UDP_PORT"
+
+/**
+ * @brief Environment variable that enables the HTTP/JSON API, set to the port to serve it on.
+ */
+#define HTTP_PORT_ENV "WEMOS_HTTP_PORT"
+
+/**
+ * @brief Environment variable with the aging interval of hub requests in milliseconds, see
+ * HUB_AGING_MS for the default.
+ */
+#define HUB_AGING_ENV "WEMOS_HUB_AGING_MS"
+
+/**
+ * @brief Environment variable with the highest number of requests outstanding on the link to a
+ * hub at once, see HUB_MAX_CONCURRENCY for the default.
+ */
+#define HUB_CONCURRENCY_ENV "WEMOS_HUB_CONCURRENCY"
+
+/**
+ * @brief Environment variable with the time a request to a hub may take in milliseconds, see
+ * HUB_TIMEOUT_MS for the default.
+ */
+#define HUB_TIMEOUT_ENV "WEMOS_HUB_TIMEOUT_MS"
+
+/**
+ * @brief Environment variable with the time posts to RGB lights and lichtkranten are held back
+ * for newer ones in milliseconds, see WRITE_COMBINE_MS for the default.
+ */
+#define WRITE_COMBINE_ENV "WEMOS_WRITE_COMBINE_MS"
+
+/**
+ * @brief Environment variable with the number of failed hub requests in a row after which the
+ * hub is given a rest, see BREAKER_FAILURE_THRESHOLD for the default.
+ */
+#define HUB_BREAKER_FAILURES_ENV "WEMOS_HUB_BREAKER_FAILURES"
+
+/**
+ * @brief Environment variable with the time a hub is given a rest in milliseconds, see
+ * BREAKER_OPEN_MS for the default.
+ */
+#define HUB_BREAKER_OPEN_ENV "WEMOS_HUB_BREAKER_OPEN_MS"
+
+/**
+ * @brief Environment variable with rate limits per connection and client IP, e.g.
+ * "hub=10/20,local=200,client_hub=25/50".
+ */
+#define RATE_LIMITS_ENV "WEMOS_RATE_LIMITS"
+
+/**
+ * @brief Environment variable that enables replication to standbys, set to the port they connect
+ * to.
+ */
+#define REPLICATION_PORT_ENV "WEMOS_REPLICATION_PORT"
+
+/**
+ * @brief Environment variable that makes this bridge a standby, set to the replication address of
+ * the primary, e.g. "10.0.0.5:5100".
+ */
+#define STANDBY_OF_ENV "WEMOS_STANDBY_OF"
+
+/**
+ * @brief Environment variable that overrides SERVER_PORT, e.g. to run several bridges of a cluster
+ * on one host. The shared-memory segment is then named after the port.
+ */
+#define PORT_ENV "WEMOS_PORT"
+
+/**
+ * @brief Environment variable with the other bridges of the cluster and the sensors they own, e.g.
+ * "10.0.0.6:5000=1000-1999;10.0.0.7:5000=2000-2999". Without it this bridge owns every sensor.
+ */
+#define CLUSTER_ENV "WEMOS_CLUSTER"
+
+/**
+ * @brief Environment variable with the device groups dashboards can post to at once, e.g.
+ * "2=200-230,64-70;3=300".
+ */
+#define DEVICE_GROUPS_ENV "WEMOS_DEVICE_GROUPS"
+
+/**
+ * @brief Environment variable that selects the sizing profile; "low" runs the low-footprint
+ * profile of lowFootprintConfig() on small gateway hardware.
+ */
+#define PROFILE_ENV "WEMOS_PROFILE"
 
 std::atomic<bool> global_shutdown_flag(false);
+WemosServer *global_server = nullptr;
 
 void signalHandler(int signum) {
-    std::cout << "Interrupt signal (" << signum << ") received.\n";
+    printf("Interrupt signal (%d) received.\n", signum);
     if (signum == SIGINT || signum == SIGTERM) {
         global_shutdown_flag = true;
     }
 }
 
-int main() {
+void statsSignalHandler(int signum) {
+    if (global_server) global_server->requestStats();
+}
+
+void restartSignalHandler(int signum) {
+    if (global_server) global_server->requestHotRestart();
+}
+
+int main(int argc, char **argv) {
     setbuf(stdout, NULL);
-    std::cout << "Starting Wemos Bridge on port " << SERVER_PORT << std::endl;
+
+    const char *port_override = getenv(PORT_ENV);
+    int port = port_override && *port_override ? atoi(port_override) : SERVER_PORT;
+    std::string shm_name = SHM_STATE_NAME;
+    if (port != SERVER_PORT) shm_name += "-" + std::to_string(port);
+    printf("Starting Wemos Bridge on port %d\n", port);
 
     // signal(SIGINT, signalHandler);
     // signal(SIGTERM, signalHandler);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, statsSignalHandler);
+    signal(SIGUSR2, restartSignalHandler);
+
+    WemosServer server(port, I2C_HUB_IP, I2C_HUB_PORT);
+    server.enableSharedMemoryExport(shm_name);
+    server.setRestartCommand(argv);
+
+    const char *hub_routes = getenv(HUBS_ENV);
+    if (hub_routes && *hub_routes) server.setHubRoutes(hub_routes);
+
+    // after the routes, so the memory budget covers the queues of every hub
+    const char *profile = getenv(PROFILE_ENV);
+    if (profile && strcmp(profile, "low") == 0) server.configure(lowFootprintConfig());
+
+    const char *deadbands = getenv(DEADBANDS_ENV);
+    if (deadbands && *deadbands) server.setDeadbands(deadbands);
+
+    const char *aggregate_windows = getenv(AGGREGATE_WINDOWS_ENV);
+    if (aggregate_windows && *aggregate_windows) server.setAggregateWindows(aggregate_windows);
+
+    const char *sensor_groups = getenv(SENSOR_GROUPS_ENV);
+    if (sensor_groups && *sensor_groups) server.setSensorGroups(sensor_groups);
+
+    const char *hub_aging = getenv(HUB_AGING_ENV);
+    if (hub_aging && *hub_aging) server.setHubAging(atoi(hub_aging));
+
+    const char *hub_concurrency = getenv(HUB_CONCURRENCY_ENV);
+    if (hub_concurrency && *hub_concurrency) server.setHubConcurrency(atoi(hub_concurrency));
+
+    const char *hub_timeout = getenv(HUB_TIMEOUT_ENV);
+    if (hub_timeout && *hub_timeout) server.setHubTimeout(atoi(hub_timeout));
+
+    const char *write_combine = getenv(WRITE_COMBINE_ENV);
+    if (write_combine && *write_combine) server.setWriteCombineWindow(atoi(write_combine));
 
-    WemosServer server(SERVER_PORT, I2C_HUB_IP, I2C_HUB_PORT);
+    const char *breaker_failures = getenv(HUB_BREAKER_FAILURES_ENV);
+    const char *breaker_open = getenv(HUB_BREAKER_OPEN_ENV);
+    if ((breaker_failures && *breaker_failures) || (breaker_open && *breaker_open)) {
+        server.setHubBreaker(
+            breaker_failures && *breaker_failures ? atoi(breaker_failures)
+                                                  : BREAKER_FAILURE_THRESHOLD,
+            breaker_open && *breaker_open ? atoi(breaker_open) : BREAKER_OPEN_MS);
+    }
+
+    const char *rate_limits = getenv(RATE_LIMITS_ENV);
+    if (rate_limits && *rate_limits) server.setRateLimits(rate_limits);
+
+    const char *device_groups = getenv(DEVICE_GROUPS_ENV);
+    if (device_groups && *device_groups) server.setDeviceGroups(device_groups);
+
+    const char *cluster = getenv(CLUSTER_ENV);
+    if (cluster && *cluster) server.setClusterMap(cluster);
+
+    const char *udp_port = getenv(UDP_PORT_ENV);
+    if (udp_port && *udp_port) server.enableUdp(atoi(udp_port));
+
+    const char *http_port = getenv(HTTP_PORT_ENV);
+    if (http_port && *http_port) server.enableHttp(atoi(http_port));
 
-    sleep(1);
+    // the trace is dumped to TRACE_FILE on SIGUSR1, together with the statistics
+    const char *trace_sample = getenv(TRACE_ENV);
+    if (trace_sample && atoi(trace_sample) > 0)
+        server.enableTracing(atoi(trace_sample), TRACE_FILE);
+
+    const char *replication_port = getenv(REPLICATION_PORT_ENV);
+    if (replication_port && *replication_port) server.enableReplication(atoi(replication_port));
+
+    const char *standby_of = getenv(STANDBY_OF_ENV);
+    if (standby_of && *standby_of) server.enableStandby(standby_of);
+
+    const char *capture_path = getenv(CAPTURE_ENV);
+    if (capture_path && *capture_path)
+        server.enableCapture(std::string(capture_path) + "." + std::to_string(getpid()));
+    global_server = &server;
+
+    const char *handoff_fd = getenv(HANDOFF_FD_ENV);
+    if (handoff_fd) {
+        // launched by a hot restart: take over instead of starting from scratch
+        unsetenv(HANDOFF_FD_ENV);
+        server.adoptHandoff(atoi(handoff_fd));
+    } else {
+        sleep(1);
+    }
 
     server.start();
 
@@ -0,0 +1,95 @@
+/**
+ * @file pool.cpp
+ * @brief Implementation of the BlockPool class.
+ * @author Daan Breur
+ */
+
+#include "pool.h"
+
+#include <cstddef>
+#include <stdexcept>
+
+static size_t alignedBlockSize(size_t block_size) {
+    const size_t alignment = alignof(std::max_align_t);
+    return (block_size + alignment - 1) / alignment * alignment;
+}
+
+BlockPool::BlockPool(size_t block_size, size_t capacity)
+    : block_size(alignedBlockSize(block_size)),
+      capacity(capacity),
+      high_water(0),
+      allocations(0),
+      failures(0) {
+    if (block_size == 0 || capacity == 0)
+        throw std::invalid_argument("Block size and capacity must not be zero");
+
+    storage.reset(new uint8_t[this->block_size * capacity]);
+    block_in_use.assign(capacity, 0);
+
+    // hand out the lowest addresses first, which keeps the touched part of the pool small
+    free_blocks.reserve(capacity);
+    for (size_t i = capacity; i > 0; --i) free_blocks.push_back(i - 1);
+}
+
+void *BlockPool::acquire() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    if (free_blocks.empty()) {
+        ++failures;
+        return nullptr;
+    }
+
+    uint32_t index = free_blocks.back();
+    free_blocks.pop_back();
+    block_in_use[index] = 1;
+
+    ++allocations;
+    size_t in_use = capacity - free_blocks.size();
+    if (in_use > high_water) high_water = in_use;
+
+    return storage.get() + index * block_size;
+}
+
+void BlockPool::release(void *block) {
+    uint8_t *address = static_cast<uint8_t *>(block);
+    if (address < storage.get() || address >= storage.get() + block_size * capacity ||
+        (address - storage.get()) % block_size != 0)
+        throw std::invalid_argument("Block does not belong to this pool");
+
+    size_t index = (address - storage.get()) / block_size;
+
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!block_in_use[index]) throw std::invalid_argument("Block released twice");
+
+    block_in_use[index] = 0;
+    free_blocks.push_back(index);
+}
+
+bool BlockPool::isInUse(size_t index) const {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return index < capacity && block_in_use[index];
+}
+
+void *BlockPool::blockAt(size_t index) const { return storage.get() + index * block_size; }
+
+size_t BlockPool::reservedBytes(size_t block_size, size_t capacity) {
+    return alignedBlockSize(block_size) * capacity;
+}
+
+size_t BlockPool::getBlockSize() const { return block_size; }
+
+size_t BlockPool::getCapacity() const { return capacity; }
+
+struct PoolStats BlockPool::getStats() const {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    struct PoolStats stats;
+    stats.capacity = capacity;
+    stats.in_use = capacity - free_blocks.size();
+    stats.high_water = high_water;
+    stats.object_size = block_size;
+    stats.allocations = allocations;
+    stats.failures = failures;
+    stats.reserved_bytes = block_size * capacity;
+    return stats;
+}
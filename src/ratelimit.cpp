@@ -0,0 +1,188 @@
+/**
+ * @file ratelimit.cpp
+ * @brief Implementation of the RateLimiter class.
+ * @author Daan Breur
+ */
+
+#include "ratelimit.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+bool takeToken(struct TokenBucket &bucket, const struct RateLimit &limit,
+               std::chrono::steady_clock::time_point now) {
+    if (limit.rate <= 0) return true;
+
+    std::chrono::duration<double> elapsed = now - bucket.refilled;
+    if (elapsed.count() > 0) {
+        bucket.tokens = std::min(limit.burst, bucket.tokens + elapsed.count() * limit.rate);
+        bucket.refilled = now;
+    }
+
+    if (bucket.tokens < 1) return false;
+    bucket.tokens -= 1;
+    return true;
+}
+
+/**
+ * @brief Throws if a limit cannot be enforced.
+ */
+static void checkLimit(const struct RateLimit &limit) {
+    if (!(limit.rate >= 0) || !(limit.burst >= 0))
+        throw std::invalid_argument("Rate limits must not be negative");
+    if (limit.rate > 0 && limit.burst < 1)
+        throw std::invalid_argument("The burst of a rate limit must allow at least one request");
+}
+
+RateLimiter::RateLimiter() : enabled(false), admitted(0), throttled(0) {
+    for (size_t index = 0; index < RATE_CLASSES; ++index) {
+        connection_limits[index] = {0, 0};
+        client_limits[index] = {0, 0};
+    }
+}
+
+void RateLimiter::setConnectionLimit(RateClass rate_class, struct RateLimit limit) {
+    checkLimit(limit);
+    connection_limits[(size_t)rate_class] = limit;
+    if (limit.rate > 0) enabled = true;
+}
+
+void RateLimiter::setClientLimit(RateClass rate_class, struct RateLimit limit) {
+    checkLimit(limit);
+    client_limits[(size_t)rate_class] = limit;
+    if (limit.rate > 0) enabled = true;
+}
+
+void RateLimiter::parse(const std::string &list) {
+    std::stringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        size_t equals = entry.find('=');
+        if (equals == std::string::npos)
+            throw std::invalid_argument("Expected budget=rate/burst in the rate limit list");
+
+        std::string value = entry.substr(equals + 1);
+        size_t slash = value.find('/');
+        std::string rate_text = value.substr(0, slash);
+        std::string burst_text = slash == std::string::npos ? rate_text : value.substr(slash + 1);
+
+        char *rate_end, *burst_end;
+        struct RateLimit limit;
+        limit.rate = strtod(rate_text.c_str(), &rate_end);
+        limit.burst = strtod(burst_text.c_str(), &burst_end);
+        if (rate_text.empty() || burst_text.empty() || *rate_end != '\0' || *burst_end != '\0')
+            throw std::invalid_argument("Invalid rate in the rate limit list");
+
+        std::string budget = entry.substr(0, equals);
+        if (budget == "hub") {
+            setConnectionLimit(RateClass::HUB, limit);
+        } else if (budget == "local") {
+            setConnectionLimit(RateClass::LOCAL, limit);
+        } else if (budget == "client_hub") {
+            setClientLimit(RateClass::HUB, limit);
+        } else if (budget == "client_local") {
+            setClientLimit(RateClass::LOCAL, limit);
+        } else {
+            throw std::invalid_argument("Unknown budget in the rate limit list");
+        }
+    }
+}
+
+void RateLimiter::resetBuckets(struct TokenBucket (&buckets)[RATE_CLASSES]) const {
+    auto now = std::chrono::steady_clock::now();
+    for (size_t index = 0; index < RATE_CLASSES; ++index)
+        buckets[index] = {connection_limits[index].burst, now};
+}
+
+bool RateLimiter::admit(struct TokenBucket *buckets, struct in_addr address,
+                        RateClass rate_class) {
+    if (!enabled) return true;
+
+    size_t index = (size_t)rate_class;
+    auto now = std::chrono::steady_clock::now();
+
+    // the connection is checked first, so a connection over its own limit costs no lock
+    bool allowed = !buckets || takeToken(buckets[index], connection_limits[index], now);
+
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        auto found = clients.find(address.s_addr);
+        if (found == clients.end()) {
+            if (clients.size() >= MAX_RATE_CLIENTS) forgetIdleClients(now);
+            if (clients.size() < MAX_RATE_CLIENTS) {
+                struct Client client = {};
+                for (size_t other = 0; other < RATE_CLASSES; ++other)
+                    client.buckets[other] = {client_limits[other].burst, now};
+                found = clients.emplace(address.s_addr, client).first;
+            }
+        }
+
+        if (found != clients.end()) {
+            struct Client &client = found->second;
+            client.last_seen = now;
+            if (allowed) allowed = takeToken(client.buckets[index], client_limits[index], now);
+            if (allowed)
+                ++client.admitted;
+            else
+                ++client.throttled[index];
+        }
+    }
+
+    if (allowed)
+        admitted.fetch_add(1, std::memory_order_relaxed);
+    else
+        throttled.fetch_add(1, std::memory_order_relaxed);
+    return allowed;
+}
+
+void RateLimiter::forgetIdleClients(std::chrono::steady_clock::time_point now) {
+    // a client idle for longer than its slowest refill looks exactly like a new one
+    std::chrono::duration<double> refill(0);
+    for (size_t index = 0; index < RATE_CLASSES; ++index) {
+        const struct RateLimit &limit = client_limits[index];
+        if (limit.rate > 0)
+            refill = std::max(refill, std::chrono::duration<double>(limit.burst / limit.rate));
+    }
+
+    for (auto client = clients.begin(); client != clients.end();) {
+        if (now - client->second.last_seen > refill)
+            client = clients.erase(client);
+        else
+            ++client;
+    }
+}
+
+std::vector<struct ClientThrottleStats> RateLimiter::topThrottled(size_t count) const {
+    std::vector<struct ClientThrottleStats> result;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        for (const auto &entry : clients) {
+            const struct Client &client = entry.second;
+            if (client.throttled[0] == 0 && client.throttled[1] == 0) continue;
+
+            struct ClientThrottleStats stats;
+            stats.address.s_addr = entry.first;
+            stats.admitted = client.admitted;
+            std::copy(std::begin(client.throttled), std::end(client.throttled), stats.throttled);
+            result.push_back(stats);
+        }
+    }
+
+    auto total = [](const struct ClientThrottleStats &stats) {
+        return stats.throttled[0] + stats.throttled[1];
+    };
+    std::sort(result.begin(), result.end(),
+              [&total](const struct ClientThrottleStats &a, const struct ClientThrottleStats &b) {
+                  return total(a) > total(b);
+              });
+    if (result.size() > count) result.resize(count);
+    return result;
+}
+
+struct RateLimiterStats RateLimiter::getStats() const {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    return {admitted.load(std::memory_order_relaxed), throttled.load(std::memory_order_relaxed),
+            clients.size()};
+}
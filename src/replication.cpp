@@ -0,0 +1,294 @@
+/**
+ * @file replication.cpp
+ * @brief Implementation of the ReplicationPublisher and ReplicationFollower classes.
+ * @author Daan Breur
+ */
+
+#include "replication.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+#include "packetview.h"
+
+/**
+ * @brief Time a standby may block a batch before it is dropped, in milliseconds.
+ */
+#define STANDBY_SEND_TIMEOUT_MS 1000
+
+/**
+ * @brief Number of words in the dirty bitmap, one bit per possible slave ID.
+ */
+#define DIRTY_WORDS ((MAX_SLAVE_ID + 1) / 64)
+
+void encodeReplicationRecord(std::vector<uint8_t> &batch, uint16_t slave_id, bool live,
+                             const struct sensor_packet &state) {
+    PacketView frame(state);
+    size_t offset = batch.size();
+    batch.resize(offset + REPLICATION_RECORD_HEADER + frame.size());
+
+    storeLE16(&batch[offset], slave_id);
+    batch[offset + 2] = live ? REPLICATION_LIVE : 0;
+    memcpy(&batch[offset + REPLICATION_RECORD_HEADER], frame.data(), frame.size());
+}
+
+ReplicationPublisher::ReplicationPublisher(const SlaveManager &slaves)
+    : slaves(slaves),
+      dirty(new std::atomic<uint64_t>[DIRTY_WORDS]),
+      listen_fd(-1),
+      running(false),
+      standby_count(0),
+      batches(0),
+      records(0),
+      bytes(0) {
+    for (size_t i = 0; i < DIRTY_WORDS; ++i) dirty[i].store(0, std::memory_order_relaxed);
+}
+
+ReplicationPublisher::~ReplicationPublisher() { stop(); }
+
+void ReplicationPublisher::start(int port) {
+    if (running) return;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) throw std::runtime_error("Could not create the replication socket");
+
+    const int enable_opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable_opt, sizeof(enable_opt));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listen_fd, 4) < 0) {
+        perror("Binding the replication port failed");
+        close(listen_fd);
+        listen_fd = -1;
+        throw std::runtime_error("Could not listen on the replication port");
+    }
+
+    running = true;
+    thread = std::thread(&ReplicationPublisher::publishLoop, this);
+}
+
+void ReplicationPublisher::stop() {
+    running = false;
+    if (thread.joinable()) thread.join();
+
+    for (int fd : standbys) close(fd);
+    standbys.clear();
+    standby_count = 0;
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+int ReplicationPublisher::getPort() const {
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    if (listen_fd < 0 || getsockname(listen_fd, (struct sockaddr *)&address, &length) < 0)
+        return -1;
+    return ntohs(address.sin_port);
+}
+
+void ReplicationPublisher::acceptStandby() {
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    int fd = accept4(listen_fd, (struct sockaddr *)&address, &length, SOCK_CLOEXEC);
+    if (fd < 0) return;
+
+    const int enable_opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable_opt, sizeof(enable_opt));
+    struct timeval timeout = {STANDBY_SEND_TIMEOUT_MS / 1000,
+                              (STANDBY_SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // changes made while the snapshot is taken are sent again with the next batch
+    std::vector<struct SlaveSnapshot> snapshot = slaves.snapshot();
+    std::vector<uint8_t> batch;
+    for (const struct SlaveSnapshot &slave : snapshot)
+        encodeReplicationRecord(batch, slave.slave_id, slave.fd >= 0, slave.sensor_data);
+
+    if (!batch.empty() &&
+        send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) < (ssize_t)batch.size()) {
+        close(fd);
+        return;
+    }
+
+    printf("Standby %s:%d follows, sent %zu devices\n", inet_ntoa(address.sin_addr),
+           ntohs(address.sin_port), snapshot.size());
+    standbys.push_back(fd);
+    standby_count = standbys.size();
+    batches.fetch_add(1, std::memory_order_relaxed);
+    records.fetch_add(snapshot.size(), std::memory_order_relaxed);
+    bytes.fetch_add(batch.size(), std::memory_order_relaxed);
+}
+
+void ReplicationPublisher::sendToStandbys(const std::vector<uint8_t> &batch,
+                                          size_t record_count) {
+    for (size_t i = 0; i < standbys.size();) {
+        if (send(standbys[i], batch.data(), batch.size(), MSG_NOSIGNAL) < (ssize_t)batch.size()) {
+            printf("Standby dropped from replication\n");
+            close(standbys[i]);
+            standbys.erase(standbys.begin() + i);
+            continue;
+        }
+        bytes.fetch_add(batch.size(), std::memory_order_relaxed);
+        ++i;
+    }
+
+    standby_count = standbys.size();
+    batches.fetch_add(1, std::memory_order_relaxed);
+    records.fetch_add(record_count, std::memory_order_relaxed);
+}
+
+void ReplicationPublisher::publishLoop() {
+    auto next_batch = std::chrono::steady_clock::now();
+    auto last_sent = next_batch;
+    std::vector<uint8_t> batch;
+
+    while (running) {
+        int wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          next_batch - std::chrono::steady_clock::now())
+                          .count();
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, std::max(wait_ms, 0)) > 0 && (pfd.revents & POLLIN)) acceptStandby();
+
+        auto now = std::chrono::steady_clock::now();
+        if (now < next_batch) continue;
+        next_batch = now + std::chrono::milliseconds(REPLICATION_INTERVAL_MS);
+
+        // taken even without standbys, so a standby that connects later does not get them twice
+        batch.clear();
+        size_t record_count = 0;
+        for (size_t word = 0; word < DIRTY_WORDS; ++word) {
+            if (dirty[word].load(std::memory_order_relaxed) == 0) continue;
+
+            uint64_t bits = dirty[word].exchange(0, std::memory_order_acquire);
+            while (bits) {
+                uint16_t slave_id = word * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                encodeReplicationRecord(batch, slave_id, slaves.getSlaveFD(slave_id) >= 0,
+                                        slaves.getSlaveState(slave_id));
+                ++record_count;
+            }
+        }
+
+        if (standbys.empty()) continue;
+        if (batch.empty()) {
+            if (now - last_sent < std::chrono::milliseconds(REPLICATION_KEEPALIVE_MS)) continue;
+            batch.assign(REPLICATION_RECORD_HEADER, 0);
+            batch[2] = REPLICATION_KEEPALIVE;
+        }
+
+        sendToStandbys(batch, record_count);
+        last_sent = now;
+    }
+}
+
+struct ReplicationStats ReplicationPublisher::getStats() const {
+    return {standby_count.load(), batches.load(std::memory_order_relaxed),
+            records.load(std::memory_order_relaxed), bytes.load(std::memory_order_relaxed)};
+}
+
+ReplicationFollower::ReplicationFollower(ApplyFunction apply)
+    : apply(std::move(apply)), records(0) {}
+
+void ReplicationFollower::applyRecords(std::vector<uint8_t> &buffer) {
+    size_t offset = 0;
+    while (offset + REPLICATION_RECORD_HEADER <= buffer.size()) {
+        const uint8_t *record = &buffer[offset];
+        uint8_t flags = record[2];
+        if (flags & REPLICATION_KEEPALIVE) {
+            offset += REPLICATION_RECORD_HEADER;
+            continue;
+        }
+
+        PacketView frame(record + REPLICATION_RECORD_HEADER,
+                         buffer.size() - offset - REPLICATION_RECORD_HEADER);
+        if (!frame.complete()) break;
+
+        struct SlaveSnapshot snapshot = {0};
+        snapshot.slave_id = loadLE16(record);
+        snapshot.fd = -1;
+        frame.frameOnly().copyTo(snapshot.sensor_data);
+        apply(snapshot, flags & REPLICATION_LIVE);
+        records.fetch_add(1, std::memory_order_relaxed);
+
+        offset += REPLICATION_RECORD_HEADER + frame.frameLength();
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + offset);
+}
+
+bool ReplicationFollower::follow(const std::string &host, int port, int timeout_ms,
+                                 const std::atomic<bool> &stop) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1 || port <= 0 || port > 65535)
+        throw std::invalid_argument("Invalid address of the primary");
+
+    bool reached = false;
+    auto last_contact = std::chrono::steady_clock::now();
+    std::vector<uint8_t> buffer;
+    int fd = -1;
+
+    while (!stop) {
+        auto now = std::chrono::steady_clock::now();
+        if (reached && now - last_contact > std::chrono::milliseconds(timeout_ms)) {
+            if (fd >= 0) close(fd);
+            return true;
+        }
+
+        if (fd < 0) {
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+                if (fd >= 0) close(fd);
+                fd = -1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(REPLICATION_RETRY_MS));
+                continue;
+            }
+
+            printf("Following the primary at %s:%d\n", host.c_str(), port);
+            reached = true;
+            last_contact = now;
+            buffer.clear();
+        }
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, REPLICATION_RETRY_MS) <= 0) continue;
+
+        uint8_t chunk[4096];
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            printf("Lost the connection to the primary\n");
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        last_contact = std::chrono::steady_clock::now();
+        buffer.insert(buffer.end(), chunk, chunk + received);
+        applyRecords(buffer);
+    }
+
+    if (fd >= 0) close(fd);
+    return false;
+}
+
+uint64_t ReplicationFollower::getRecords() const {
+    return records.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,207 @@
+/**
+ * @file shmstate.cpp
+ * @brief Implementation of the ShmStateWriter and ShmStateReader classes.
+ * @author Daan Breur
+ */
+
+#include "shmstate.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <stdexcept>
+
+#include "packets.h"
+
+static long futex(std::atomic<uint32_t> *address, int op, uint32_t value,
+                  const struct timespec *timeout) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(address), op, value, timeout, nullptr,
+                   0);
+}
+
+ShmStateWriter::ShmStateWriter(const std::string &name) : name(name), segment(nullptr) {
+    if (name.size() < 2 || name[0] != '/' || name.find('/', 1) != std::string::npos)
+        throw std::invalid_argument("Invalid shared-memory object name");
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0660);
+    if (fd < 0) {
+        perror("shm_open() failed");
+        throw std::runtime_error("shm_open() failed");
+    }
+
+    if (ftruncate(fd, sizeof(struct ShmStateSegment)) < 0) {
+        perror("ftruncate() failed");
+        close(fd);
+        throw std::runtime_error("ftruncate() failed");
+    }
+
+    void *mapping =
+        mmap(nullptr, sizeof(struct ShmStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("mmap() failed");
+        throw std::runtime_error("mmap() failed");
+    }
+
+    segment = static_cast<struct ShmStateSegment *>(mapping);
+
+    // a previous instance may have left its state behind; readers must never see it
+    segment->header.magic = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    for (struct ShmStateSlot &slot : segment->slots) {
+        slot.version.store(0, std::memory_order_relaxed);
+        slot.change_seq = 0;
+        slot.updated_ns = 0;
+        slot.packet = {};
+    }
+
+    segment->header.layout_version = SHM_STATE_LAYOUT_VERSION;
+    segment->header.slot_count = SHM_STATE_SLOTS;
+    segment->header.slot_size = sizeof(struct ShmStateSlot);
+    segment->header.writer_pid = getpid();
+    segment->header.change_seq.store(0, std::memory_order_relaxed);
+    segment->header.waiters.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->header.magic = SHM_STATE_MAGIC;
+}
+
+ShmStateWriter::~ShmStateWriter() {
+    munmap(segment, sizeof(struct ShmStateSegment));
+    shm_unlink(name.c_str());
+}
+
+void ShmStateWriter::publish(uint8_t sensor_id, const struct sensor_packet &packet) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    struct ShmStateSlot &slot = segment->slots[sensor_id];
+    struct ShmStateHeader &header = segment->header;
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+
+    uint32_t version = slot.version.load(std::memory_order_relaxed);
+    slot.version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t change_seq = header.change_seq.load(std::memory_order_relaxed) + 1;
+    memcpy(&slot.packet, &packet, sizeof(slot.packet));
+    slot.updated_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    slot.change_seq = change_seq;
+
+    slot.version.store(version + 2, std::memory_order_release);
+    // seq_cst, so the load of waiters below cannot be ordered before it; a reader that registers
+    // as waiter after this store sees the new sequence and does not go to sleep
+    header.change_seq.store(change_seq, std::memory_order_seq_cst);
+
+    // only pay for the wake-up system call when someone is actually sleeping
+    if (header.waiters.load(std::memory_order_seq_cst) > 0)
+        futex(&header.change_seq, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+ShmStateReader::ShmStateReader(const std::string &name) : segment(nullptr) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        perror("shm_open() failed");
+        throw std::runtime_error("Could not open shared-memory state segment");
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(struct ShmStateSegment)) {
+        close(fd);
+        throw std::runtime_error("Shared-memory state segment has an unexpected size");
+    }
+
+    // the mapping is writable only so readers can register themselves as futex waiters
+    void *mapping =
+        mmap(nullptr, sizeof(struct ShmStateSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("mmap() failed");
+        throw std::runtime_error("mmap() failed");
+    }
+
+    segment = static_cast<struct ShmStateSegment *>(mapping);
+
+    uint32_t magic = segment->header.magic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (magic != SHM_STATE_MAGIC || segment->header.layout_version != SHM_STATE_LAYOUT_VERSION ||
+        segment->header.slot_count != SHM_STATE_SLOTS ||
+        segment->header.slot_size != sizeof(struct ShmStateSlot)) {
+        munmap(segment, sizeof(struct ShmStateSegment));
+        throw std::runtime_error("Shared-memory state segment has an unexpected layout");
+    }
+}
+
+ShmStateReader::~ShmStateReader() { munmap(segment, sizeof(struct ShmStateSegment)); }
+
+bool ShmStateReader::read(uint8_t sensor_id, struct sensor_packet &packet,
+                          uint32_t *change_seq) const {
+    const struct ShmStateSlot &slot = segment->slots[sensor_id];
+
+    uint32_t before, after, seq;
+    do {
+        before = slot.version.load(std::memory_order_acquire);
+        if (before == 0) return false;
+        if (before & 1) continue;  // writer is busy with this slot
+
+        memcpy(&packet, &slot.packet, sizeof(packet));
+        seq = slot.change_seq;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = slot.version.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    if (change_seq) *change_seq = seq;
+    return true;
+}
+
+uint32_t ShmStateReader::changeSequence() const {
+    return segment->header.change_seq.load(std::memory_order_acquire);
+}
+
+bool ShmStateReader::waitForChange(uint32_t last_seen, int timeout_ms) {
+    struct ShmStateHeader &header = segment->header;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (timeout_ms >= 0) {
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    header.waiters.fetch_add(1, std::memory_order_seq_cst);
+    while (header.change_seq.load(std::memory_order_seq_cst) == last_seen) {
+        struct timespec remaining, *timeout = nullptr;
+        if (timeout_ms >= 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec -= 1;
+                remaining.tv_nsec += 1000000000L;
+            }
+            if (remaining.tv_sec < 0) break;
+            timeout = &remaining;
+        }
+
+        // returns immediately with EAGAIN if the sequence moved on before we went to sleep
+        if (futex(&header.change_seq, FUTEX_WAIT, last_seen, timeout) < 0 && errno == ETIMEDOUT)
+            break;
+    }
+    header.waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+    return header.change_seq.load(std::memory_order_acquire) != last_seen;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file singleflight.cpp
+ * @brief Implementation of the SingleFlight class.
+ * @author Daan Breur
+ */
+
+#include "singleflight.h"
+
+SingleFlight::SingleFlight() : flights(), in_flight(0), requests_sent(0), requests_saved(0) {}
+
+struct sensor_packet SingleFlight::run(const struct sensor_metadata &metadata,
+                                       struct sensor_packet (*read)(const void *context),
+                                       const void *context) {
+    struct Flight &flight = flights[metadata.sensor_id];
+
+    std::unique_lock<std::mutex> lock(flights_mutex);
+
+    if (flight.active && !flight.done && flight.type == metadata.sensor_type) {
+        ++flight.waiters;
+        ++requests_saved;
+
+        flights_condition.wait(lock, [&flight] { return flight.done; });
+        std::exception_ptr error = flight.error;
+        struct sensor_packet response;
+        if (!error) response = *flight.response;
+        if (--flight.waiters == 0) flights_condition.notify_all();
+        lock.unlock();
+
+        if (error) std::rethrow_exception(error);
+        return response;
+    }
+
+    // another type of the same ID, or a flight whose waiters are still copying, cannot be shared
+    bool leading = !flight.active;
+    if (leading) {
+        flight.active = true;
+        flight.type = metadata.sensor_type;
+        flight.done = false;
+        flight.waiters = 0;
+        ++in_flight;
+    }
+    ++requests_sent;
+    lock.unlock();
+
+    struct sensor_packet response;
+    std::exception_ptr error;
+    try {
+        response = read(context);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (!leading) {
+        if (error) std::rethrow_exception(error);
+        return response;
+    }
+
+    lock.lock();
+    flight.done = true;
+    flight.response = &response;
+    flight.error = error;
+    flights_condition.notify_all();
+
+    // the waiters copy the response from this frame, so it has to outlive them
+    flights_condition.wait(lock, [&flight] { return flight.waiters == 0; });
+    flight.active = false;
+    flight.response = nullptr;
+    flight.error = nullptr;
+    --in_flight;
+    lock.unlock();
+
+    if (error) std::rethrow_exception(error);
+    return response;
+}
+
+struct SingleFlightStats SingleFlight::getStats() {
+    std::lock_guard<std::mutex> lock(flights_mutex);
+    return {requests_sent, requests_saved, in_flight};
+}
@@ -7,72 +7,198 @@
 #include "slavemanager.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <stdexcept>
 
+#include "framing.h"
+#include "latency.h"
 #include "packets.h"
+#include "tracer.h"
 
 bool SlaveDevice::isConnected() const { return (-1 != fd); }
 void SlaveDevice::setSensorData(const struct sensor_packet& pkt) {
     memcpy(&sensor_data, &pkt, sizeof(sensor_data));
 }
 
-SlaveManager::SlaveManager() {
-    for (int i = 0; i <= MAX_SLAVE_ID; ++i) {
-        slave_devices[i].fd = -1;
-    }
+SlaveManager::SlaveManager(size_t capacity)
+    : slot_index(new std::atomic<uint16_t>[MAX_SLAVE_ID + 1]),
+      capacity(0),
+      device_count(0),
+      refused(0),
+      capture(nullptr) {
+    for (int i = 0; i <= MAX_SLAVE_ID; ++i) slot_index[i].store(0, std::memory_order_relaxed);
+    setCapacity(capacity);
 }
 
 SlaveManager::~SlaveManager() {
-    for (int i = 0; i <= MAX_SLAVE_ID; ++i) {
-        if (slave_devices[i].fd >= 0) {
+    size_t count = device_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (slave_devices[i].fd >= 0 && !slave_devices[i].udp) {
             close(slave_devices[i].fd);
             slave_devices[i].fd = -1;
         }
     }
 }
 
-void SlaveManager::registerSlave(uint8_t slave_id, int fd) {
+SlaveDevice* SlaveManager::findDevice(uint16_t slave_id) const {
+    uint16_t slot = slot_index[slave_id].load(std::memory_order_acquire);
+    return slot ? &slave_devices[slot - 1] : nullptr;
+}
+
+SlaveDevice* SlaveManager::findOrAddDevice(uint16_t slave_id) {
+    SlaveDevice* device = findDevice(slave_id);
+    if (device) return device;
+
+    std::lock_guard<std::mutex> lock(insert_mutex);
+
+    // someone else may have added it while we were waiting for the lock
+    device = findDevice(slave_id);
+    if (device) return device;
+
+    size_t slot = device_count.load(std::memory_order_relaxed);
+    if (slot >= capacity) {
+        refused.fetch_add(1, std::memory_order_relaxed);
+        printf("Device table full, ignoring slave ID=%u\n", slave_id);
+        return nullptr;
+    }
+
+    slave_devices[slot] = SlaveDevice();
+    slave_ids[slot] = slave_id;
+    device_count.store(slot + 1, std::memory_order_release);
+    slot_index[slave_id].store(slot + 1, std::memory_order_release);
+    return &slave_devices[slot];
+}
+
+void SlaveManager::setCapacity(size_t new_capacity) {
+    if (new_capacity == 0 || new_capacity > MAX_SLAVE_ID)
+        throw std::invalid_argument("Invalid device table capacity");
+    if (device_count.load() > 0)
+        throw std::logic_error("Cannot resize the device table once devices are known");
+
+    slave_devices.reset(new SlaveDevice[new_capacity]);
+    slave_ids.reset(new uint16_t[new_capacity]);
+    capacity = new_capacity;
+}
+
+size_t SlaveManager::reservedBytes(size_t capacity) {
+    return capacity * (sizeof(SlaveDevice) + sizeof(uint16_t)) +
+           (MAX_SLAVE_ID + 1) * sizeof(std::atomic<uint16_t>);
+}
+
+struct SlaveManagerStats SlaveManager::getStats() const {
+    return {device_count.load(std::memory_order_acquire), capacity,
+            refused.load(std::memory_order_relaxed)};
+}
+
+void SlaveManager::registerSlave(uint16_t slave_id, int fd, bool extended_ids) {
     if (slave_id > MAX_SLAVE_ID || slave_id < 0) {
         printf("Invalid slave ID=%u\n", slave_id);
         throw std::invalid_argument("Invalid slave ID");
     }
 
+    SlaveDevice* device = findOrAddDevice(slave_id);
+    if (!device) return;
+
     printf("Registering new slave ID=%u\n", slave_id);
 
-    slave_devices[slave_id].fd = fd;
-    memset(&slave_devices[slave_id].sensor_data, 0, sizeof(slave_devices[slave_id].sensor_data));
+    device->fd = fd;
+    device->udp = false;
+    device->extended_ids = extended_ids;
+    memset(&device->sensor_data, 0, sizeof(device->sensor_data));
 }
 
-void SlaveManager::unregisterSlave(uint8_t slave_id) {
+void SlaveManager::registerUdpSlave(uint16_t slave_id, int udp_fd,
+                                    const struct sockaddr_in& address) {
+    if (slave_id > MAX_SLAVE_ID || slave_id < 0) {
+        printf("Invalid slave ID=%u\n", slave_id);
+        throw std::invalid_argument("Invalid slave ID");
+    }
+
+    SlaveDevice* device = findOrAddDevice(slave_id);
+    if (!device) return;
+
+    // heartbeats arrive constantly over UDP, only (re)register when the address actually changed
+    if (device->udp && device->fd == udp_fd &&
+        device->udp_address.sin_addr.s_addr == address.sin_addr.s_addr &&
+        device->udp_address.sin_port == address.sin_port) {
+        return;
+    }
+
+    printf("Registering new UDP slave ID=%u at %s:%d\n", slave_id, inet_ntoa(address.sin_addr),
+           ntohs(address.sin_port));
+
+    device->fd = udp_fd;
+    device->udp = true;
+    device->udp_address = address;
+    device->extended_ids = false;
+    memset(&device->sensor_data, 0, sizeof(device->sensor_data));
+}
+
+void SlaveManager::unregisterSlave(uint16_t slave_id) {
     if (slave_id > MAX_SLAVE_ID || slave_id < 0) {
         printf("Invalid slave ID=%u\n", slave_id);
         throw std::invalid_argument("Invalid slave ID");
     }
 
     printf("Unregistering slave ID=%u\n", slave_id);
-    close(slave_devices[slave_id].fd);
-    slave_devices[slave_id].fd = -1;
+    SlaveDevice* device = findDevice(slave_id);
+    if (!device) return;
+
+    if (!device->udp) close(device->fd);
+    device->fd = -1;
+    device->udp = false;
+}
+
+std::vector<uint16_t> SlaveManager::detachConnection(int fd) {
+    std::vector<uint16_t> detached;
+    size_t count = device_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        SlaveDevice& device = slave_devices[i];
+        if (device.udp || device.fd != fd) continue;
+
+        printf("Slave ID=%u disconnected\n", slave_ids[i]);
+        device.fd = -1;
+        detached.push_back(slave_ids[i]);
+    }
+    return detached;
 }
 
-int SlaveManager::sendToSlave(uint8_t slave_id, const void* data, size_t length) {
+void SlaveManager::setCapture(CaptureWriter* writer) { capture = writer; }
+
+int SlaveManager::sendToSlave(uint16_t slave_id, const void* data, size_t length) {
     if (slave_id > MAX_SLAVE_ID || slave_id < 0) {
         printf("Invalid slave ID=%u\n", slave_id);
         throw std::invalid_argument("Invalid slave ID");
     }
 
     printf("Sending %zu bytes to slave ID=%u\n", length, slave_id);
-    if (slave_devices[slave_id].fd < 0) {
+    const SlaveDevice* device = findDevice(slave_id);
+    if (!device || device->fd < 0) {
         printf("Slave ID=%u not registered\n", slave_id);
         return -1;
     }
 
-    ssize_t bytes_sent = send(slave_devices[slave_id].fd, data, length, 0);
+    ssize_t bytes_sent;
+    uint64_t sending_ns = monotonicNanoseconds();
+    if (device->udp) {
+        bytes_sent = sendto(device->fd, data, length, 0,
+                            (const struct sockaddr*)&device->udp_address,
+                            sizeof(device->udp_address));
+    } else {
+        bytes_sent = send(device->fd, data, length, 0);
+        if (bytes_sent > 0 && capture)
+            capture->record(CaptureEvent::CLIENT_OUT, device->fd, data, bytes_sent);
+    }
+    Latency::recordSince(LatencyStage::SEND, sending_ns);
     if (bytes_sent < 0) {
         perror("send to slave failed");
         return -1;
@@ -81,19 +207,159 @@ int SlaveManager::sendToSlave(uint8_t slave_id, const void* data, size_t length)
     return 0;
 }
 
-int SlaveManager::getSlaveFD(uint8_t slave_id) const {
+int SlaveManager::sendToSlave(uint16_t slave_id, const PacketView& packet) {
+    const SlaveDevice* device = findDevice(slave_id);
+    bool extended_ids = device && device->extended_ids;
+
+    // devices that never negotiated 16-bit IDs cannot be addressed beyond 8 bits
+    if (slave_id > MAX_BASIC_SLAVE_ID && !extended_ids) {
+        printf("Slave ID=%u not reachable\n", slave_id);
+        return -1;
+    }
+
+    uint8_t frame[MAX_FRAME_SIZE];
+    size_t length = encodeFrame(packet, slave_id, extended_ids, frame);
+    return sendToSlave(slave_id, frame, length);
+}
+
+std::vector<int> SlaveManager::sendToSlaves(const std::vector<uint16_t>& slave_ids,
+                                            const PacketView& packet, int timeout_ms) {
+    /** @brief The frames of all devices on one connection, sent as one write */
+    struct PendingWrite {
+        int fd;
+        std::vector<uint8_t> frames;
+        size_t sent;
+        std::vector<size_t> members;
+    };
+
+    std::vector<int> results(slave_ids.size(), -1);
+    std::vector<struct PendingWrite> writes;
+    uint8_t frame[MAX_FRAME_SIZE];
+
+    for (size_t i = 0; i < slave_ids.size(); ++i) {
+        const SlaveDevice* device = findDevice(slave_ids[i]);
+        if (!device || device->fd < 0) continue;
+        if (slave_ids[i] > MAX_BASIC_SLAVE_ID && !device->extended_ids) continue;
+        size_t length = encodeFrame(packet, slave_ids[i], device->extended_ids, frame);
+
+        if (device->udp) {
+            if (sendto(device->fd, frame, length, MSG_DONTWAIT,
+                       (const struct sockaddr*)&device->udp_address,
+                       sizeof(device->udp_address)) == (ssize_t)length)
+                results[i] = 0;
+            continue;
+        }
+
+        auto write = std::find_if(writes.begin(), writes.end(), [device](const PendingWrite& w) {
+            return w.fd == device->fd;
+        });
+        if (write == writes.end()) write = writes.insert(writes.end(), {device->fd, {}, 0, {}});
+        write->frames.insert(write->frames.end(), frame, frame + length);
+        write->members.push_back(i);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::vector<struct pollfd> waiting;
+    while (!writes.empty()) {
+        waiting.clear();
+        for (size_t w = 0; w < writes.size();) {
+            struct PendingWrite& write = writes[w];
+            ssize_t sent = send(write.fd, write.frames.data() + write.sent,
+                                write.frames.size() - write.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent > 0) {
+                if (capture)
+                    capture->record(CaptureEvent::CLIENT_OUT, write.fd,
+                                    write.frames.data() + write.sent, sent);
+                write.sent += sent;
+            }
+
+            bool blocked = sent >= 0 || errno == EAGAIN || errno == EWOULDBLOCK;
+            if (write.sent == write.frames.size() || !blocked) {
+                if (write.sent == write.frames.size())
+                    for (size_t member : write.members) results[member] = 0;
+                writes.erase(writes.begin() + w);
+                continue;
+            }
+            waiting.push_back({write.fd, POLLOUT, 0});
+            ++w;
+        }
+        if (writes.empty()) break;
+
+        int wait_ms = std::chrono::ceil<std::chrono::milliseconds>(
+                          deadline - std::chrono::steady_clock::now())
+                          .count();
+        if (wait_ms <= 0) break;
+        poll(waiting.data(), waiting.size(), wait_ms);
+    }
+
+    for (struct PendingWrite& write : writes) {
+        if (write.sent == 0) continue;
+
+        // a frame cut in half would garble the stream and waiting for the rest would hold up the
+        // caller, so the connection is dropped; its worker closes it and the devices reconnect
+        printf("Connection fd=%d too slow to take its frames, shutting it down\n", write.fd);
+        shutdown(write.fd, SHUT_RDWR);
+    }
+    return results;
+}
+
+int SlaveManager::getSlaveFD(uint16_t slave_id) const {
     if (slave_id > MAX_SLAVE_ID || slave_id < 0) {
         printf("Invalid slave ID=%u\n", slave_id);
         throw std::invalid_argument("Invalid slave ID");
     }
 
-    return slave_devices[slave_id].fd;
+    const SlaveDevice* device = findDevice(slave_id);
+    return device ? device->fd : -1;
 }
 
-void SlaveManager::updateSlaveState(uint8_t slave_id, const struct sensor_packet& packet) {
-    slave_devices[slave_id].setSensorData(packet);
+void SlaveManager::updateSlaveState(uint16_t slave_id, const struct sensor_packet& packet) {
+    SlaveDevice* device = findOrAddDevice(slave_id);
+    if (!device) return;
+
+    device->setSensorData(packet);
+    TRACE_POINT(slave_state_updated, SLAVE_STATE_UPDATED, slave_id, packet.header.length);
 }
 
-struct sensor_packet SlaveManager::getSlaveState(uint8_t slave_id) {
-    return slave_devices[slave_id].sensor_data;
+struct sensor_packet SlaveManager::getSlaveState(uint16_t slave_id) const {
+    const SlaveDevice* device = findDevice(slave_id);
+    if (!device) return {};
+
+    return device->sensor_data;
+}
+
+std::vector<struct SlaveSnapshot> SlaveManager::snapshot() const {
+    std::vector<struct SlaveSnapshot> snapshots;
+
+    size_t count = device_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        const SlaveDevice& device = slave_devices[i];
+        if (device.fd < 0 && device.sensor_data.header.length == 0) continue;
+
+        struct SlaveSnapshot snapshot;
+        snapshot.slave_id = slave_ids[i];
+        snapshot.fd = device.fd;
+        snapshot.udp = device.udp;
+        snapshot.udp_address = device.udp_address;
+        snapshot.sensor_data = device.sensor_data;
+        snapshot.extended_ids = device.extended_ids;
+        snapshots.push_back(snapshot);
+    }
+
+    std::sort(snapshots.begin(), snapshots.end(),
+              [](const struct SlaveSnapshot& a, const struct SlaveSnapshot& b) {
+                  return a.slave_id < b.slave_id;
+              });
+    return snapshots;
+}
+
+void SlaveManager::restore(const struct SlaveSnapshot& snapshot) {
+    SlaveDevice* device = findOrAddDevice(snapshot.slave_id);
+    if (!device) return;
+
+    device->fd = snapshot.fd;
+    device->udp = snapshot.udp && snapshot.fd >= 0;
+    device->udp_address = snapshot.udp_address;
+    device->extended_ids = snapshot.extended_ids;
+    device->setSensorData(snapshot.sensor_data);
 }
@@ -0,0 +1,186 @@
+/**
+ * @file tracer.cpp
+ * @brief Implementation of the Tracer class.
+ * @author Daan Breur
+ */
+
+#include "tracer.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <stdexcept>
+
+#include "latency.h"
+
+std::atomic<bool> Tracer::enabled(false);
+std::atomic<uint64_t> Tracer::request_counter(0);
+std::atomic<unsigned int> Tracer::sample_every(1);
+std::mutex Tracer::events_mutex;
+std::unique_ptr<RingBuffer<struct TraceEvent>> Tracer::events;
+
+/**
+ * @brief The request currently handled by this thread, 0 if it is not sampled.
+ */
+static thread_local uint64_t current_trace_id = 0;
+static thread_local uint64_t current_start_ns = 0;
+static thread_local PacketType current_packet_type = PacketType::DATA;
+static thread_local uint16_t current_sensor_id = 0;
+
+static uint32_t threadId() {
+    static thread_local uint32_t thread_id = syscall(SYS_gettid);
+    return thread_id;
+}
+
+static const char *stageName(TraceStage stage) {
+    switch (stage) {
+        case TraceStage::FRAME_PARSED:
+            return "frame_parsed";
+        case TraceStage::HUB_REQUEST_SENT:
+            return "hub_request_sent";
+        case TraceStage::HUB_RESPONSE_DEQUEUED:
+            return "hub_response_dequeued";
+        case TraceStage::DASHBOARD_SENT:
+            return "dashboard_sent";
+        case TraceStage::SLAVE_STATE_UPDATED:
+            return "slave_state_updated";
+    }
+    return "unknown";
+}
+
+static const char *packetTypeName(PacketType packet_type) {
+    switch (packet_type) {
+        case PacketType::DATA:
+            return "DATA";
+        case PacketType::HEARTBEAT:
+            return "HEARTBEAT";
+        case PacketType::DASHBOARD_POST:
+            return "DASHBOARD_POST";
+        case PacketType::DASHBOARD_GET:
+            return "DASHBOARD_GET";
+        case PacketType::DASHBOARD_RESPONSE:
+            return "DASHBOARD_RESPONSE";
+        case PacketType::DASHBOARD_ERROR:
+            return "DASHBOARD_ERROR";
+        case PacketType::HELLO:
+            return "HELLO";
+        case PacketType::AGGREGATE_QUERY:
+            return "AGGREGATE_QUERY";
+        case PacketType::AGGREGATE_RESPONSE:
+            return "AGGREGATE_RESPONSE";
+        case PacketType::GROUP_POST:
+            return "GROUP_POST";
+        case PacketType::GROUP_RESULT:
+            return "GROUP_RESULT";
+        case PacketType::POST_ACK:
+            return "POST_ACK";
+    }
+    return "UNKNOWN";
+}
+
+void Tracer::enable(unsigned int every, size_t capacity) {
+    if (every == 0) throw std::invalid_argument("Sample rate must not be zero");
+
+    std::lock_guard<std::mutex> lock(events_mutex);
+    events = std::make_unique<RingBuffer<struct TraceEvent>>(capacity);
+    sample_every.store(every, std::memory_order_relaxed);
+    enabled.store(true, std::memory_order_release);
+}
+
+void Tracer::disable() {
+    enabled.store(false, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(events_mutex);
+    events.reset();
+}
+
+void Tracer::record(const struct TraceEvent &event) {
+    std::lock_guard<std::mutex> lock(events_mutex);
+    if (events) events->pushOverwrite(event);
+}
+
+void Tracer::beginRequest(PacketType packet_type, uint16_t sensor_id) {
+    uint64_t request = request_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (request % sample_every.load(std::memory_order_relaxed) != 0) {
+        current_trace_id = 0;
+        return;
+    }
+
+    current_trace_id = request;
+    current_start_ns = monotonicNanoseconds();
+    current_packet_type = packet_type;
+    current_sensor_id = sensor_id;
+}
+
+void Tracer::endRequest() {
+    if (current_trace_id == 0) return;
+
+    struct TraceEvent event;
+    event.trace_id = current_trace_id;
+    event.timestamp_ns = current_start_ns;
+    event.duration_ns = monotonicNanoseconds() - current_start_ns;
+    event.thread_id = threadId();
+    event.request_span = true;
+    event.stage = TraceStage::FRAME_PARSED;
+    event.packet_type = current_packet_type;
+    event.sensor_id = current_sensor_id;
+    record(event);
+
+    current_trace_id = 0;
+}
+
+void Tracer::stage(TraceStage stage, uint16_t sensor_id) {
+    if (current_trace_id == 0) return;
+
+    struct TraceEvent event;
+    event.trace_id = current_trace_id;
+    event.timestamp_ns = monotonicNanoseconds();
+    event.duration_ns = 0;
+    event.thread_id = threadId();
+    event.request_span = false;
+    event.stage = stage;
+    event.packet_type = current_packet_type;
+    event.sensor_id = sensor_id;
+    record(event);
+}
+
+size_t Tracer::dumpChromeTrace(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        perror("fopen() failed");
+        throw std::runtime_error("Could not open trace file");
+    }
+
+    size_t written = 0;
+    pid_t pid = getpid();
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    {
+        std::lock_guard<std::mutex> lock(events_mutex);
+        if (events) {
+            events->forEach([&](const struct TraceEvent &event) {
+                // Chrome expects timestamps and durations in microseconds
+                fprintf(file, "%s\n{\"cat\":\"wemos\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,",
+                        written ? "," : "", (int)pid, event.thread_id,
+                        event.timestamp_ns / 1000.0);
+
+                if (event.request_span) {
+                    fprintf(file, "\"ph\":\"X\",\"name\":\"%s\",\"dur\":%.3f,",
+                            packetTypeName(event.packet_type), event.duration_ns / 1000.0);
+                } else {
+                    fprintf(file, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\",",
+                            stageName(event.stage));
+                }
+
+                fprintf(file, "\"args\":{\"trace_id\":%llu,\"sensor_id\":%u}}",
+                        (unsigned long long)event.trace_id, event.sensor_id);
+                ++written;
+            });
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) throw std::runtime_error("Could not write trace file");
+    return written;
+}
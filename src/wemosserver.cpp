@@ -12,153 +12,1350 @@
 
 #include <arpa/inet.h>
 #include <asm-generic/socket.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
-#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <thread>
 
+#include "framing.h"
+#include "httpapi.h"
 #include "packets.h"
+#include "shmstate.h"
 #include "slavemanager.h"
+#include "tracer.h"
 
 /**
- * @brief Maximum data size to be read or sent over the wire.
+ * @brief Maximum number of pending connections that have not been accepted yet.
  */
-#define BUFFER_SIZE 1024
+#define MAX_CLIENTS 128
+
+/**
+ * @brief Maximum number of datagrams read from the UDP socket with a single recvmmsg() call.
+ */
+#define UDP_BATCH_SIZE 16
+
+/**
+ * @brief Maximum size of a single UDP datagram; anything longer gets truncated and discarded.
+ */
+#define UDP_DATAGRAM_SIZE 512
+
+/**
+ * @brief Interval at which worker threads check whether they should stop reading.
+ */
+#define CLIENT_POLL_INTERVAL_MS 200
+
+/**
+ * @brief Maximum number of events handled by a worker per epoll_wait() call.
+ */
+#define WORKER_EVENT_BATCH 32
+
+/**
+ * @brief Connection features this server agrees to when a client asks for them with HELLO.
+ */
+#define SUPPORTED_FEATURES (FEATURE_EXTENDED_IDS | FEATURE_CLUSTER_PEER)
+
+/**
+ * @brief Returns the budget a request of the binary protocol is admitted against.
+ */
+static RateClass rateClassFor(PacketType ptype, uint16_t sensor_id) {
+    bool hub_bound = (ptype == PacketType::DASHBOARD_GET || ptype == PacketType::DASHBOARD_POST) &&
+                     sensor_id <= MAX_HUB_SENSOR_ID;
+    // a group may reach every hub at once
+    return hub_bound || ptype == PacketType::GROUP_POST ? RateClass::HUB : RateClass::LOCAL;
+}
+
+/**
+ * @brief Returns the current time in milliseconds since the epoch, the clock of the aggregates.
+ */
+static uint64_t wallClockMilliseconds() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Returns the budget an HTTP request is admitted against.
+ * @details Reads are served from the JSON cache; only writes to hub sensors reach the I2C bus.
+ */
+static RateClass httpRateClass(const struct HttpRequest &request) {
+    const char prefix[] = "/sensors/";
+    if (request.method != HttpMethod::POST || strncmp(request.path, prefix, sizeof(prefix) - 1))
+        return RateClass::LOCAL;
+
+    char *end;
+    unsigned long sensor_id = strtoul(request.path + sizeof(prefix) - 1, &end, 10);
+    return *end == '\0' && sensor_id <= MAX_HUB_SENSOR_ID ? RateClass::HUB : RateClass::LOCAL;
+}
+
+/**
+ * @brief Size of a receive buffer block for the given configuration.
+ * @details Leaves room for a whole struct sensor_packet behind the last byte, so a packet at the
+ * end of the buffer can be accessed through a struct sensor_packet pointer.
+ */
+static size_t receiveBlockSize(const struct ServerConfig &config) {
+    return config.receive_buffer_size + sizeof(struct sensor_packet);
+}
+
+/**
+ * @brief Number of hub transaction records for the given configuration.
+ * @details Enough for a full executor queue, a transaction on every thread and as many answers
+ * waiting for their workers; a transaction that finds none left is refused like one that finds
+ * the queue full.
+ */
+static size_t hubTransactionCapacity(const struct ServerConfig &config) {
+    return 2 * HUB_EXECUTOR_QUEUE_CAPACITY + config.hub_threads;
+}
+
+/**
+ * @brief Memory reserved by the pools for the given configuration, in bytes.
+ */
+static size_t poolFootprint(const struct ServerConfig &config, size_t hub_count) {
+    return BlockPool::reservedBytes(sizeof(struct Connection), config.max_connections) +
+           BlockPool::reservedBytes(receiveBlockSize(config), config.max_connections) +
+           hub_count * config.hub_queue_capacity * sizeof(struct sensor_packet) +
+           SlaveManager::reservedBytes(config.max_devices) +
+           BlockPool::reservedBytes(sizeof(struct HubTransaction), hubTransactionCapacity(config));
+}
+
+/**
+ * @brief Makes every thread started from now on use the given stack size.
+ * @details The threads of the server, the hubs and the dispatchers are all std::threads, which
+ * take their stack size from the process-wide default attributes.
+ */
+static void applyThreadStackSize(size_t stack_size) {
+    if (stack_size == 0) return;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    int err = pthread_attr_setstacksize(&attr, stack_size);
+    if (err == 0) err = pthread_setattr_default_np(&attr);
+    pthread_attr_destroy(&attr);
+    if (err != 0) throw std::runtime_error("Could not set the thread stack size");
+}
+
+// private methods start here
+void WemosServer::startWorkers() {
+    while (worker_epoll_fds.size() < config.worker_threads) {
+        int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            perror("epoll_create1() failed");
+            throw std::runtime_error("epoll_create1() failed");
+        }
+        worker_epoll_fds.push_back(epoll_fd);
+
+        // the answers of hub transactions wake the worker up like a client does
+        auto mailbox =
+            std::make_unique<struct WorkerMailbox>(transaction_pool->getStats().capacity);
+        mailbox->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        if (mailbox->event_fd < 0 ||
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mailbox->event_fd, &event) < 0) {
+            perror("Setting up a worker mailbox failed");
+            if (mailbox->event_fd >= 0) close(mailbox->event_fd);
+            throw std::runtime_error("Setting up a worker mailbox failed");
+        }
+        mailboxes.push_back(std::move(mailbox));
+    }
+
+    serving = true;
+    for (size_t i = 0; i < worker_epoll_fds.size(); ++i) {
+        workers.emplace_back(&WemosServer::workerLoop, this, i);
+    }
+}
+
+void WemosServer::stopWorkers() {
+    serving = false;
+    for (std::thread &worker : workers) worker.join();
+    workers.clear();
+}
+
+void WemosServer::workerLoop(size_t worker) {
+    struct epoll_event events[WORKER_EVENT_BATCH];
+
+    // wake up regularly, so a hot restart never has to wait for quiet clients
+    while (serving) {
+        int ready = epoll_wait(worker_epoll_fds[worker], events, WORKER_EVENT_BATCH,
+                               CLIENT_POLL_INTERVAL_MS);
+        if (ready < 0) {
+            if (errno != EINTR) perror("epoll_wait() failed");
+            continue;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            struct Connection *conn = static_cast<struct Connection *>(events[i].data.ptr);
+            if (!conn)
+                completeHubTransactions(worker);
+            else if (!readClient(*conn))
+                closeClient(conn);
+        }
+    }
+}
+
+bool WemosServer::addClient(const struct HandoffClient &client) {
+    int client_fd = client.fd;
+    const struct sockaddr_in &client_address = client.address;
+    // the receive buffer of this process may be smaller than that of the previous one
+    if (client.pending.size() > config.receive_buffer_size) {
+        printf("Dropping %s:%d, its %zu pending bytes do not fit the receive buffer\n",
+               inet_ntoa(client_address.sin_addr), ntohs(client_address.sin_port),
+               client.pending.size());
+        return false;
+    }
+
+    struct Connection *conn = connection_pool->acquire();
+    uint8_t *buffer = conn ? static_cast<uint8_t *>(buffer_pool->acquire()) : nullptr;
+    if (!buffer) {
+        if (conn) connection_pool->release(conn);
+        printf("Connection limit of %zu reached, refusing %s:%d\n", config.max_connections,
+               inet_ntoa(client_address.sin_addr), ntohs(client_address.sin_port));
+        return false;
+    }
+
+    conn->fd = client_fd;
+    conn->address = client_address;
+    conn->buffer = buffer;
+    conn->buffered = client.pending.size();
+    if (conn->buffered > 0) memcpy(buffer, client.pending.data(), conn->buffered);
+    conn->extended_ids = client.extended_ids;
+    conn->http = client.http;
+    conn->cluster_peer = client.cluster_peer;
+    conn->http_request = client.http_request;
+    admission.resetBuckets(conn->budgets);
+    memset(&conn->received, 0, sizeof(conn->received));
+    enableReceiveTimestamps(client_fd);
+    conn->worker = next_worker++ % worker_epoll_fds.size();
+    conn->hub_transactions = 0;
+    conn->closing = false;
+
+    // HTTP traffic cannot be replayed against the binary protocol, so it is not captured
+    if (capture && !client.http) capture->record(CaptureEvent::CLIENT_OPEN, client_fd);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = conn;
+
+    if (epoll_ctl(worker_epoll_fds[conn->worker], EPOLL_CTL_ADD, client_fd, &event) < 0) {
+        perror("epoll_ctl() failed");
+        buffer_pool->release(buffer);
+        connection_pool->release(conn);
+        return false;
+    }
+
+    return true;
+}
+
+void WemosServer::acceptClient(int listen_fd, bool http) {
+    struct sockaddr_in client_address;
+    socklen_t client_addr_len = sizeof(client_address);
+    int client_fd = accept(listen_fd, (struct sockaddr *)&client_address, &client_addr_len);
+
+    if (-1 == client_fd) {
+        // no one tried to connect
+        return;
+    }
+
+    struct HandoffClient client;
+    client.fd = client_fd;
+    client.address = client_address;
+    client.http = http;
+    if (!addClient(client)) {
+        close(client_fd);
+        return;
+    }
+
+    printf("Connection accepted from %s:%d%s\n", inet_ntoa(client_address.sin_addr),
+           ntohs(client_address.sin_port), http ? " (HTTP)" : "");
+}
+
+void WemosServer::closeClient(struct Connection *conn) {
+    if (capture && !conn->http) capture->record(CaptureEvent::CLIENT_CLOSE, conn->fd);
+
+    // closing the descriptor removes it from the epoll instance it belongs to
+    for (uint16_t slave_id : slave_manager.detachConnection(conn->fd)) {
+        if (replication) replication->markDirty(slave_id);
+    }
+    close(conn->fd);
+
+    // the hub transactions still running for the client hold on to the connection
+    if (conn->hub_transactions > 0) {
+        conn->closing = true;
+        return;
+    }
+    releaseClient(conn);
+}
+
+void WemosServer::releaseClient(struct Connection *conn) {
+    buffer_pool->release(conn->buffer);
+    connection_pool->release(conn);
+}
+
+struct HubTransaction *WemosServer::beginHubTransaction(HubTask task, struct Connection *conn,
+                                                        const PacketView &request,
+                                                        uint16_t sensor_id) {
+    struct HubTransaction *transaction = transaction_pool->acquire();
+    if (!transaction) return nullptr;
+
+    transaction->task = task;
+    transaction->conn = conn;
+    request.copyTo(transaction->request);
+    transaction->metadata = request.metadata();
+    transaction->sensor_id = sensor_id;
+    transaction->from_peer = conn && conn->cluster_peer;
+    transaction->deadline = std::chrono::steady_clock::now() + hub_timeout;
+    transaction->received = {};
+    if (conn) transaction->received = conn->received;
+    transaction->keep_alive = false;
+    transaction->succeeded = false;
+    transaction->reply_length = 0;
+    return transaction;
+}
+
+bool WemosServer::submitHubTransaction(struct HubTransaction *transaction) {
+    if (!transaction) return false;
+
+    if (!hub_executor.submit(transaction)) {
+        transaction_pool->release(transaction);
+        return false;
+    }
+    if (transaction->conn) ++transaction->conn->hub_transactions;
+    return true;
+}
+
+void WemosServer::runHubTransaction(struct HubTransaction &transaction) {
+    PacketView request(transaction.request);
+    uint16_t s_id = transaction.sensor_id;
+
+    switch (transaction.task) {
+        case HubTask::READ:
+            try {
+                // dashboards refreshing at the same time share a single hub transaction
+                struct sensor_packet response = hub_reads.read(transaction.metadata, [&]() {
+                    I2CClient &hub = hub_router.hubFor(s_id);
+                    // held until the response is in, which measures the round trip
+                    HubScheduler::Slot slot(hub_router.schedulerFor(s_id), hubPriorityFor(request),
+                                            transaction.deadline);
+                    hub.sendRawData(request.data(), request.size());
+
+#ifndef WEMOS_LOW_FOOTPRINT
+                    printf("incoming data: ");
+                    for (size_t i = 0; i < request.size(); ++i) {
+                        printf("%02X ", request.data()[i]);
+                    }
+                    printf("\n");
+#endif
+
+                    struct sensor_packet response =
+                        hub.retrievePacketFor(transaction.metadata.sensor_id, transaction.deadline);
+                    slot.completed();
+                    return response;
+                });
+
+                // remembered, so it can be served while the hub is down
+                updateState(s_id, response);
+
+                PacketView frame(response);
+                memcpy(transaction.reply, frame.data(), frame.size());
+                transaction.reply_length = frame.size();
+                transaction.succeeded = true;
+            } catch (std::runtime_error &exc) {
+                printf("I2C hub unavailable (%s), serving last known state\n", exc.what());
+            }
+            break;
+
+        case HubTask::POST:
+            transaction.succeeded = postToSensor(request, s_id);
+            break;
+
+        case HubTask::GROUP_POST:
+            transaction.reply_length =
+                postToGroup(request, s_id, transaction.from_peer, transaction.reply);
+            transaction.succeeded = true;
+            break;
+
+        case HubTask::BUTTON_TOGGLE:
+            try {
+                struct sensor_packet &led_state = transaction.request;
+                I2CClient &hub = hub_router.hubFor(s_id);
+                HubScheduler::Slot slot(hub_router.schedulerFor(s_id), HubPriority::ACTUATION,
+                                        transaction.deadline);
+                hub.sendRawData((uint8_t*)&led_state, sizeof(struct sensor_header) + led_state.header.length);
+                led_state.data.light.target_state = !hub.retrievePacketFor(s_id, transaction.deadline).data.light.target_state;
+                slot.completed();
+                printf("led state = %hhu\n", led_state.data.light.target_state);
+
+                led_state.header.ptype = PacketType::DASHBOARD_POST;
+                hub.sendRawData((uint8_t*)&led_state, sizeof(struct sensor_header) + led_state.header.length);
+                transaction.succeeded = true;
+            } catch (std::runtime_error &exc) {
+                printf("I2C hub unavailable (%s), ignoring button press\n", exc.what());
+            }
+            break;
+
+        case HubTask::FORWARD_READ:
+        case HubTask::FORWARD_HTTP_READ:
+            try {
+                struct sensor_packet response = cluster.ownerOf(s_id)->call(request, s_id);
+                PacketView frame(response);
+                memcpy(transaction.reply, frame.data(), frame.size());
+                transaction.reply_length = frame.size();
+                transaction.succeeded = true;
+            } catch (std::runtime_error &exc) {
+                printf("Cluster bridge unavailable (%s)\n", exc.what());
+            }
+            break;
+    }
+
+    if (!transaction.conn) {
+        transaction_pool->release(&transaction);
+        return;
+    }
+
+    struct WorkerMailbox &mailbox = *mailboxes[transaction.conn->worker];
+    {
+        std::lock_guard<std::mutex> lock(mailbox.mutex);
+        mailbox.completions.pushOverwrite(&transaction);
+    }
+    uint64_t one = 1;
+    if (write(mailbox.event_fd, &one, sizeof(one)) < 0) perror("write() to eventfd failed");
+}
+
+void WemosServer::finishHubTransaction(struct HubTransaction &transaction) {
+    struct Connection &conn = *transaction.conn;
+    --conn.hub_transactions;
+    if (conn.closing) {
+        if (conn.hub_transactions == 0) releaseClient(&conn);
+        transaction_pool->release(&transaction);
+        return;
+    }
+
+    PacketView reply(transaction.reply, transaction.reply_length);
+    switch (transaction.task) {
+        case HubTask::READ:
+            if (transaction.succeeded) {
+                printf("sending back to dashboard :D\n");
+                sendToDashboard(conn, reply, transaction.sensor_id);
+            } else {
+                sendLastKnownState(conn, transaction.metadata);
+            }
+            break;
+
+        case HubTask::POST:
+            acknowledgePost(conn, transaction.metadata, transaction.sensor_id,
+                            transaction.succeeded ? ErrorCode::NONE : ErrorCode::HUB_UNAVAILABLE);
+            break;
+
+        case HubTask::GROUP_POST:
+            if (transaction.reply_length > 0)
+                sendToDashboard(conn, reply, transaction.sensor_id);
+            else
+                sendErrorToDashboard(conn, transaction.metadata, transaction.sensor_id,
+                                     ErrorCode::UNKNOWN_GROUP);
+            break;
+
+        case HubTask::BUTTON_TOGGLE:
+            break;
+
+        case HubTask::FORWARD_READ:
+            if (transaction.succeeded)
+                sendToDashboard(conn, reply, transaction.sensor_id);
+            else
+                sendErrorToDashboard(conn, transaction.metadata, transaction.sensor_id,
+                                     ErrorCode::NODE_UNAVAILABLE);
+            break;
+
+        case HubTask::FORWARD_HTTP_READ:
+            sendForwardedHttpRead(conn, transaction);
+            break;
+    }
+    bool keep_alive = transaction.keep_alive;
+    if (!conn.http) Latency::recordRequest(transaction.received);
+    transaction_pool->release(&transaction);
+    if (!conn.http) return;
+
+    // the requests pipelined behind the forwarded one are still waiting; while the workers are
+    // stopped for a hot restart, they are handed over unparsed
+    watchClient(conn, true);
+    if (!keep_alive || (serving && !serveHttp(conn))) closeClient(&conn);
+}
+
+void WemosServer::watchClient(struct Connection &conn, bool reading) {
+    struct epoll_event event;
+    event.events = reading ? EPOLLIN : 0;
+    event.data.ptr = &conn;
+    if (epoll_ctl(worker_epoll_fds[conn.worker], EPOLL_CTL_MOD, conn.fd, &event) < 0)
+        perror("epoll_ctl() failed");
+}
+
+void WemosServer::completeHubTransactions(size_t worker) {
+    struct WorkerMailbox &mailbox = *mailboxes[worker];
+    uint64_t signalled;
+    if (read(mailbox.event_fd, &signalled, sizeof(signalled)) < 0 && errno != EAGAIN)
+        perror("read() from eventfd failed");
+
+    while (true) {
+        struct HubTransaction *transaction;
+        {
+            std::lock_guard<std::mutex> lock(mailbox.mutex);
+            if (!mailbox.completions.pop(transaction)) return;
+        }
+        finishHubTransaction(*transaction);
+    }
+}
+
+void WemosServer::startHubExecutor() {
+    hub_executor.start(config.hub_threads, [this](void *transaction) {
+        runHubTransaction(*static_cast<struct HubTransaction *>(transaction));
+    });
+}
+
+void WemosServer::stopHubExecutor() {
+    hub_executor.stop();
+    for (size_t worker = 0; worker < mailboxes.size(); ++worker) completeHubTransactions(worker);
+}
+
+bool WemosServer::readClient(struct Connection &conn) {
+    struct iovec iov = {conn.buffer + conn.buffered, config.receive_buffer_size - conn.buffered};
+    alignas(struct cmsghdr) uint8_t control[RECEIVE_TIMESTAMP_CONTROL_SIZE];
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t bytes_received = recvmsg(conn.fd, &message, 0);
+
+    if (bytes_received == 0) {
+        printf("Connection closed by %s:%d\n", inet_ntoa(conn.address.sin_addr),
+               ntohs(conn.address.sin_port));
+        return false;
+    }
+    if (bytes_received < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return true;
+        perror("recv failed");
+        return false;
+    }
+
+    conn.received = receiveTimestamps(message);
+    Latency::recordReceive(LatencyStage::KERNEL_TO_USER, conn.received);
+
+    if (conn.http) {
+        conn.buffered += bytes_received;
+        return serveHttp(conn);
+    }
+
+    if (capture)
+        capture->record(CaptureEvent::CLIENT_IN, conn.fd, conn.buffer + conn.buffered,
+                        bytes_received);
+
+#ifndef WEMOS_LOW_FOOTPRINT
+    // formatting every byte is more than small gateway hardware can spare, the capture has them
+    printf("Received %zd bytes from %s:%d:\n", bytes_received, inet_ntoa(conn.address.sin_addr),
+           ntohs(conn.address.sin_port));
+
+    for (int i = 0; i < bytes_received; i++) printf("%02X ", conn.buffer[conn.buffered + i]);
+    printf("\n");
+#endif
+
+    conn.buffered += bytes_received;
+
+    size_t offset = 0;
+    while (offset + sizeof(struct sensor_header) <= conn.buffered) {
+        PacketView packet(&conn.buffer[offset], conn.buffered - offset);
+
+        // the rest of the packet arrives with a later read
+        if (!packet.complete()) break;
+        size_t packet_length = packet.frameLength();
+
+        // extended frames are converted to the 8-bit layout, basic ones are read in place
+        struct sensor_packet converted;
+        uint16_t sensor_id = 0;
+        if (conn.extended_ids) {
+            if (!decodeFrame(packet.data(), true, converted, sensor_id)) {
+                printf("Ignoring extended frame without a sensor ID\n");
+                offset += packet_length;
+                continue;
+            }
+            packet = PacketView(converted);
+        } else {
+            packet = packet.frameOnly();
+            sensor_id = packet.sensorId();
+        }
+
+        TRACE_REQUEST_BEGIN(packet.type(), sensor_id);
+        TRACE_POINT(frame_parsed, FRAME_PARSED, sensor_id, conn.fd);
+
+        Latency::recordSince(LatencyStage::PARSE_TO_DISPATCH, conn.received.user_ns);
+        // a request handed to the hub executor is recorded once it is answered
+        if (handleFrame(conn, packet, sensor_id)) Latency::recordRequest(conn.received);
+        offset += packet_length;
+
+        TRACE_REQUEST_END();
+    }
+
+    conn.buffered -= offset;
+    if (conn.buffered > 0 && offset > 0) memmove(conn.buffer, conn.buffer + offset, conn.buffered);
+
+    return true;
+}
+
+bool WemosServer::handleFrame(struct Connection &conn, const PacketView &packet,
+                              uint16_t sensor_id) {
+    int client_fd = conn.fd;
+    uint8_t data_length = packet.length();
+    PacketType ptype = packet.type();
+    SensorType s_type = packet.sensorType();
+    struct sensor_metadata metadata = packet.metadata();
+    uint16_t s_id = sensor_id;
+
+    // rejected before any work is done, so a flooding client cannot queue up in front of the hub;
+    // requests forwarded by another bridge were admitted there already
+    if (ptype != PacketType::HELLO && ptype != PacketType::HEARTBEAT && !conn.cluster_peer &&
+        !admission.admit(conn.budgets, conn.address.sin_addr, rateClassFor(ptype, s_id))) {
+        if (ptype == PacketType::DASHBOARD_GET || ptype == PacketType::DASHBOARD_POST ||
+            ptype == PacketType::AGGREGATE_QUERY || ptype == PacketType::GROUP_POST)
+            sendErrorToDashboard(conn, metadata, s_id, ErrorCode::RATE_LIMITED);
+        return true;
+    }
+
+    // a request that was forwarded once is served here, even if the maps of the bridges disagree
+    if ((ptype == PacketType::DASHBOARD_GET || ptype == PacketType::DASHBOARD_POST) &&
+        !conn.cluster_peer) {
+        PeerLink *owner = cluster.ownerOf(s_id);
+        if (owner) return forwardToOwner(conn, *owner, packet, s_id);
+    }
+
+    switch (ptype) {
+        case PacketType::DATA:
+            printf("Packet length: %u, type: %u\n", data_length, s_type);
+
+            processSensorData(packet, s_id);
+            break;
+
+        case PacketType::HEARTBEAT:
+            printf("Heartbeat packet: ID=%u, type=%u\n", s_id, s_type);
+
+            // Register the slave device
+            slave_manager.registerSlave(s_id, client_fd, conn.extended_ids);
+            if (replication) replication->markDirty(s_id);
+            break;
+
+        case PacketType::DASHBOARD_GET:
+            printf("Dashboard requested data on sensor: ID=%u, type=%u\n", s_id, s_type);
+
+            // an HTTP read forwarded by another bridge, which cannot know the type of the sensor,
+            // gets the last known state, as a local HTTP read does
+            if (s_type == SensorType::NOOP && conn.cluster_peer) {
+                struct sensor_packet s_packet = slave_manager.getSlaveState(s_id);
+                if (s_packet.header.length == 0) {
+                    sendErrorToDashboard(conn, metadata, s_id, ErrorCode::NOT_CONNECTED);
+                } else {
+                    s_packet.header.ptype = PacketType::DASHBOARD_RESPONSE;
+                    sendToDashboard(conn, s_packet, s_id);
+                }
+            } else if (s_id > MAX_HUB_SENSOR_ID) {
+                // YIPEE
+                struct sensor_packet s_packet = slave_manager.getSlaveState(s_id);
+                // an empty state carries no sensor ID, which another bridge could not match
+                if (conn.cluster_peer && s_packet.header.length == 0)
+                    sendErrorToDashboard(conn, metadata, s_id, ErrorCode::NOT_CONNECTED);
+                else
+                    sendToDashboard(conn, s_packet, s_id);
+            } else {
+                if (submitHubTransaction(beginHubTransaction(HubTask::READ, &conn, packet, s_id)))
+                    return false;
+
+                printf("Too many hub transactions waiting, serving last known state\n");
+                sendLastKnownState(conn, metadata);
+            }
+            break;
+
+        case PacketType::DASHBOARD_POST:
+            printf("Dashboard posting data on sensor: ID=%u, type=%u\n", s_id, s_type);
+            // of a burst of posts to a slider or color picker only the latest is sent
+            if (combinesWrites(packet) && actuator_writes.post(s_id, packet)) {
+                acknowledgePost(conn, metadata, s_id);
+                break;
+            }
+
+            // the dashboard is trying to update something
+            if (s_id <= MAX_HUB_SENSOR_ID) {
+                if (submitHubTransaction(beginHubTransaction(HubTask::POST, &conn, packet, s_id)))
+                    return false;
+
+                acknowledgePost(conn, metadata, s_id, ErrorCode::HUB_UNAVAILABLE);
+            } else {
+                postToSensor(packet, s_id);
+                acknowledgePost(conn, metadata, s_id);
+            }
+            break;
+
+        case PacketType::HELLO: {
+            uint8_t features = packet.helloFeatures() & SUPPORTED_FEATURES;
+            // skipping the rate limits and the forwarding is only for the bridges of the cluster
+            if (!cluster.isNode(conn.address.sin_addr)) features &= ~FEATURE_CLUSTER_PEER;
+            printf("Hello from %s:%d, agreed on features 0x%02X\n",
+                   inet_ntoa(conn.address.sin_addr), ntohs(conn.address.sin_port), features);
+
+            struct sensor_packet reply = {0};
+            reply.header.length = sizeof(struct connection_hello);
+            reply.header.ptype = PacketType::HELLO;
+            reply.data.hello.features = features;
+            sendToDashboard(conn, reply, 0);
+
+            // the reply still goes out in the old framing, everything after it uses the new one
+            conn.extended_ids = features & FEATURE_EXTENDED_IDS;
+            conn.cluster_peer = features & FEATURE_CLUSTER_PEER;
+            break;
+        }
+
+        case PacketType::AGGREGATE_QUERY: {
+            struct Aggregate aggregate;
+            if (!packet.holds<struct aggregate_query>() ||
+                !aggregates.query(packet.aggregateScope(), s_id, s_type, packet.windowMinutes(),
+                                  wallClockMilliseconds(), aggregate)) {
+                sendErrorToDashboard(conn, metadata, s_id, ErrorCode::NOT_AGGREGATED);
+                break;
+            }
+
+            uint8_t response[sizeof(struct sensor_header) + sizeof(struct aggregate_response)];
+            size_t length = encodeAggregateResponse(metadata, packet.aggregateScope(),
+                                                    packet.windowMinutes(), aggregate, response);
+            sendToDashboard(conn, PacketView(response, length), s_id);
+            break;
+        }
+
+        case PacketType::GROUP_POST: {
+            printf("Dashboard posting data on group: ID=%u, type=%u\n", s_id, s_type);
+            if (submitHubTransaction(beginHubTransaction(HubTask::GROUP_POST, &conn, packet, s_id)))
+                return false;
+
+            sendErrorToDashboard(conn, metadata, s_id, ErrorCode::HUB_UNAVAILABLE);
+            break;
+        }
+
+        default:
+            // unknown packet type
+            break;
+    }
+    return true;
+}
+
+bool WemosServer::postToSensor(const PacketView &packet, uint16_t sensor_id) {
+    if (sensor_id > MAX_HUB_SENSOR_ID) {
+        // blabla
+        slave_manager.sendToSlave(sensor_id, packet);
+        updateState(sensor_id, packet);
+        return true;
+    }
+
+    try {
+        I2CClient &hub = hub_router.hubFor(sensor_id);
+        HubScheduler::Slot slot(hub_router.schedulerFor(sensor_id), HubPriority::ACTUATION,
+                                std::chrono::steady_clock::now() + hub_timeout);
+        hub.sendRawData(packet.data(), packet.size());
+        updateState(sensor_id, packet);
+        return true;
+    } catch (std::runtime_error &exc) {
+        printf("I2C hub unavailable (%s), rejecting post\n", exc.what());
+        return false;
+    }
+}
+
+size_t WemosServer::postToGroup(const PacketView &packet, uint16_t group_id, bool from_peer,
+                                uint8_t *reply) {
+    const std::vector<uint16_t> *members = device_groups.members(group_id);
+    if (!members) return 0;
+
+    // every member gets the post the dashboard would have sent it on its own
+    struct sensor_packet post;
+    packet.copyTo(post);
+    post.header.ptype = PacketType::DASHBOARD_POST;
+    auto addressedTo = [&post](uint16_t sensor_id) -> const struct sensor_packet & {
+        post.data.generic.metadata.sensor_id = sensor_id & 0xFF;
+        return post;
+    };
+
+    /** @brief The posts to the members behind one I2C hub, sent as one write */
+    struct HubBatch {
+        HubScheduler *scheduler;
+        std::vector<uint8_t> frames;
+        std::vector<size_t> members;
+    };
+    std::map<I2CClient *, struct HubBatch> hub_batches;
+    std::vector<uint16_t> slave_ids;
+    std::vector<size_t> slave_members;
+    std::vector<struct GroupMemberResult> results;
+
+    for (uint16_t sensor_id : *members) {
+        results.push_back({sensor_id, ErrorCode::NONE});
+
+        if (PeerLink *owner = from_peer ? nullptr : cluster.ownerOf(sensor_id)) {
+            try {
+                owner->post(addressedTo(sensor_id), sensor_id);
+            } catch (std::runtime_error &exc) {
+                results.back().status = ErrorCode::NODE_UNAVAILABLE;
+            }
+        } else if (sensor_id <= MAX_HUB_SENSOR_ID) {
+            try {
+                struct HubBatch &batch = hub_batches[&hub_router.hubFor(sensor_id)];
+                batch.scheduler = &hub_router.schedulerFor(sensor_id);
+                PacketView frame(addressedTo(sensor_id));
+                batch.frames.insert(batch.frames.end(), frame.data(), frame.data() + frame.size());
+                batch.members.push_back(results.size() - 1);
+            } catch (std::runtime_error &exc) {
+                results.back().status = ErrorCode::HUB_UNAVAILABLE;
+            }
+        } else {
+            slave_ids.push_back(sensor_id);
+            slave_members.push_back(results.size() - 1);
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + hub_timeout;
+    for (auto &hub_batch : hub_batches) {
+        struct HubBatch &batch = hub_batch.second;
+        try {
+            HubScheduler::Slot slot(*batch.scheduler, HubPriority::ACTUATION, deadline);
+            hub_batch.first->sendRawData(batch.frames.data(), batch.frames.size());
+        } catch (std::runtime_error &exc) {
+            printf("I2C hub unavailable (%s), rejecting %zu group members\n", exc.what(),
+                   batch.members.size());
+            for (size_t member : batch.members) results[member].status = ErrorCode::HUB_UNAVAILABLE;
+            continue;
+        }
+        for (size_t member : batch.members)
+            updateState(results[member].sensor_id, addressedTo(results[member].sensor_id));
+    }
+
+    std::vector<int> sent = slave_manager.sendToSlaves(slave_ids, post, GROUP_SEND_TIMEOUT_MS);
+    for (size_t i = 0; i < slave_ids.size(); ++i) {
+        // like a single post, the state follows even if the slave is not there to receive it
+        updateState(slave_ids[i], addressedTo(slave_ids[i]));
+        if (sent[i] != 0) results[slave_members[i]].status = ErrorCode::NOT_CONNECTED;
+    }
+
+    return encodeGroupResult(packet.metadata(), results, reply);
+}
+
+bool WemosServer::forwardToOwner(struct Connection &conn, PeerLink &owner,
+                                 const PacketView &packet, uint16_t sensor_id) {
+    if (packet.type() == PacketType::DASHBOARD_POST) {
+        try {
+            // the owner acknowledges the post, the link consumes the answer without waiting for it
+            owner.post(packet, sensor_id);
+        } catch (std::runtime_error &exc) {
+            printf("Cluster bridge unavailable (%s)\n", exc.what());
+            sendErrorToDashboard(conn, packet.metadata(), sensor_id, ErrorCode::NODE_UNAVAILABLE);
+        }
+        return true;
+    }
+
+    // waiting for the owner would hold up every other connection of the worker
+    if (submitHubTransaction(beginHubTransaction(HubTask::FORWARD_READ, &conn, packet, sensor_id)))
+        return false;
+
+    sendErrorToDashboard(conn, packet.metadata(), sensor_id, ErrorCode::NODE_UNAVAILABLE);
+    return true;
+}
+
+/**
+ * @brief Returns the JSON body of an error response.
+ */
+static std::string errorJson(const std::string &message) {
+    return "{\"error\":\"" + jsonEscape(message.data(), message.size()) + "\"}";
+}
+
+bool WemosServer::serveHttp(struct Connection &conn) {
+    // a forwarded request is waiting for its answer, the requests behind it wait for it
+    if (conn.hub_transactions > 0) return true;
+
+    bool keep_open = true;
+    size_t offset = 0;
+    while (keep_open && offset < conn.buffered) {
+        size_t consumed;
+        HttpParseResult result =
+            parseHttpRequest(conn.http_request, conn.buffer + offset, conn.buffered - offset,
+                             config.receive_buffer_size, consumed);
+        offset += consumed;
+        if (result == HttpParseResult::INCOMPLETE) break;
+
+        if (result != HttpParseResult::COMPLETE) {
+            int status = result == HttpParseResult::HEADER_TOO_LARGE ? 431
+                         : result == HttpParseResult::BODY_TOO_LARGE ? 413
+                                                                      : 400;
+            sendHttpResponse(conn, status, errorJson(httpStatusText(status)), false);
+            return false;
+        }
+
+        const char *body = (const char *)conn.buffer + offset - conn.http_request.content_length;
+        bool answered = handleHttpRequest(conn, conn.http_request, body);
+        keep_open = conn.http_request.keep_alive;
+        memset(&conn.http_request, 0, sizeof(conn.http_request));
+
+        // stays open for the answer, which decides whether it stays open after that
+        if (!answered) {
+            watchClient(conn, false);
+            keep_open = true;
+            break;
+        }
+    }
+
+    // parsed header lines are dropped right away, so only a single line has to fit the buffer
+    conn.buffered -= offset;
+    if (conn.buffered > 0 && offset > 0) memmove(conn.buffer, conn.buffer + offset, conn.buffered);
+
+    return keep_open;
+}
+
+bool WemosServer::handleHttpRequest(struct Connection &conn, const struct HttpRequest &request,
+                                    const char *body) {
+    const std::string path = request.path;
+    const std::string sensor_prefix = "/sensors/";
+    bool keep_alive = request.keep_alive;
+
+    printf("HTTP request for %s from %s:%d\n", request.path, inet_ntoa(conn.address.sin_addr),
+           ntohs(conn.address.sin_port));
+
+    // answers the CORS preflight of browsers posting JSON
+    if (request.method == HttpMethod::OPTIONS) {
+        sendHttpResponse(conn, 204, "", keep_alive);
+        return true;
+    }
+
+    if (!admission.admit(conn.budgets, conn.address.sin_addr, httpRateClass(request))) {
+        sendHttpResponse(conn, 429, errorJson("Rate limit exceeded"), keep_alive);
+        return true;
+    }
+
+    if (path == "/health" || path == "/sensors" || path == "/sensors/") {
+        if (request.method != HttpMethod::GET) {
+            sendHttpResponse(conn, 405, errorJson("Only GET is allowed here"), keep_alive);
+        } else if (path == "/health") {
+            sendHttpResponse(conn, 200, healthJson(), keep_alive);
+        } else {
+            // shared with every other reader until the state changes
+            std::shared_ptr<const std::string> document = json_state->document();
+            sendHttpResponse(conn, 200, *document, keep_alive);
+        }
+        return true;
+    }
+
+    if (path.compare(0, sensor_prefix.size(), sensor_prefix) != 0) {
+        sendHttpResponse(conn, 404, errorJson("Unknown path"), keep_alive);
+        return true;
+    }
+
+    std::string id_text = path.substr(sensor_prefix.size());
+    char *id_end;
+    unsigned long sensor_id = strtoul(id_text.c_str(), &id_end, 10);
+    if (id_text.empty() || *id_end != '\0' || id_text[0] == '-' || sensor_id > MAX_SLAVE_ID) {
+        sendHttpResponse(conn, 404, errorJson("Invalid sensor ID"), keep_alive);
+        return true;
+    }
+
+    // the state of a sensor owned by another bridge is only known there
+    PeerLink *owner = cluster.ownerOf(sensor_id);
+
+    if (request.method == HttpMethod::POST) {
+        struct sensor_packet packet;
+        try {
+            parseSensorWrite(body, request.content_length, sensor_id, packet);
+        } catch (std::invalid_argument &exc) {
+            sendHttpResponse(conn, 400, errorJson(exc.what()), keep_alive);
+            return true;
+        }
+
+        if (owner) return forwardHttpToOwner(conn, *owner, &packet, sensor_id, keep_alive);
+        if (!postToSensor(packet, sensor_id)) {
+            sendHttpResponse(conn, 503, errorJson("I2C hub unavailable"), keep_alive);
+            return true;
+        }
+    } else if (request.method != HttpMethod::GET) {
+        sendHttpResponse(conn, 405, errorJson("Only GET and POST are allowed here"), keep_alive);
+        return true;
+    } else if (owner) {
+        return forwardHttpToOwner(conn, *owner, nullptr, sensor_id, keep_alive);
+    }
+
+    std::shared_ptr<const std::string> fragment = json_state->sensor(sensor_id);
+    if (fragment)
+        sendHttpResponse(conn, 200, *fragment, keep_alive);
+    else
+        sendHttpResponse(conn, 404, errorJson("Nothing known about this sensor"), keep_alive);
+    return true;
+}
+
+bool WemosServer::forwardHttpToOwner(struct Connection &conn, PeerLink &owner,
+                                     const struct sensor_packet *write, uint16_t sensor_id,
+                                     bool keep_alive) {
+    if (write) {
+        try {
+            owner.post(PacketView(*write), sensor_id);
+            sendHttpResponse(conn, 202, sensorToJson(sensor_id, PacketView(*write)), keep_alive);
+        } catch (std::runtime_error &exc) {
+            printf("Cluster bridge unavailable (%s)\n", exc.what());
+            sendHttpResponse(conn, 502, errorJson("Bridge " + owner.address() + " is unavailable"),
+                             keep_alive);
+        }
+        return true;
+    }
+
+    // the type of the sensor is not known here; the owner answers a NOOP read with the state it
+    // holds, whatever its type
+    struct sensor_packet request = {0};
+    request.header.length = sizeof(struct sensor_metadata);
+    request.header.ptype = PacketType::DASHBOARD_GET;
+    request.data.generic.metadata.sensor_id = (uint8_t)sensor_id;
+
+    struct HubTransaction *transaction =
+        beginHubTransaction(HubTask::FORWARD_HTTP_READ, &conn, PacketView(request), sensor_id);
+    if (transaction) transaction->keep_alive = keep_alive;
+    if (submitHubTransaction(transaction)) return false;
+
+    sendHttpResponse(conn, 503, errorJson("Too many requests waiting for other bridges"),
+                     keep_alive);
+    return true;
+}
+
+void WemosServer::sendForwardedHttpRead(const struct Connection &conn,
+                                        const struct HubTransaction &transaction) {
+    uint16_t sensor_id = transaction.sensor_id;
+    if (!transaction.succeeded) {
+        std::string address = cluster.ownerOf(sensor_id)->address();
+        sendHttpResponse(conn, 502, errorJson("Bridge " + address + " is unavailable"),
+                         transaction.keep_alive);
+        return;
+    }
+
+    PacketView answer(transaction.reply, transaction.reply_length);
+    // the owner answers a read of a device it never heard from with ErrorCode::NOT_CONNECTED
+    bool unknown = !answer.holds<struct sensor_metadata>() ||
+                   (answer.type() == PacketType::DASHBOARD_ERROR &&
+                    answer.holds<struct sensor_packet_error>() &&
+                    answer.errorCode() == ErrorCode::NOT_CONNECTED);
+    if (unknown)
+        sendHttpResponse(conn, 404, errorJson("Nothing known about this sensor"),
+                         transaction.keep_alive);
+    else if (answer.type() == PacketType::DASHBOARD_ERROR)
+        sendHttpResponse(conn, 503, errorJson("Sensor unavailable at its bridge"),
+                         transaction.keep_alive);
+    else
+        sendHttpResponse(conn, 200, sensorToJson(sensor_id, answer), transaction.keep_alive);
+}
+
+void WemosServer::sendHttpResponse(const struct Connection &conn, int status,
+                                   const std::string &body, bool keep_alive) {
+    std::string head = httpResponseHead(status, body.size(), keep_alive);
+
+    struct iovec parts[2];
+    parts[0].iov_base = const_cast<char *>(head.data());
+    parts[0].iov_len = head.size();
+    parts[1].iov_base = const_cast<char *>(body.data());
+    parts[1].iov_len = body.size();
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = body.empty() ? 1 : 2;
+
+    // large documents may go out in several pieces
+    while (message.msg_iovlen > 0) {
+        ssize_t sent = sendmsg(conn.fd, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            perror("sendmsg() failed");
+            return;
+        }
+
+        while (message.msg_iovlen > 0 && (size_t)sent >= message.msg_iov->iov_len) {
+            sent -= message.msg_iov->iov_len;
+            ++message.msg_iov;
+            --message.msg_iovlen;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base = (char *)message.msg_iov->iov_base + sent;
+            message.msg_iov->iov_len -= sent;
+        }
+    }
+}
+
+std::string WemosServer::healthJson() {
+    bool all_connected = true;
+    std::string hubs;
+    for (size_t i = 0; i < hub_router.size(); ++i) {
+        bool connected = hub_router.hub(i).getStats().connected;
+        all_connected = all_connected && connected;
+
+        std::string address = hub_router.hubAddress(i);
+        if (i > 0) hubs += ',';
+        hubs += "{\"address\":\"" + jsonEscape(address.data(), address.size()) +
+                "\",\"connected\":" + (connected ? "true" : "false") + "}";
+    }
+
+    auto uptime = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - started_at);
+    struct AllocatorStats pools = getAllocatorStats();
+
+    return std::string("{\"status\":\"") + (all_connected ? "ok" : "degraded") +
+           "\",\"uptime_s\":" + std::to_string(uptime.count()) +
+           ",\"devices\":" + std::to_string(pools.devices.in_use) +
+           ",\"connections\":" + std::to_string(pools.connections.in_use) +
+           ",\"hubs\":[" + hubs + "]}";
+}
+
+void WemosServer::hotRestart() {
+    if (!restart_argv) {
+        printf("Hot restart requested, but no restart command was set\n");
+        return;
+    }
+
+    printf("Hot restart requested, handing over to a new process\n");
+
+    // stop touching any of the sockets, without closing a single one of them
+    stopWorkers();
+    // the answers of the last hub transactions go out before the connections are handed over
+    stopHubExecutor();
+
+    udp_running = false;
+    if (udp_thread.joinable()) udp_thread.join();
 
-/**
- * @brief Maximum number of clients that can be connected to the server.
- */
-#define MAX_CLIENTS 128
+    struct HandoffState state;
+    state.listen_fd = server_fd;
+    state.udp_fd = udp_fd;
+    state.http_fd = http_fd;
+    // posts held back still go out over the connections about to be handed over
+    actuator_writes.stop();
+    state.hub_fds = hub_router.releaseConnections();
+    // events already received still make it into the state handed over
+    hub_events.stop();
+    connection_pool->forEach([&state](struct Connection &conn) {
+        struct HandoffClient client;
+        client.fd = conn.fd;
+        client.address = conn.address;
+        client.extended_ids = conn.extended_ids;
+        client.http = conn.http;
+        client.cluster_peer = conn.cluster_peer;
+        // the start of a frame or request, the rest of it arrives at the new process
+        client.pending.assign(conn.buffer, conn.buffer + conn.buffered);
+        client.http_request = conn.http_request;
+        state.clients.push_back(client);
+    });
+    state.slaves = slave_manager.snapshot();
 
-// private methods start here
-void WemosServer::handleClient(int client_fd, const struct sockaddr_in client_address) {
-    uint8_t buffer[BUFFER_SIZE] = {0};
-    ssize_t bytes_received;
+    // the new process starts a capture of its own
+    if (capture) capture->flush();
+    // the standbys reconnect to the new process and get a full snapshot from it
+    if (replication) replication->stop();
 
-    std::cout << "Thread " << std::this_thread::get_id() << " : Connection accepted from "
-              << inet_ntoa(client_address.sin_addr) << ':' << ntohs(client_address.sin_port)
-              << std::endl;
+    if (launchSuccessor(state)) {
+        // no destructors: they would close sockets and remove the shared-memory segment, which
+        // all belong to the new process now
+        printf("Handed %zu connections over to the new process, exiting\n", state.clients.size());
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
 
-    while ((bytes_received = recv(client_fd, buffer, BUFFER_SIZE, 0)) > 0) {
-        printf("Received %zd bytes from %s:%d:\n", bytes_received,
-               inet_ntoa(client_address.sin_addr), ntohs(client_address.sin_port));
+    printf("Hot restart failed, resuming service\n");
 
-        for (int i = 0; i < bytes_received; i++) printf("%02X ", buffer[i]);
-        printf("\n");
+    if (replication) replication->start(replication_port);
 
-        size_t offset = 0;
-        while (offset + 2 <= bytes_received) {
-            struct sensor_packet *pkt_ptr = (struct sensor_packet *)&buffer[offset];
-            uint8_t data_length = pkt_ptr->header.length;
-            PacketType ptype = pkt_ptr->header.ptype;
-            SensorType s_type = pkt_ptr->data.generic.metadata.sensor_type;
-            uint8_t s_id = pkt_ptr->data.generic.metadata.sensor_id;
+    hub_router.adoptConnections(state.hub_fds);
+    startHubEvents();
+    startWriteCombiner();
+    hub_router.start();
+    startHubExecutor();
 
-            if (offset + data_length + sizeof(struct sensor_header) > bytes_received) {
-                printf("Incomplete packet received, discarding\n");
-                break;
-            }
+    if (udp_fd >= 0) {
+        udp_running = true;
+        udp_thread = std::thread(&WemosServer::udpReceiveLoop, this);
+    }
 
-            switch (ptype) {
-                case PacketType::DATA:
-                    printf("Packet length: %u, type: %u\n", data_length, s_type);
-
-                    processSensorData((const struct sensor_packet *)&buffer[offset]);
-                    break;
-
-                case PacketType::HEARTBEAT:
-                    printf("Heartbeat packet: ID=%u, type=%u\n",
-                           pkt_ptr->data.heartbeat.metadata.sensor_id,
-                           pkt_ptr->data.heartbeat.metadata.sensor_type);
-
-                    // Register the slave device
-                    slave_manager.registerSlave(pkt_ptr->data.heartbeat.metadata.sensor_id,
-                                                client_fd);
-                    break;
-
-                case PacketType::DASHBOARD_GET:
-                    printf("Dashboard requested data on sensor: ID=%u, type=%u\n",
-                           pkt_ptr->data.generic.metadata.sensor_id,
-                           pkt_ptr->data.generic.metadata.sensor_type);
-
-                    if (s_id > 127) {
-                        // YIPEE
-                        struct sensor_packet s_packet =
-                            slave_manager.getSlaveState(pkt_ptr->data.generic.metadata.sensor_id);
-                        sendToDashboard(client_fd, &s_packet,
-                                        sizeof(s_packet.header) + s_packet.header.length);
-                    } else {
-                        i2c_client.sendRawData((uint8_t *)pkt_ptr,
-                                               sizeof(struct sensor_header) + data_length);
-
-                        printf("incoming data: ");
-                        for (int i = 0; i < sizeof(struct sensor_header) + pkt_ptr->header.length;
-                             ++i) {
-                            printf("%02X ", ((uint8_t *)(pkt_ptr))[i]);
-                        }
-                        printf("\n");
-                        struct sensor_packet ret_pkt;
-                        do {
-                            ret_pkt = i2c_client.retrievePacket(true);
-                        } while (ret_pkt.data.generic.metadata.sensor_id !=
-                                 pkt_ptr->data.generic.metadata.sensor_id);
-
-                        printf("sending back to dashboard :D\n");
-                        sendToDashboard(client_fd, pkt_ptr,
-                                        sizeof(struct sensor_header) + data_length);
-                    }
-                    break;
-
-                case PacketType::DASHBOARD_POST:
-                    printf("Dashboard posting data on sensor: ID=%u, type=%u\n",
-                           pkt_ptr->data.generic.metadata.sensor_id,
-                           pkt_ptr->data.generic.metadata.sensor_type);
-                    // the dashboard is trying to update something
-                    if (s_id > 127) {
-                        // blabla
-                        slave_manager.sendToSlave(
-                            pkt_ptr->data.generic.metadata.sensor_id, (uint8_t *)pkt_ptr,
-                            sizeof(struct sensor_header) + pkt_ptr->header.length);
-                        slave_manager.updateSlaveState(pkt_ptr->data.generic.metadata.sensor_id,
-                                                       *pkt_ptr);
-                    } else {
-                        i2c_client.sendRawData((uint8_t *)pkt_ptr,
-                                               sizeof(struct sensor_header) + data_length);
-                    }
-                    break;
+    // the connections never left the epoll instances of their workers
+    startWorkers();
+}
 
-                default:
-                    // unknown packet type
-                    break;
-            }
+bool WemosServer::launchSuccessor(const struct HandoffState &state) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) < 0) {
+        perror("socketpair() failed");
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork() failed");
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
 
-            offset += data_length + sizeof(struct sensor_header);
+    if (pid == 0) {
+        // only the handoff socket may survive the exec, everything else arrives over it
+        if (sockets[1] == HANDOFF_FD) {
+            fcntl(HANDOFF_FD, F_SETFD, 0);
+        } else {
+            dup2(sockets[1], HANDOFF_FD);
         }
+        close_range(HANDOFF_FD + 1, ~0U, 0);
+
+        setenv(HANDOFF_FD_ENV, std::to_string(HANDOFF_FD).c_str(), 1);
+        execvp(restart_argv[0], restart_argv);
+
+        perror("execvp() failed");
+        _exit(127);
     }
 
-    if (bytes_received == 0) {
-        printf("Connection closed by %s:%d\n", inet_ntoa(client_address.sin_addr),
-               ntohs(client_address.sin_port));
-    } else if (bytes_received < 0) {
-        perror("recv failed");
+    close(sockets[1]);
+
+    bool taken_over = false;
+    try {
+        sendHandoffState(sockets[0], state);
+        taken_over = waitForHandoffAck(sockets[0], HANDOFF_ACK_TIMEOUT_MS);
+    } catch (std::runtime_error &exc) {
+        printf("Handing over to the new process failed: %s\n", exc.what());
+    }
+    close(sockets[0]);
+
+    if (!taken_over) {
+        // never end up with two processes serving the same sockets
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+
+    return taken_over;
+}
+
+void WemosServer::udpReceiveLoop() {
+    static_assert(UDP_DATAGRAM_SIZE >= sizeof(struct sensor_packet), "datagram buffer too small");
+
+    uint8_t buffers[UDP_BATCH_SIZE][UDP_DATAGRAM_SIZE];
+    alignas(struct cmsghdr) uint8_t controls[UDP_BATCH_SIZE][RECEIVE_TIMESTAMP_CONTROL_SIZE];
+    struct iovec iovecs[UDP_BATCH_SIZE];
+    struct sockaddr_in senders[UDP_BATCH_SIZE];
+    struct mmsghdr messages[UDP_BATCH_SIZE];
+
+    struct pollfd pf;
+    pf.fd = udp_fd;
+    pf.events = POLLIN;
+
+    while (udp_running) {
+        // wait up to one second, so tearDown() does not have to wait forever
+        int ready = poll(&pf, 1, 1000);
+        if (ready < 1) {
+            if (ready == -1 && errno != EINTR) perror("poll() on UDP socket failed");
+            continue;
+        }
+
+        // the headers get modified by recvmmsg(), so they have to be reset every batch
+        memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < UDP_BATCH_SIZE; ++i) {
+            iovecs[i].iov_base = buffers[i];
+            iovecs[i].iov_len = UDP_DATAGRAM_SIZE;
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = &senders[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+            messages[i].msg_hdr.msg_control = controls[i];
+            messages[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        }
+
+        int received = recvmmsg(udp_fd, messages, UDP_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("recvmmsg() failed");
+            continue;
+        }
+
+        for (int i = 0; i < received; ++i) {
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                printf("Truncated datagram from %s:%d, discarding\n",
+                       inet_ntoa(senders[i].sin_addr), ntohs(senders[i].sin_port));
+                continue;
+            }
+
+            // the whole batch was read at once, later datagrams wait for the earlier ones
+            struct ReceiveTimestamps received = receiveTimestamps(messages[i].msg_hdr);
+            Latency::recordReceive(LatencyStage::KERNEL_TO_USER, received);
+            Latency::recordSince(LatencyStage::PARSE_TO_DISPATCH, received.user_ns);
+            handleDatagram(buffers[i], messages[i].msg_len, senders[i]);
+            Latency::recordRequest(received);
+        }
     }
+}
+
+void WemosServer::handleDatagram(const uint8_t *data, size_t length,
+                                 const struct sockaddr_in &sender) {
+    size_t offset = 0;
+    while (offset + sizeof(struct sensor_header) <= length) {
+        PacketView packet(&data[offset], length - offset);
+
+        if (!packet.complete()) {
+            printf("Incomplete packet in datagram from %s:%d, discarding\n",
+                   inet_ntoa(sender.sin_addr), ntohs(sender.sin_port));
+            break;
+        }
+
+        // read in place; the view keeps short packets from being read past their end
+        packet = packet.frameOnly();
+        size_t packet_length = packet.frameLength();
 
-    close(client_fd);
+        switch (packet.type()) {
+            case PacketType::DATA:
+                if (!admission.admit(nullptr, sender.sin_addr, RateClass::LOCAL)) break;
+                processSensorData(packet, packet.sensorId());
+                break;
+
+            case PacketType::HEARTBEAT:
+                slave_manager.registerUdpSlave(packet.sensorId(), udp_fd, sender);
+                if (replication) replication->markDirty(packet.sensorId());
+                break;
+
+            default:
+                printf("Ignoring packet of type %u received over UDP\n",
+                       static_cast<unsigned>(packet.type()));
+                break;
+        }
+
+        offset += packet_length;
+    }
 }
 
-void WemosServer::processSensorData(const struct sensor_packet *packet) {
-  uint8_t slave_id = packet->data.generic.metadata.sensor_id;
-    slave_manager.updateSlaveState(slave_id, *packet);
+void WemosServer::processSensorData(const PacketView &packet, uint16_t sensor_id) {
+  uint16_t slave_id = sensor_id;
+
+    // aggregated before the deadband, which drops readings but not what they add to a mean
+    float reading;
+    if (sensorReading(packet, reading))
+        aggregates.add(slave_id, packet.sensorType(), reading, wallClockMilliseconds());
+
+    // a reading that changes nothing is not worth a state write, nor any of what follows it
+    if (!telemetry_filter.accept(slave_id, slave_manager.getSlaveState(slave_id), packet)) return;
+    updateState(slave_id, packet);
 
     #define TAFEL_KNOP_1 0x80
     #define TAFEL_LAMP_1 0x6D
 
-    switch (packet->data.generic.metadata.sensor_type) {
+    switch (packet.sensorType()) {
         case SensorType::BUTTON: {
             printf("Processing button data: ID=%u\n", slave_id);
 
@@ -175,12 +1372,11 @@ void WemosServer::processSensorData(const struct sensor_packet *packet) {
                     led_state.data.light.metadata.sensor_id = TAFEL_LAMP_1;
                     led_state.data.light.metadata.sensor_type = SensorType::LIGHT;
 
-                    i2c_client.sendRawData((uint8_t*)&led_state, sizeof(struct sensor_header) + led_state.header.length);
-                    led_state.data.light.target_state = !i2c_client.retrievePacket(true).data.light.target_state;
-                    printf("led state = %hhu\n", led_state.data.light.target_state);
-
-                    led_state.header.ptype = PacketType::DASHBOARD_POST;
-                    i2c_client.sendRawData((uint8_t*)&led_state, sizeof(struct sensor_header) + led_state.header.length);
+                    // the round trip runs on the hub executor, not on the worker or UDP thread
+                    bool submitted = submitHubTransaction(beginHubTransaction(
+                        HubTask::BUTTON_TOGGLE, nullptr, PacketView(led_state), TAFEL_LAMP_1));
+                    if (!submitted)
+                        printf("Too many hub transactions waiting, ignoring button press\n");
 
                 break;
               }
@@ -188,29 +1384,137 @@ void WemosServer::processSensorData(const struct sensor_packet *packet) {
         }
 
         default:
-            printf("No action defined for sensor type %u\n",
-                   packet->data.generic.metadata.sensor_type);
+            printf("No action defined for sensor type %u\n", packet.sensorType());
             break;
     }
 }
 
-void WemosServer::sendToDashboard(int dashboard_fd, struct sensor_packet *pkt_ptr, size_t len) {
-    send(dashboard_fd, pkt_ptr, len, 0);
+void WemosServer::startHubEvents() {
+    hub_events.start([this](const struct sensor_packet &event) {
+        PacketView packet(event);
+        processSensorData(packet, packet.sensorId());
+    });
+}
+
+void WemosServer::startWriteCombiner() {
+    actuator_writes.start([this](uint16_t sensor_id, const PacketView &packet) {
+        return postToSensor(packet, sensor_id);
+    });
+}
+
+void WemosServer::updateState(uint16_t sensor_id, const PacketView &packet) {
+    // the one copy of the packet, into storage
+    struct sensor_packet state;
+    packet.copyTo(state);
+
+    slave_manager.updateSlaveState(sensor_id, state);
+    if (replication) replication->markDirty(sensor_id);
+
+    // the shared-memory layout only has room for 8-bit IDs
+    if (shm_writer && sensor_id <= MAX_BASIC_SLAVE_ID) shm_writer->publish(sensor_id, state);
+    if (json_state) json_state->update(sensor_id, state);
+}
+
+void WemosServer::sendToDashboard(const struct Connection &conn, const PacketView &packet,
+                                  uint16_t sensor_id) {
+    const void *frame = packet.data();
+    size_t len = packet.size();
+
+    uint8_t extended_frame[MAX_FRAME_SIZE];
+    if (conn.extended_ids) {
+        len = encodeFrame(packet, sensor_id, true, extended_frame);
+        frame = extended_frame;
+    }
+
+    uint64_t sending_ns = monotonicNanoseconds();
+    ssize_t bytes_sent = send(conn.fd, frame, len, MSG_NOSIGNAL);
+    Latency::recordSince(LatencyStage::SEND, sending_ns);
+    if (bytes_sent > 0 && capture)
+        capture->record(CaptureEvent::CLIENT_OUT, conn.fd, frame, bytes_sent);
+    TRACE_POINT(dashboard_sent, DASHBOARD_SENT, sensor_id, conn.fd);
+}
+
+void WemosServer::sendErrorToDashboard(const struct Connection &conn,
+                                       const struct sensor_metadata &metadata, uint16_t sensor_id,
+                                       ErrorCode error_code) {
+    struct sensor_packet pkt = {0};
+    pkt.header.length = sizeof(struct sensor_packet_error);
+    pkt.header.ptype = PacketType::DASHBOARD_ERROR;
+    pkt.data.error.metadata = metadata;
+    pkt.data.error.error_code = error_code;
+
+    sendToDashboard(conn, pkt, sensor_id);
+}
+
+void WemosServer::acknowledgePost(const struct Connection &conn,
+                                  const struct sensor_metadata &metadata, uint16_t sensor_id,
+                                  ErrorCode error_code) {
+    if (!conn.cluster_peer) {
+        if (error_code != ErrorCode::NONE)
+            sendErrorToDashboard(conn, metadata, sensor_id, error_code);
+        return;
+    }
+
+    struct sensor_packet pkt = {0};
+    pkt.header.length = sizeof(struct sensor_packet_error);
+    pkt.header.ptype = PacketType::POST_ACK;
+    pkt.data.error.metadata = metadata;
+    pkt.data.error.error_code = error_code;
+
+    sendToDashboard(conn, pkt, sensor_id);
+}
+
+void WemosServer::sendLastKnownState(const struct Connection &conn,
+                                     const struct sensor_metadata &metadata) {
+    struct sensor_packet pkt = slave_manager.getSlaveState(metadata.sensor_id);
+
+    if (pkt.header.length == 0 || pkt.data.generic.metadata.sensor_type != metadata.sensor_type) {
+        // never seen this sensor, so there is nothing sensible to fall back on
+        sendErrorToDashboard(conn, metadata, metadata.sensor_id, ErrorCode::HUB_UNAVAILABLE);
+        return;
+    }
+
+    pkt.header.ptype = PacketType::DASHBOARD_RESPONSE;
+    sendToDashboard(conn, pkt, metadata.sensor_id);
 }
 // private methods end here
 
 WemosServer::WemosServer(int port, const std::string &hub_ip, int hub_port)
-    : server_fd(-1), hub_ip(hub_ip), hub_port(hub_port), i2c_client() {
+    : server_fd(-1),
+      udp_fd(-1),
+      udp_enabled(false),
+      udp_running(false),
+      http_fd(-1),
+      http_enabled(false),
+      started_at(std::chrono::steady_clock::now()),
+      stats_requested(false),
+      stop_requested(false),
+      serving(true),
+      restart_requested(false),
+      restart_argv(nullptr),
+      next_worker(0),
+      hub_timeout(HUB_TIMEOUT_MS),
+      replication_port(0),
+      primary_port(0) {
     if (port <= 0 || port > 65535) throw std::invalid_argument("Invalid listen port number");
 
     if (INADDR_NONE == inet_addr(hub_ip.c_str()))
         throw std::invalid_argument("Invalid hub IP address passed");
     if (hub_port <= 0 || hub_port > 65535) throw std::invalid_argument("Invalid hub port passed");
 
+    // unsolicited hub packets are processed like telemetry, off the receive thread of the hub
+    hub_router.setEventHandler(
+        [this](const struct sensor_packet &event) { hub_events.post(event); });
+
+    // a single hub serves every hub sensor unless a routing table is set
+    hub_router.route(0, MAX_HUB_SENSOR_ID, hub_router.addHub(hub_ip, hub_port));
+
     memset(&listen_address, 0, sizeof(listen_address));
     listen_address.sin_family = AF_INET;
     listen_address.sin_addr = {INADDR_ANY};
     listen_address.sin_port = htons(port);
+
+    configure(config);
 }
 
 WemosServer::~WemosServer() {
@@ -218,6 +1522,142 @@ WemosServer::~WemosServer() {
     // other shit
 }
 
+void WemosServer::configure(const struct ServerConfig &new_config) {
+    if (!workers.empty()) throw std::logic_error("Cannot reconfigure a running server");
+
+    if (new_config.max_connections == 0 || new_config.worker_threads == 0 ||
+        new_config.hub_threads == 0 || new_config.hub_queue_capacity == 0 ||
+        new_config.max_devices == 0)
+        throw std::invalid_argument(
+            "Connection, thread, hub queue and device limits must not be zero");
+    if (new_config.max_devices > MAX_SLAVE_ID)
+        throw std::invalid_argument("Device limit exceeds the number of possible IDs");
+    if (new_config.receive_buffer_size < MIN_RECEIVE_BUFFER_SIZE)
+        throw std::invalid_argument("Receive buffer is too small for the largest packet");
+    if (new_config.thread_stack_size > 0 && new_config.thread_stack_size < PTHREAD_STACK_MIN)
+        throw std::invalid_argument("Thread stack size is below PTHREAD_STACK_MIN");
+    if (new_config.memory_limit > 0 &&
+        poolFootprint(new_config, hub_router.size()) > new_config.memory_limit)
+        throw std::invalid_argument("Configuration needs more memory than its memory limit");
+
+    connection_pool =
+        std::make_unique<ObjectPool<struct Connection>>(new_config.max_connections);
+    buffer_pool = std::make_unique<BlockPool>(receiveBlockSize(new_config),
+                                              new_config.max_connections);
+    transaction_pool = std::make_unique<ObjectPool<struct HubTransaction>>(
+        hubTransactionCapacity(new_config));
+    hub_router.setQueueCapacity(new_config.hub_queue_capacity);
+    if (slave_manager.getStats().capacity != new_config.max_devices)
+        slave_manager.setCapacity(new_config.max_devices);
+
+    config = new_config;
+}
+
+void WemosServer::setHubRoutes(const std::string &table) {
+    if (!workers.empty()) throw std::logic_error("Cannot change the hubs of a running server");
+
+    hub_router.parseTable(table);
+    hub_router.setQueueCapacity(config.hub_queue_capacity);
+    hub_router.setCapture(capture.get());
+
+    for (size_t i = 0; i < hub_router.size(); ++i)
+        printf("I2C hub %zu at %s\n", i, hub_router.hubAddress(i).c_str());
+}
+
+void WemosServer::setDeadbands(const std::string &list) {
+    telemetry_filter.parse(list);
+
+    printf("Telemetry deadbands: %s\n", list.c_str());
+}
+
+void WemosServer::setAggregateWindows(const std::string &list) {
+    aggregates.parseWindows(list);
+
+    printf("Aggregate windows: %s\n", aggregates.describeWindows().c_str());
+}
+
+void WemosServer::setSensorGroups(const std::string &list) {
+    aggregates.parseGroups(list);
+
+    printf("Sensor groups: %s\n", list.c_str());
+}
+
+void WemosServer::setRateLimits(const std::string &list) {
+    admission.parse(list);
+
+    printf("Rate limits: %s\n", list.c_str());
+}
+
+void WemosServer::setDeviceGroups(const std::string &list) {
+    device_groups.parse(list);
+
+    printf("Device groups: %s\n", list.c_str());
+}
+
+void WemosServer::setClusterMap(const std::string &table) {
+    if (!workers.empty()) throw std::logic_error("Cannot change the cluster of a running server");
+
+    cluster.parseTable(table);
+
+    for (size_t i = 0; i < cluster.size(); ++i)
+        printf("Cluster bridge %zu at %s\n", i, cluster.node(i).address().c_str());
+}
+
+void WemosServer::setHubConcurrency(size_t max_limit) {
+    hub_router.setSchedulerConcurrency(max_limit);
+
+    printf("Up to %zu requests may be outstanding on every I2C hub\n", max_limit);
+}
+
+void WemosServer::setHubTimeout(unsigned int timeout_ms) {
+    if (timeout_ms == 0) throw std::invalid_argument("Hub timeout must not be zero");
+    hub_timeout = std::chrono::milliseconds(timeout_ms);
+
+    printf("Requests to the I2C hubs time out after %u ms\n", timeout_ms);
+}
+
+void WemosServer::setHubBreaker(unsigned int threshold, unsigned int open_ms) {
+    hub_router.setBreaker(threshold, std::chrono::milliseconds(open_ms));
+
+    if (threshold)
+        printf("An I2C hub failing %u requests in a row is given %u ms of rest\n", threshold,
+               open_ms);
+    else
+        printf("I2C hubs are never given a rest\n");
+}
+
+void WemosServer::setWriteCombineWindow(unsigned int window_ms) {
+    actuator_writes.setWindow(std::chrono::milliseconds(window_ms));
+
+    printf("Posts to RGB lights and lichtkranten are combined over %u ms\n", window_ms);
+}
+
+void WemosServer::setHubAging(unsigned int aging_ms) {
+    hub_router.setSchedulerAging(std::chrono::milliseconds(aging_ms));
+
+    printf("I2C hub requests are promoted every %u ms of waiting\n", aging_ms);
+}
+
+size_t WemosServer::memoryFootprint() const { return poolFootprint(config, hub_router.size()); }
+
+struct AllocatorStats WemosServer::getAllocatorStats() const {
+    struct AllocatorStats stats;
+    stats.connections = connection_pool->getStats();
+    stats.receive_buffers = buffer_pool->getStats();
+    stats.hub_queue = hub_router.getQueueStats();
+
+    struct SlaveManagerStats devices = slave_manager.getStats();
+    stats.devices.capacity = devices.capacity;
+    stats.devices.in_use = devices.devices;
+    stats.devices.high_water = devices.devices;
+    stats.devices.object_size = sizeof(SlaveDevice);
+    stats.devices.allocations = devices.devices;
+    stats.devices.failures = devices.refused;
+    stats.devices.reserved_bytes = SlaveManager::reservedBytes(devices.capacity);
+    stats.hub_transactions = transaction_pool->getStats();
+    return stats;
+}
+
 void WemosServer::socketSetup() {
     if ((server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
         perror("socket() failed");
@@ -245,51 +1685,424 @@ void WemosServer::socketSetup() {
         exit(EXIT_FAILURE);
     }
 
-    std::cout << "Listening on port " << ntohs(listen_address.sin_port) << " (max " << MAX_CLIENTS
-              << " clients)" << std::endl;
+    printf("Listening on port %d (max %zu clients)\n", ntohs(listen_address.sin_port),
+           config.max_connections);
+}
+
+void WemosServer::enableReplication(int port) {
+    if (port <= 0 || port > 65535) throw std::invalid_argument("Invalid replication port number");
+
+    if (!replication) replication = std::make_unique<ReplicationPublisher>(slave_manager);
+    replication_port = port;
+}
+
+void WemosServer::enableStandby(const std::string &primary) {
+    size_t colon = primary.rfind(':');
+    char *end = nullptr;
+    long port = colon == std::string::npos ? 0 : strtol(primary.c_str() + colon + 1, &end, 10);
+    if (port <= 0 || port > 65535 || *end != '\0' ||
+        INADDR_NONE == inet_addr(primary.substr(0, colon).c_str()))
+        throw std::invalid_argument("Expected ip:port as the address of the primary");
+
+    primary_ip = primary.substr(0, colon);
+    primary_port = port;
+}
+
+bool WemosServer::followPrimary() {
+    printf("Standing by for the primary at %s:%d\n", primary_ip.c_str(), primary_port);
+
+    std::set<uint16_t> live_devices;
+    ReplicationFollower follower(
+        [this, &live_devices](const struct SlaveSnapshot &slave, bool live) {
+            slave_manager.restore(slave);
+            if (live)
+                live_devices.insert(slave.slave_id);
+            else
+                live_devices.erase(slave.slave_id);
+        });
+    if (!follower.follow(primary_ip, primary_port, REPLICATION_TIMEOUT_MS, stop_requested))
+        return false;
+
+    std::vector<struct SlaveSnapshot> slaves = slave_manager.snapshot();
+    for (const struct SlaveSnapshot &slave : slaves) {
+        if (shm_writer && slave.sensor_data.header.length > 0 &&
+            slave.slave_id <= MAX_BASIC_SLAVE_ID)
+            shm_writer->publish(slave.slave_id, slave.sensor_data);
+    }
+
+    // the devices that were connected to the primary are expected to reconnect to this server
+    printf("Primary is gone, taking over %zu devices, %zu of them connected to it\n",
+           slaves.size(), live_devices.size());
+    return true;
+}
+
+void WemosServer::enableUdp(int port) {
+    if (port <= 0 || port > 65535) throw std::invalid_argument("Invalid UDP port number");
+
+    memset(&udp_listen_address, 0, sizeof(udp_listen_address));
+    udp_listen_address.sin_family = AF_INET;
+    udp_listen_address.sin_addr = {INADDR_ANY};
+    udp_listen_address.sin_port = htons(port);
+    udp_enabled = true;
+}
+
+void WemosServer::udpSocketSetup() {
+    if ((udp_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket() failed");
+        throw std::runtime_error("socket() failed");
+    }
+
+    const int enable_opt = 1;
+    if (setsockopt(udp_fd, SOL_SOCKET, SO_REUSEADDR, &enable_opt, sizeof(enable_opt)) < 0) {
+        perror("setsockopt() failed");
+        throw std::runtime_error("setsockopt() failed");
+    }
+
+    if (bind(udp_fd, (struct sockaddr *)&udp_listen_address, sizeof(udp_listen_address)) < 0) {
+        perror("bind() failed");
+        throw std::runtime_error("bind() failed");
+    }
+    enableReceiveTimestamps(udp_fd);
+
+    printf("Listening for UDP telemetry on port %d\n", ntohs(udp_listen_address.sin_port));
+}
+
+void WemosServer::enableHttp(int port) {
+    if (port <= 0 || port > 65535) throw std::invalid_argument("Invalid HTTP port number");
+
+    memset(&http_listen_address, 0, sizeof(http_listen_address));
+    http_listen_address.sin_family = AF_INET;
+    http_listen_address.sin_addr = {INADDR_ANY};
+    http_listen_address.sin_port = htons(port);
+    http_enabled = true;
+    if (!json_state) json_state = std::make_unique<JsonStateCache>();
+}
+
+void WemosServer::httpSocketSetup() {
+    if ((http_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+        perror("socket() failed");
+        throw std::runtime_error("socket() failed");
+    }
+
+    const int enable_opt = 1;
+    if (setsockopt(http_fd, SOL_SOCKET, SO_REUSEADDR, &enable_opt, sizeof(enable_opt)) < 0) {
+        perror("setsockopt() failed");
+        throw std::runtime_error("setsockopt() failed");
+    }
+
+    if (bind(http_fd, (struct sockaddr *)&http_listen_address, sizeof(http_listen_address)) < 0) {
+        perror("bind() failed");
+        throw std::runtime_error("bind() failed");
+    }
+
+    if (listen(http_fd, MAX_CLIENTS) < 0) {
+        perror("listen() failed");
+        throw std::runtime_error("listen() failed");
+    }
+
+    printf("Serving the HTTP API on port %d\n", ntohs(http_listen_address.sin_port));
+}
+
+void WemosServer::enableSharedMemoryExport(const std::string &name) {
+    shm_writer = std::make_unique<ShmStateWriter>(name);
+
+    printf("Publishing sensor state in shared-memory segment %s\n", name.c_str());
+}
+
+void WemosServer::enableTracing(unsigned int sample_every, const std::string &path) {
+    Tracer::enable(sample_every);
+    trace_path = path;
+
+    printf("Tracing 1 in %u requests to %s\n", sample_every, path.c_str());
+}
+
+void WemosServer::enableCapture(const std::string &path) {
+    capture = std::make_unique<CaptureWriter>(path);
+    hub_router.setCapture(capture.get());
+    slave_manager.setCapture(capture.get());
+
+    printf("Capturing traffic to %s\n", path.c_str());
 }
 
-void WemosServer::setupI2cClient() { i2c_client.setup(hub_ip, hub_port); }
 
 void WemosServer::start() {
-    socketSetup();
+    // before anything below starts a thread, the replication and cluster links included
+    applyThreadStackSize(config.thread_stack_size);
 
-    setupI2cClient();
-    i2c_client.openConnection();
-    i2c_client.start();
+    // a process that took over the sockets of its predecessor is the primary already
+    if (server_fd < 0 && !primary_ip.empty() && !followPrimary()) return;
 
-    while (true) {
-        struct sensor_packet pkt;
-        try {
-            // pkt = i2c_client.retrievePacket();
+    // the sockets may have been taken over from a previous process already
+    if (server_fd < 0) socketSetup();
+    if (replication) replication->start(replication_port);
+    cluster.start();
 
-            // std::cout << "packet received from the I2C hub!" << std::endl;
+    if (udp_enabled) {
+        if (udp_fd < 0) udpSocketSetup();
+        udp_running = true;
+        udp_thread = std::thread(&WemosServer::udpReceiveLoop, this);
+    }
 
-            // now do things with the I2C packet if necessary
+    if (http_enabled) {
+        if (http_fd < 0) httpSocketSetup();
 
-        } catch (std::runtime_error &exc) {
-            /* this means there is no new I2C packet available */
-            // std::cerr << exc.what() << std::endl;
+        // state taken over from a previous process is served right away
+        for (const struct SlaveSnapshot &slave : slave_manager.snapshot()) {
+            if (slave.sensor_data.header.length > 0)
+                json_state->update(slave.slave_id, slave.sensor_data);
         }
+    }
 
-        struct sockaddr_in client_address;
-        socklen_t client_addr_len = sizeof(client_address);
-        int client_fd = accept(server_fd, (struct sockaddr *)&client_address, &client_addr_len);
+    startHubEvents();
+    startWriteCombiner();
 
-        if (-1 == client_fd) {
-            // no one tried to connect
-            continue;
+    // every hub connects in the background; slave-side traffic is served right away
+    hub_router.start();
+
+    startHubExecutor();
+    startWorkers();
+
+    for (const struct HandoffClient &client : adopted_clients) {
+        if (!addClient(client)) close(client.fd);
+    }
+    adopted_clients.clear();
+
+    while (!stop_requested) {
+        if (stats_requested.exchange(false)) printStats();
+        if (restart_requested.exchange(false)) hotRestart();
+
+        // poll() skips the HTTP listener while it is disabled and -1
+        struct pollfd pfs[2];
+        pfs[0].fd = server_fd;
+        pfs[0].events = POLLIN;
+        pfs[1].fd = http_fd;
+        pfs[1].events = POLLIN;
+        if (poll(pfs, 2, 1000) < 1) continue;
+
+        if (pfs[0].revents & POLLIN) acceptClient(server_fd, false);
+        if (pfs[1].revents & POLLIN) acceptClient(http_fd, true);
+    }
+}
+
+void WemosServer::requestStats() { stats_requested = true; }
+
+void WemosServer::requestStop() { stop_requested = true; }
+
+void WemosServer::setRestartCommand(char **argv) { restart_argv = argv; }
+
+void WemosServer::requestHotRestart() { restart_requested = true; }
+
+void WemosServer::adoptHandoff(int handoff_fd) {
+    struct HandoffState state = receiveHandoffState(handoff_fd);
+
+    server_fd = state.listen_fd;
+    if (state.udp_fd >= 0) {
+        udp_fd = state.udp_fd;
+        udp_enabled = true;
+    }
+    if (state.http_fd >= 0) {
+        http_fd = state.http_fd;
+        http_enabled = true;
+        if (!json_state) json_state = std::make_unique<JsonStateCache>();
+    }
+    hub_router.adoptConnections(state.hub_fds);
+
+    for (const struct SlaveSnapshot &slave : state.slaves) {
+        slave_manager.restore(slave);
+        if (shm_writer && slave.sensor_data.header.length > 0 &&
+            slave.slave_id <= MAX_BASIC_SLAVE_ID)
+            shm_writer->publish(slave.slave_id, slave.sensor_data);
+    }
+
+    adopted_clients = state.clients;
+
+    sendHandoffAck(handoff_fd);
+    close(handoff_fd);
+
+    printf("Took over %zu connections and %zu slaves from the previous process\n",
+           state.clients.size(), state.slaves.size());
+}
+
+void WemosServer::printStats() {
+    for (size_t i = 0; i < hub_router.size(); ++i) {
+        struct HubConnectionStats hub = hub_router.hub(i).getStats();
+
+        printf("I2C hub %zu (%s): %s, %llu reconnects, %llu failed connection attempts\n", i,
+               hub_router.hubAddress(i).c_str(), hub.connected ? "connected" : "DISCONNECTED",
+               (unsigned long long)hub.reconnects, (unsigned long long)hub.failed_attempts);
+        printf("I2C hub %zu downtime: %llu ms in total, current outage %llu ms\n", i,
+               (unsigned long long)hub.total_downtime_ms,
+               (unsigned long long)hub.current_downtime_ms);
+
+        struct HubConcurrencyStats concurrency = hub_router.scheduler(i).getConcurrencyStats();
+        printf("I2C hub %zu concurrency: limit %zu of %zu, %zu in flight, rtt %.2f ms (min %.2f "
+               "ms) over %llu round trips, %llu backoffs\n",
+               i, concurrency.limit, concurrency.max_limit, concurrency.in_flight,
+               concurrency.rtt_us / 1000.0, concurrency.min_rtt_us / 1000.0,
+               (unsigned long long)concurrency.samples, (unsigned long long)concurrency.backoffs);
+
+        static const char *const breaker_states[] = {"closed", "OPEN", "half open"};
+        printf("I2C hub %zu breaker: %s, %zu failures in a row, opened %llu times, %llu requests "
+               "rejected, %llu timeouts, %llu late answers dropped\n",
+               i, breaker_states[(size_t)hub.breaker.state], hub.breaker.consecutive_failures,
+               (unsigned long long)hub.breaker.opened, (unsigned long long)hub.breaker.rejected,
+               (unsigned long long)hub.timeouts, (unsigned long long)hub.late_responses);
+    }
+
+    if (replication) {
+        struct ReplicationStats replicated = replication->getStats();
+        printf("Replication: %zu standbys, %llu batches, %llu records, %llu bytes sent\n",
+               replicated.standbys, (unsigned long long)replicated.batches,
+               (unsigned long long)replicated.records, (unsigned long long)replicated.bytes);
+    }
+
+    for (size_t i = 0; i < cluster.size(); ++i) {
+        struct PeerStats peer = cluster.node(i).getStats();
+        printf("Cluster bridge %s: %s, %llu forwarded, %llu failed, %llu unmatched, "
+               "%zu in flight (peak %zu)\n",
+               cluster.node(i).address().c_str(), peer.connected ? "up" : "down",
+               (unsigned long long)peer.forwarded, (unsigned long long)peer.failed,
+               (unsigned long long)peer.unmatched, peer.in_flight, peer.peak_in_flight);
+    }
+
+    struct DeadbandStats telemetry = telemetry_filter.getStats();
+    printf("Telemetry: %llu updates accepted, %llu suppressed by deadbands\n",
+           (unsigned long long)telemetry.accepted, (unsigned long long)telemetry.suppressed);
+
+    struct AggregatorStats aggregated = aggregates.getStats();
+    printf("Aggregates: %zu series, %llu readings (%llu not aggregated), %llu queries\n",
+           aggregated.series, (unsigned long long)aggregated.readings,
+           (unsigned long long)aggregated.dropped, (unsigned long long)aggregated.queries);
+
+    struct SingleFlightStats reads = hub_reads.getStats();
+    printf("I2C hub reads: %llu sent, %llu saved by coalescing, %zu in flight\n",
+           (unsigned long long)reads.requests_sent, (unsigned long long)reads.requests_saved,
+           reads.in_flight);
+
+    struct WriteCombinerStats combined = actuator_writes.getStats();
+    printf("Actuator writes: %llu posts, %llu sent, %llu collapsed, %llu failed, %zu pending\n",
+           (unsigned long long)combined.posted, (unsigned long long)combined.sent,
+           (unsigned long long)combined.collapsed, (unsigned long long)combined.failed,
+           combined.pending);
+
+    struct HubExecutorStats executor = hub_executor.getStats();
+    printf("I2C hub transactions: %zu threads, %llu submitted, %llu completed, %llu rejected, "
+           "%zu queued, %zu running\n",
+           executor.threads, (unsigned long long)executor.submitted,
+           (unsigned long long)executor.completed, (unsigned long long)executor.rejected,
+           executor.queued, executor.running);
+
+    struct HubEventStats events = hub_events.getStats();
+    printf("I2C hub events: %llu received, %llu processed, %llu dropped, %zu queued\n",
+           (unsigned long long)events.posted, (unsigned long long)events.dispatched,
+           (unsigned long long)events.dropped, events.queued);
+
+    struct RateLimiterStats limits = admission.getStats();
+    printf("Admission: %llu requests admitted, %llu throttled, %zu clients tracked\n",
+           (unsigned long long)limits.admitted, (unsigned long long)limits.throttled,
+           limits.clients);
+    for (const struct ClientThrottleStats &client : admission.topThrottled(5)) {
+        printf("  %s: %llu hub and %llu local requests throttled, %llu admitted\n",
+               inet_ntoa(client.address), (unsigned long long)client.throttled[0],
+               (unsigned long long)client.throttled[1], (unsigned long long)client.admitted);
+    }
+
+    static const char *const class_names[HUB_PRIORITY_CLASSES] = {"actuation", "interactive",
+                                                                  "background"};
+    struct HubSchedulerStats scheduling = hub_router.getSchedulerStats();
+    for (size_t index = 0; index < HUB_PRIORITY_CLASSES; ++index) {
+        const struct HubClassStats &entry = scheduling.classes[index];
+        printf("I2C hub %s: %llu granted (%llu aged), %zu waiting, %llu expired, wait avg %.2f "
+               "ms max %.2f ms\n",
+               class_names[index], (unsigned long long)entry.granted,
+               (unsigned long long)entry.aged, entry.waiting, (unsigned long long)entry.expired,
+               entry.granted ? entry.total_wait_us / 1000.0 / entry.granted : 0.0,
+               entry.max_wait_us / 1000.0);
+    }
+
+    for (size_t index = 0; index < LATENCY_STAGES; ++index) {
+        struct LatencyHistogram histogram = Latency::snapshot((LatencyStage)index);
+        if (histogram.count == 0) continue;
+
+        printf("Latency %s: %llu samples, avg %.3f ms, p50 < %.3f ms, p99 < %.3f ms, "
+               "max %.3f ms\n",
+               latencyStageName((LatencyStage)index), (unsigned long long)histogram.count,
+               histogram.total_ns / 1e6 / histogram.count,
+               latencyPercentileUs(histogram, 50) / 1000.0,
+               latencyPercentileUs(histogram, 99) / 1000.0, histogram.max_ns / 1e6);
+        printf(" ");
+        for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+            if (histogram.buckets[bucket] == 0) continue;
+            printf(" <%lluus:%llu", 1ULL << bucket,
+                   (unsigned long long)histogram.buckets[bucket]);
         }
+        printf("\n");
+    }
+
+    struct AllocatorStats pools = getAllocatorStats();
+    printf("Connections: %zu of %zu in use, peak %zu, %llu refused\n", pools.connections.in_use,
+           pools.connections.capacity, pools.connections.high_water,
+           (unsigned long long)pools.connections.failures);
+    printf("I2C hub queue: %zu of %zu packets queued, peak %zu, %llu dropped\n",
+           pools.hub_queue.in_use, pools.hub_queue.capacity, pools.hub_queue.high_water,
+           (unsigned long long)pools.hub_queue.failures);
+    printf("Devices: %zu of %zu known, %llu refused\n", pools.devices.in_use,
+           pools.devices.capacity, (unsigned long long)pools.devices.failures);
+    printf("Hub transactions: %zu of %zu records in use, peak %zu, %llu refused\n",
+           pools.hub_transactions.in_use, pools.hub_transactions.capacity,
+           pools.hub_transactions.high_water,
+           (unsigned long long)pools.hub_transactions.failures);
+    printf("Memory reserved by pools: %zu bytes (%zu per connection)\n", memoryFootprint(),
+           pools.connections.object_size + pools.receive_buffers.object_size);
+
+    if (json_state) {
+        struct JsonStateStats json = json_state->getStats();
+        printf("HTTP API: %zu sensors, %llu fragments and %llu documents serialized, %llu reads\n",
+               json.sensors, (unsigned long long)json.fragments_serialized,
+               (unsigned long long)json.documents_serialized, (unsigned long long)json.reads);
+    }
 
-        std::cout << "Connection accepted from " << inet_ntoa(client_address.sin_addr) << ":"
-                  << ntohs(client_address.sin_port) << std::endl;
+    if (capture) capture->flush();
 
-        new std::thread(&WemosServer::handleClient, this, client_fd, client_address);
-        // printf("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\n");
+    if (!trace_path.empty()) {
+        try {
+            size_t events = Tracer::dumpChromeTrace(trace_path);
+            printf("Wrote %zu trace events to %s\n", events, trace_path.c_str());
+        } catch (std::runtime_error &exc) {
+            printf("Dumping the trace failed: %s\n", exc.what());
+        }
     }
 }
 
 void WemosServer::tearDown() {
-    close(server_fd);
-    i2c_client.closeConnection();
+    stopWorkers();
+    // returns the connections of clients that left while their hub transactions were running
+    stopHubExecutor();
+    connection_pool->forEach([this](struct Connection &conn) { closeClient(&conn); });
+    for (int epoll_fd : worker_epoll_fds) close(epoll_fd);
+    worker_epoll_fds.clear();
+    for (const std::unique_ptr<struct WorkerMailbox> &mailbox : mailboxes)
+        close(mailbox->event_fd);
+    mailboxes.clear();
+
+    udp_running = false;
+    if (udp_thread.joinable()) udp_thread.join();
+    if (udp_fd >= 0) {
+        close(udp_fd);
+        udp_fd = -1;
+    }
+
+    if (server_fd >= 0) {
+        close(server_fd);
+        server_fd = -1;
+    }
+    if (http_fd >= 0) {
+        close(http_fd);
+        http_fd = -1;
+    }
+    actuator_writes.stop();
+    hub_router.closeConnections();
+    hub_events.stop();
+    if (replication) replication->stop();
+    cluster.stop();
 }
@@ -0,0 +1,127 @@
+/**
+ * @file writecombiner.cpp
+ * @brief Implementation of the WriteCombiner class.
+ * @author Daan Breur
+ */
+
+#include "writecombiner.h"
+
+#include <stdexcept>
+
+bool combinesWrites(const PacketView &packet) {
+    switch (packet.sensorType()) {
+        case SensorType::RGB_LIGHT:
+        case SensorType::LICHTKRANT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+WriteCombiner::WriteCombiner()
+    : window(std::chrono::milliseconds(WRITE_COMBINE_MS)),
+      running(false),
+      posted(0),
+      sent(0),
+      collapsed(0),
+      failed(0) {}
+
+WriteCombiner::~WriteCombiner() { stop(); }
+
+void WriteCombiner::start(std::function<bool(uint16_t, const PacketView &)> new_sender) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running) throw std::logic_error("The write combiner is already running");
+
+    sender = std::move(new_sender);
+    running = true;
+    thread = std::thread(&WriteCombiner::sendLoop, this);
+}
+
+void WriteCombiner::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    condition.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+bool WriteCombiner::post(uint16_t sensor_id, const PacketView &packet) {
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running) return false;
+
+        auto found = writes.find(sensor_id);
+        if (found == writes.end()) {
+            if (writes.size() >= MAX_COMBINED_ACTUATORS) return false;
+            found = writes.emplace(sensor_id, PendingWrite{}).first;
+        }
+
+        struct PendingWrite &write = found->second;
+        if (write.held) {
+            // the newer post takes the place of the older one, and its turn
+            ++collapsed;
+        } else {
+            write.held = true;
+            write.due = now + window;
+        }
+        packet.copyTo(write.packet);
+        ++posted;
+    }
+    condition.notify_one();
+    return true;
+}
+
+void WriteCombiner::sendLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        // the write that is due first, left waiting while an earlier one to its actuator is sent
+        auto next = writes.end();
+        for (auto it = writes.begin(); it != writes.end(); ++it) {
+            if (!it->second.held || it->second.sending) continue;
+            if (next == writes.end() || it->second.due < next->second.due) next = it;
+        }
+
+        if (next == writes.end()) {
+            if (!running) return;
+            condition.wait(lock);
+            continue;
+        }
+        if (running && std::chrono::steady_clock::now() < next->second.due) {
+            condition.wait_until(lock, next->second.due);
+            continue;
+        }
+
+        uint16_t sensor_id = next->first;
+        struct PendingWrite &write = next->second;
+        struct sensor_packet packet = write.packet;
+        write.held = false;
+        write.sending = true;
+
+        // sent without the lock, so newer posts can take the place of this one meanwhile
+        lock.unlock();
+        bool ok = sender(sensor_id, PacketView(packet));
+        lock.lock();
+
+        if (ok)
+            ++sent;
+        else
+            ++failed;
+
+        // looked up again, post() may have rehashed the map meanwhile
+        struct PendingWrite &after = writes.at(sensor_id);
+        after.sending = false;
+        if (!after.held) writes.erase(sensor_id);
+    }
+}
+
+void WriteCombiner::setWindow(std::chrono::milliseconds new_window) {
+    std::lock_guard<std::mutex> lock(mutex);
+    window = new_window;
+}
+
+struct WriteCombinerStats WriteCombiner::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {posted, sent, collapsed, failed, writes.size()};
+}
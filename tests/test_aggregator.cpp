@@ -0,0 +1,140 @@
+/**
+ * @file test_aggregator.cpp
+ * @brief Unit tests for Aggregator class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include "aggregator.h"
+
+/**
+ * @brief One minute in milliseconds.
+ */
+static const uint64_t MINUTE = 60000;
+
+/**
+ * @test AggregatorTests.SlidingWindow
+ * @details
+ * - Add a temperature every minute for 20 minutes, then query the 5 and 15 minute windows.
+ * - Expects each window to cover its last minutes at bucket resolution, with the right count,
+ *   sum, min, max, mean and last reading, and readings to fall out as the window slides on.
+ * @ingroup AggregatorTests
+ */
+TEST(AggregatorTests, SlidingWindow) {
+    Aggregator aggregator;
+    aggregator.parseWindows("5m,15m");
+
+    // 5 minute buckets of 25 s and 15 minute buckets of 75 s both start on every full minute here
+    uint64_t start = 1000 * 75 * MINUTE;
+    for (int i = 0; i < 20; ++i)
+        aggregator.add(200, SensorType::TEMPERATURE, 10.0f + i, start + i * MINUTE);
+
+    uint64_t now = start + 19 * MINUTE;
+    struct Aggregate aggregate;
+    ASSERT_TRUE(aggregator.query(AggregateScope::SENSOR, 200, SensorType::TEMPERATURE, 5, now,
+                                 aggregate));
+    EXPECT_EQ(aggregate.count, 5u);
+    EXPECT_FLOAT_EQ(aggregate.min, 25.0f);
+    EXPECT_FLOAT_EQ(aggregate.max, 29.0f);
+    EXPECT_FLOAT_EQ(aggregate.mean(), 27.0f);
+    EXPECT_FLOAT_EQ(aggregate.last, 29.0f);
+
+    ASSERT_TRUE(aggregator.query(AggregateScope::SENSOR, 200, SensorType::TEMPERATURE, 15, now,
+                                 aggregate));
+    EXPECT_EQ(aggregate.count, 15u);
+    EXPECT_DOUBLE_EQ(aggregate.sum, 15 * 22.0);
+    EXPECT_FLOAT_EQ(aggregate.min, 15.0f);
+
+    // nothing was added for an hour, so every window is empty again
+    ASSERT_TRUE(aggregator.query(AggregateScope::SENSOR, 200, SensorType::TEMPERATURE, 15,
+                                 now + 60 * MINUTE, aggregate));
+    EXPECT_EQ(aggregate.count, 0u);
+    EXPECT_FLOAT_EQ(aggregate.mean(), 0.0f);
+
+    // other types and unknown windows are kept apart
+    ASSERT_TRUE(
+        aggregator.query(AggregateScope::SENSOR, 200, SensorType::CO2, 5, now, aggregate));
+    EXPECT_EQ(aggregate.count, 0u);
+    EXPECT_FALSE(aggregator.query(AggregateScope::SENSOR, 200, SensorType::TEMPERATURE, 60, now,
+                                  aggregate));
+}
+
+/**
+ * @test AggregatorTests.TumblingWindowAndGroups
+ * @details
+ * - Put two CO2 sensors in a group and add readings on two days to a tumbling day window.
+ * - Expects the group to aggregate the readings of both sensors, the day window to start over at
+ *   midnight, and unknown groups to be refused.
+ * @ingroup AggregatorTests
+ */
+TEST(AggregatorTests, TumblingWindowAndGroups) {
+    Aggregator aggregator;
+    aggregator.parseWindows("tumbling:1d");
+    aggregator.parseGroups("7=200-201;8=210");
+    EXPECT_EQ(aggregator.describeWindows(), "tumbling:1440m");
+
+    uint64_t midnight = 20000 * 24 * 60 * MINUTE;
+    aggregator.add(200, SensorType::CO2, 400, midnight - MINUTE);
+    aggregator.add(200, SensorType::CO2, 500, midnight + MINUTE);
+    aggregator.add(201, SensorType::CO2, 900, midnight + 2 * MINUTE);
+    aggregator.add(202, SensorType::CO2, 5000, midnight + 3 * MINUTE);
+
+    struct Aggregate aggregate;
+    ASSERT_TRUE(aggregator.query(AggregateScope::GROUP, 7, SensorType::CO2, 24 * 60,
+                                 midnight + 10 * MINUTE, aggregate));
+    EXPECT_EQ(aggregate.count, 2u);
+    EXPECT_FLOAT_EQ(aggregate.min, 500);
+    EXPECT_FLOAT_EQ(aggregate.max, 900);
+    EXPECT_FLOAT_EQ(aggregate.last, 900);
+
+    ASSERT_TRUE(aggregator.query(AggregateScope::SENSOR, 200, SensorType::CO2, 24 * 60,
+                                 midnight - 1, aggregate));
+    EXPECT_EQ(aggregate.count, 1u);
+    EXPECT_FLOAT_EQ(aggregate.last, 400);
+
+    EXPECT_FALSE(aggregator.query(AggregateScope::GROUP, 9, SensorType::CO2, 24 * 60, midnight,
+                                  aggregate));
+    EXPECT_EQ(aggregator.getStats().series, 4u);
+}
+
+/**
+ * @test AggregatorTests.ConfigurationAndEncoding
+ * @details
+ * - Parse malformed window and group lists, exceed the series limit and encode a response.
+ * - Expects std::invalid_argument for malformed lists, readings of sensors beyond the limit to be
+ *   counted as dropped, and the response to decode to the aggregate in little-endian order.
+ * @ingroup AggregatorTests
+ */
+TEST(AggregatorTests, ConfigurationAndEncoding) {
+    Aggregator aggregator(1);
+    EXPECT_THROW(aggregator.parseWindows(""), std::invalid_argument);
+    EXPECT_THROW(aggregator.parseWindows("5x"), std::invalid_argument);
+    EXPECT_THROW(aggregator.parseWindows("5m,tumbling:5m"), std::invalid_argument);
+    EXPECT_THROW(aggregator.parseGroups("1"), std::invalid_argument);
+    EXPECT_THROW(aggregator.parseGroups("1=20-10"), std::invalid_argument);
+    EXPECT_THROW(aggregator.parseGroups("1=70000"), std::invalid_argument);
+
+    aggregator.add(200, SensorType::HUMIDITY, 40, 0);
+    aggregator.add(201, SensorType::HUMIDITY, 50, 0);
+    struct AggregatorStats stats = aggregator.getStats();
+    EXPECT_EQ(stats.readings, 2u);
+    EXPECT_EQ(stats.dropped, 1u);
+
+    struct Aggregate aggregate = {4, 10.0, 1.5f, 3.5f, 2.0f};
+    uint8_t frame[sizeof(struct sensor_header) + sizeof(struct aggregate_response)];
+    size_t length = encodeAggregateResponse({SensorType::TEMPERATURE, 12},
+                                            AggregateScope::GROUP, 15, aggregate, frame);
+    ASSERT_EQ(length, sizeof(frame));
+
+    PacketView view(frame, length);
+    EXPECT_EQ(view.type(), PacketType::AGGREGATE_RESPONSE);
+    EXPECT_EQ(view.sensorId(), 12);
+    EXPECT_EQ(view.aggregateScope(), AggregateScope::GROUP);
+    EXPECT_EQ(view.windowMinutes(), 15);
+    const uint8_t *payload = view.payload();
+    EXPECT_EQ(loadLE32(payload + offsetof(struct aggregate_response, count)), 4u);
+    EXPECT_FLOAT_EQ(loadLEFloat(payload + offsetof(struct aggregate_response, mean)), 2.5f);
+    EXPECT_FLOAT_EQ(loadLEFloat(payload + offsetof(struct aggregate_response, last)), 2.0f);
+}
@@ -0,0 +1,157 @@
+/**
+ * @file test_capture.cpp
+ * @brief Unit tests for the CaptureWriter class and the capture reader.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+
+/**
+ * @brief Returns a capture file name that does not collide with other test runs.
+ */
+static std::string testCaptureFile() {
+    return "/tmp/wemos-test-capture-" + std::to_string(getpid()) + ".wcap";
+}
+
+/**
+ * @test CaptureTests.RoundTrip
+ * @details
+ * - Record a few events and verify that they are read back unchanged and in order.
+ * @ingroup CaptureTests
+ */
+TEST(CaptureTests, RoundTrip) {
+    const uint8_t request[] = {0x02, 0x03, 0x02, 0x05};
+    const uint8_t response[] = {0x06, 0x04, 0x02, 0x05, 0x00, 0x00, 0xAC, 0x41};
+    {
+        CaptureWriter writer(testCaptureFile());
+        writer.record(CaptureEvent::CLIENT_OPEN, 7);
+        writer.record(CaptureEvent::CLIENT_IN, 7, request, sizeof(request));
+        writer.record(CaptureEvent::HUB_OUT, 3, request, sizeof(request));
+        writer.record(CaptureEvent::HUB_IN, 3, response, sizeof(response));
+        writer.record(CaptureEvent::CLIENT_OUT, 7, response, sizeof(response));
+        writer.record(CaptureEvent::CLIENT_CLOSE, 7);
+    }
+
+    std::vector<struct CaptureRecord> records = readCapture(testCaptureFile());
+    unlink(testCaptureFile().c_str());
+
+    ASSERT_EQ(records.size(), 6u);
+    EXPECT_EQ(records[0].event, CaptureEvent::CLIENT_OPEN);
+    EXPECT_EQ(records[0].connection, 7);
+    EXPECT_TRUE(records[0].data.empty());
+    EXPECT_EQ(records[1].data, std::vector<uint8_t>(request, request + sizeof(request)));
+    EXPECT_EQ(records[3].event, CaptureEvent::HUB_IN);
+    EXPECT_EQ(records[3].connection, 3);
+    EXPECT_EQ(records[4].data, std::vector<uint8_t>(response, response + sizeof(response)));
+    EXPECT_EQ(records[5].event, CaptureEvent::CLIENT_CLOSE);
+
+    for (size_t i = 1; i < records.size(); ++i) {
+        EXPECT_GE(records[i].timestamp_ns, records[i - 1].timestamp_ns);
+    }
+}
+
+/**
+ * @test CaptureTests.LargeRecordIsSplit
+ * @details
+ * - Verify that data longer than a single record can hold is split over several records without
+ *   losing any bytes.
+ * @ingroup CaptureTests
+ */
+TEST(CaptureTests, LargeRecordIsSplit) {
+    std::vector<uint8_t> data(70000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = i % 251;
+    {
+        CaptureWriter writer(testCaptureFile());
+        writer.record(CaptureEvent::CLIENT_IN, 1, data.data(), data.size());
+    }
+
+    std::vector<struct CaptureRecord> records = readCapture(testCaptureFile());
+    unlink(testCaptureFile().c_str());
+
+    ASSERT_EQ(records.size(), 2u);
+    std::vector<uint8_t> joined = records[0].data;
+    joined.insert(joined.end(), records[1].data.begin(), records[1].data.end());
+    EXPECT_EQ(joined, data);
+}
+
+/**
+ * @test CaptureTests.TruncatedRecordIsDropped
+ * @details
+ * - Verify that a record cut off by a crash is ignored while all complete records are kept.
+ * @ingroup CaptureTests
+ */
+TEST(CaptureTests, TruncatedRecordIsDropped) {
+    const uint8_t data[] = {1, 2, 3, 4};
+    {
+        CaptureWriter writer(testCaptureFile());
+        writer.record(CaptureEvent::CLIENT_IN, 1, data, sizeof(data));
+        writer.record(CaptureEvent::CLIENT_IN, 1, data, sizeof(data));
+    }
+    ASSERT_EQ(truncate(testCaptureFile().c_str(), sizeof(struct CaptureFileHeader) +
+                                                       2 * sizeof(struct CaptureRecordHeader) +
+                                                       sizeof(data) + 1),
+              0);
+
+    std::vector<struct CaptureRecord> records = readCapture(testCaptureFile());
+    unlink(testCaptureFile().c_str());
+    EXPECT_EQ(records.size(), 1u);
+}
+
+/**
+ * @test CaptureTests.LittleEndianOnDisk
+ * @details
+ * - Record an event and read the raw bytes of the file.
+ * - Expects the magic, the connection and the length to be stored little-endian.
+ * @ingroup CaptureTests
+ */
+TEST(CaptureTests, LittleEndianOnDisk) {
+    const uint8_t data[] = {0xAA, 0xBB, 0xCC};
+    {
+        CaptureWriter writer(testCaptureFile());
+        writer.record(CaptureEvent::HUB_OUT, 0x01020304, data, sizeof(data));
+    }
+
+    uint8_t bytes[sizeof(struct CaptureFileHeader) + sizeof(struct CaptureRecordHeader)];
+    FILE *file = fopen(testCaptureFile().c_str(), "rb");
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(fread(bytes, sizeof(bytes), 1, file), 1u);
+    fclose(file);
+    unlink(testCaptureFile().c_str());
+
+    EXPECT_EQ(memcmp(bytes, "WCAP", 4), 0);
+    EXPECT_EQ(bytes[4], CAPTURE_VERSION);
+    EXPECT_EQ(bytes[5], 0);
+
+    const uint8_t *record = bytes + sizeof(struct CaptureFileHeader);
+    const uint8_t connection[] = {0x04, 0x03, 0x02, 0x01};
+    EXPECT_EQ(memcmp(record + offsetof(struct CaptureRecordHeader, connection), connection, 4), 0);
+    EXPECT_EQ(record[offsetof(struct CaptureRecordHeader, event)], (uint8_t)CaptureEvent::HUB_OUT);
+    EXPECT_EQ(record[offsetof(struct CaptureRecordHeader, length)], sizeof(data));
+    EXPECT_EQ(record[offsetof(struct CaptureRecordHeader, length) + 1], 0);
+}
+
+/**
+ * @test CaptureTests.InvalidFile
+ * @details
+ * - Verify that missing files and files that are not captures are rejected.
+ * - Expects std::runtime_error to be thrown.
+ * @ingroup CaptureTests
+ */
+TEST(CaptureTests, InvalidFile) {
+    EXPECT_THROW(readCapture(testCaptureFile() + "-missing"), std::runtime_error);
+
+    FILE *file = fopen(testCaptureFile().c_str(), "w");
+    fputs("definitely not a capture file", file);
+    fclose(file);
+    EXPECT_THROW(readCapture(testCaptureFile()), std::runtime_error);
+    unlink(testCaptureFile().c_str());
+}
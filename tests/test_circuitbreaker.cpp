@@ -0,0 +1,72 @@
+/**
+ * @file test_circuitbreaker.cpp
+ * @brief Unit tests for CircuitBreaker class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "circuitbreaker.h"
+
+/**
+ * @test CircuitBreakerTests.OpensAfterRepeatedFailures
+ * @details
+ * - Report fewer failures in a row than the threshold, a success, then as many as the threshold.
+ * - Expects only the failures in a row to open the breaker, and requests to be rejected then.
+ * @ingroup CircuitBreakerTests
+ */
+TEST(CircuitBreakerTests, OpensAfterRepeatedFailures) {
+    CircuitBreaker breaker;
+    breaker.configure(3, std::chrono::milliseconds(1000));
+
+    breaker.failed();
+    breaker.failed();
+    breaker.succeeded();
+    breaker.failed();
+    breaker.failed();
+    EXPECT_TRUE(breaker.allow());
+    EXPECT_EQ(breaker.getStats().state, BreakerState::CLOSED);
+
+    breaker.failed();
+    EXPECT_FALSE(breaker.allow());
+    EXPECT_FALSE(breaker.allow());
+
+    struct BreakerStats stats = breaker.getStats();
+    EXPECT_EQ(stats.state, BreakerState::OPEN);
+    EXPECT_EQ(stats.consecutive_failures, 3u);
+    EXPECT_EQ(stats.opened, 1u);
+    EXPECT_EQ(stats.rejected, 2u);
+}
+
+/**
+ * @test CircuitBreakerTests.ProbesForRecovery
+ * @details
+ * - Open the breaker, wait out the open interval and fail the probe, then wait again and let the
+ *   next probe succeed.
+ * - Expects a single probe per interval, a failed probe to reopen the breaker and a successful one
+ *   to close it.
+ * @ingroup CircuitBreakerTests
+ */
+TEST(CircuitBreakerTests, ProbesForRecovery) {
+    CircuitBreaker breaker;
+    breaker.configure(1, std::chrono::milliseconds(20));
+    breaker.failed();
+    EXPECT_FALSE(breaker.allow());
+
+    usleep(30000);
+    EXPECT_TRUE(breaker.allow());
+    EXPECT_EQ(breaker.getStats().state, BreakerState::HALF_OPEN);
+    EXPECT_FALSE(breaker.allow());
+    breaker.failed();
+    EXPECT_EQ(breaker.getStats().state, BreakerState::OPEN);
+    EXPECT_FALSE(breaker.allow());
+
+    usleep(30000);
+    EXPECT_TRUE(breaker.allow());
+    breaker.succeeded();
+    EXPECT_EQ(breaker.getStats().state, BreakerState::CLOSED);
+    EXPECT_TRUE(breaker.allow());
+    EXPECT_EQ(breaker.getStats().opened, 1u);
+}
@@ -0,0 +1,317 @@
+/**
+ * @file test_cluster.cpp
+ * @brief Unit tests for ClusterMap and PeerLink classes.
+ * @author Daan Breur
+ */
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "cluster.h"
+#include "framing.h"
+#include "packetview.h"
+
+/**
+ * @brief Size of an extended DASHBOARD_GET frame: header, high ID byte and metadata.
+ */
+#define GET_FRAME_SIZE (sizeof(struct sensor_header) + 1 + sizeof(struct sensor_metadata))
+
+/**
+ * @brief Receives exactly length bytes, waiting at most two seconds.
+ */
+static bool receiveAll(int fd, uint8_t *buffer, size_t length) {
+    while (length > 0) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 2000) <= 0) return false;
+        ssize_t received = recv(fd, buffer, length, 0);
+        if (received <= 0) return false;
+        buffer += received;
+        length -= received;
+    }
+    return true;
+}
+
+/**
+ * @brief A bridge that only answers DASHBOARD_GETs, and only once a whole batch of them is in.
+ */
+class FakeBridge {
+   public:
+    int listen_fd;
+    int port;
+    std::thread thread;
+    /** @brief Number of requests that had arrived before the first answer went out */
+    std::atomic<size_t> received_before_answering;
+
+    FakeBridge() : received_before_answering(0) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_fd, (struct sockaddr *)&address, sizeof(address));
+        listen(listen_fd, 1);
+
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd, (struct sockaddr *)&address, &length);
+        port = ntohs(address.sin_port);
+    }
+
+    ~FakeBridge() {
+        if (thread.joinable()) thread.join();
+        close(listen_fd);
+    }
+
+    /**
+     * @brief Accepts one bridge, agrees to its HELLO and answers a batch of requests in order.
+     */
+    void serve(size_t batch) {
+        thread = std::thread([this, batch]() {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            uint8_t hello[sizeof(struct sensor_header) + sizeof(struct connection_hello)];
+            if (!receiveAll(fd, hello, sizeof(hello))) {
+                close(fd);
+                return;
+            }
+            send(fd, hello, sizeof(hello), MSG_NOSIGNAL);
+
+            std::vector<uint16_t> sensor_ids;
+            for (size_t i = 0; i < batch; ++i) {
+                uint8_t frame[GET_FRAME_SIZE];
+                if (!receiveAll(fd, frame, sizeof(frame))) break;
+
+                struct sensor_packet request;
+                uint16_t sensor_id;
+                decodeFrame(frame, true, request, sensor_id);
+                sensor_ids.push_back(sensor_id);
+            }
+            received_before_answering = sensor_ids.size();
+
+            for (uint16_t sensor_id : sensor_ids) {
+                struct sensor_packet response = {0};
+                response.header.length = sizeof(struct sensor_packet_temperature);
+                response.header.ptype = PacketType::DASHBOARD_RESPONSE;
+                response.data.temperature.metadata.sensor_type = SensorType::TEMPERATURE;
+                setTemperature(response, sensor_id / 100.0f);
+
+                uint8_t frame[MAX_FRAME_SIZE];
+                size_t length = encodeFrame(response, sensor_id, true, frame);
+                send(fd, frame, length, MSG_NOSIGNAL);
+            }
+
+            // keeps the connection open until the link goes away
+            uint8_t rest;
+            receiveAll(fd, &rest, 1);
+            close(fd);
+        });
+    }
+};
+
+/**
+ * @brief Returns a DASHBOARD_GET for a temperature sensor.
+ */
+static struct sensor_packet getRequest(uint16_t sensor_id) {
+    struct sensor_packet request = {0};
+    request.header.length = sizeof(struct sensor_metadata);
+    request.header.ptype = PacketType::DASHBOARD_GET;
+    request.data.generic.metadata = {SensorType::TEMPERATURE, (uint8_t)sensor_id};
+    return request;
+}
+
+/**
+ * @test ClusterTests.MapAssignsSensorsToBridges
+ * @details
+ * - Parse a table with two bridges, one of them owning a single sensor and a range.
+ * - Expects the listed sensors to belong to their bridge and every other sensor to be local.
+ * - Expects connections from the IP address of a bridge to be told apart from other clients.
+ * - Expects malformed tables and sensors owned twice to be rejected.
+ * @ingroup ClusterTests
+ */
+TEST(ClusterTests, MapAssignsSensorsToBridges) {
+    ClusterMap cluster;
+    cluster.parseTable("127.0.0.1:6001=1000-1999;127.0.0.1:6002=64,2000-2999");
+
+    ASSERT_EQ(cluster.size(), 2u);
+    EXPECT_EQ(cluster.node(0).address(), "127.0.0.1:6001");
+    EXPECT_EQ(cluster.ownerOf(1000), &cluster.node(0));
+    EXPECT_EQ(cluster.ownerOf(1999), &cluster.node(0));
+    EXPECT_EQ(cluster.ownerOf(64), &cluster.node(1));
+    EXPECT_EQ(cluster.ownerOf(2999), &cluster.node(1));
+    EXPECT_EQ(cluster.ownerOf(999), nullptr);
+    EXPECT_EQ(cluster.ownerOf(3000), nullptr);
+
+    struct in_addr address;
+    inet_pton(AF_INET, "127.0.0.1", &address);
+    EXPECT_TRUE(cluster.isNode(address));
+    inet_pton(AF_INET, "10.0.0.6", &address);
+    EXPECT_FALSE(cluster.isNode(address));
+
+    EXPECT_THROW(cluster.parseTable("127.0.0.1=1000"), std::invalid_argument);
+    EXPECT_THROW(cluster.parseTable("127.0.0.1:6001=2000-1000"), std::invalid_argument);
+    EXPECT_THROW(cluster.parseTable("127.0.0.1:6001=70000"), std::invalid_argument);
+    EXPECT_THROW(cluster.parseTable("bridge:6001=1000"), std::invalid_argument);
+    EXPECT_THROW(cluster.parseTable("127.0.0.1:6001=1000-1100;127.0.0.1:6002=1100"),
+                 std::invalid_argument);
+
+    // a rejected table leaves the previous one in place
+    EXPECT_EQ(cluster.ownerOf(1000), &cluster.node(0));
+}
+
+/**
+ * @test ClusterTests.PipelinesRequests
+ * @details
+ * - Let several threads forward a DASHBOARD_GET each over one link to a bridge that only answers
+ *   once all of them are in.
+ * - Expects every request to be on the wire before the first answer, and every thread to get the
+ *   answer for its own sensor.
+ * @ingroup ClusterTests
+ */
+TEST(ClusterTests, PipelinesRequests) {
+    const size_t requests = 8;
+    FakeBridge bridge;
+    bridge.serve(requests);
+
+    PeerLink link("127.0.0.1", bridge.port);
+    link.start();
+    for (int i = 0; i < 200 && !link.isConnected(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_TRUE(link.isConnected());
+
+    std::vector<float> answers(requests, -1);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < requests; ++i) {
+        threads.emplace_back([&link, &answers, i]() {
+            uint16_t sensor_id = 1000 + i * 100;
+            struct sensor_packet request = getRequest(sensor_id);
+            answers[i] = PacketView(link.call(request, sensor_id, 2000)).temperature();
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    EXPECT_EQ(bridge.received_before_answering, requests);
+    for (size_t i = 0; i < requests; ++i) EXPECT_FLOAT_EQ(answers[i], 10.0f + i);
+
+    struct PeerStats stats = link.getStats();
+    EXPECT_EQ(stats.forwarded, requests);
+    EXPECT_EQ(stats.failed, 0u);
+    EXPECT_EQ(stats.in_flight, 0u);
+    EXPECT_EQ(stats.peak_in_flight, requests);
+
+    link.stop();
+}
+
+/**
+ * @test ClusterTests.ConsumesPostAnswers
+ * @details
+ * - Forward two posts and then a DASHBOARD_GET for the same sensor to a bridge that answers the
+ *   read first, with an error, and only then rejects the first post and acknowledges the second.
+ * - Expects the read to get its own answer instead of the POST_ACK of a post, even though the
+ *   answers came out of order, and the rejected post to be counted as failed.
+ * @ingroup ClusterTests
+ */
+TEST(ClusterTests, ConsumesPostAnswers) {
+    FakeBridge bridge;
+    std::thread owner([&bridge]() {
+        int fd = accept(bridge.listen_fd, nullptr, nullptr);
+        uint8_t hello[sizeof(struct sensor_header) + sizeof(struct connection_hello)];
+        if (!receiveAll(fd, hello, sizeof(hello))) {
+            close(fd);
+            return;
+        }
+        send(fd, hello, sizeof(hello), MSG_NOSIGNAL);
+
+        uint8_t frame[MAX_FRAME_SIZE];
+        size_t post_length = sizeof(struct sensor_header) + 1 + sizeof(struct sensor_packet_light);
+        if (!receiveAll(fd, frame, post_length) || !receiveAll(fd, frame, post_length) ||
+            !receiveAll(fd, frame, GET_FRAME_SIZE)) {
+            close(fd);
+            return;
+        }
+
+        // like a hub read that takes longer than the posts
+        struct sensor_packet answer = {0};
+        answer.header.length = sizeof(struct sensor_packet_error);
+        answer.header.ptype = PacketType::DASHBOARD_ERROR;
+        answer.data.error.metadata = {SensorType::TEMPERATURE, (uint8_t)1000};
+        answer.data.error.error_code = ErrorCode::HUB_UNAVAILABLE;
+        send(fd, frame, encodeFrame(answer, 1000, true, frame), MSG_NOSIGNAL);
+
+        answer.header.ptype = PacketType::POST_ACK;
+        answer.data.error.metadata = {SensorType::LIGHT, (uint8_t)1000};
+        answer.data.error.error_code = ErrorCode::NOT_CONNECTED;
+        send(fd, frame, encodeFrame(answer, 1000, true, frame), MSG_NOSIGNAL);
+        answer.data.error.error_code = ErrorCode::NONE;
+        send(fd, frame, encodeFrame(answer, 1000, true, frame), MSG_NOSIGNAL);
+
+        uint8_t rest;
+        receiveAll(fd, &rest, 1);
+        close(fd);
+    });
+
+    PeerLink link("127.0.0.1", bridge.port);
+    link.start();
+    for (int i = 0; i < 200 && !link.isConnected(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_TRUE(link.isConnected());
+
+    struct sensor_packet post = {0};
+    post.header.length = sizeof(struct sensor_packet_light);
+    post.header.ptype = PacketType::DASHBOARD_POST;
+    post.data.light.metadata = {SensorType::LIGHT, (uint8_t)1000};
+    post.data.light.target_state = 1;
+    link.post(post, 1000);
+    link.post(post, 1000);
+
+    struct sensor_packet request = getRequest(1000);
+    struct sensor_packet response = link.call(request, 1000, 2000);
+    EXPECT_EQ(response.header.ptype, PacketType::DASHBOARD_ERROR);
+    EXPECT_EQ(response.data.error.error_code, ErrorCode::HUB_UNAVAILABLE);
+
+    for (int i = 0; i < 200 && link.getStats().in_flight > 0; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    struct PeerStats stats = link.getStats();
+    EXPECT_EQ(stats.forwarded, 3u);
+    EXPECT_EQ(stats.failed, 1u);
+    EXPECT_EQ(stats.in_flight, 0u);
+    EXPECT_EQ(stats.unmatched, 0u);
+
+    link.stop();
+    owner.join();
+}
+
+/**
+ * @test ClusterTests.UnreachableBridgeFails
+ * @details
+ * - Forward a request and a post over a link to a port nothing listens on.
+ * - Expects both to fail right away instead of waiting for an answer.
+ * @ingroup ClusterTests
+ */
+TEST(ClusterTests, UnreachableBridgeFails) {
+    int port;
+    {
+        // a port that was free a moment ago
+        FakeBridge closed;
+        port = closed.port;
+    }
+
+    PeerLink link("127.0.0.1", port);
+    link.start();
+
+    struct sensor_packet request = getRequest(1000);
+    auto started = std::chrono::steady_clock::now();
+    EXPECT_THROW(link.call(request, 1000), std::runtime_error);
+    EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(500));
+
+    request.header.ptype = PacketType::DASHBOARD_POST;
+    EXPECT_THROW(link.post(request, 1000), std::runtime_error);
+    EXPECT_EQ(link.getStats().failed, 2u);
+
+    link.stop();
+}
@@ -0,0 +1,123 @@
+/**
+ * @file test_deadband.cpp
+ * @brief Unit tests for DeadbandFilter class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include "deadband.h"
+
+/**
+ * @brief Returns a temperature packet for the given sensor.
+ */
+static struct sensor_packet temperaturePacket(uint8_t sensor_id, float value) {
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_temperature);
+    packet.header.ptype = PacketType::DATA;
+    packet.data.temperature.metadata.sensor_type = SensorType::TEMPERATURE;
+    packet.data.temperature.metadata.sensor_id = sensor_id;
+    setTemperature(packet, value);
+    return packet;
+}
+
+/**
+ * @test DeadbandTests.ExactCompareByDefault
+ * @details
+ * - Filter identical and different updates without any deadbands set.
+ * - Expects only identical updates to be suppressed, and the first update of a sensor to pass.
+ * @ingroup DeadbandTests
+ */
+TEST(DeadbandTests, ExactCompareByDefault) {
+    DeadbandFilter filter;
+    struct sensor_packet none = {0};
+
+    struct sensor_packet light = {0};
+    light.header.length = sizeof(struct sensor_packet_light);
+    light.data.light.metadata.sensor_type = SensorType::LIGHT;
+    light.data.light.metadata.sensor_id = 200;
+    light.data.light.target_state = 1;
+
+    EXPECT_TRUE(filter.accept(200, none, light));
+    EXPECT_FALSE(filter.accept(200, light, light));
+
+    struct sensor_packet off = light;
+    off.data.light.target_state = 0;
+    EXPECT_TRUE(filter.accept(200, light, off));
+
+    EXPECT_FALSE(filter.accept(201, temperaturePacket(201, 21.5f), temperaturePacket(201, 21.5f)));
+    EXPECT_TRUE(filter.accept(201, temperaturePacket(201, 21.5f), temperaturePacket(201, 21.51f)));
+
+    struct DeadbandStats stats = filter.getStats();
+    EXPECT_EQ(stats.accepted, 3u);
+    EXPECT_EQ(stats.suppressed, 2u);
+}
+
+/**
+ * @test DeadbandTests.ButtonPressesAlwaysPass
+ * @details
+ * - Filter two identical button presses.
+ * - Expects both to pass, presses are events rather than states.
+ * @ingroup DeadbandTests
+ */
+TEST(DeadbandTests, ButtonPressesAlwaysPass) {
+    DeadbandFilter filter;
+
+    struct sensor_packet press = {0};
+    press.header.length = sizeof(struct sensor_packet_generic);
+    press.data.generic.metadata.sensor_type = SensorType::BUTTON;
+    press.data.generic.metadata.sensor_id = 0x80;
+
+    EXPECT_TRUE(filter.accept(0x80, press, press));
+    EXPECT_TRUE(filter.accept(0x80, press, press));
+}
+
+/**
+ * @test DeadbandTests.Thresholds
+ * @details
+ * - Set an absolute deadband for a type, and a relative one overriding it for a single sensor.
+ * - Expects readings to pass only once they move beyond the deadband that applies to them.
+ * @ingroup DeadbandTests
+ */
+TEST(DeadbandTests, Thresholds) {
+    DeadbandFilter filter;
+    filter.parse("temperature=0.5,210=10%");
+
+    EXPECT_FALSE(filter.accept(201, temperaturePacket(201, 20.0f), temperaturePacket(201, 20.4f)));
+    EXPECT_FALSE(filter.accept(201, temperaturePacket(201, 20.0f), temperaturePacket(201, 19.6f)));
+    EXPECT_TRUE(filter.accept(201, temperaturePacket(201, 20.0f), temperaturePacket(201, 20.6f)));
+
+    EXPECT_FALSE(filter.accept(210, temperaturePacket(210, 20.0f), temperaturePacket(210, 21.5f)));
+    EXPECT_TRUE(filter.accept(210, temperaturePacket(210, 20.0f), temperaturePacket(210, 22.5f)));
+
+    // an extended ID that shares its low byte with sensor 210 gets the deadband of its type
+    EXPECT_TRUE(filter.accept(0x1D2, temperaturePacket(210, 20.0f), temperaturePacket(210, 21.5f)));
+
+    struct sensor_packet known = {0}, update = {0};
+    known.header.length = update.header.length = sizeof(struct sensor_packet_co2);
+    known.data.co2.metadata.sensor_type = update.data.co2.metadata.sensor_type = SensorType::CO2;
+    setCo2(known, 400);
+    setCo2(update, 420);
+    filter.setTypeDeadband(SensorType::CO2, {25, 0});
+    EXPECT_FALSE(filter.accept(0, known, update));
+    filter.setTypeDeadband(SensorType::CO2, {10, 0});
+    EXPECT_TRUE(filter.accept(0, known, update));
+}
+
+/**
+ * @test DeadbandTests.ParseInvalid
+ * @details
+ * - Parse malformed deadband lists.
+ * - Expects std::invalid_argument to be thrown.
+ * @ingroup DeadbandTests
+ */
+TEST(DeadbandTests, ParseInvalid) {
+    DeadbandFilter filter;
+    for (const char *list : {"temperature", "temperature=", "temperature=-1", "temperature=abc",
+                             "pressure=1", "256=1", "200=1%%"})
+        EXPECT_THROW(filter.parse(list), std::invalid_argument) << list;
+
+    EXPECT_THROW(filter.setSensorDeadband(200, {-1, 0}), std::invalid_argument);
+    EXPECT_NO_THROW(filter.parse("humidity=1/2%,co2=20,200=0.1"));
+}
@@ -0,0 +1,72 @@
+/**
+ * @file test_devicegroups.cpp
+ * @brief Unit tests for DeviceGroups class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "devicegroups.h"
+#include "framing.h"
+#include "packetview.h"
+
+/**
+ * @test DeviceGroupTests.ParseGroups
+ * @details
+ * - Parse groups mixing single devices and ranges, with a device listed twice.
+ * - Expects the members in the order they were listed without duplicates, unknown groups to have
+ *   no members, and malformed lists and oversized groups to be rejected.
+ * @ingroup DeviceGroupTests
+ */
+TEST(DeviceGroupTests, ParseGroups) {
+    DeviceGroups groups;
+    groups.parse("2=200-202,64,201;3=1000");
+
+    ASSERT_EQ(groups.size(), 2u);
+    ASSERT_NE(groups.members(2), nullptr);
+    EXPECT_EQ(*groups.members(2), std::vector<uint16_t>({200, 201, 202, 64}));
+    EXPECT_EQ(*groups.members(3), std::vector<uint16_t>({1000}));
+    EXPECT_EQ(groups.members(4), nullptr);
+
+    EXPECT_THROW(groups.parse("5"), std::invalid_argument);
+    EXPECT_THROW(groups.parse("5=300-200"), std::invalid_argument);
+    EXPECT_THROW(groups.parse("5=70000"), std::invalid_argument);
+    EXPECT_THROW(groups.parse("6=1-" + std::to_string(MAX_GROUP_MEMBERS + 1)),
+                 std::invalid_argument);
+}
+
+/**
+ * @test DeviceGroupTests.EncodeGroupResult
+ * @details
+ * - Encode the result of a post to the largest possible group and send it as an extended frame.
+ * - Expects every member status to survive, so the result fits a frame even with the high byte
+ *   of the ID.
+ * @ingroup DeviceGroupTests
+ */
+TEST(DeviceGroupTests, EncodeGroupResult) {
+    std::vector<struct GroupMemberResult> results;
+    for (uint16_t i = 0; i < MAX_GROUP_MEMBERS; ++i)
+        results.push_back(
+            {(uint16_t)(1000 + i), i % 2 ? ErrorCode::NOT_CONNECTED : ErrorCode::NONE});
+
+    uint8_t frame[MAX_FRAME_SIZE];
+    size_t length = encodeGroupResult({SensorType::LIGHT, 2}, results, frame);
+    EXPECT_EQ(length, sizeof(struct sensor_header) + sizeof(struct group_result) +
+                          MAX_GROUP_MEMBERS * sizeof(struct group_member_status));
+
+    uint8_t extended[MAX_FRAME_SIZE];
+    size_t extended_length = encodeFrame(PacketView(frame, length), 0x0102, true, extended);
+    ASSERT_EQ(extended_length, length + 1);
+
+    const uint8_t *payload = extended + sizeof(struct sensor_header) + 1;
+    EXPECT_EQ(extended[1], (uint8_t)PacketType::GROUP_RESULT);
+    EXPECT_EQ(payload[offsetof(struct group_result, metadata) + 1], 0x02);
+    EXPECT_EQ(payload[offsetof(struct group_result, member_count)], MAX_GROUP_MEMBERS);
+
+    const uint8_t *last = payload + sizeof(struct group_result) +
+                          (MAX_GROUP_MEMBERS - 1) * sizeof(struct group_member_status);
+    EXPECT_EQ(loadLE16(last), 1000 + MAX_GROUP_MEMBERS - 1);
+    EXPECT_EQ(last[2], (uint8_t)results.back().status);
+}
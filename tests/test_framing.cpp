@@ -0,0 +1,82 @@
+/**
+ * @file test_framing.cpp
+ * @brief Unit tests for the frame encoding and decoding.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include "framing.h"
+
+/**
+ * @brief Returns a light packet with the low byte of the given sensor ID in its metadata.
+ */
+static struct sensor_packet lightPacket(uint16_t sensor_id) {
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_light);
+    packet.header.ptype = PacketType::DASHBOARD_POST;
+    packet.data.light.metadata.sensor_type = SensorType::LIGHT;
+    packet.data.light.metadata.sensor_id = sensor_id & 0xFF;
+    packet.data.light.target_state = 1;
+    return packet;
+}
+
+/**
+ * @test FramingTests.RoundTrip
+ * @details
+ * - Encode and decode a packet on a basic and on an extended connection.
+ * - Expects the extended frame to be one byte longer, and both to decode to the same packet.
+ * @ingroup FramingTests
+ */
+TEST(FramingTests, RoundTrip) {
+    uint8_t frame[MAX_FRAME_SIZE];
+    struct sensor_packet decoded;
+    uint16_t sensor_id;
+
+    size_t basic_length = encodeFrame(lightPacket(200), 200, false, frame);
+    EXPECT_EQ(basic_length, sizeof(struct sensor_header) + sizeof(struct sensor_packet_light));
+    ASSERT_TRUE(decodeFrame(frame, false, decoded, sensor_id));
+    EXPECT_EQ(sensor_id, 200);
+    EXPECT_EQ(decoded.data.light.target_state, 1);
+
+    size_t extended_length = encodeFrame(lightPacket(0xABCD), 0xABCD, true, frame);
+    EXPECT_EQ(extended_length, basic_length + 1);
+    ASSERT_TRUE(decodeFrame(frame, true, decoded, sensor_id));
+    EXPECT_EQ(sensor_id, 0xABCD);
+    EXPECT_EQ(decoded.header.length, sizeof(struct sensor_packet_light));
+    EXPECT_EQ(decoded.data.light.metadata.sensor_type, SensorType::LIGHT);
+    EXPECT_EQ(decoded.data.light.target_state, 1);
+}
+
+/**
+ * @test FramingTests.BasicFrameRejectsWideId
+ * @details
+ * - Encode a packet for a 16-bit sensor ID on a basic connection.
+ * - Expects std::invalid_argument to be thrown.
+ * @ingroup FramingTests
+ */
+TEST(FramingTests, BasicFrameRejectsWideId) {
+    uint8_t frame[MAX_FRAME_SIZE];
+    EXPECT_THROW(encodeFrame(lightPacket(0x100), 0x100, false, frame), std::invalid_argument);
+}
+
+/**
+ * @test FramingTests.ShortExtendedFrame
+ * @details
+ * - Decode an extended frame without any payload, and one with only the high ID byte.
+ * - Expects the first to be rejected and the second to decode to an empty packet.
+ * @ingroup FramingTests
+ */
+TEST(FramingTests, ShortExtendedFrame) {
+    struct sensor_packet decoded;
+    uint16_t sensor_id;
+
+    uint8_t empty[] = {0, (uint8_t)PacketType::HEARTBEAT};
+    EXPECT_FALSE(decodeFrame(empty, true, decoded, sensor_id));
+
+    uint8_t id_only[] = {1, (uint8_t)PacketType::HEARTBEAT, 0x02};
+    ASSERT_TRUE(decodeFrame(id_only, true, decoded, sensor_id));
+    EXPECT_EQ(sensor_id, 0x0200);
+    EXPECT_EQ(decoded.header.length, 0);
+}
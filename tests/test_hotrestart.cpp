@@ -0,0 +1,251 @@
+/**
+ * @file test_hotrestart.cpp
+ * @brief Unit tests for the socket and state handoff used for hot restarts.
+ * @author Daan Breur
+ */
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <string.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "hotrestart.h"
+
+/**
+ * @brief Checks that data written to one end of a pipe comes out of the other end.
+ */
+static bool pipeWorks(int write_fd, int read_fd) {
+    char byte = 'x';
+    if (write(write_fd, &byte, 1) != 1) return false;
+    byte = 0;
+    return read(read_fd, &byte, 1) == 1 && byte == 'x';
+}
+
+/**
+ * @test HotRestartTests.Handoff_RoundTrip
+ * @details
+ * - Hand a listening socket, two hub sockets, clients and slave state over a socketpair.
+ * - Expects the received file descriptors to refer to the same open files.
+ * - Expects the slave to client mapping and the slave state to be preserved.
+ * @ingroup HotRestartTests
+ */
+TEST(HotRestartTests, Handoff_RoundTrip) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+
+    int listen_pipe[2], hub_pipe[2], second_hub_pipe[2], client_pipe[2];
+    ASSERT_EQ(pipe(listen_pipe), 0);
+    ASSERT_EQ(pipe(hub_pipe), 0);
+    ASSERT_EQ(pipe(second_hub_pipe), 0);
+    ASSERT_EQ(pipe(client_pipe), 0);
+
+    struct HandoffState sent;
+    sent.listen_fd = listen_pipe[1];
+    sent.hub_fds = {hub_pipe[1], -1, second_hub_pipe[1]};
+
+    struct sockaddr_in client_address = {0};
+    client_address.sin_family = AF_INET;
+    client_address.sin_port = htons(4242);
+    sent.clients.push_back({client_pipe[1], client_address, true});
+
+    struct SlaveSnapshot connected_slave = {0};
+    connected_slave.slave_id = 40000;
+    connected_slave.extended_ids = true;
+    connected_slave.fd = client_pipe[1];
+    connected_slave.sensor_data.header.length = sizeof(struct sensor_packet_light);
+    connected_slave.sensor_data.data.light.metadata.sensor_id = 40000 & 0xFF;
+    connected_slave.sensor_data.data.light.target_state = 1;
+    sent.slaves.push_back(connected_slave);
+
+    struct SlaveSnapshot hub_sensor = {0};
+    hub_sensor.slave_id = 10;
+    hub_sensor.fd = -1;
+    hub_sensor.sensor_data.header.length = sizeof(struct sensor_packet_generic);
+    sent.slaves.push_back(hub_sensor);
+
+    std::thread sender([&]() { sendHandoffState(sockets[0], sent); });
+    struct HandoffState received = receiveHandoffState(sockets[1]);
+    sender.join();
+
+    EXPECT_TRUE(pipeWorks(received.listen_fd, listen_pipe[0]));
+    ASSERT_EQ(received.hub_fds.size(), 3u);
+    EXPECT_TRUE(pipeWorks(received.hub_fds[0], hub_pipe[0]));
+    EXPECT_EQ(received.hub_fds[1], -1);
+    EXPECT_TRUE(pipeWorks(received.hub_fds[2], second_hub_pipe[0]));
+    EXPECT_EQ(received.udp_fd, -1);
+    EXPECT_NE(fcntl(received.hub_fds[0], F_GETFD) & FD_CLOEXEC, 0);
+
+    ASSERT_EQ(received.clients.size(), 1u);
+    EXPECT_TRUE(pipeWorks(received.clients[0].fd, client_pipe[0]));
+    EXPECT_EQ(ntohs(received.clients[0].address.sin_port), 4242);
+    EXPECT_TRUE(received.clients[0].extended_ids);
+
+    ASSERT_EQ(received.slaves.size(), 2u);
+    EXPECT_EQ(received.slaves[0].slave_id, 40000);
+    EXPECT_TRUE(received.slaves[0].extended_ids);
+    EXPECT_FALSE(received.slaves[1].extended_ids);
+    EXPECT_EQ(received.slaves[0].fd, received.clients[0].fd);
+    EXPECT_EQ(received.slaves[0].sensor_data.data.light.target_state, 1);
+    EXPECT_EQ(received.slaves[1].slave_id, 10);
+    EXPECT_EQ(received.slaves[1].fd, -1);
+
+    for (int fd : {sockets[0], sockets[1], listen_pipe[0], listen_pipe[1], hub_pipe[0], hub_pipe[1],
+                   second_hub_pipe[0], second_hub_pipe[1], client_pipe[0], client_pipe[1],
+                   received.listen_fd, received.hub_fds[0], received.hub_fds[2],
+                   received.clients[0].fd})
+        close(fd);
+}
+
+/**
+ * @test HotRestartTests.Handoff_PendingBytes
+ * @details
+ * - Hand over a binary client with the first part of a frame buffered, an HTTP client halfway
+ *   through its headers and a slave.
+ * - Expects the buffered bytes and the HTTP parse state to arrive with their own client, and the
+ *   slave after them to be intact.
+ * @ingroup HotRestartTests
+ */
+TEST(HotRestartTests, Handoff_PendingBytes) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+    int client_pipe[2];
+    ASSERT_EQ(pipe(client_pipe), 0);
+
+    struct HandoffState sent;
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+
+    struct HandoffClient binary;
+    binary.fd = client_pipe[1];
+    binary.address = address;
+    binary.pending = {0x05, 0x03, 0x01};
+    sent.clients.push_back(binary);
+
+    struct HandoffClient http;
+    http.fd = dup(client_pipe[1]);
+    http.address = address;
+    http.http = true;
+    http.pending = {'H', 'o', 's', 't'};
+    http.http_request.started = true;
+    http.http_request.method = HttpMethod::POST;
+    strcpy(http.http_request.path, "/sensors/200");
+    sent.clients.push_back(http);
+
+    struct SlaveSnapshot slave = {0};
+    slave.slave_id = 200;
+    slave.fd = client_pipe[1];
+    sent.slaves.push_back(slave);
+
+    std::thread sender([&]() { sendHandoffState(sockets[0], sent); });
+    struct HandoffState received = receiveHandoffState(sockets[1]);
+    sender.join();
+
+    ASSERT_EQ(received.clients.size(), 2u);
+    EXPECT_EQ(received.clients[0].pending, binary.pending);
+    EXPECT_FALSE(received.clients[0].http_request.started);
+    EXPECT_TRUE(received.clients[1].http);
+    EXPECT_EQ(received.clients[1].pending, http.pending);
+    EXPECT_TRUE(received.clients[1].http_request.started);
+    EXPECT_EQ(received.clients[1].http_request.method, HttpMethod::POST);
+    EXPECT_STREQ(received.clients[1].http_request.path, "/sensors/200");
+
+    ASSERT_EQ(received.slaves.size(), 1u);
+    EXPECT_EQ(received.slaves[0].slave_id, 200);
+    EXPECT_EQ(received.slaves[0].fd, received.clients[0].fd);
+
+    for (int fd : {sockets[0], sockets[1], client_pipe[0], client_pipe[1], http.fd,
+                   received.clients[0].fd, received.clients[1].fd})
+        close(fd);
+}
+
+/**
+ * @test HotRestartTests.Handoff_ManyClients
+ * @details
+ * - Hand over more client connections than fit in a single SCM_RIGHTS message.
+ * - Expects all of them to arrive, in order.
+ * @ingroup HotRestartTests
+ */
+TEST(HotRestartTests, Handoff_ManyClients) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+
+    int client_pipe[2];
+    ASSERT_EQ(pipe(client_pipe), 0);
+
+    struct HandoffState sent;
+    for (int i = 0; i < 450; ++i) {
+        struct sockaddr_in address = {0};
+        address.sin_port = htons(i);
+        sent.clients.push_back({dup(client_pipe[1]), address});
+    }
+
+    std::thread sender([&]() { sendHandoffState(sockets[0], sent); });
+    struct HandoffState received = receiveHandoffState(sockets[1]);
+    sender.join();
+
+    ASSERT_EQ(received.clients.size(), sent.clients.size());
+    for (size_t i = 0; i < received.clients.size(); ++i) {
+        EXPECT_EQ(ntohs(received.clients[i].address.sin_port), i);
+        close(received.clients[i].fd);
+        close(sent.clients[i].fd);
+    }
+
+    for (int fd : {sockets[0], sockets[1], client_pipe[0], client_pipe[1]}) close(fd);
+}
+
+/**
+ * @test HotRestartTests.Handoff_ManySlaves
+ * @details
+ * - Hand over the state of more slaves than fit in a single message on the handoff socket.
+ * - Expects all of them to arrive, in order and with their state.
+ * @ingroup HotRestartTests
+ */
+TEST(HotRestartTests, Handoff_ManySlaves) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+
+    struct HandoffState sent;
+    for (int id = 1; id <= 10000; ++id) {
+        struct SlaveSnapshot slave = {0};
+        slave.slave_id = id;
+        slave.fd = -1;
+        slave.sensor_data.header.length = sizeof(struct sensor_packet_temperature);
+        slave.sensor_data.data.temperature.value = id;
+        sent.slaves.push_back(slave);
+    }
+
+    std::thread sender([&]() { sendHandoffState(sockets[0], sent); });
+    struct HandoffState received = receiveHandoffState(sockets[1]);
+    sender.join();
+
+    ASSERT_EQ(received.slaves.size(), sent.slaves.size());
+    for (size_t i = 0; i < received.slaves.size(); ++i) {
+        EXPECT_EQ(received.slaves[i].slave_id, sent.slaves[i].slave_id);
+        EXPECT_EQ(received.slaves[i].sensor_data.data.temperature.value, (float)(i + 1));
+    }
+
+    for (int fd : {sockets[0], sockets[1]}) close(fd);
+}
+
+/**
+ * @test HotRestartTests.Ack
+ * @details
+ * - Verify that the acknowledgement of the new process is picked up.
+ * - Verify that a new process dying before acknowledging is detected.
+ * @ingroup HotRestartTests
+ */
+TEST(HotRestartTests, Ack) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+
+    sendHandoffAck(sockets[1]);
+    EXPECT_TRUE(waitForHandoffAck(sockets[0], 1000));
+
+    close(sockets[1]);
+    EXPECT_FALSE(waitForHandoffAck(sockets[0], 1000));
+    close(sockets[0]);
+}
@@ -0,0 +1,172 @@
+/**
+ * @file test_httpapi.cpp
+ * @brief Unit tests for the HTTP request parser and the JSON helpers of the HTTP API.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "httpapi.h"
+
+/**
+ * @brief Feeds a complete request to the parser.
+ */
+static HttpParseResult parse(struct HttpRequest &request, const std::string &text,
+                             size_t &consumed, size_t capacity = 512) {
+    memset(&request, 0, sizeof(request));
+    return parseHttpRequest(request, (const uint8_t *)text.data(), text.size(), capacity,
+                            consumed);
+}
+
+/**
+ * @test HttpApiTests.ParseRequest
+ * @details
+ * - Parse a GET with a query string, an HTTP/1.0 request and a POST with a body.
+ * - Expects method, path, keep-alive and body length to be picked up.
+ * @ingroup HttpApiTests
+ */
+TEST(HttpApiTests, ParseRequest) {
+    struct HttpRequest request;
+    size_t consumed;
+
+    std::string get = "GET /sensors/200?pretty=1 HTTP/1.1\r\nHost: bridge\r\n\r\n";
+    ASSERT_EQ(parse(request, get, consumed), HttpParseResult::COMPLETE);
+    EXPECT_EQ(consumed, get.size());
+    EXPECT_EQ(request.method, HttpMethod::GET);
+    EXPECT_STREQ(request.path, "/sensors/200");
+    EXPECT_TRUE(request.keep_alive);
+
+    ASSERT_EQ(parse(request, "GET /health HTTP/1.0\r\n\r\n", consumed), HttpParseResult::COMPLETE);
+    EXPECT_FALSE(request.keep_alive);
+
+    std::string post = "POST /sensors/10 HTTP/1.1\r\ncontent-length: 4\r\nConnection: close\r\n"
+                       "\r\n{}\r\nGET";
+    ASSERT_EQ(parse(request, post, consumed), HttpParseResult::COMPLETE);
+    EXPECT_EQ(request.method, HttpMethod::POST);
+    EXPECT_EQ(request.content_length, 4u);
+    EXPECT_FALSE(request.keep_alive);
+    EXPECT_EQ(consumed, post.size() - 3);
+}
+
+/**
+ * @test HttpApiTests.ParseIncrementally
+ * @details
+ * - Feed a request in pieces, dropping consumed bytes like a connection does.
+ * - Expects header lines to be consumed as soon as they are complete, and the request to complete
+ *   once the body has arrived.
+ * @ingroup HttpApiTests
+ */
+TEST(HttpApiTests, ParseIncrementally) {
+    struct HttpRequest request;
+    memset(&request, 0, sizeof(request));
+    std::string buffer;
+    size_t consumed;
+
+    for (const char *piece : {"POST /sensors/1 HT", "TP/1.1\r\nContent-Length: 2\r\nUser-Ag",
+                              "ent: test\r\n\r\n{", "}"}) {
+        buffer += piece;
+        HttpParseResult result = parseHttpRequest(request, (const uint8_t *)buffer.data(),
+                                                  buffer.size(), 64, consumed);
+        buffer.erase(0, consumed);
+        if (strcmp(piece, "}") == 0) {
+            EXPECT_EQ(result, HttpParseResult::COMPLETE);
+            EXPECT_TRUE(buffer.empty());
+        } else {
+            EXPECT_EQ(result, HttpParseResult::INCOMPLETE) << piece;
+        }
+    }
+    EXPECT_STREQ(request.path, "/sensors/1");
+}
+
+/**
+ * @test HttpApiTests.ParseInvalid
+ * @details
+ * - Parse malformed requests, a header line longer than the buffer and a body that cannot fit.
+ * - Expects each of them to be reported as such.
+ * @ingroup HttpApiTests
+ */
+TEST(HttpApiTests, ParseInvalid) {
+    struct HttpRequest request;
+    size_t consumed;
+
+    EXPECT_EQ(parse(request, "GET\r\n\r\n", consumed), HttpParseResult::BAD_REQUEST);
+    EXPECT_EQ(parse(request, "GET /x HTTP/2\r\n\r\n", consumed), HttpParseResult::BAD_REQUEST);
+    EXPECT_EQ(parse(request, "GET /x HTTP/1.1\r\nbroken\r\n\r\n", consumed),
+              HttpParseResult::BAD_REQUEST);
+    EXPECT_EQ(parse(request, "POST /x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", consumed),
+              HttpParseResult::BAD_REQUEST);
+
+    // the request line is consumed first, then the rest of the buffer is a single line
+    std::string cookie = "Cookie: " + std::string(56, 'a');
+    EXPECT_EQ(parse(request, "GET /x HTTP/1.1\r\n" + cookie, consumed, 64),
+              HttpParseResult::INCOMPLETE);
+    EXPECT_EQ(parseHttpRequest(request, (const uint8_t *)cookie.data(), cookie.size(), 64,
+                               consumed),
+              HttpParseResult::HEADER_TOO_LARGE);
+    EXPECT_EQ(parse(request, "POST /x HTTP/1.1\r\nContent-Length: 65\r\n\r\n", consumed, 64),
+              HttpParseResult::BODY_TOO_LARGE);
+}
+
+/**
+ * @test HttpApiTests.SensorToJson
+ * @details
+ * - Serialize the state of sensors of several types.
+ * - Expects the fields of the type, and no fields if the packet is too short to hold them.
+ * @ingroup HttpApiTests
+ */
+TEST(HttpApiTests, SensorToJson) {
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_temperature);
+    packet.data.temperature.metadata.sensor_type = SensorType::TEMPERATURE;
+    setTemperature(packet, 21.5f);
+    EXPECT_EQ(sensorToJson(10, packet), "{\"id\":10,\"type\":\"temperature\",\"value\":21.5}");
+
+    packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_lichtkrant);
+    packet.data.lichtkrant.metadata.sensor_type = SensorType::LICHTKRANT;
+    memcpy(packet.data.lichtkrant.text, "say \"hi\"", 8);
+    EXPECT_EQ(sensorToJson(40000, packet),
+              "{\"id\":40000,\"type\":\"lichtkrant\",\"text\":\"say \\\"hi\\\"\"}");
+
+    packet.header.length = sizeof(struct sensor_packet_generic);
+    packet.data.generic.metadata.sensor_type = SensorType::RGB_LIGHT;
+    EXPECT_EQ(sensorToJson(3, packet), "{\"id\":3,\"type\":\"rgb_light\"}");
+}
+
+/**
+ * @test HttpApiTests.ParseSensorWrite
+ * @details
+ * - Parse actuator writes for every writable type, and malformed ones.
+ * - Expects DASHBOARD_POST packets for the valid writes and std::invalid_argument otherwise.
+ * @ingroup HttpApiTests
+ */
+TEST(HttpApiTests, ParseSensorWrite) {
+    struct sensor_packet packet;
+    auto write = [&packet](const std::string &body, uint16_t sensor_id) {
+        parseSensorWrite(body.data(), body.size(), sensor_id, packet);
+    };
+
+    write(" {\"type\": \"light\", \"target_state\": true}\n", 0x1234);
+    EXPECT_EQ(packet.header.ptype, PacketType::DASHBOARD_POST);
+    EXPECT_EQ(packet.header.length, sizeof(struct sensor_packet_light));
+    EXPECT_EQ(packet.data.light.metadata.sensor_type, SensorType::LIGHT);
+    EXPECT_EQ(packet.data.light.metadata.sensor_id, 0x34);
+    EXPECT_EQ(packet.data.light.target_state, 1);
+
+    write("{\"type\":\"rgb_light\",\"red\":255,\"green\":0,\"blue\":7}", 8);
+    EXPECT_EQ(packet.data.rgb_light.red_state, 255);
+    EXPECT_EQ(packet.data.rgb_light.blue_state, 7);
+
+    write("{\"text\":\"Hi \\u0041\",\"type\":\"lichtkrant\"}", 9);
+    EXPECT_STREQ(packet.data.lichtkrant.text, "Hi A");
+
+    for (const char *body :
+         {"", "{", "{\"type\":\"light\"}", "{\"type\":\"light\",\"target_state\":2}",
+          "{\"type\":\"temperature\",\"value\":1}", "{\"type\":\"rgb_light\",\"red\":-1}",
+          "{\"type\":\"lichtkrant\",\"text\":\"this is far too long\"}",
+          "{\"type\":\"light\",\"target_state\":1} trailing"})
+        EXPECT_THROW(write(body, 1), std::invalid_argument) << body;
+}
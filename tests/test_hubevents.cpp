@@ -0,0 +1,79 @@
+/**
+ * @file test_hubevents.cpp
+ * @brief Unit tests for HubEventDispatcher class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+#include "hubevents.h"
+
+/**
+ * @brief Returns a button event of the given sensor.
+ */
+static struct sensor_packet buttonEvent(uint8_t sensor_id) {
+    struct sensor_packet event = {0};
+    event.header.length = sizeof(struct sensor_packet_generic);
+    event.header.ptype = PacketType::DATA;
+    event.data.generic.metadata.sensor_type = SensorType::BUTTON;
+    event.data.generic.metadata.sensor_id = sensor_id;
+    return event;
+}
+
+/**
+ * @test HubEventTests.DispatchedInOrder
+ * @details
+ * - Post events before and after starting the dispatcher, then stop it.
+ * - Expects every event to be handled once, in the order posted, by the time stop() returns.
+ * @ingroup HubEventTests
+ */
+TEST(HubEventTests, DispatchedInOrder) {
+    HubEventDispatcher dispatcher;
+    std::vector<uint8_t> handled;
+
+    dispatcher.post(buttonEvent(1));
+    dispatcher.start([&handled](const struct sensor_packet &event) {
+        handled.push_back(event.data.generic.metadata.sensor_id);
+    });
+    for (uint8_t id = 2; id <= 5; ++id) dispatcher.post(buttonEvent(id));
+    dispatcher.stop();
+
+    std::vector<uint8_t> expected = {1, 2, 3, 4, 5};
+    EXPECT_EQ(handled, expected);
+
+    struct HubEventStats stats = dispatcher.getStats();
+    EXPECT_EQ(stats.posted, 5u);
+    EXPECT_EQ(stats.dispatched, 5u);
+    EXPECT_EQ(stats.queued, 0u);
+}
+
+/**
+ * @test HubEventTests.OldestDroppedWhenFull
+ * @details
+ * - Post more events than fit in the queue while the handler is busy.
+ * - Expects the oldest waiting events to be dropped and counted, and posting never to block.
+ * @ingroup HubEventTests
+ */
+TEST(HubEventTests, OldestDroppedWhenFull) {
+    HubEventDispatcher dispatcher(2);
+    std::atomic<bool> release(false);
+    std::vector<uint8_t> handled;
+
+    dispatcher.start([&](const struct sensor_packet &event) {
+        while (!release) usleep(1000);
+        handled.push_back(event.data.generic.metadata.sensor_id);
+    });
+    dispatcher.post(buttonEvent(1));
+    while (dispatcher.getStats().queued > 0) usleep(1000);
+
+    for (uint8_t id = 2; id <= 5; ++id) dispatcher.post(buttonEvent(id));
+    release = true;
+    dispatcher.stop();
+
+    std::vector<uint8_t> expected = {1, 4, 5};
+    EXPECT_EQ(handled, expected);
+    EXPECT_EQ(dispatcher.getStats().dropped, 2u);
+}
@@ -0,0 +1,106 @@
+/**
+ * @file test_hubexecutor.cpp
+ * @brief Unit tests for HubExecutor class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+#include "hubexecutor.h"
+
+/**
+ * @brief Runs a transaction that is a std::function, as the records of the tests are.
+ */
+static void runFunction(void *transaction) {
+    (*static_cast<std::function<void()> *>(transaction))();
+}
+
+/**
+ * @test HubExecutorTests.RunsAlongsideSlowTransactions
+ * @details
+ * - Start an executor with two threads and submit a transaction that blocks like a hub that does
+ *   not answer.
+ * - Expects submit() to return right away and a second transaction to finish while the first one
+ *   is still blocked.
+ * - Expects stop() to wait for both.
+ * @ingroup HubExecutorTests
+ */
+TEST(HubExecutorTests, RunsAlongsideSlowTransactions) {
+    HubExecutor executor;
+    executor.start(2, runFunction);
+
+    std::atomic<bool> release(false);
+    std::atomic<bool> slow_done(false);
+    std::atomic<bool> fast_done(false);
+    std::thread::id caller = std::this_thread::get_id();
+    std::atomic<bool> ran_on_caller(false);
+
+    std::function<void()> slow = [&]() {
+        while (!release) usleep(1000);
+        slow_done = true;
+    };
+    std::function<void()> fast = [&]() {
+        ran_on_caller = std::this_thread::get_id() == caller;
+        fast_done = true;
+    };
+    ASSERT_TRUE(executor.submit(&slow));
+    ASSERT_TRUE(executor.submit(&fast));
+
+    for (int i = 0; i < 2000 && !fast_done; ++i) usleep(1000);
+    EXPECT_TRUE(fast_done);
+    EXPECT_FALSE(slow_done);
+    EXPECT_FALSE(ran_on_caller);
+    EXPECT_EQ(executor.getStats().running, 1u);
+
+    release = true;
+    executor.stop();
+    EXPECT_TRUE(slow_done);
+
+    struct HubExecutorStats stats = executor.getStats();
+    EXPECT_EQ(stats.submitted, 2u);
+    EXPECT_EQ(stats.completed, 2u);
+    EXPECT_EQ(stats.running, 0u);
+}
+
+/**
+ * @test HubExecutorTests.RejectsWhenFull
+ * @details
+ * - Fill the queue of a single-threaded executor while its thread is blocked.
+ * - Expects further transactions to be rejected instead of waiting, and the queued ones to run
+ *   by the time stop() returns.
+ * - Expects a stopped executor to reject everything and zero threads to be refused.
+ * @ingroup HubExecutorTests
+ */
+TEST(HubExecutorTests, RejectsWhenFull) {
+    HubExecutor executor(2);
+    EXPECT_THROW(executor.start(0, runFunction), std::invalid_argument);
+    executor.start(1, runFunction);
+
+    std::atomic<bool> release(false);
+    std::atomic<int> ran(0);
+    std::function<void()> slow = [&]() {
+        while (!release) usleep(1000);
+        ++ran;
+    };
+    std::function<void()> count = [&]() { ++ran; };
+    ASSERT_TRUE(executor.submit(&slow));
+    while (executor.getStats().running == 0) usleep(1000);
+
+    EXPECT_TRUE(executor.submit(&count));
+    EXPECT_TRUE(executor.submit(&count));
+    EXPECT_FALSE(executor.submit(&count));
+    EXPECT_EQ(executor.getStats().queued, 2u);
+
+    release = true;
+    executor.stop();
+    EXPECT_EQ(ran, 3);
+    EXPECT_EQ(executor.getStats().rejected, 1u);
+
+    EXPECT_FALSE(executor.submit(&count));
+    EXPECT_EQ(ran, 3);
+}
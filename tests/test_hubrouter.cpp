@@ -0,0 +1,114 @@
+/**
+ * @file test_hubrouter.cpp
+ * @brief Unit tests for HubRouter class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include "hubrouter.h"
+#include "hubstub.h"
+
+/**
+ * @brief Polls a condition until it holds or the timeout expires.
+ * @return Whether the condition held in time.
+ */
+static bool waitFor(const std::function<bool()> &condition, int timeout_ms = 5000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        usleep(10000);
+    }
+    return true;
+}
+
+/**
+ * @test HubRouterTests.parseTable_Routes
+ * @details
+ * - Parse a table with two hubs, using both ranges and single IDs.
+ * - Expects every listed sensor to be routed to its hub and all others to be unrouted.
+ * @ingroup HubRouterTests
+ */
+TEST(HubRouterTests, parseTable_Routes) {
+    HubRouter router;
+    router.parseTable("10.0.0.2:5000=0-63,100;10.0.0.3:5001=64-99,127");
+
+    ASSERT_EQ(router.size(), 2u);
+    EXPECT_EQ(router.hubAddress(0), "10.0.0.2:5000");
+    EXPECT_EQ(router.hubAddress(1), "10.0.0.3:5001");
+
+    EXPECT_EQ(router.hubIndex(0), 0);
+    EXPECT_EQ(router.hubIndex(63), 0);
+    EXPECT_EQ(router.hubIndex(100), 0);
+    EXPECT_EQ(router.hubIndex(64), 1);
+    EXPECT_EQ(router.hubIndex(127), 1);
+    EXPECT_EQ(router.hubIndex(101), NO_HUB);
+    EXPECT_EQ(router.hubIndex(200), NO_HUB);
+
+    EXPECT_EQ(&router.hubFor(100), &router.hub(0));
+    EXPECT_THROW(router.hubFor(101), std::runtime_error);
+}
+
+/**
+ * @test HubRouterTests.parseTable_Invalid
+ * @details
+ * - Parse malformed tables: missing IDs or port, bad addresses, out of range and overlapping IDs.
+ * - Expects std::invalid_argument to be thrown and the previous table to be kept.
+ * @ingroup HubRouterTests
+ */
+TEST(HubRouterTests, parseTable_Invalid) {
+    HubRouter router;
+    router.parseTable("10.0.0.2:5000=0-127");
+
+    for (const char *table :
+         {"", "10.0.0.2:5000", "10.0.0.2=0-10", "10.0.0.2:0=0-10", "10.0.0.2:70000=0-10",
+          "not-an-ip:5000=0-10", "10.0.0.2:5000=0-128", "10.0.0.2:5000=10-5", "10.0.0.2:5000=a",
+          "10.0.0.2:5000=0-10;10.0.0.3:5000=10-20"})
+        EXPECT_THROW(router.parseTable(table), std::invalid_argument) << table;
+
+    ASSERT_EQ(router.size(), 1u);
+    EXPECT_EQ(router.hubIndex(127), 0);
+}
+
+/**
+ * @test HubRouterTests.route_TwoHubs
+ * @details
+ * - Route two halves of the sensor IDs to two hub stand-ins and request a sensor from each.
+ * - Expects every request to reach only the hub the sensor is routed to.
+ * @ingroup HubRouterTests
+ */
+TEST(HubRouterTests, route_TwoHubs) {
+    HubStub first, second;
+    first.start();
+    second.start();
+
+    HubRouter router;
+    router.parseTable("127.0.0.1:" + std::to_string(first.getPort()) + "=0-63;127.0.0.1:" +
+                      std::to_string(second.getPort()) + "=64-127");
+    router.start();
+    ASSERT_TRUE(waitFor([&router] {
+        return router.hub(0).isConnected() && router.hub(1).isConnected();
+    }));
+
+    for (uint8_t sensor_id : {10, 70}) {
+        struct sensor_packet request = {0};
+        request.header.length = sizeof(struct sensor_packet_light);
+        request.header.ptype = PacketType::DASHBOARD_GET;
+        request.data.light.metadata.sensor_type = SensorType::LIGHT;
+        request.data.light.metadata.sensor_id = sensor_id;
+
+        I2CClient &hub = router.hubFor(sensor_id);
+        hub.sendRawData((uint8_t *)&request, sizeof(struct sensor_header) + request.header.length);
+        EXPECT_EQ(hub.retrievePacket(true).data.light.metadata.sensor_id, sensor_id);
+    }
+
+    EXPECT_EQ(first.getRequestCount(), 1u);
+    EXPECT_EQ(second.getRequestCount(), 1u);
+    EXPECT_EQ(router.getQueueStats().capacity, 2u * I2C_QUEUE_CAPACITY);
+
+    router.closeConnections();
+}
@@ -0,0 +1,210 @@
+/**
+ * @file test_hubscheduler.cpp
+ * @brief Unit tests for HubScheduler class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "hubscheduler.h"
+
+/**
+ * @brief Queues a request of the given class on another thread, which records its turn.
+ * @details Returns once the request is waiting, so requests queue in the order of the calls.
+ */
+static std::thread queueRequest(HubScheduler &scheduler, HubPriority priority, std::mutex &mutex,
+                                std::vector<HubPriority> &order) {
+    size_t waiting = scheduler.getStats().classes[(size_t)priority].waiting;
+    std::thread thread([&scheduler, priority, &mutex, &order]() {
+        HubScheduler::Slot slot(scheduler, priority);
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(priority);
+    });
+    while (scheduler.getStats().classes[(size_t)priority].waiting == waiting) usleep(1000);
+    return thread;
+}
+
+/**
+ * @test HubSchedulerTests.StrictPriority
+ * @details
+ * - Queue background, interactive and actuation requests, in that order, behind a busy link.
+ * - Expects them to be served actuation first and background last, and their waits to be counted.
+ * @ingroup HubSchedulerTests
+ */
+TEST(HubSchedulerTests, StrictPriority) {
+    HubScheduler scheduler;
+    scheduler.setAging(std::chrono::milliseconds(0));
+    std::mutex mutex;
+    std::vector<HubPriority> order;
+
+    std::vector<std::thread> threads;
+    scheduler.acquire(HubPriority::BACKGROUND);
+    threads.push_back(queueRequest(scheduler, HubPriority::BACKGROUND, mutex, order));
+    threads.push_back(queueRequest(scheduler, HubPriority::INTERACTIVE, mutex, order));
+    threads.push_back(queueRequest(scheduler, HubPriority::ACTUATION, mutex, order));
+    usleep(10000);
+    scheduler.release();
+    for (std::thread &thread : threads) thread.join();
+
+    std::vector<HubPriority> expected = {HubPriority::ACTUATION, HubPriority::INTERACTIVE,
+                                         HubPriority::BACKGROUND};
+    EXPECT_EQ(order, expected);
+
+    struct HubSchedulerStats stats = scheduler.getStats();
+    EXPECT_EQ(stats.classes[(size_t)HubPriority::ACTUATION].granted, 1);
+    EXPECT_EQ(stats.classes[(size_t)HubPriority::BACKGROUND].granted, 2);
+    EXPECT_GE(stats.classes[(size_t)HubPriority::BACKGROUND].max_wait_us, 10000);
+    EXPECT_EQ(stats.classes[(size_t)HubPriority::BACKGROUND].waiting, 0);
+}
+
+/**
+ * @test HubSchedulerTests.AgingPreventsStarvation
+ * @details
+ * - Queue a background request, wait for two aging intervals, then queue an actuation request.
+ * - Expects the background request to have been promoted, and served first for being older.
+ * @ingroup HubSchedulerTests
+ */
+TEST(HubSchedulerTests, AgingPreventsStarvation) {
+    HubScheduler scheduler;
+    scheduler.setAging(std::chrono::milliseconds(10));
+    std::mutex mutex;
+    std::vector<HubPriority> order;
+
+    std::vector<std::thread> threads;
+    scheduler.acquire(HubPriority::ACTUATION);
+    threads.push_back(queueRequest(scheduler, HubPriority::BACKGROUND, mutex, order));
+    usleep(30000);
+    threads.push_back(queueRequest(scheduler, HubPriority::ACTUATION, mutex, order));
+    scheduler.release();
+    for (std::thread &thread : threads) thread.join();
+
+    std::vector<HubPriority> expected = {HubPriority::BACKGROUND, HubPriority::ACTUATION};
+    EXPECT_EQ(order, expected);
+    EXPECT_EQ(scheduler.getStats().classes[(size_t)HubPriority::BACKGROUND].aged, 1);
+}
+
+/**
+ * @test HubSchedulerTests.ConcurrencyAdaptsToRoundTrips
+ * @details
+ * - Complete requests at a steady round trip while the limit is reached, then report round trips
+ *   ten times as long.
+ * - Expects the limit to grow to the maximum, several requests to get the link at once, and the
+ *   limit to be halved once the round trips inflate.
+ * @ingroup HubSchedulerTests
+ */
+TEST(HubSchedulerTests, ConcurrencyAdaptsToRoundTrips) {
+    HubScheduler scheduler;
+    scheduler.setMaxConcurrency(4);
+    EXPECT_EQ(scheduler.getConcurrencyStats().limit, 1u);
+
+    auto fast = std::chrono::milliseconds(2);
+    for (int round = 0; round < 20; ++round) {
+        size_t limit = scheduler.getConcurrencyStats().limit;
+        for (size_t i = 0; i < limit; ++i) scheduler.acquire(HubPriority::BACKGROUND);
+        for (size_t i = 0; i < limit; ++i) {
+            scheduler.sample(fast, false);
+            scheduler.release();
+        }
+    }
+
+    struct HubConcurrencyStats stats = scheduler.getConcurrencyStats();
+    EXPECT_EQ(stats.limit, 4u);
+    EXPECT_EQ(stats.max_limit, 4u);
+    EXPECT_EQ(stats.in_flight, 0u);
+    EXPECT_EQ(stats.rtt_us, 2000u);
+    EXPECT_EQ(stats.min_rtt_us, 2000u);
+    EXPECT_EQ(stats.backoffs, 0u);
+
+    // as many requests as the limit get the link without waiting
+    for (size_t i = 0; i < 4; ++i) scheduler.acquire(HubPriority::BACKGROUND);
+    EXPECT_EQ(scheduler.getConcurrencyStats().in_flight, 4u);
+
+    for (size_t i = 0; i < 4; ++i) {
+        scheduler.sample(fast * 10, false);
+        scheduler.release();
+    }
+    stats = scheduler.getConcurrencyStats();
+    EXPECT_EQ(stats.limit, 2u);
+    EXPECT_EQ(stats.backoffs, 1u);
+}
+
+/**
+ * @test HubSchedulerTests.FailedRequestBacksOff
+ * @details
+ * - Let a request that was granted the link unwind with an exception before its answer is in.
+ * - Expects the limit to be halved and the link to be given up.
+ * @ingroup HubSchedulerTests
+ */
+TEST(HubSchedulerTests, FailedRequestBacksOff) {
+    HubScheduler scheduler;
+    scheduler.acquire(HubPriority::INTERACTIVE);
+    scheduler.sample(std::chrono::milliseconds(2), false);
+    scheduler.release();
+    ASSERT_EQ(scheduler.getConcurrencyStats().limit, 2u);
+
+    try {
+        HubScheduler::Slot slot(scheduler, HubPriority::INTERACTIVE);
+        throw std::runtime_error("Connection to I2C-bridge lost");
+    } catch (std::runtime_error &) {
+    }
+
+    struct HubConcurrencyStats stats = scheduler.getConcurrencyStats();
+    EXPECT_EQ(stats.limit, 1u);
+    EXPECT_EQ(stats.in_flight, 0u);
+    EXPECT_EQ(stats.backoffs, 1u);
+}
+
+/**
+ * @test HubSchedulerTests.DeadlineExpires
+ * @details
+ * - Queue a request with a deadline behind a busy link that is not given up in time.
+ * - Expects the request to fail at its deadline, leave the queue, and be counted as expired.
+ * @ingroup HubSchedulerTests
+ */
+TEST(HubSchedulerTests, DeadlineExpires) {
+    HubScheduler scheduler;
+    scheduler.acquire(HubPriority::BACKGROUND);
+
+    auto started = std::chrono::steady_clock::now();
+    EXPECT_THROW(HubScheduler::Slot(scheduler, HubPriority::INTERACTIVE,
+                                    started + std::chrono::milliseconds(20)),
+                 std::runtime_error);
+    EXPECT_GE(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(20));
+
+    struct HubSchedulerStats stats = scheduler.getStats();
+    EXPECT_EQ(stats.classes[(size_t)HubPriority::INTERACTIVE].expired, 1u);
+    EXPECT_EQ(stats.classes[(size_t)HubPriority::INTERACTIVE].waiting, 0u);
+    EXPECT_EQ(stats.classes[(size_t)HubPriority::INTERACTIVE].granted, 0u);
+
+    // the link is handed on as usual once it is given up
+    scheduler.release();
+    EXPECT_TRUE(scheduler.acquire(HubPriority::INTERACTIVE,
+                                  std::chrono::steady_clock::now() + std::chrono::seconds(1)));
+    scheduler.release();
+}
+
+/**
+ * @test HubSchedulerTests.Classification
+ * @details
+ * - Classify posts, reads of a light and reads of telemetry.
+ * - Expects actuation, interactive and background respectively.
+ * @ingroup HubSchedulerTests
+ */
+TEST(HubSchedulerTests, Classification) {
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_metadata);
+    packet.header.ptype = PacketType::DASHBOARD_POST;
+    packet.data.generic.metadata.sensor_type = SensorType::LIGHT;
+    EXPECT_EQ(hubPriorityFor(packet), HubPriority::ACTUATION);
+
+    packet.header.ptype = PacketType::DASHBOARD_GET;
+    EXPECT_EQ(hubPriorityFor(packet), HubPriority::INTERACTIVE);
+
+    packet.data.generic.metadata.sensor_type = SensorType::CO2;
+    EXPECT_EQ(hubPriorityFor(packet), HubPriority::BACKGROUND);
+}
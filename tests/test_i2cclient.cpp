@@ -4,9 +4,30 @@
  * @author Daan Breur
  */
 #include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
 
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "hubstub.h"
 #include "i2cclient.h"
 
+/**
+ * @brief Polls a condition until it holds or the timeout expires.
+ * @return Whether the condition held in time.
+ */
+static bool waitFor(const std::function<bool()> &condition, int timeout_ms = 5000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        usleep(10000);
+    }
+    return true;
+}
+
 /**
  * @test I2CClientTests.setup_ValidPort
  * @brief Test the setup() function with valid port numbers.
@@ -59,3 +80,326 @@ TEST(I2CClientTests, setup_InvalidPort_High) {
     EXPECT_THROW(server.setup("10.0.0.1", 65536), std::invalid_argument);
     EXPECT_THROW(server.setup("10.0.0.1", 69696), std::invalid_argument);
 }
+
+/**
+ * @test I2CClientTests.start_HubUnreachable
+ * @details
+ * - Start the client while nothing listens at the hub address.
+ * - Expects start() to return without throwing, and sending to fail fast.
+ * @ingroup I2CClientTests
+ */
+TEST(I2CClientTests, start_HubUnreachable) {
+    uint16_t unused_port;
+    {
+        HubStub stub;
+        stub.start();
+        unused_port = stub.getPort();
+    }
+
+    I2CClient client;
+    client.setup("127.0.0.1", unused_port);
+    EXPECT_NO_THROW(client.start());
+    EXPECT_FALSE(client.isConnected());
+
+    uint8_t data[2] = {0};
+    EXPECT_THROW(client.sendRawData(data, sizeof(data)), std::runtime_error);
+    EXPECT_THROW(client.retrievePacket(true), std::runtime_error);
+
+    EXPECT_TRUE(waitFor([&client] { return client.getStats().failed_attempts > 0; }));
+    EXPECT_FALSE(client.getStats().connected);
+    client.closeConnection();
+}
+
+/**
+ * @test I2CClientTests.retrievePacket_Response
+ * @details
+ * - Connect to a hub stand-in and request the state of a sensor.
+ * - Expects the response to carry the state held by the hub.
+ * @ingroup I2CClientTests
+ */
+TEST(I2CClientTests, retrievePacket_Response) {
+    HubStub stub;
+    stub.start();
+
+    struct sensor_packet state = {0};
+    state.header.length = sizeof(struct sensor_packet_light);
+    state.header.ptype = PacketType::DATA;
+    state.data.light.metadata.sensor_type = SensorType::LIGHT;
+    state.data.light.metadata.sensor_id = 0x6D;
+    state.data.light.target_state = 1;
+    stub.setState(state);
+
+    I2CClient client;
+    client.setup("127.0.0.1", stub.getPort());
+    client.start();
+    ASSERT_TRUE(waitFor([&client] { return client.isConnected(); }));
+
+    struct sensor_packet request = state;
+    request.header.ptype = PacketType::DASHBOARD_GET;
+    request.data.light.target_state = 0;
+    client.sendRawData((uint8_t *)&request, sizeof(struct sensor_header) + request.header.length);
+
+    struct sensor_packet response = client.retrievePacket(true);
+    EXPECT_EQ(response.header.ptype, PacketType::DASHBOARD_RESPONSE);
+    EXPECT_EQ(response.data.light.metadata.sensor_id, 0x6D);
+    EXPECT_EQ(response.data.light.target_state, 1);
+}
+
+/**
+ * @test I2CClientTests.retrievePacketFor_OutOfOrder
+ * @details
+ * - Request the state of two sensors back to back, then wait for the second one first.
+ * - Expects every wait to get the response of its own sensor, none of them being discarded.
+ * @ingroup I2CClientTests
+ */
+TEST(I2CClientTests, retrievePacketFor_OutOfOrder) {
+    HubStub stub;
+    stub.start();
+
+    struct sensor_packet state = {0};
+    state.header.length = sizeof(struct sensor_packet_light);
+    state.header.ptype = PacketType::DATA;
+    state.data.light.metadata.sensor_type = SensorType::LIGHT;
+    for (uint8_t sensor_id : {0x30, 0x31}) {
+        state.data.light.metadata.sensor_id = sensor_id;
+        state.data.light.target_state = sensor_id & 1;
+        stub.setState(state);
+    }
+
+    I2CClient client;
+    client.setup("127.0.0.1", stub.getPort());
+    client.start();
+    ASSERT_TRUE(waitFor([&client] { return client.isConnected(); }));
+
+    struct sensor_packet request = state;
+    request.header.ptype = PacketType::DASHBOARD_GET;
+    for (uint8_t sensor_id : {0x30, 0x31}) {
+        request.data.light.metadata.sensor_id = sensor_id;
+        client.sendRawData((uint8_t *)&request,
+                           sizeof(struct sensor_header) + request.header.length);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    struct sensor_packet second = client.retrievePacketFor(0x31, deadline);
+    struct sensor_packet first = client.retrievePacketFor(0x30, deadline);
+    EXPECT_EQ(second.data.light.metadata.sensor_id, 0x31);
+    EXPECT_EQ(second.data.light.target_state, 1);
+    EXPECT_EQ(first.data.light.metadata.sensor_id, 0x30);
+    EXPECT_EQ(first.data.light.target_state, 0);
+}
+
+/**
+ * @test I2CClientTests.retrievePacketFor_Deadline
+ * @details
+ * - Let the hub stop answering and read a sensor until the circuit breaker opens, then let the
+ *   hub answer again and wait out the open interval.
+ * - Expects every read to fail at its deadline, further requests to be rejected without being
+ *   sent, and the probe after the interval to close the breaker and get a fresh answer.
+ * @ingroup I2CClientTests
+ */
+TEST(I2CClientTests, retrievePacketFor_Deadline) {
+    HubStub stub;
+    stub.start();
+
+    struct sensor_packet state = {0};
+    state.header.length = sizeof(struct sensor_packet_light);
+    state.header.ptype = PacketType::DATA;
+    state.data.light.metadata.sensor_type = SensorType::LIGHT;
+    state.data.light.metadata.sensor_id = 0x40;
+    state.data.light.target_state = 1;
+    stub.setState(state);
+
+    I2CClient client;
+    client.setBreaker(2, std::chrono::milliseconds(100));
+    client.setup("127.0.0.1", stub.getPort());
+    client.start();
+    ASSERT_TRUE(waitFor([&client] { return client.isConnected(); }));
+
+    struct sensor_packet request = state;
+    request.header.ptype = PacketType::DASHBOARD_GET;
+    size_t length = sizeof(struct sensor_header) + request.header.length;
+
+    stub.setSilent(true);
+    for (int i = 0; i < 2; ++i) {
+        auto started = std::chrono::steady_clock::now();
+        client.sendRawData((uint8_t *)&request, length);
+        EXPECT_THROW(client.retrievePacketFor(0x40, started + std::chrono::milliseconds(50)),
+                     std::runtime_error);
+        EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(1000));
+    }
+    ASSERT_TRUE(waitFor([&stub] { return stub.getRequestCount() == 2; }));
+
+    EXPECT_THROW(client.sendRawData((uint8_t *)&request, length), std::runtime_error);
+    struct HubConnectionStats stats = client.getStats();
+    EXPECT_EQ(stats.timeouts, 2u);
+    EXPECT_EQ(stats.breaker.state, BreakerState::OPEN);
+    EXPECT_EQ(stats.breaker.rejected, 1u);
+    EXPECT_EQ(stub.getRequestCount(), 2u);
+
+    stub.setSilent(false);
+    usleep(150000);
+    client.sendRawData((uint8_t *)&request, length);
+    struct sensor_packet response = client.retrievePacketFor(
+        0x40, std::chrono::steady_clock::now() + std::chrono::seconds(5));
+    EXPECT_EQ(response.data.light.target_state, 1);
+    EXPECT_EQ(client.getStats().breaker.state, BreakerState::CLOSED);
+}
+
+/**
+ * @test I2CClientTests.sendRawData_PostsCloseBreaker
+ * @details
+ * - Open the circuit breaker with reads the hub does not answer, then only send posts once the
+ *   open interval has passed.
+ * - Expects the first post to be let through as the probe and to close the breaker, so the posts
+ *   after it are sent as well instead of being rejected.
+ * @ingroup I2CClientTests
+ */
+TEST(I2CClientTests, sendRawData_PostsCloseBreaker) {
+    HubStub stub;
+    stub.start();
+
+    I2CClient client;
+    client.setBreaker(2, std::chrono::milliseconds(100));
+    client.setup("127.0.0.1", stub.getPort());
+    client.start();
+    ASSERT_TRUE(waitFor([&client] { return client.isConnected(); }));
+
+    struct sensor_packet request = {0};
+    request.header.length = sizeof(struct sensor_packet_light);
+    request.header.ptype = PacketType::DASHBOARD_GET;
+    request.data.light.metadata.sensor_type = SensorType::LIGHT;
+    request.data.light.metadata.sensor_id = 0x41;
+    size_t length = sizeof(struct sensor_header) + request.header.length;
+
+    stub.setSilent(true);
+    for (int i = 0; i < 2; ++i) {
+        client.sendRawData((uint8_t *)&request, length);
+        EXPECT_THROW(client.retrievePacketFor(
+                         0x41, std::chrono::steady_clock::now() + std::chrono::milliseconds(20)),
+                     std::runtime_error);
+    }
+    EXPECT_EQ(client.getStats().breaker.state, BreakerState::OPEN);
+
+    usleep(150000);
+    request.header.ptype = PacketType::DASHBOARD_POST;
+    request.data.light.target_state = 1;
+    for (int i = 0; i < 3; ++i) EXPECT_NO_THROW(client.sendRawData((uint8_t *)&request, length));
+
+    struct HubConnectionStats stats = client.getStats();
+    EXPECT_EQ(stats.breaker.state, BreakerState::CLOSED);
+    EXPECT_EQ(stats.breaker.rejected, 0u);
+    EXPECT_TRUE(waitFor([&stub] { return stub.getRequestCount() == 5; }));
+}
+
+/**
+ * @test I2CClientTests.eventHandler_SortsOutUnsolicited
+ * @details
+ * - Let the hub send a DATA packet on its own, then request the state of a sensor.
+ * - Expects the unsolicited packet to go to the event handler and the response to the queue.
+ * @ingroup I2CClientTests
+ */
+TEST(I2CClientTests, eventHandler_SortsOutUnsolicited) {
+    HubStub stub;
+    stub.start();
+
+    std::mutex events_mutex;
+    std::vector<struct sensor_packet> events;
+
+    I2CClient client;
+    client.setup("127.0.0.1", stub.getPort());
+    client.setEventHandler([&](const struct sensor_packet &event) {
+        std::lock_guard<std::mutex> lock(events_mutex);
+        events.push_back(event);
+    });
+    client.start();
+    ASSERT_TRUE(waitFor([&stub] { return stub.hasClient(); }));
+
+    struct sensor_packet button = {0};
+    button.header.length = sizeof(struct sensor_packet_generic);
+    button.header.ptype = PacketType::DATA;
+    button.data.generic.metadata.sensor_type = SensorType::BUTTON;
+    button.data.generic.metadata.sensor_id = 0x20;
+    ASSERT_TRUE(stub.emit(button));
+    ASSERT_TRUE(waitFor([&client] { return client.getStats().events == 1; }));
+
+    struct sensor_packet request = button;
+    request.header.ptype = PacketType::DASHBOARD_GET;
+    client.sendRawData((uint8_t *)&request, sizeof(struct sensor_header) + request.header.length);
+    struct sensor_packet response = client.retrievePacket(true);
+    EXPECT_EQ(response.header.ptype, PacketType::DASHBOARD_RESPONSE);
+
+    std::lock_guard<std::mutex> lock(events_mutex);
+    ASSERT_EQ(events.size(), 1u);
+    EXPECT_EQ(events[0].data.generic.metadata.sensor_id, 0x20);
+    EXPECT_EQ(client.getStats().events, 1u);
+}
+
+/**
+ * @test I2CClientTests.eventHandler_SplitPackets
+ * @details
+ * - Let the hub send a DATA packet cut in two, the second part together with a whole packet.
+ * - Expects both packets to reach the event handler intact instead of the first being discarded.
+ * @ingroup I2CClientTests
+ */
+TEST(I2CClientTests, eventHandler_SplitPackets) {
+    HubStub stub;
+    stub.start();
+
+    std::mutex events_mutex;
+    std::vector<struct sensor_packet> events;
+
+    I2CClient client;
+    client.setup("127.0.0.1", stub.getPort());
+    client.setEventHandler([&](const struct sensor_packet &event) {
+        std::lock_guard<std::mutex> lock(events_mutex);
+        events.push_back(event);
+    });
+    client.start();
+    ASSERT_TRUE(waitFor([&stub] { return stub.hasClient(); }));
+
+    struct sensor_packet packets[2] = {};
+    for (int i = 0; i < 2; ++i) {
+        packets[i].header.length = sizeof(struct sensor_packet_generic);
+        packets[i].header.ptype = PacketType::DATA;
+        packets[i].data.generic.metadata.sensor_type = SensorType::BUTTON;
+        packets[i].data.generic.metadata.sensor_id = 0x20 + i;
+    }
+    size_t frame_length = sizeof(struct sensor_header) + packets[0].header.length;
+    uint8_t stream[2 * sizeof(struct sensor_packet)];
+    memcpy(stream, &packets[0], frame_length);
+    memcpy(stream + frame_length, &packets[1], frame_length);
+
+    ASSERT_TRUE(stub.emitRaw(stream, 3));
+    usleep(50000);
+    ASSERT_TRUE(stub.emitRaw(stream + 3, 2 * frame_length - 3));
+    ASSERT_TRUE(waitFor([&client] { return client.getStats().events == 2; }));
+
+    std::lock_guard<std::mutex> lock(events_mutex);
+    ASSERT_EQ(events.size(), 2u);
+    EXPECT_EQ(events[0].data.generic.metadata.sensor_id, 0x20);
+    EXPECT_EQ(events[1].data.generic.metadata.sensor_id, 0x21);
+    EXPECT_EQ(events[0].header.length, packets[0].header.length);
+}
+
+/**
+ * @test I2CClientTests.reconnect_AfterHubDrop
+ * @details
+ * - Drop the connection from the hub side, as a rebooting hub would.
+ * - Expects the client to reconnect on its own and count the reconnect.
+ * @ingroup I2CClientTests
+ */
+TEST(I2CClientTests, reconnect_AfterHubDrop) {
+    HubStub stub;
+    stub.start();
+
+    I2CClient client;
+    client.setup("127.0.0.1", stub.getPort());
+    client.start();
+    ASSERT_TRUE(waitFor([&client] { return client.isConnected(); }));
+    EXPECT_EQ(client.getStats().reconnects, 0u);
+
+    stub.disconnectClients();
+    ASSERT_TRUE(waitFor([&client] { return client.getStats().reconnects == 1; }));
+    EXPECT_TRUE(client.isConnected());
+    EXPECT_EQ(client.getStats().current_downtime_ms, 0u);
+}
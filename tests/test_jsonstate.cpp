@@ -0,0 +1,75 @@
+/**
+ * @file test_jsonstate.cpp
+ * @brief Unit tests for JsonStateCache class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "jsonstate.h"
+
+/**
+ * @brief Returns a light packet with the given target state.
+ */
+static struct sensor_packet lightPacket(uint8_t target_state) {
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_light);
+    packet.data.light.metadata.sensor_type = SensorType::LIGHT;
+    packet.data.light.target_state = target_state;
+    return packet;
+}
+
+/**
+ * @test JsonStateTests.DocumentIsShared
+ * @details
+ * - Read the document several times without any change in between.
+ * - Expects every reader to get the very same string, assembled only once.
+ * @ingroup JsonStateTests
+ */
+TEST(JsonStateTests, DocumentIsShared) {
+    JsonStateCache cache;
+    EXPECT_EQ(*cache.document(), "{\"sensors\":[]}");
+
+    cache.update(300, lightPacket(1));
+    cache.update(20, lightPacket(0));
+
+    std::shared_ptr<const std::string> first = cache.document();
+    std::shared_ptr<const std::string> second = cache.document();
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(*first, "{\"sensors\":[{\"id\":20,\"type\":\"light\",\"target_state\":0},"
+                      "{\"id\":300,\"type\":\"light\",\"target_state\":1}]}");
+
+    struct JsonStateStats stats = cache.getStats();
+    EXPECT_EQ(stats.sensors, 2u);
+    EXPECT_EQ(stats.documents_serialized, 2u);
+    EXPECT_EQ(stats.reads, 3u);
+}
+
+/**
+ * @test JsonStateTests.ChangesInvalidate
+ * @details
+ * - Update a sensor with a different and with the same state.
+ * - Expects only the real change to invalidate the document, and the fragment to follow it.
+ * @ingroup JsonStateTests
+ */
+TEST(JsonStateTests, ChangesInvalidate) {
+    JsonStateCache cache;
+    EXPECT_EQ(cache.sensor(20), nullptr);
+
+    cache.update(20, lightPacket(0));
+    std::shared_ptr<const std::string> before = cache.document();
+
+    cache.update(20, lightPacket(0));
+    EXPECT_EQ(cache.document(), before);
+
+    cache.update(20, lightPacket(1));
+    std::shared_ptr<const std::string> after = cache.document();
+    EXPECT_NE(after, before);
+    EXPECT_NE(after->find("\"target_state\":1"), std::string::npos);
+    EXPECT_EQ(*cache.sensor(20), "{\"id\":20,\"type\":\"light\",\"target_state\":1}");
+
+    // a reader still holding the old document is not affected
+    EXPECT_NE(before->find("\"target_state\":0"), std::string::npos);
+}
@@ -0,0 +1,112 @@
+/**
+ * @file test_latency.cpp
+ * @brief Unit tests for the Latency class and receive timestamps.
+ * @author Daan Breur
+ */
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "latency.h"
+
+/**
+ * @test LatencyTests.BucketsAndPercentiles
+ * @details
+ * - Record latencies of 0.5 us, 3 us and 1.5 ms into a stage.
+ * - Expects each of them in the power-of-two bucket above it, and the percentiles, average and
+ *   maximum to follow from them.
+ * - Expects other stages to stay empty and reset() to clear everything.
+ * @ingroup LatencyTests
+ */
+TEST(LatencyTests, BucketsAndPercentiles) {
+    Latency::reset();
+    Latency::record(LatencyStage::HUB_ROUND_TRIP, 500);
+    Latency::record(LatencyStage::HUB_ROUND_TRIP, 3000);
+    Latency::record(LatencyStage::HUB_ROUND_TRIP, 1500000);
+
+    struct LatencyHistogram histogram = Latency::snapshot(LatencyStage::HUB_ROUND_TRIP);
+    EXPECT_EQ(histogram.count, 3u);
+    EXPECT_EQ(histogram.buckets[0], 1u);
+    EXPECT_EQ(histogram.buckets[2], 1u);
+    EXPECT_EQ(histogram.buckets[11], 1u);
+    EXPECT_EQ(histogram.total_ns, 1503500u);
+    EXPECT_EQ(histogram.max_ns, 1500000u);
+
+    EXPECT_EQ(latencyPercentileUs(histogram, 0), 1u);
+    EXPECT_EQ(latencyPercentileUs(histogram, 50), 4u);
+    EXPECT_EQ(latencyPercentileUs(histogram, 99), 2048u);
+
+    EXPECT_EQ(Latency::snapshot(LatencyStage::SEND).count, 0u);
+    EXPECT_EQ(latencyPercentileUs(Latency::snapshot(LatencyStage::SEND), 50), 0u);
+
+    Latency::reset();
+    histogram = Latency::snapshot(LatencyStage::HUB_ROUND_TRIP);
+    EXPECT_EQ(histogram.count, 0u);
+    EXPECT_EQ(histogram.buckets[11], 0u);
+    EXPECT_EQ(histogram.max_ns, 0u);
+}
+
+/**
+ * @test LatencyTests.KernelReceiveTimestamp
+ * @details
+ * - Send a datagram over loopback to a socket with receive timestamps enabled, wait a moment and
+ *   read it with recvmsg().
+ * - Expects the read to carry a kernel timestamp, with a waiting time no longer than the time
+ *   between sending and reading. The kernel may stamp a loopback datagram only when it gets round
+ *   to queueing it, so the waiting time itself is not checked against the sleep.
+ * - Expects a read without a control buffer to carry no kernel timestamp.
+ * @ingroup LatencyTests
+ */
+TEST(LatencyTests, KernelReceiveTimestamp) {
+    int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(receiver, 0);
+    ASSERT_GE(sender, 0);
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(receiver, (struct sockaddr *)&address, sizeof(address)), 0);
+    socklen_t length = sizeof(address);
+    getsockname(receiver, (struct sockaddr *)&address, &length);
+    enableReceiveTimestamps(receiver);
+
+    struct timespec sent;
+    clock_gettime(CLOCK_REALTIME, &sent);
+    uint8_t datagram[4] = {1, 2, 3, 4};
+    for (int i = 0; i < 2; ++i)
+        sendto(sender, datagram, sizeof(datagram), 0, (struct sockaddr *)&address, sizeof(address));
+    usleep(20000);
+
+    uint8_t buffer[16];
+    struct iovec iov = {buffer, sizeof(buffer)};
+    alignas(struct cmsghdr) uint8_t control[RECEIVE_TIMESTAMP_CONTROL_SIZE];
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ASSERT_EQ(recvmsg(receiver, &message, 0), (ssize_t)sizeof(datagram));
+
+    struct ReceiveTimestamps received = receiveTimestamps(message);
+    struct timespec read;
+    clock_gettime(CLOCK_REALTIME, &read);
+    uint64_t window_ns = (uint64_t)(read.tv_sec - sent.tv_sec) * 1000000000ULL + read.tv_nsec -
+                         sent.tv_nsec;
+    EXPECT_TRUE(received.kernel_stamped);
+    EXPECT_LE(received.kernel_delay_ns, window_ns);
+    EXPECT_GT(received.user_ns, 0u);
+
+    message.msg_control = nullptr;
+    message.msg_controllen = 0;
+    ASSERT_EQ(recvmsg(receiver, &message, 0), (ssize_t)sizeof(datagram));
+    received = receiveTimestamps(message);
+    EXPECT_FALSE(received.kernel_stamped);
+    EXPECT_EQ(received.kernel_delay_ns, 0u);
+
+    close(sender);
+    close(receiver);
+}
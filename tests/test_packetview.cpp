@@ -0,0 +1,81 @@
+/**
+ * @file test_packetview.cpp
+ * @brief Unit tests for the PacketView class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include "packetview.h"
+
+/**
+ * @test PacketViewTests.LittleEndianReadings
+ * @details
+ * - View frames with known wire bytes: a temperature of 21.5 and a CO2 level of 420 ppm.
+ * - Expects the readings to be decoded from little-endian byte order.
+ * @ingroup PacketViewTests
+ */
+TEST(PacketViewTests, LittleEndianReadings) {
+    const uint8_t temperature[] = {6, 0, 2, 10, 0x00, 0x00, 0xAC, 0x41};
+    PacketView view(temperature, sizeof(temperature));
+    ASSERT_TRUE(view.complete());
+    EXPECT_EQ(view.type(), PacketType::DATA);
+    EXPECT_EQ(view.sensorType(), SensorType::TEMPERATURE);
+    EXPECT_EQ(view.sensorId(), 10);
+    EXPECT_FLOAT_EQ(view.temperature(), 21.5f);
+
+    const uint8_t co2[] = {4, 0, 3, 11, 0xA4, 0x01};
+    EXPECT_EQ(PacketView(co2, sizeof(co2)).co2(), 420);
+}
+
+/**
+ * @test PacketViewTests.Bounds
+ * @details
+ * - View a frame that announces more payload than is available, and one that is too short for
+ *   its reading.
+ * - Expects incomplete frames to be recognised, readings past the payload to throw and missing
+ *   metadata to read as zero.
+ * @ingroup PacketViewTests
+ */
+TEST(PacketViewTests, Bounds) {
+    const uint8_t partial[] = {6, 0, 2, 10, 0x00};
+    PacketView incomplete(partial, sizeof(partial));
+    EXPECT_FALSE(incomplete.complete());
+    EXPECT_EQ(incomplete.frameLength(), 8);
+    EXPECT_EQ(incomplete.size(), sizeof(partial));
+    EXPECT_THROW(incomplete.temperature(), std::out_of_range);
+
+    const uint8_t short_frame[] = {1, 0, 2, 99};
+    PacketView view = PacketView(short_frame, sizeof(short_frame)).frameOnly();
+    ASSERT_TRUE(view.complete());
+    EXPECT_EQ(view.sensorType(), SensorType::TEMPERATURE);
+    EXPECT_EQ(view.sensorId(), 0);
+    EXPECT_FALSE(view.holds<struct sensor_packet_temperature>());
+    EXPECT_THROW(view.temperature(), std::out_of_range);
+}
+
+/**
+ * @test PacketViewTests.CopyTo
+ * @details
+ * - Copy a frame with a payload longer than sensor_packet into storage, and set readings with
+ *   the setters.
+ * - Expects the copy to be cut off with a matching length, and the setters to round-trip.
+ * @ingroup PacketViewTests
+ */
+TEST(PacketViewTests, CopyTo) {
+    uint8_t long_frame[sizeof(struct sensor_header) + 40] = {40, 0, 9, 12};
+    struct sensor_packet packet;
+    PacketView(long_frame, sizeof(long_frame)).copyTo(packet);
+    EXPECT_EQ(packet.header.length, sizeof(packet.data));
+    EXPECT_EQ(packet.data.lichtkrant.metadata.sensor_id, 12);
+
+    packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_humidity);
+    setHumidity(packet, 55.25f);
+    EXPECT_FLOAT_EQ(PacketView(packet).humidity(), 55.25f);
+
+    setCo2(packet, 0x1234);
+    EXPECT_EQ(((uint8_t *)&packet.data)[2], 0x34);
+    EXPECT_EQ(PacketView(packet).co2(), 0x1234);
+}
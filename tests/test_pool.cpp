@@ -0,0 +1,146 @@
+/**
+ * @file test_pool.cpp
+ * @brief Unit tests for the BlockPool, ObjectPool and RingBuffer classes.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "pool.h"
+
+/**
+ * @test PoolTests.BlockPool_InvalidArguments
+ * @details
+ * - Verify that a pool without blocks or with empty blocks cannot be created.
+ * - Expects std::invalid_argument to be thrown.
+ * @ingroup PoolTests
+ */
+TEST(PoolTests, BlockPool_InvalidArguments) {
+    EXPECT_THROW(BlockPool pool(0, 4), std::invalid_argument);
+    EXPECT_THROW(BlockPool pool(16, 0), std::invalid_argument);
+}
+
+/**
+ * @test PoolTests.BlockPool_Exhaustion
+ * @details
+ * - Acquire every block of a pool, then verify that the next acquire fails and is counted.
+ * - Release a block and verify that it can be acquired again.
+ * @ingroup PoolTests
+ */
+TEST(PoolTests, BlockPool_Exhaustion) {
+    BlockPool pool(10, 4);
+    EXPECT_EQ(pool.getBlockSize() % alignof(std::max_align_t), 0u);
+
+    std::set<void *> blocks;
+    for (int i = 0; i < 4; ++i) {
+        void *block = pool.acquire();
+        ASSERT_NE(block, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % alignof(std::max_align_t), 0u);
+        blocks.insert(block);
+    }
+    EXPECT_EQ(blocks.size(), 4u);
+    EXPECT_EQ(pool.acquire(), nullptr);
+
+    void *released = *blocks.begin();
+    pool.release(released);
+    EXPECT_EQ(pool.acquire(), released);
+
+    struct PoolStats stats = pool.getStats();
+    EXPECT_EQ(stats.capacity, 4u);
+    EXPECT_EQ(stats.in_use, 4u);
+    EXPECT_EQ(stats.high_water, 4u);
+    EXPECT_EQ(stats.allocations, 5u);
+    EXPECT_EQ(stats.failures, 1u);
+    EXPECT_EQ(stats.reserved_bytes, BlockPool::reservedBytes(10, 4));
+}
+
+/**
+ * @test PoolTests.BlockPool_InvalidRelease
+ * @details
+ * - Verify that releasing foreign or already released blocks is detected.
+ * - Expects std::invalid_argument to be thrown.
+ * @ingroup PoolTests
+ */
+TEST(PoolTests, BlockPool_InvalidRelease) {
+    BlockPool pool(16, 2);
+    int foreign = 0;
+    EXPECT_THROW(pool.release(&foreign), std::invalid_argument);
+
+    void *block = pool.acquire();
+    pool.release(block);
+    EXPECT_THROW(pool.release(block), std::invalid_argument);
+}
+
+/**
+ * @test PoolTests.ObjectPool_ConstructAndDestroy
+ * @details
+ * - Verify that objects are constructed on acquire and destroyed on release, and that forEach()
+ *   only visits objects in use.
+ * @ingroup PoolTests
+ */
+TEST(PoolTests, ObjectPool_ConstructAndDestroy) {
+    struct Tracked {
+        int value;
+        int *alive;
+        Tracked(int value, int *alive) : value(value), alive(alive) { ++*alive; }
+        ~Tracked() { --*alive; }
+    };
+
+    int alive = 0;
+    ObjectPool<Tracked> pool(3);
+
+    Tracked *first = pool.acquire(1, &alive);
+    Tracked *second = pool.acquire(2, &alive);
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    EXPECT_EQ(alive, 2);
+
+    pool.release(first);
+    EXPECT_EQ(alive, 1);
+
+    std::vector<int> values;
+    pool.forEach([&values](Tracked &tracked) { values.push_back(tracked.value); });
+    EXPECT_EQ(values, std::vector<int>{2});
+
+    pool.release(second);
+    EXPECT_EQ(alive, 0);
+    EXPECT_EQ(pool.getStats().high_water, 2u);
+}
+
+/**
+ * @test PoolTests.RingBuffer_Fifo
+ * @details
+ * - Verify that elements come out in the order they went in.
+ * - Verify that pushing into a full buffer drops the oldest element and counts it.
+ * @ingroup PoolTests
+ */
+TEST(PoolTests, RingBuffer_Fifo) {
+    EXPECT_THROW(RingBuffer<int> buffer(0), std::invalid_argument);
+
+    RingBuffer<int> buffer(3);
+    int value = 0;
+    EXPECT_FALSE(buffer.pop(value));
+
+    EXPECT_TRUE(buffer.pushOverwrite(1));
+    EXPECT_TRUE(buffer.pushOverwrite(2));
+    EXPECT_TRUE(buffer.pushOverwrite(3));
+    EXPECT_FALSE(buffer.pushOverwrite(4));
+    EXPECT_EQ(buffer.size(), 3u);
+
+    for (int expected : {2, 3, 4}) {
+        ASSERT_TRUE(buffer.pop(value));
+        EXPECT_EQ(value, expected);
+    }
+    EXPECT_TRUE(buffer.empty());
+
+    struct PoolStats stats = buffer.getStats();
+    EXPECT_EQ(stats.capacity, 3u);
+    EXPECT_EQ(stats.high_water, 3u);
+    EXPECT_EQ(stats.allocations, 4u);
+    EXPECT_EQ(stats.failures, 1u);
+}
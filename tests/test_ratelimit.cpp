@@ -0,0 +1,104 @@
+/**
+ * @file test_ratelimit.cpp
+ * @brief Unit tests for RateLimiter class.
+ * @author Daan Breur
+ */
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include "ratelimit.h"
+
+/**
+ * @test RateLimitTests.TokenBucketRefills
+ * @details
+ * - Drain a bucket of 10 requests per second with a burst of 2, then let time pass.
+ * - Expects the burst to be admitted, the third request to be rejected and one token to come back
+ *   every 100 ms, never more than the burst.
+ * @ingroup RateLimitTests
+ */
+TEST(RateLimitTests, TokenBucketRefills) {
+    struct RateLimit limit = {10, 2};
+    auto start = std::chrono::steady_clock::now();
+    struct TokenBucket bucket = {limit.burst, start};
+
+    EXPECT_TRUE(takeToken(bucket, limit, start));
+    EXPECT_TRUE(takeToken(bucket, limit, start));
+    EXPECT_FALSE(takeToken(bucket, limit, start));
+
+    auto later = start + std::chrono::milliseconds(100);
+    EXPECT_TRUE(takeToken(bucket, limit, later));
+    EXPECT_FALSE(takeToken(bucket, limit, later));
+
+    auto much_later = later + std::chrono::seconds(10);
+    EXPECT_TRUE(takeToken(bucket, limit, much_later));
+    EXPECT_TRUE(takeToken(bucket, limit, much_later));
+    EXPECT_FALSE(takeToken(bucket, limit, much_later));
+
+    EXPECT_TRUE(takeToken(bucket, {0, 0}, much_later));
+}
+
+/**
+ * @test RateLimitTests.ConnectionAndClientBudgets
+ * @details
+ * - Limit hub requests per connection to a burst of 2 and per client to a burst of 3, and make
+ *   hub requests over two connections of the same client.
+ * - Expects each connection to be stopped at its own limit, the client at the combined one, local
+ *   requests to be unaffected and the offender to be reported.
+ * @ingroup RateLimitTests
+ */
+TEST(RateLimitTests, ConnectionAndClientBudgets) {
+    RateLimiter limiter;
+    limiter.parse("hub=0.001/2,client_hub=0.001/3");
+
+    struct in_addr address, other;
+    inet_aton("10.0.0.5", &address);
+    inet_aton("10.0.0.6", &other);
+
+    struct TokenBucket first[RATE_CLASSES], second[RATE_CLASSES];
+    limiter.resetBuckets(first);
+    limiter.resetBuckets(second);
+
+    EXPECT_TRUE(limiter.admit(first, address, RateClass::HUB));
+    EXPECT_TRUE(limiter.admit(first, address, RateClass::HUB));
+    EXPECT_FALSE(limiter.admit(first, address, RateClass::HUB));
+    EXPECT_TRUE(limiter.admit(second, address, RateClass::HUB));
+    EXPECT_FALSE(limiter.admit(second, address, RateClass::HUB));
+    EXPECT_TRUE(limiter.admit(first, address, RateClass::LOCAL));
+    EXPECT_TRUE(limiter.admit(nullptr, other, RateClass::HUB));
+
+    struct RateLimiterStats stats = limiter.getStats();
+    EXPECT_EQ(stats.admitted, 5);
+    EXPECT_EQ(stats.throttled, 2);
+    EXPECT_EQ(stats.clients, 2);
+
+    auto offenders = limiter.topThrottled(5);
+    ASSERT_EQ(offenders.size(), 1);
+    EXPECT_EQ(offenders[0].address.s_addr, address.s_addr);
+    EXPECT_EQ(offenders[0].throttled[(size_t)RateClass::HUB], 2);
+    EXPECT_EQ(offenders[0].admitted, 4);
+}
+
+/**
+ * @test RateLimitTests.Parse
+ * @details
+ * - Parse valid and malformed limit lists.
+ * - Expects an unlimited limiter to admit everything, and malformed lists to throw.
+ * @ingroup RateLimitTests
+ */
+TEST(RateLimitTests, Parse) {
+    RateLimiter limiter;
+    struct in_addr address;
+    inet_aton("10.0.0.5", &address);
+    for (int i = 0; i < 1000; ++i) EXPECT_TRUE(limiter.admit(nullptr, address, RateClass::HUB));
+    EXPECT_EQ(limiter.getStats().clients, 0);
+
+    EXPECT_NO_THROW(limiter.parse("hub=10/20,local=200,client_hub=25,client_local=500/1000"));
+    EXPECT_THROW(limiter.parse("hub"), std::invalid_argument);
+    EXPECT_THROW(limiter.parse("hub=fast"), std::invalid_argument);
+    EXPECT_THROW(limiter.parse("hub=10/"), std::invalid_argument);
+    EXPECT_THROW(limiter.parse("hub=-1"), std::invalid_argument);
+    EXPECT_THROW(limiter.parse("hub=10/0.5"), std::invalid_argument);
+    EXPECT_THROW(limiter.parse("disk=10"), std::invalid_argument);
+}
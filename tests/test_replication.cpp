@@ -0,0 +1,132 @@
+/**
+ * @file test_replication.cpp
+ * @brief Unit tests for ReplicationPublisher and ReplicationFollower classes.
+ * @author Daan Breur
+ */
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "packetview.h"
+#include "replication.h"
+
+/**
+ * @brief Returns a temperature reading of a sensor.
+ */
+static struct sensor_packet temperature(uint8_t sensor_id, float value) {
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_temperature);
+    packet.header.ptype = PacketType::DATA;
+    packet.data.temperature.metadata = {SensorType::TEMPERATURE, sensor_id};
+    setTemperature(packet, value);
+    return packet;
+}
+
+/**
+ * @brief The devices a follower received, as the standby would see them.
+ */
+struct Replica {
+    std::mutex mutex;
+    std::map<uint16_t, std::pair<struct sensor_packet, bool>> devices;
+
+    bool has(uint16_t slave_id, float value, bool live) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = devices.find(slave_id);
+        return found != devices.end() && found->second.second == live &&
+               PacketView(found->second.first).temperature() == value;
+    }
+};
+
+/**
+ * @brief Waits until the condition holds, for at most two seconds.
+ */
+template <typename Condition>
+static bool eventually(Condition condition) {
+    for (int i = 0; i < 200 && !condition(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return condition();
+}
+
+/**
+ * @test ReplicationTests.StandbyFollowsAndTakesOver
+ * @details
+ * - Start a publisher with one known device, let a follower connect, then change a device and
+ *   register another one, and finally stop the publisher.
+ * - Expects the follower to receive the snapshot and both changes with their liveness, and to
+ *   report the primary gone once nothing has arrived for its timeout.
+ * @ingroup ReplicationTests
+ */
+TEST(ReplicationTests, StandbyFollowsAndTakesOver) {
+    SlaveManager slaves;
+    slaves.updateSlaveState(200, temperature(200, 20.5f));
+
+    ReplicationPublisher publisher(slaves);
+    publisher.start(0);
+    ASSERT_GT(publisher.getPort(), 0);
+
+    Replica replica;
+    ReplicationFollower follower([&replica](const struct SlaveSnapshot &slave, bool live) {
+        EXPECT_EQ(slave.fd, -1);
+        std::lock_guard<std::mutex> lock(replica.mutex);
+        replica.devices[slave.slave_id] = {slave.sensor_data, live};
+    });
+
+    std::atomic<bool> stop(false);
+    std::atomic<bool> gone(false);
+    std::thread standby([&]() {
+        gone = follower.follow("127.0.0.1", publisher.getPort(), 300, stop);
+    });
+
+    EXPECT_TRUE(eventually([&]() { return replica.has(200, 20.5f, false); }));
+
+    slaves.updateSlaveState(200, temperature(200, 21.0f));
+    publisher.markDirty(200);
+    slaves.registerSlave(300, open("/dev/null", O_RDONLY | O_CLOEXEC));
+    slaves.updateSlaveState(300, temperature(44, 18.0f));
+    publisher.markDirty(300);
+
+    EXPECT_TRUE(eventually([&]() { return replica.has(200, 21.0f, false); }));
+    EXPECT_TRUE(eventually([&]() { return replica.has(300, 18.0f, true); }));
+    EXPECT_EQ(publisher.getStats().standbys, 1u);
+
+    // a primary that is gone for good is taken over from
+    publisher.stop();
+    standby.join();
+    EXPECT_TRUE(gone);
+    EXPECT_GE(follower.getRecords(), 3u);
+}
+
+/**
+ * @test ReplicationTests.StandbyWaitsForUnreachedPrimary
+ * @details
+ * - Follow a primary that never comes up for longer than the timeout, then stop the follower.
+ * - Expects the follower not to take over from a primary it never reached, and to return false
+ *   once stopped.
+ * @ingroup ReplicationTests
+ */
+TEST(ReplicationTests, StandbyWaitsForUnreachedPrimary) {
+    // a port nobody listens on any more
+    SlaveManager slaves(1);
+    ReplicationPublisher unused(slaves);
+    unused.start(0);
+    int port = unused.getPort();
+    unused.stop();
+
+    ReplicationFollower follower([](const struct SlaveSnapshot &, bool) {});
+    std::atomic<bool> stop(false);
+    std::atomic<bool> gone(true);
+    std::thread standby([&]() { gone = follower.follow("127.0.0.1", port, 100, stop); });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    stop = true;
+    standby.join();
+    EXPECT_FALSE(gone);
+
+    EXPECT_THROW(follower.follow("not an address", port, 100, stop), std::invalid_argument);
+}
@@ -0,0 +1,137 @@
+/**
+ * @file test_shmstate.cpp
+ * @brief Unit tests for ShmStateWriter and ShmStateReader classes.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "shmstate.h"
+
+/**
+ * @brief Returns a segment name that does not collide with other test runs.
+ */
+static std::string testSegmentName() { return "/wemos-test-" + std::to_string(getpid()); }
+
+/**
+ * @brief Builds a temperature packet with the given ID and value.
+ */
+static struct sensor_packet temperaturePacket(uint8_t sensor_id, float value) {
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_temperature);
+    packet.header.ptype = PacketType::DATA;
+    packet.data.temperature.metadata.sensor_type = SensorType::TEMPERATURE;
+    packet.data.temperature.metadata.sensor_id = sensor_id;
+    packet.data.temperature.value = value;
+    return packet;
+}
+
+/**
+ * @test ShmStateTests.Writer_InvalidName
+ * @details
+ * - Verify that the writer rejects names that are not valid shared-memory object names.
+ * - Expects std::invalid_argument to be thrown.
+ * @ingroup ShmStateTests
+ */
+TEST(ShmStateTests, Writer_InvalidName) {
+    EXPECT_THROW(ShmStateWriter writer(""), std::invalid_argument);
+    EXPECT_THROW(ShmStateWriter writer("no-slash"), std::invalid_argument);
+    EXPECT_THROW(ShmStateWriter writer("/nested/name"), std::invalid_argument);
+}
+
+/**
+ * @test ShmStateTests.Reader_MissingSegment
+ * @details
+ * - Verify that opening a segment that does not exist fails.
+ * - Expects std::runtime_error to be thrown.
+ * @ingroup ShmStateTests
+ */
+TEST(ShmStateTests, Reader_MissingSegment) {
+    EXPECT_THROW(ShmStateReader reader(testSegmentName() + "-missing"), std::runtime_error);
+}
+
+/**
+ * @test ShmStateTests.PublishAndRead
+ * @details
+ * - Publish the state of a sensor and read it back through a reader.
+ * - Expects slots that were never published to be reported as such.
+ * - Expects the change sequence to move on with every update.
+ * @ingroup ShmStateTests
+ */
+TEST(ShmStateTests, PublishAndRead) {
+    ShmStateWriter writer(testSegmentName());
+    ShmStateReader reader(testSegmentName());
+
+    struct sensor_packet packet;
+    EXPECT_FALSE(reader.read(42, packet));
+    EXPECT_EQ(reader.changeSequence(), 0u);
+
+    writer.publish(42, temperaturePacket(42, 21.5f));
+    writer.publish(43, temperaturePacket(43, 19.0f));
+
+    uint32_t change_seq = 0;
+    ASSERT_TRUE(reader.read(42, packet, &change_seq));
+    EXPECT_EQ(packet.data.temperature.metadata.sensor_id, 42);
+    EXPECT_FLOAT_EQ(packet.data.temperature.value, 21.5f);
+    EXPECT_EQ(change_seq, 1u);
+    EXPECT_EQ(reader.changeSequence(), 2u);
+}
+
+/**
+ * @test ShmStateTests.WaitForChange
+ * @details
+ * - Verify that waiting without any update times out.
+ * - Verify that a waiting reader is woken up by an update from another thread.
+ * @ingroup ShmStateTests
+ */
+TEST(ShmStateTests, WaitForChange) {
+    ShmStateWriter writer(testSegmentName());
+    ShmStateReader reader(testSegmentName());
+
+    EXPECT_FALSE(reader.waitForChange(reader.changeSequence(), 10));
+
+    uint32_t seen = reader.changeSequence();
+    std::thread publisher([&writer]() {
+        usleep(20000);
+        writer.publish(1, temperaturePacket(1, 1.0f));
+    });
+
+    EXPECT_TRUE(reader.waitForChange(seen, 5000));
+    publisher.join();
+}
+
+/**
+ * @test ShmStateTests.ConcurrentReadsAreConsistent
+ * @details
+ * - Hammer a single slot with updates while reading it from another thread.
+ * - Expects every read to return a packet that was published as a whole.
+ * @ingroup ShmStateTests
+ */
+TEST(ShmStateTests, ConcurrentReadsAreConsistent) {
+    ShmStateWriter writer(testSegmentName());
+    ShmStateReader reader(testSegmentName());
+    std::atomic<bool> done(false);
+
+    std::thread publisher([&]() {
+        for (int i = 1; i <= 100000; ++i) {
+            // the ID and the value always move in lockstep, so a torn read shows up as a mismatch
+            writer.publish(7, temperaturePacket(i & 0xFF, (float)(i & 0xFF)));
+        }
+        done = true;
+    });
+
+    size_t torn = 0;
+    struct sensor_packet packet;
+    while (!done) {
+        if (reader.read(7, packet) &&
+            (float)packet.data.temperature.metadata.sensor_id != packet.data.temperature.value)
+            ++torn;
+    }
+    publisher.join();
+
+    EXPECT_EQ(torn, 0u);
+}
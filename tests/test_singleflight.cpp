@@ -0,0 +1,171 @@
+/**
+ * @file test_singleflight.cpp
+ * @brief Unit tests for SingleFlight class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "singleflight.h"
+
+/**
+ * @brief Returns a light packet for the given sensor.
+ */
+static struct sensor_packet lightPacket(uint8_t sensor_id, uint8_t target_state) {
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_light);
+    packet.header.ptype = PacketType::DASHBOARD_RESPONSE;
+    packet.data.light.metadata.sensor_type = SensorType::LIGHT;
+    packet.data.light.metadata.sensor_id = sensor_id;
+    packet.data.light.target_state = target_state;
+    return packet;
+}
+
+/**
+ * @test SingleFlightTests.ConcurrentReadsAreCoalesced
+ * @details
+ * - Read the same sensor from several threads while the first read is still in flight.
+ * - Expects a single read to be performed and every thread to receive its response.
+ * @ingroup SingleFlightTests
+ */
+TEST(SingleFlightTests, ConcurrentReadsAreCoalesced) {
+    SingleFlight single_flight;
+    struct sensor_metadata metadata = {SensorType::LIGHT, 0x6D};
+    std::atomic<int> reads(0);
+    std::atomic<int> correct(0);
+
+    auto slowRead = [&reads]() {
+        ++reads;
+        usleep(200000);
+        return lightPacket(0x6D, 1);
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&]() {
+            if (single_flight.read(metadata, slowRead).data.light.target_state == 1) ++correct;
+        });
+        if (i == 0) usleep(50000);  // let the first read take off
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    EXPECT_EQ(reads, 1);
+    EXPECT_EQ(correct, 8);
+
+    struct SingleFlightStats stats = single_flight.getStats();
+    EXPECT_EQ(stats.requests_sent, 1u);
+    EXPECT_EQ(stats.requests_saved, 7u);
+    EXPECT_EQ(stats.in_flight, 0u);
+}
+
+/**
+ * @test SingleFlightTests.ErrorIsShared
+ * @details
+ * - Let a read that others are waiting for fail.
+ * - Expects every waiting thread to receive the same exception.
+ * @ingroup SingleFlightTests
+ */
+TEST(SingleFlightTests, ErrorIsShared) {
+    SingleFlight single_flight;
+    struct sensor_metadata metadata = {SensorType::LIGHT, 0x6D};
+    std::atomic<int> failures(0);
+
+    auto failingRead = []() -> struct sensor_packet {
+        usleep(200000);
+        throw std::runtime_error("Not connected to I2C-bridge");
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&]() {
+            try {
+                single_flight.read(metadata, failingRead);
+            } catch (std::runtime_error &exc) {
+                ++failures;
+            }
+        });
+        if (i == 0) usleep(50000);
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    EXPECT_EQ(failures, 4);
+    EXPECT_EQ(single_flight.getStats().requests_sent, 1u);
+}
+
+/**
+ * @test SingleFlightTests.DifferentSensorsAndLaterReads
+ * @details
+ * - Read two different sensors at the same time, then read one of them again.
+ * - Expects every one of these reads to be performed, nothing is cached.
+ * @ingroup SingleFlightTests
+ */
+TEST(SingleFlightTests, DifferentSensorsAndLaterReads) {
+    SingleFlight single_flight;
+    std::atomic<int> reads(0);
+
+    std::thread other([&]() {
+        single_flight.read({SensorType::LIGHT, 0x10}, [&reads]() {
+            ++reads;
+            usleep(100000);
+            return lightPacket(0x10, 0);
+        });
+    });
+    usleep(20000);
+
+    auto read = [&reads]() {
+        ++reads;
+        return lightPacket(0x11, 1);
+    };
+    EXPECT_EQ(single_flight.read({SensorType::LIGHT, 0x11}, read).data.light.metadata.sensor_id,
+              0x11);
+    EXPECT_EQ(single_flight.read({SensorType::LIGHT, 0x11}, read).data.light.metadata.sensor_id,
+              0x11);
+    other.join();
+
+    EXPECT_EQ(reads, 3);
+    EXPECT_EQ(single_flight.getStats().requests_saved, 0u);
+}
+
+/**
+ * @test SingleFlightTests.OtherTypeOfSameId
+ * @details
+ * - Read a sensor ID as another type while a read of that ID is in flight.
+ * - Expects the second read to be performed on its own instead of sharing the response of the
+ *   first, and the table slot to be free again afterwards.
+ * @ingroup SingleFlightTests
+ */
+TEST(SingleFlightTests, OtherTypeOfSameId) {
+    SingleFlight single_flight;
+    std::atomic<int> reads(0);
+
+    std::thread light([&]() {
+        single_flight.read({SensorType::LIGHT, 0x20}, [&reads]() {
+            ++reads;
+            usleep(100000);
+            return lightPacket(0x20, 1);
+        });
+    });
+    usleep(20000);
+
+    struct sensor_packet button =
+        single_flight.read({SensorType::BUTTON, 0x20}, [&reads]() -> struct sensor_packet {
+            ++reads;
+            struct sensor_packet packet = lightPacket(0x20, 0);
+            packet.data.generic.metadata.sensor_type = SensorType::BUTTON;
+            return packet;
+        });
+    light.join();
+
+    EXPECT_EQ(button.data.generic.metadata.sensor_type, SensorType::BUTTON);
+    EXPECT_EQ(reads, 2);
+
+    struct SingleFlightStats stats = single_flight.getStats();
+    EXPECT_EQ(stats.requests_sent, 2u);
+    EXPECT_EQ(stats.requests_saved, 0u);
+    EXPECT_EQ(stats.in_flight, 0u);
+}
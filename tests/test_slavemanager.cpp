@@ -3,8 +3,19 @@
  * @brief Unit tests for SlaveManager class.
  * @author Daan Breur
  */
+#include <arpa/inet.h>
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
 
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+#include "framing.h"
 #include "slavemanager.h"
 
 TEST(SlaveManagerTests, RegisterSlave) {
@@ -25,3 +36,333 @@ TEST(SlaveManagerTests, UnregisterSlave) {
     EXPECT_NO_THROW(manager.unregisterSlave(1));
     EXPECT_EQ(manager.getSlaveFD(1), -1);
 }
+
+/**
+ * @brief Creates a UDP socket bound to an ephemeral port on localhost.
+ * @param address Filled with the address the socket ended up bound to.
+ * @return The file descriptor of the socket.
+ */
+static int makeLocalUdpSocket(struct sockaddr_in &address) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    bind(fd, (struct sockaddr *)&address, sizeof(address));
+
+    socklen_t address_length = sizeof(address);
+    getsockname(fd, (struct sockaddr *)&address, &address_length);
+    return fd;
+}
+
+/**
+ * @test SlaveManagerTests.RegisterUdpSlave_SendsToLearnedAddress
+ * @details
+ * - Register a slave reached over UDP and send data to it.
+ * - Expects the data to arrive at the address learned from the heartbeat.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, RegisterUdpSlave_SendsToLearnedAddress) {
+    struct sockaddr_in server_address, slave_address;
+    int server_fd = makeLocalUdpSocket(server_address);
+    int slave_fd = makeLocalUdpSocket(slave_address);
+
+    {
+        SlaveManager manager;
+        EXPECT_NO_THROW(manager.registerUdpSlave(200, server_fd, slave_address));
+        EXPECT_EQ(manager.getSlaveFD(200), server_fd);
+
+        const char message[] = "hello";
+        EXPECT_EQ(manager.sendToSlave(200, message, sizeof(message)), 0);
+
+        char received[sizeof(message)] = {0};
+        EXPECT_EQ(recv(slave_fd, received, sizeof(received), 0), (ssize_t)sizeof(message));
+        EXPECT_STREQ(received, message);
+    }
+
+    // the shared UDP socket must survive the manager
+    EXPECT_NE(fcntl(server_fd, F_GETFD), -1);
+
+    close(server_fd);
+    close(slave_fd);
+}
+
+/**
+ * @test SlaveManagerTests.UnregisterUdpSlave_KeepsSocketOpen
+ * @details
+ * - Unregister a slave reached over UDP.
+ * - Expects the slave to be gone, but the shared UDP socket to stay open.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, UnregisterUdpSlave_KeepsSocketOpen) {
+    struct sockaddr_in server_address;
+    int server_fd = makeLocalUdpSocket(server_address);
+
+    SlaveManager manager;
+    manager.registerUdpSlave(200, server_fd, server_address);
+    EXPECT_NO_THROW(manager.unregisterSlave(200));
+    EXPECT_EQ(manager.getSlaveFD(200), -1);
+    EXPECT_NE(fcntl(server_fd, F_GETFD), -1);
+
+    close(server_fd);
+}
+
+/**
+ * @test SlaveManagerTests.SnapshotAndRestore
+ * @details
+ * - Take a snapshot of a manager and restore it into another one.
+ * - Expects registered slaves and known states to carry over, and nothing else.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, SnapshotAndRestore) {
+    SlaveManager original;
+    original.registerSlave(200, 5);
+
+    struct sensor_packet state = {0};
+    state.header.length = sizeof(struct sensor_packet_light);
+    state.data.light.metadata.sensor_id = 10;
+    state.data.light.target_state = 1;
+    original.updateSlaveState(10, state);
+
+    std::vector<struct SlaveSnapshot> snapshots = original.snapshot();
+    ASSERT_EQ(snapshots.size(), 2u);
+    EXPECT_EQ(snapshots[0].slave_id, 10);
+    EXPECT_EQ(snapshots[1].slave_id, 200);
+
+    SlaveManager restored;
+    for (const struct SlaveSnapshot &snapshot : snapshots) restored.restore(snapshot);
+
+    EXPECT_EQ(restored.getSlaveFD(200), 5);
+    EXPECT_EQ(restored.getSlaveFD(10), -1);
+    EXPECT_EQ(restored.getSlaveState(10).data.light.target_state, 1);
+
+    // both managers think they own fd 5 now; only one of them may close it
+    restored.restore({200, -1, false, {}, {}});
+}
+
+/**
+ * @test SlaveManagerTests.ExtendedIds
+ * @details
+ * - Register slaves with IDs beyond 8 bits, one of them sharing its low byte with another slave.
+ * - Expects every ID to be tracked on its own, and states to stay apart.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, ExtendedIds) {
+    SlaveManager manager;
+    manager.registerSlave(200, 5);
+    manager.registerSlave(40000, 6, true);
+    manager.registerSlave(0x1C8, 7, true);
+
+    EXPECT_EQ(manager.getSlaveFD(200), 5);
+    EXPECT_EQ(manager.getSlaveFD(40000), 6);
+    EXPECT_EQ(manager.getSlaveFD(0x1C8), 7);
+
+    struct sensor_packet state = {0};
+    state.header.length = sizeof(struct sensor_packet_light);
+    state.data.light.target_state = 1;
+    manager.updateSlaveState(0x1C8, state);
+    EXPECT_EQ(manager.getSlaveState(0x1C8).data.light.target_state, 1);
+    EXPECT_EQ(manager.getSlaveState(200).header.length, 0);
+
+    std::vector<struct SlaveSnapshot> snapshots = manager.snapshot();
+    ASSERT_EQ(snapshots.size(), 3u);
+    EXPECT_EQ(snapshots[1].slave_id, 0x1C8);
+    EXPECT_TRUE(snapshots[1].extended_ids);
+    EXPECT_EQ(snapshots[2].slave_id, 40000);
+
+    for (uint16_t id : {200, 40000, 0x1C8}) manager.restore({id, -1, false, {}, {}, false});
+}
+
+/**
+ * @test SlaveManagerTests.TableFull
+ * @details
+ * - Register more slaves than the device table has room for.
+ * - Expects the extra slaves to be refused and counted, and the capacity to be fixed once used.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, TableFull) {
+    SlaveManager manager(2);
+    manager.updateSlaveState(1, {});
+    manager.updateSlaveState(2, {});
+    manager.updateSlaveState(3, {});
+
+    EXPECT_EQ(manager.getSlaveFD(3), -1);
+    struct SlaveManagerStats stats = manager.getStats();
+    EXPECT_EQ(stats.devices, 2u);
+    EXPECT_EQ(stats.capacity, 2u);
+    EXPECT_EQ(stats.refused, 1u);
+
+    EXPECT_THROW(manager.setCapacity(8), std::logic_error);
+    EXPECT_THROW(SlaveManager().setCapacity(0), std::invalid_argument);
+}
+
+/**
+ * @test SlaveManagerTests.SendToExtendedSlave
+ * @details
+ * - Send a packet to a slave on a basic and on an extended connection.
+ * - Expects the extended frame to carry the high byte of the ID, and 16-bit IDs to be refused on
+ *   the basic connection.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, SendToExtendedSlave) {
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    SlaveManager manager;
+    manager.registerSlave(0x1234, sockets[0], true);
+    manager.registerSlave(0x0300, dup(sockets[0]), false);
+
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_light);
+    packet.header.ptype = PacketType::DASHBOARD_POST;
+    packet.data.light.metadata.sensor_type = SensorType::LIGHT;
+    packet.data.light.target_state = 1;
+    EXPECT_EQ(manager.sendToSlave(0x1234, packet), 0);
+    EXPECT_EQ(manager.sendToSlave(0x0300, packet), -1);
+
+    uint8_t frame[MAX_FRAME_SIZE];
+    ssize_t length = recv(sockets[1], frame, sizeof(frame), 0);
+    ASSERT_EQ(length, (ssize_t)(sizeof(struct sensor_header) + 1 + packet.header.length));
+    EXPECT_EQ(frame[0], packet.header.length + 1);
+    EXPECT_EQ(frame[sizeof(struct sensor_header)], 0x12);
+
+    struct sensor_packet decoded;
+    uint16_t sensor_id;
+    ASSERT_TRUE(decodeFrame(frame, true, decoded, sensor_id));
+    EXPECT_EQ(sensor_id, 0x1234);
+    EXPECT_EQ(decoded.data.light.target_state, 1);
+
+    manager.unregisterSlave(0x1234);
+    manager.unregisterSlave(0x0300);
+    close(sockets[1]);
+}
+
+/**
+ * @test SlaveManagerTests.DetachConnection
+ * @details
+ * - Detach the connection two slaves registered on, while a third uses another connection.
+ * - Expects only the slaves on that connection to lose their file descriptor, and to keep their
+ *   state.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, DetachConnection) {
+    SlaveManager manager;
+    manager.registerSlave(200, 5);
+    manager.registerSlave(201, 5);
+    manager.registerSlave(202, 6);
+
+    struct sensor_packet state = {0};
+    state.header.length = sizeof(struct sensor_packet_light);
+    state.data.light.target_state = 1;
+    manager.updateSlaveState(200, state);
+
+    manager.detachConnection(5);
+    EXPECT_EQ(manager.getSlaveFD(200), -1);
+    EXPECT_EQ(manager.getSlaveFD(201), -1);
+    EXPECT_EQ(manager.getSlaveFD(202), 6);
+    EXPECT_EQ(manager.getSlaveState(200).data.light.target_state, 1);
+
+    manager.restore({202, -1, false, {}, {}, false});
+}
+
+/**
+ * @test SlaveManagerTests.SendToSlaves_FansOut
+ * @details
+ * - Send one packet to two slaves sharing a connection, a slave whose connection is full and a
+ *   slave that is not connected.
+ * - Expects the slaves on the shared connection to get both frames in one write, and the other
+ *   two to fail once the timeout has passed, instead of blocking the send.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, SendToSlaves_FansOut) {
+    int shared[2], stalled[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, shared), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, stalled), 0);
+
+    // a device that stopped reading: its connection takes nothing more
+    uint8_t filler[4096] = {0};
+    while (send(stalled[0], filler, sizeof(filler), MSG_DONTWAIT) > 0) {
+    }
+
+    SlaveManager manager;
+    manager.registerSlave(200, shared[0]);
+    manager.registerSlave(201, dup(shared[0]));
+    manager.registerSlave(202, stalled[0]);
+
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_light);
+    packet.header.ptype = PacketType::DASHBOARD_POST;
+    packet.data.light.metadata.sensor_type = SensorType::LIGHT;
+    packet.data.light.target_state = 1;
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<int> results = manager.sendToSlaves({200, 201, 202, 203}, packet, 100);
+    auto elapsed = std::chrono::steady_clock::now() - started;
+
+    EXPECT_EQ(results, std::vector<int>({0, 0, -1, -1}));
+    EXPECT_GE(elapsed, std::chrono::milliseconds(90));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(1000));
+
+    uint8_t frames[2 * MAX_FRAME_SIZE];
+    size_t frame_length = sizeof(struct sensor_header) + packet.header.length;
+    ASSERT_EQ(recv(shared[1], frames, sizeof(frames), 0), (ssize_t)(2 * frame_length));
+    EXPECT_EQ(frames[sizeof(struct sensor_header) + 1], 200);
+    EXPECT_EQ(frames[frame_length + sizeof(struct sensor_header) + 1], 201);
+
+    manager.unregisterSlave(200);
+    manager.unregisterSlave(201);
+    manager.unregisterSlave(202);
+    close(shared[1]);
+    close(stalled[1]);
+}
+
+/**
+ * @test SlaveManagerTests.SendToSlaves_ShutsDownPartialWrites
+ * @details
+ * - Send one packet to more slaves on a single connection than the connection can take while its
+ *   device does not read.
+ * - Expects the send to give up once the timeout has passed instead of blocking on the rest, and
+ *   the connection to be shut down so no half frame is left on it.
+ * @ingroup SlaveManagerTests
+ */
+TEST(SlaveManagerTests, SendToSlaves_ShutsDownPartialWrites) {
+    int pair[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+    int buffer_size = 4096;
+    setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+    // a device that stops reading must not hang the test either
+    struct timeval timeout = {2, 0};
+    setsockopt(pair[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    SlaveManager manager(4000);
+    std::vector<uint16_t> slave_ids;
+    for (uint16_t slave_id = 1; slave_id <= 4000; ++slave_id) {
+        manager.registerSlave(slave_id, pair[0], true);
+        slave_ids.push_back(slave_id);
+    }
+
+    struct sensor_packet packet = {0};
+    packet.header.length = sizeof(struct sensor_packet_light);
+    packet.header.ptype = PacketType::DASHBOARD_POST;
+    packet.data.light.metadata.sensor_type = SensorType::LIGHT;
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<int> results = manager.sendToSlaves(slave_ids, packet, 100);
+    auto elapsed = std::chrono::steady_clock::now() - started;
+
+    EXPECT_EQ(results, std::vector<int>(slave_ids.size(), -1));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(1000));
+
+    // the device reads what was written and then the end of the stream
+    uint8_t received[4096];
+    ssize_t length;
+    size_t total = 0;
+    while ((length = recv(pair[1], received, sizeof(received), 0)) > 0) total += length;
+    EXPECT_EQ(length, 0);
+    EXPECT_GT(total, 0u);
+
+    for (uint16_t slave_id : slave_ids) manager.unregisterSlave(slave_id);
+    close(pair[0]);
+    close(pair[1]);
+}
@@ -0,0 +1,120 @@
+/**
+ * @file test_tracer.cpp
+ * @brief Unit tests for the Tracer class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "tracer.h"
+
+/**
+ * @brief Returns a trace file name that does not collide with other test runs.
+ */
+static std::string testTraceFile() {
+    return "/tmp/wemos-test-trace-" + std::to_string(getpid()) + ".json";
+}
+
+/**
+ * @brief Reads a whole file into a string.
+ */
+static std::string readFile(const std::string &path) {
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+/**
+ * @brief Traces a single request that passes through all stages.
+ */
+static void traceRequest(uint8_t sensor_id) {
+    Tracer::beginRequest(PacketType::DASHBOARD_GET, sensor_id);
+    Tracer::stage(TraceStage::FRAME_PARSED, sensor_id);
+    Tracer::stage(TraceStage::HUB_REQUEST_SENT, sensor_id);
+    Tracer::stage(TraceStage::HUB_RESPONSE_DEQUEUED, sensor_id);
+    Tracer::stage(TraceStage::SLAVE_STATE_UPDATED, sensor_id);
+    Tracer::stage(TraceStage::DASHBOARD_SENT, sensor_id);
+    Tracer::endRequest();
+}
+
+/**
+ * @test TracerTests.Disabled_RecordsNothing
+ * @details
+ * - Verify that a disabled tracer dumps an empty trace.
+ * @ingroup TracerTests
+ */
+TEST(TracerTests, Disabled_RecordsNothing) {
+    Tracer::disable();
+    EXPECT_FALSE(Tracer::isEnabled());
+    EXPECT_THROW(Tracer::enable(0), std::invalid_argument);
+
+    traceRequest(1);
+    EXPECT_EQ(Tracer::dumpChromeTrace(testTraceFile()), 0u);
+    unlink(testTraceFile().c_str());
+}
+
+/**
+ * @test TracerTests.ChromeTrace
+ * @details
+ * - Trace a request and verify that the dump contains the request span and all of its stages.
+ * @ingroup TracerTests
+ */
+TEST(TracerTests, ChromeTrace) {
+    Tracer::enable(1);
+    traceRequest(42);
+
+    EXPECT_EQ(Tracer::dumpChromeTrace(testTraceFile()), 6u);
+    std::string trace = readFile(testTraceFile());
+    unlink(testTraceFile().c_str());
+    Tracer::disable();
+
+    EXPECT_EQ(trace.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["), 0u);
+    EXPECT_NE(trace.find("\"ph\":\"X\",\"name\":\"DASHBOARD_GET\""), std::string::npos);
+    for (const char *stage : {"frame_parsed", "hub_request_sent", "hub_response_dequeued",
+                              "slave_state_updated", "dashboard_sent"}) {
+        EXPECT_NE(trace.find(std::string("\"name\":\"") + stage + "\""), std::string::npos)
+            << stage;
+    }
+    EXPECT_NE(trace.find("\"sensor_id\":42"), std::string::npos);
+}
+
+/**
+ * @test TracerTests.Sampling
+ * @details
+ * - Verify that only one out of every N requests is traced, and that stages outside of a sampled
+ *   request are not recorded.
+ * @ingroup TracerTests
+ */
+TEST(TracerTests, Sampling) {
+    Tracer::enable(4);
+    for (int i = 0; i < 40; ++i) traceRequest(i);
+    Tracer::stage(TraceStage::DASHBOARD_SENT, 1);
+
+    EXPECT_EQ(Tracer::dumpChromeTrace(testTraceFile()), 10u * 6u);
+    unlink(testTraceFile().c_str());
+    Tracer::disable();
+}
+
+/**
+ * @test TracerTests.RingBufferOverwrites
+ * @details
+ * - Verify that the tracer keeps only the most recent events once its buffer is full.
+ * @ingroup TracerTests
+ */
+TEST(TracerTests, RingBufferOverwrites) {
+    Tracer::enable(1, 12);
+    for (int i = 0; i < 10; ++i) traceRequest(i);
+
+    EXPECT_EQ(Tracer::dumpChromeTrace(testTraceFile()), 12u);
+    std::string trace = readFile(testTraceFile());
+    unlink(testTraceFile().c_str());
+    Tracer::disable();
+
+    EXPECT_EQ(trace.find("\"sensor_id\":7}"), std::string::npos);
+    EXPECT_NE(trace.find("\"sensor_id\":9}"), std::string::npos);
+}
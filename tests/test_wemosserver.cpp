@@ -138,3 +138,113 @@ TEST(WemosServerTest, Constructor_InvalidHubPort_High) {
 TEST(WemosServerTest, Constructor_InvalidHubPort_Zero) {
     EXPECT_THROW(WemosServer server(5000, "10.0.0.1", 0), std::invalid_argument);
 }
+
+/**
+ * @test WemosServerTest.EnableUdp_ValidPort
+ * @brief Test enabling the UDP listener with valid port numbers.
+ * @ingroup WemosServerTest
+ */
+TEST(WemosServerTest, EnableUdp_ValidPort) {
+    WemosServer server(5000, "10.0.0.1", 5000);
+    EXPECT_NO_THROW(server.enableUdp(5000));
+    EXPECT_NO_THROW(server.enableUdp(65535));
+}
+
+/**
+ * @test WemosServerTest.EnableUdp_InvalidPort
+ * @brief Test enabling the UDP listener with invalid port numbers.
+ * @details
+ * - Expects std::invalid_argument to be thrown for zero, negative and too high port numbers.
+ * @ingroup WemosServerTest
+ */
+TEST(WemosServerTest, EnableUdp_InvalidPort) {
+    WemosServer server(5000, "10.0.0.1", 5000);
+    EXPECT_THROW(server.enableUdp(0), std::invalid_argument);
+    EXPECT_THROW(server.enableUdp(-1), std::invalid_argument);
+    EXPECT_THROW(server.enableUdp(65536), std::invalid_argument);
+}
+
+/**
+ * @test WemosServerTest.Configure_Valid
+ * @brief Test that configuring the server reserves pools of the configured size.
+ * @ingroup WemosServerTest
+ */
+TEST(WemosServerTest, Configure_Valid) {
+    WemosServer server(5000, "10.0.0.1", 5000);
+
+    struct ServerConfig config;
+    config.max_connections = 8;
+    config.hub_queue_capacity = 4;
+    EXPECT_NO_THROW(server.configure(config));
+
+    struct AllocatorStats stats = server.getAllocatorStats();
+    EXPECT_EQ(stats.connections.capacity, 8u);
+    EXPECT_EQ(stats.connections.in_use, 0u);
+    EXPECT_EQ(stats.receive_buffers.capacity, 8u);
+    EXPECT_EQ(stats.hub_queue.capacity, 4u);
+    EXPECT_EQ(server.memoryFootprint(), stats.connections.reserved_bytes +
+                                            stats.receive_buffers.reserved_bytes +
+                                            stats.hub_queue.reserved_bytes +
+                                            stats.devices.reserved_bytes +
+                                            stats.hub_transactions.reserved_bytes);
+}
+
+/**
+ * @test WemosServerTest.Configure_Invalid
+ * @brief Test configuring the server with invalid limits.
+ * @details
+ * - Expects std::invalid_argument to be thrown for zero limits, a receive buffer that cannot hold
+ *   the largest packet and a memory limit the configuration does not fit in.
+ * @ingroup WemosServerTest
+ */
+TEST(WemosServerTest, Configure_Invalid) {
+    WemosServer server(5000, "10.0.0.1", 5000);
+
+    struct ServerConfig config;
+    config.max_connections = 0;
+    EXPECT_THROW(server.configure(config), std::invalid_argument);
+
+    config = ServerConfig();
+    config.worker_threads = 0;
+    EXPECT_THROW(server.configure(config), std::invalid_argument);
+
+    config = ServerConfig();
+    config.hub_threads = 0;
+    EXPECT_THROW(server.configure(config), std::invalid_argument);
+
+    config = ServerConfig();
+    config.receive_buffer_size = MIN_RECEIVE_BUFFER_SIZE - 1;
+    EXPECT_THROW(server.configure(config), std::invalid_argument);
+
+    config = ServerConfig();
+    config.max_devices = MAX_SLAVE_ID + 1;
+    EXPECT_THROW(server.configure(config), std::invalid_argument);
+
+    config = ServerConfig();
+    config.memory_limit = 1024;
+    EXPECT_THROW(server.configure(config), std::invalid_argument);
+
+    config.memory_limit = server.memoryFootprint();
+    EXPECT_NO_THROW(server.configure(config));
+}
+
+/**
+ * @test WemosServerTest.Configure_LowFootprint
+ * @brief Test that the low-footprint profile fits in its own memory budget.
+ * @details
+ * - Expects lowFootprintConfig() to be accepted, also with a few more hubs.
+ * - Expects std::invalid_argument for a thread stack below PTHREAD_STACK_MIN.
+ * @ingroup WemosServerTest
+ */
+TEST(WemosServerTest, Configure_LowFootprint) {
+    WemosServer server(5000, "10.0.0.1", 5000);
+    server.setHubRoutes("10.0.0.1:5000=0-31;10.0.0.2:5000=32-63;10.0.0.3:5000=64-127");
+
+    struct ServerConfig config = lowFootprintConfig();
+    EXPECT_NO_THROW(server.configure(config));
+    EXPECT_LE(server.memoryFootprint(), config.memory_limit);
+    EXPECT_EQ(server.getAllocatorStats().connections.capacity, LOW_FOOTPRINT_MAX_CONNECTIONS);
+
+    config.thread_stack_size = 1024;
+    EXPECT_THROW(server.configure(config), std::invalid_argument);
+}
@@ -0,0 +1,127 @@
+/**
+ * @file test_writecombiner.cpp
+ * @brief Unit tests for WriteCombiner class.
+ * @author Daan Breur
+ */
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "writecombiner.h"
+
+/**
+ * @brief Returns a post setting an RGB light to the given red value.
+ */
+static struct sensor_packet colorPost(uint8_t sensor_id, uint8_t red) {
+    struct sensor_packet post = {0};
+    post.header.length = sizeof(struct sensor_packet_rgb_light);
+    post.header.ptype = PacketType::DASHBOARD_POST;
+    post.data.rgb_light.metadata = {SensorType::RGB_LIGHT, sensor_id};
+    post.data.rgb_light.red_state = red;
+    return post;
+}
+
+/**
+ * @brief Returns the red value a post to an RGB light sets.
+ */
+static uint8_t redOf(const PacketView &packet) {
+    struct sensor_packet post;
+    packet.copyTo(post);
+    return post.data.rgb_light.red_state;
+}
+
+/**
+ * @test WriteCombinerTests.CollapsesBursts
+ * @details
+ * - Post a burst of colors to one light and a single color to another within the window.
+ * - Expects one write per light carrying the latest color, and the replaced posts to be counted.
+ * @ingroup WriteCombinerTests
+ */
+TEST(WriteCombinerTests, CollapsesBursts) {
+    std::mutex mutex;
+    std::vector<std::pair<uint16_t, uint8_t>> writes;
+
+    WriteCombiner combiner;
+    combiner.setWindow(std::chrono::milliseconds(50));
+    combiner.start([&](uint16_t sensor_id, const PacketView &packet) {
+        std::lock_guard<std::mutex> lock(mutex);
+        writes.push_back(std::make_pair(sensor_id, redOf(packet)));
+        return true;
+    });
+
+    for (uint8_t red = 1; red <= 10; ++red) EXPECT_TRUE(combiner.post(300, colorPost(44, red)));
+    EXPECT_TRUE(combiner.post(301, colorPost(45, 7)));
+    combiner.stop();
+
+    ASSERT_EQ(writes.size(), 2u);
+    EXPECT_EQ(writes[0], std::make_pair((uint16_t)300, (uint8_t)10));
+    EXPECT_EQ(writes[1], std::make_pair((uint16_t)301, (uint8_t)7));
+
+    struct WriteCombinerStats stats = combiner.getStats();
+    EXPECT_EQ(stats.posted, 11u);
+    EXPECT_EQ(stats.sent, 2u);
+    EXPECT_EQ(stats.collapsed, 9u);
+    EXPECT_EQ(stats.pending, 0u);
+}
+
+/**
+ * @test WriteCombinerTests.CombinesWhileSending
+ * @details
+ * - Without a window, post to a light whose writes take a while, and keep posting while the first
+ *   write is being sent.
+ * - Expects the first post to go out right away and the posts made meanwhile to end up as a single
+ *   write of the latest one.
+ * @ingroup WriteCombinerTests
+ */
+TEST(WriteCombinerTests, CombinesWhileSending) {
+    std::atomic<int> started(0);
+    std::vector<uint8_t> writes;
+
+    WriteCombiner combiner;
+    combiner.setWindow(std::chrono::milliseconds(0));
+    combiner.start([&](uint16_t, const PacketView &packet) {
+        ++started;
+        writes.push_back(redOf(packet));
+        usleep(50000);
+        return writes.size() == 1;
+    });
+
+    combiner.post(44, colorPost(44, 1));
+    for (int i = 0; i < 200 && started == 0; ++i) usleep(1000);
+    ASSERT_EQ(started, 1);
+    for (uint8_t red = 2; red <= 5; ++red) combiner.post(44, colorPost(44, red));
+    combiner.stop();
+
+    std::vector<uint8_t> expected = {1, 5};
+    EXPECT_EQ(writes, expected);
+
+    struct WriteCombinerStats stats = combiner.getStats();
+    EXPECT_EQ(stats.sent, 1u);
+    EXPECT_EQ(stats.failed, 1u);
+    EXPECT_EQ(stats.collapsed, 3u);
+}
+
+/**
+ * @test WriteCombinerTests.OnlyLatestStateActuators
+ * @details
+ * - Check which posts may be combined, and post to a stopped combiner.
+ * - Expects RGB lights and lichtkranten to be combined but not plain lights, and a stopped
+ *   combiner to leave the post to the caller.
+ * @ingroup WriteCombinerTests
+ */
+TEST(WriteCombinerTests, OnlyLatestStateActuators) {
+    struct sensor_packet post = colorPost(44, 1);
+    EXPECT_TRUE(combinesWrites(post));
+    post.data.generic.metadata.sensor_type = SensorType::LICHTKRANT;
+    EXPECT_TRUE(combinesWrites(post));
+    post.data.generic.metadata.sensor_type = SensorType::LIGHT;
+    EXPECT_FALSE(combinesWrites(post));
+
+    WriteCombiner combiner;
+    EXPECT_FALSE(combiner.post(44, colorPost(44, 1)));
+}